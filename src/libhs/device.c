@@ -15,6 +15,9 @@
 #include "device_priv.h"
 #include "monitor.h"
 #include "platform.h"
+#ifdef _HS_SIMULATOR
+    #include "simulator_priv.h"
+#endif
 
 hs_device *hs_device_ref(hs_device *dev)
 {
@@ -87,6 +90,11 @@ int hs_port_open(hs_device *dev, hs_port_mode mode, hs_port **rport)
     if (dev->status != HS_DEVICE_STATUS_ONLINE)
         return hs_error(HS_ERROR_NOT_FOUND, "Device '%s' is not connected", dev->path);
 
+#ifdef _HS_SIMULATOR
+    if (_hs_simulator_is_device(dev))
+        return _hs_simulator_open_port(dev, mode, rport);
+#endif
+
     switch (dev->type) {
         case HS_DEVICE_TYPE_HID: {
 #ifdef __APPLE__
@@ -110,6 +118,13 @@ void hs_port_close(hs_port *port)
     if (!port)
         return;
 
+#ifdef _HS_SIMULATOR
+    if (port->sim) {
+        _hs_simulator_close_port(port);
+        return;
+    }
+#endif
+
     switch (port->type) {
         case HS_DEVICE_TYPE_HID: {
 #ifdef __APPLE__
@@ -139,6 +154,11 @@ hs_handle hs_port_get_poll_handle(const hs_port *port)
 {
     assert(port);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_get_port_poll_handle(port);
+#endif
+
     switch (port->type) {
         case HS_DEVICE_TYPE_HID: {
 #ifdef __APPLE__
@@ -19,6 +19,10 @@ struct hs_port {
     const char *path;
     hs_port_mode mode;
     hs_device *dev;
+#ifdef _HS_SIMULATOR
+    // Set for simulated devices, the union is unused then
+    struct _hs_simulator_port *sim;
+#endif
 
     union {
 #if defined(_WIN32)
@@ -19,6 +19,9 @@
 #include "device_priv.h"
 #include "hid.h"
 #include "platform.h"
+#ifdef _HS_SIMULATOR
+    #include "simulator_priv.h"
+#endif
 
 static bool detect_kernel26_byte_bug()
 {
@@ -40,6 +43,11 @@ ssize_t hs_hid_read(hs_port *port, uint8_t *buf, size_t size, int timeout)
     assert(buf);
     assert(size);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_hid_read(port, buf, size, timeout);
+#endif
+
     ssize_t r;
 
     if (timeout) {
@@ -111,6 +119,11 @@ ssize_t hs_hid_write(hs_port *port, const uint8_t *buf, size_t size)
     if (size < 2)
         return 0;
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_hid_write(port, buf, size);
+#endif
+
     ssize_t r;
 
 restart:
@@ -135,6 +148,11 @@ ssize_t hs_hid_get_feature_report(hs_port *port, uint8_t report_id, uint8_t *buf
     assert(buf);
     assert(size);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_hid_get_feature_report(port, report_id, buf, size);
+#endif
+
     ssize_t r;
 
     if (size >= 2)
@@ -164,6 +182,11 @@ ssize_t hs_hid_send_feature_report(hs_port *port, const uint8_t *buf, size_t siz
     if (size < 2)
         return 0;
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_hid_send_feature_report(port, buf, size);
+#endif
+
     ssize_t r;
 
 restart:
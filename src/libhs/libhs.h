@@ -37,6 +37,7 @@
 #include "monitor.h"
 #include "platform.h"
 #include "serial.h"
+#include "simulator.h"
 
 #endif
 
@@ -80,6 +81,9 @@
         #include "monitor_linux.c"
         #include "platform_posix.c"
         #include "serial_posix.c"
+        #ifdef _HS_SIMULATOR
+            #include "simulator.c"
+        #endif
     #else
         #error "Platform not supported"
     #endif
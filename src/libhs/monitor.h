@@ -27,6 +27,30 @@ HS_BEGIN_C
  */
 struct hs_monitor;
 
+/**
+ * @ingroup monitor
+ * @brief Source of the device change notifications.
+ *
+ * @sa hs_monitor_set_backend()
+ */
+typedef enum hs_monitor_backend {
+    /** Device manager of the OS (udev on Linux). */
+    HS_MONITOR_BACKEND_DEFAULT,
+    /**
+     * Linux only: kernel uevents, with device details read directly from sysfs.
+     *
+     * Devices are reported as soon as the kernel creates them, without waiting for udev to run
+     * its rules. Devices whose node is not accessible yet (permissions are usually set by udev
+     * rules) are reported once udev is done with them.
+     */
+    HS_MONITOR_BACKEND_KERNEL,
+    /**
+     * Simulated devices only, see @ref simulator. This backend is only available when libhs
+     * is built with the simulator.
+     */
+    HS_MONITOR_BACKEND_SIMULATOR
+} hs_monitor_backend;
+
 /**
  * @ingroup monitor
  * @brief Device enumeration and event callback.
@@ -85,6 +109,21 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
  */
 int hs_find(const hs_match_spec *matches, unsigned int count, struct hs_device **rdev);
 
+/**
+ * @ingroup monitor
+ * @brief Use a persistent cache of device details.
+ *
+ * Enumeration (including the one done by hs_monitor_start()) reads the cache from this file
+ * and updates it when devices change, so that already known devices do not need to be queried
+ * again. Entries are validated against the OS device tree, stale entries are never used.
+ *
+ * The cache is only implemented on Linux, this function does nothing on other platforms.
+ *
+ * @param filename Path of the cache file, or NULL to disable the cache (default).
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+int hs_enumerate_set_cache_file(const char *filename);
+
 /**
  * @{
  * @name Monitoring Functions
@@ -117,6 +156,19 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
  */
 void hs_monitor_free(hs_monitor *monitor);
 
+/**
+ * @ingroup monitor
+ * @brief Change the source of the device change notifications.
+ *
+ * The new backend is used the next time the monitor is started.
+ *
+ * @param monitor Device monitor.
+ * @param backend Notification backend, see @ref hs_monitor_backend.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value if the
+ *     backend is not available on this platform.
+ */
+int hs_monitor_set_backend(hs_monitor *monitor, hs_monitor_backend backend);
+
 /**
  * @ingroup monitor
  * @brief Get a pollable descriptor for device monitor events.
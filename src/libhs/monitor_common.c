@@ -27,6 +27,25 @@ int hs_find(const hs_match_spec *matches, unsigned int count, hs_device **rdev)
     return hs_enumerate(matches, count, find_callback, rdev);
 }
 
+#ifndef __linux__
+int hs_enumerate_set_cache_file(const char *filename)
+{
+    (void)filename;
+    return 0;
+}
+
+int hs_monitor_set_backend(hs_monitor *monitor, hs_monitor_backend backend)
+{
+    assert(monitor);
+
+    if (backend != HS_MONITOR_BACKEND_DEFAULT)
+        return hs_error(HS_ERROR_SYSTEM, "%s monitor backend is only available on Linux",
+                        backend == HS_MONITOR_BACKEND_KERNEL ? "Kernel" : "Simulator");
+
+    return 0;
+}
+#endif
+
 void _hs_monitor_clear_devices(_hs_htable *devices)
 {
     _hs_htable_foreach(cur, devices) {
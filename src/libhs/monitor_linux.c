@@ -12,20 +12,37 @@
 #include <fcntl.h>
 #include <linux/hidraw.h>
 #include <libudev.h>
+#include <linux/netlink.h>
 #include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include "device_priv.h"
 #include "match_priv.h"
 #include "monitor_priv.h"
 #include "platform.h"
+#ifdef _HS_SIMULATOR
+    #include "simulator_priv.h"
+#endif
 
 struct hs_monitor {
     _hs_match_helper match_helper;
     _hs_htable devices;
 
+    hs_monitor_backend backend;
+
     struct udev_monitor *udev_mon;
+    // Only used with HS_MONITOR_BACKEND_KERNEL, wait_fd then points to epoll_fd
+    int uevent_fd;
+    int epoll_fd;
+    bool uevent_lost;
+#ifdef _HS_SIMULATOR
+    // Only used with HS_MONITOR_BACKEND_SIMULATOR, udev is left alone then
+    _hs_simulator_watch *sim_watch;
+#endif
     int wait_fd;
 };
 
@@ -46,6 +63,11 @@ static struct device_subsystem device_subsystems[] = {
     {NULL}
 };
 
+// Multicast group of the raw kernel uevents, udev rebroadcasts processed events on group 2
+#define UEVENT_KERNEL_GROUP 1
+#define UEVENT_BUFFER_SIZE 8192
+#define UEVENT_SOCKET_BUFFER_SIZE (1024 * 1024)
+
 static pthread_mutex_t udev_init_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct udev *udev;
 static int common_eventfd = -1;
@@ -352,6 +374,559 @@ cleanup:
     return r;
 }
 
+/* Optional persistent cache of the device details, which saves the udev parent walks and
+   the HID descriptor reads for devices we have already seen. Entries are keyed by syspath
+   and validated against the inode number of the sysfs directory: kernfs gives a new inode
+   number to each new node, so it changes whenever the device is plugged again or replaced
+   by another one, even at the same syspath. The timestamps are not usable for that, kernfs
+   resets them when the inode gets evicted from memory. Nodes that do not belong to an USB
+   interface (e.g. ttyS*) are cached too, there are usually a lot of them. */
+
+#define CACHE_MAGIC "HSENUMC"
+#define CACHE_VERSION 1
+#define CACHE_TABLE_SIZE 256
+#define CACHE_NULL_STRING UINT16_MAX
+
+struct cache_entry {
+    _hs_htable_head hnode;
+    char *syspath;
+
+    uint64_t ino;
+
+    bool seen;
+    // NULL for nodes we do not support
+    hs_device *dev;
+};
+
+struct cache_record {
+    uint64_t ino;
+
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t usage_page;
+    uint16_t usage;
+    uint8_t supported;
+    uint8_t type;
+    uint8_t iface_number;
+    uint8_t numbered_reports;
+
+    // syspath, key, location, path, manufacturer, product, serial number
+    uint16_t lengths[7];
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_filename;
+static bool cache_loaded;
+static bool cache_dirty;
+static _hs_htable cache_entries;
+
+static int copy_string(const char *src, char **rdest)
+{
+    if (src) {
+        *rdest = strdup(src);
+        if (!*rdest)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    return 0;
+}
+
+static int copy_device(const hs_device *src, hs_device **rdev)
+{
+    hs_device *dev;
+    int r;
+
+    dev = (hs_device *)calloc(1, sizeof(*dev));
+    if (!dev) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    dev->refcount = 1;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+
+    dev->type = src->type;
+    dev->vid = src->vid;
+    dev->pid = src->pid;
+    dev->iface_number = src->iface_number;
+    dev->u = src->u;
+
+    if ((r = copy_string(src->key, &dev->key)) < 0 ||
+            (r = copy_string(src->location, &dev->location)) < 0 ||
+            (r = copy_string(src->path, &dev->path)) < 0 ||
+            (r = copy_string(src->manufacturer_string, &dev->manufacturer_string)) < 0 ||
+            (r = copy_string(src->product_string, &dev->product_string)) < 0 ||
+            (r = copy_string(src->serial_number_string, &dev->serial_number_string)) < 0)
+        goto error;
+
+    *rdev = dev;
+    return 0;
+
+error:
+    hs_device_unref(dev);
+    return r;
+}
+
+static bool stat_syspath(const char *syspath, uint64_t *rino)
+{
+    struct stat sb;
+
+    if (stat(syspath, &sb) < 0)
+        return false;
+
+    *rino = (uint64_t)sb.st_ino;
+    return true;
+}
+
+static void free_cache_entry(struct cache_entry *entry)
+{
+    if (entry) {
+        hs_device_unref(entry->dev);
+        free(entry->syspath);
+    }
+
+    free(entry);
+}
+
+static void clear_cache(void)
+{
+    _hs_htable_foreach(cur, &cache_entries) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+        free_cache_entry(entry);
+    }
+    _hs_htable_clear(&cache_entries);
+}
+
+static struct cache_entry *find_cache_entry(const char *syspath)
+{
+    _hs_htable_foreach_hash(cur, &cache_entries, _hs_htable_hash_str(syspath)) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+
+        if (strcmp(entry->syspath, syspath) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void add_cache_entry(struct cache_entry *entry)
+{
+    struct cache_entry *prev = find_cache_entry(entry->syspath);
+
+    if (prev) {
+        _hs_htable_remove(&prev->hnode);
+        free_cache_entry(prev);
+    }
+    _hs_htable_add(&cache_entries, _hs_htable_hash_str(entry->syspath), &entry->hnode);
+}
+
+static bool read_cache_string(FILE *fp, uint16_t len, char **rstr)
+{
+    char *str;
+
+    if (len == CACHE_NULL_STRING)
+        return true;
+
+    str = (char *)malloc((size_t)len + 1);
+    if (!str)
+        return false;
+    if (len && fread(str, 1, len, fp) != len) {
+        free(str);
+        return false;
+    }
+    str[len] = 0;
+
+    *rstr = str;
+    return true;
+}
+
+static bool read_cache_entry(FILE *fp, struct cache_entry **rentry)
+{
+    struct cache_record record;
+    struct cache_entry *entry = NULL;
+    char *strings[7] = {0};
+    hs_device *dev = NULL;
+
+    if (fread(&record, sizeof(record), 1, fp) != 1)
+        goto error;
+    for (unsigned int i = 0; i < _HS_COUNTOF(strings); i++) {
+        if (!read_cache_string(fp, record.lengths[i], &strings[i]))
+            goto error;
+    }
+    if (!strings[0])
+        goto error;
+
+    if (record.supported) {
+        if ((record.type != HS_DEVICE_TYPE_HID && record.type != HS_DEVICE_TYPE_SERIAL) ||
+                !strings[1] || !strings[2] || !strings[3])
+            goto error;
+
+        dev = (hs_device *)calloc(1, sizeof(*dev));
+        if (!dev)
+            goto error;
+        dev->refcount = 1;
+        dev->status = HS_DEVICE_STATUS_ONLINE;
+
+        dev->type = (hs_device_type)record.type;
+        dev->key = strings[1];
+        dev->location = strings[2];
+        dev->path = strings[3];
+        dev->manufacturer_string = strings[4];
+        dev->product_string = strings[5];
+        dev->serial_number_string = strings[6];
+        memset(strings + 1, 0, sizeof(strings) - sizeof(*strings));
+        dev->vid = record.vid;
+        dev->pid = record.pid;
+        dev->iface_number = record.iface_number;
+        if (dev->type == HS_DEVICE_TYPE_HID) {
+            dev->u.hid.usage_page = record.usage_page;
+            dev->u.hid.usage = record.usage;
+            dev->u.hid.numbered_reports = record.numbered_reports;
+        }
+    }
+
+    entry = (struct cache_entry *)calloc(1, sizeof(*entry));
+    if (!entry)
+        goto error;
+    entry->syspath = strings[0];
+    strings[0] = NULL;
+    entry->ino = record.ino;
+    entry->dev = dev;
+
+    for (unsigned int i = 1; i < _HS_COUNTOF(strings); i++)
+        free(strings[i]);
+
+    *rentry = entry;
+    return true;
+
+error:
+    hs_device_unref(dev);
+    for (unsigned int i = 0; i < _HS_COUNTOF(strings); i++)
+        free(strings[i]);
+    return false;
+}
+
+// The cache is only an optimization, an invalid or truncated file is simply ignored
+static void load_cache(void)
+{
+    FILE *fp;
+    char magic[8];
+    uint32_t version;
+
+    cache_loaded = true;
+    cache_dirty = false;
+
+    fp = fopen(cache_filename, "rb");
+    if (!fp)
+        return;
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, CACHE_MAGIC, sizeof(magic)) ||
+            fread(&version, sizeof(version), 1, fp) != 1 || version != CACHE_VERSION) {
+        hs_log(HS_LOG_DEBUG, "Ignoring invalid enumeration cache '%s'", cache_filename);
+        goto cleanup;
+    }
+
+    for (;;) {
+        struct cache_entry *entry;
+
+        if (!read_cache_entry(fp, &entry))
+            break;
+        add_cache_entry(entry);
+    }
+    if (!feof(fp))
+        hs_log(HS_LOG_DEBUG, "Ignoring end of invalid enumeration cache '%s'", cache_filename);
+
+cleanup:
+    fclose(fp);
+}
+
+static void write_cache_entry(FILE *fp, const struct cache_entry *entry)
+{
+    struct cache_record record;
+    const char *strings[7] = {0};
+
+    memset(&record, 0, sizeof(record));
+    record.ino = entry->ino;
+    strings[0] = entry->syspath;
+
+    if (entry->dev) {
+        const hs_device *dev = entry->dev;
+
+        record.supported = 1;
+        record.type = (uint8_t)dev->type;
+        record.vid = dev->vid;
+        record.pid = dev->pid;
+        record.iface_number = dev->iface_number;
+        if (dev->type == HS_DEVICE_TYPE_HID) {
+            record.usage_page = dev->u.hid.usage_page;
+            record.usage = dev->u.hid.usage;
+            record.numbered_reports = dev->u.hid.numbered_reports;
+        }
+
+        strings[1] = dev->key;
+        strings[2] = dev->location;
+        strings[3] = dev->path;
+        strings[4] = dev->manufacturer_string;
+        strings[5] = dev->product_string;
+        strings[6] = dev->serial_number_string;
+    }
+
+    for (unsigned int i = 0; i < _HS_COUNTOF(strings); i++) {
+        size_t len = strings[i] ? strlen(strings[i]) : CACHE_NULL_STRING;
+
+        // Not worth caching, we'll read it again next time
+        if (strings[i] && len >= CACHE_NULL_STRING)
+            return;
+        record.lengths[i] = (uint16_t)len;
+    }
+
+    fwrite(&record, sizeof(record), 1, fp);
+    for (unsigned int i = 0; i < _HS_COUNTOF(strings); i++) {
+        if (strings[i])
+            fwrite(strings[i], 1, record.lengths[i], fp);
+    }
+}
+
+// Write a new file and rename it, so that concurrent readers never see a partial cache
+static void save_cache(void)
+{
+    char *tmp_filename = NULL;
+    FILE *fp = NULL;
+    uint32_t version = CACHE_VERSION;
+    int r;
+
+    r = _hs_asprintf(&tmp_filename, "%s.%d.tmp", cache_filename, (int)getpid());
+    if (r < 0) {
+        tmp_filename = NULL;
+        goto cleanup;
+    }
+
+    fp = fopen(tmp_filename, "wb");
+    if (!fp) {
+        hs_log(HS_LOG_DEBUG, "Cannot write enumeration cache '%s': %s", tmp_filename,
+               strerror(errno));
+        goto cleanup;
+    }
+
+    fwrite(CACHE_MAGIC, 8, 1, fp);
+    fwrite(&version, sizeof(version), 1, fp);
+    _hs_htable_foreach(cur, &cache_entries) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+        write_cache_entry(fp, entry);
+    }
+
+    r = fclose(fp);
+    fp = NULL;
+    if (r || rename(tmp_filename, cache_filename) < 0) {
+        hs_log(HS_LOG_DEBUG, "Cannot write enumeration cache '%s': %s", cache_filename,
+               strerror(errno));
+        unlink(tmp_filename);
+        goto cleanup;
+    }
+
+    cache_dirty = false;
+
+cleanup:
+    if (fp) {
+        fclose(fp);
+        unlink(tmp_filename);
+    }
+    free(tmp_filename);
+}
+
+int hs_enumerate_set_cache_file(const char *filename)
+{
+    char *new_filename = NULL;
+    int r;
+
+    if (filename) {
+        new_filename = strdup(filename);
+        if (!new_filename)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_entries.size) {
+        r = _hs_htable_init(&cache_entries, CACHE_TABLE_SIZE);
+        if (r < 0) {
+            pthread_mutex_unlock(&cache_lock);
+            free(new_filename);
+            return r;
+        }
+    }
+
+    clear_cache();
+    free(cache_filename);
+    cache_filename = new_filename;
+    cache_loaded = false;
+    cache_dirty = false;
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return 0;
+}
+
+/* Returns 1 and sets *rdev (possibly to NULL for unsupported nodes) if the cache holds a
+   valid entry for this syspath, or 0 if the device needs to be read from udev. */
+static int find_cached_device(const char *syspath, uint64_t ino, hs_device **rdev)
+{
+    struct cache_entry *entry;
+    hs_device *dev = NULL;
+    int r;
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_filename) {
+        r = 0;
+        goto cleanup;
+    }
+    if (!cache_loaded)
+        load_cache();
+
+    entry = find_cache_entry(syspath);
+    if (!entry || entry->ino != ino) {
+        r = 0;
+        goto cleanup;
+    }
+
+    if (entry->dev) {
+        // Cheap enough, and fill_device_details() does the same
+        if (access(entry->dev->path, F_OK) != 0) {
+            r = 0;
+            goto cleanup;
+        }
+
+        r = copy_device(entry->dev, &dev);
+        if (r < 0)
+            goto cleanup;
+    }
+    entry->seen = true;
+
+    *rdev = dev;
+    r = 1;
+cleanup:
+    pthread_mutex_unlock(&cache_lock);
+    return r;
+}
+
+static int cache_device(const char *syspath, uint64_t ino, hs_device *dev)
+{
+    struct cache_entry *entry = NULL;
+    int r;
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_filename) {
+        r = 0;
+        goto cleanup;
+    }
+
+    entry = (struct cache_entry *)calloc(1, sizeof(*entry));
+    if (!entry) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    entry->syspath = strdup(syspath);
+    if (!entry->syspath) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    entry->ino = ino;
+    entry->seen = true;
+    if (dev) {
+        r = copy_device(dev, &entry->dev);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    add_cache_entry(entry);
+    entry = NULL;
+    cache_dirty = true;
+
+    r = 0;
+cleanup:
+    pthread_mutex_unlock(&cache_lock);
+    free_cache_entry(entry);
+    return r;
+}
+
+/* Drop the entries that were not seen during a complete enumeration (unplugged devices),
+   and write the cache if anything changed. */
+static void flush_cache(bool complete)
+{
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_filename)
+        goto cleanup;
+
+    _hs_htable_foreach(cur, &cache_entries) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+
+        if (complete && !entry->seen) {
+            _hs_htable_remove(&entry->hnode);
+            free_cache_entry(entry);
+            cache_dirty = true;
+        } else {
+            entry->seen = false;
+        }
+    }
+
+    if (cache_dirty)
+        save_cache();
+
+cleanup:
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static int read_device_from_syspath(const char *syspath, hs_device **rdev)
+{
+    struct udev_device *udev_dev;
+    uint64_t ino = 0;
+    bool cacheable;
+    hs_device *dev = NULL;
+    int r;
+
+    cacheable = stat_syspath(syspath, &ino);
+    if (cacheable) {
+        r = find_cached_device(syspath, ino, &dev);
+        if (r < 0)
+            return r;
+        if (r) {
+            *rdev = dev;
+            return !!dev;
+        }
+    }
+
+    udev_dev = udev_device_new_from_syspath(udev, syspath);
+    if (!udev_dev) {
+        if (errno == ENOMEM)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        return 0;
+    }
+
+    r = read_device_information(udev_dev, &dev);
+    if (r < 0)
+        goto cleanup;
+
+    /* Devices that are not ready yet may fail for other reasons, only remember the
+       nodes that will never be supported. */
+    if (cacheable && (r || !udev_device_get_parent_with_subsystem_devtype(udev_dev, "usb",
+                                                                          "usb_interface"))) {
+        int r2 = cache_device(syspath, ino, dev);
+        if (r2 < 0) {
+            hs_device_unref(dev);
+            r = r2;
+            goto cleanup;
+        }
+    }
+
+    if (r)
+        *rdev = dev;
+cleanup:
+    udev_device_unref(udev_dev);
+    return r;
+}
+
 static void release_udev(void)
 {
     close(common_eventfd);
@@ -402,6 +977,7 @@ cleanup:
 static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void *udata)
 {
     struct udev_enumerate *enumerate;
+    bool complete = true;
     int r;
 
     enumerate = udev_enumerate_new(udev);
@@ -418,6 +994,8 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
                 r = hs_error(HS_ERROR_MEMORY, NULL);
                 goto cleanup;
             }
+        } else {
+            complete = false;
         }
     }
 
@@ -430,20 +1008,9 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
 
     struct udev_list_entry *cur;
     udev_list_entry_foreach(cur, udev_enumerate_get_list_entry(enumerate)) {
-        struct udev_device *udev_dev;
         hs_device *dev;
 
-        udev_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(cur));
-        if (!udev_dev) {
-            if (errno == ENOMEM) {
-                r = hs_error(HS_ERROR_MEMORY, NULL);
-                goto cleanup;
-            }
-            continue;
-        }
-
-        r = read_device_information(udev_dev, &dev);
-        udev_device_unref(udev_dev);
+        r = read_device_from_syspath(udev_list_entry_get_name(cur), &dev);
         if (r < 0)
             goto cleanup;
         if (!r)
@@ -461,6 +1028,9 @@ static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void
 
     r = 0;
 cleanup:
+    // Interrupted enumerations did not see every device
+    if (r >= 0)
+        flush_cache(complete && !r);
     udev_enumerate_unref(enumerate);
     return r;
 }
@@ -499,11 +1069,207 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
     ctx.udata = udata;
 
     r = enumerate(&match_helper, enumerate_enumerate_callback, &ctx);
+#ifdef _HS_SIMULATOR
+    if (!r)
+        r = _hs_simulator_enumerate(&match_helper, enumerate_enumerate_callback, &ctx);
+#endif
 
     _hs_match_helper_release(&match_helper);
     return r;
 }
 
+/* Kernel uevents look like "add@/devices/...\0ACTION=add\0DEVPATH=/devices/...\0...", and buf
+   must be NUL-terminated. The strings point inside buf. */
+bool _hs_parse_uevent(const char *buf, size_t len, _hs_uevent *ruevent)
+{
+    _hs_uevent uevent = {0};
+    const char *end = buf + len;
+
+    // Messages sent by libudev start with "libudev", they are not for us anyway
+    if (!strchr(buf, '@'))
+        return false;
+
+    for (const char *ptr = buf + strlen(buf) + 1; ptr < end; ptr += strlen(ptr) + 1) {
+        if (strncmp(ptr, "ACTION=", 7) == 0) {
+            uevent.action = ptr + 7;
+        } else if (strncmp(ptr, "DEVPATH=", 8) == 0) {
+            uevent.devpath = ptr + 8;
+        } else if (strncmp(ptr, "SUBSYSTEM=", 10) == 0) {
+            uevent.subsystem = ptr + 10;
+        }
+    }
+    if (!uevent.action || !uevent.devpath || !uevent.subsystem)
+        return false;
+
+    *ruevent = uevent;
+    return true;
+}
+
+static int open_uevent_socket(int *rfd)
+{
+    struct sockaddr_nl addr = {0};
+    int size = UEVENT_SOCKET_BUFFER_SIZE;
+    int fd;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "socket(NETLINK_KOBJECT_UEVENT) failed: %s",
+                        strerror(errno));
+
+    // Boards rebooting together produce bursts, SO_RCVBUFFORCE needs CAP_NET_ADMIN
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int r = hs_error(HS_ERROR_SYSTEM, "bind() failed on uevent socket: %s", strerror(errno));
+        close(fd);
+        return r;
+    }
+
+    *rfd = fd;
+    return 0;
+}
+
+static bool is_monitored_subsystem(hs_monitor *monitor, const char *subsystem)
+{
+    for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
+        if (strcmp(device_subsystems[i].subsystem, subsystem) == 0)
+            return _hs_match_helper_has_type(&monitor->match_helper, device_subsystems[i].type);
+    }
+
+    return false;
+}
+
+static int process_uevent(hs_monitor *monitor, const _hs_uevent *uevent,
+                          hs_enumerate_func *f, void *udata)
+{
+    int r;
+
+    if (!is_monitored_subsystem(monitor, uevent->subsystem))
+        return 0;
+
+    if (strcmp(uevent->action, "add") == 0) {
+        char syspath[4096];
+        hs_device *dev = NULL;
+
+        if (snprintf(syspath, sizeof(syspath), "/sys%s", uevent->devpath) >= (int)sizeof(syspath))
+            return 0;
+
+        r = read_device_from_syspath(syspath, &dev);
+        if (r <= 0)
+            return r;
+
+        /* Until udev rules have run, the device node may still belong to root. In this
+           case the udev event will report the device a bit later. */
+        if (access(dev->path, R_OK | W_OK) == 0) {
+            r = _hs_match_helper_match(&monitor->match_helper, dev, &dev->match_udata);
+            if (r)
+                r = _hs_monitor_add(&monitor->devices, dev, f, udata);
+        } else {
+            r = 0;
+        }
+
+        hs_device_unref(dev);
+        return r;
+    } else if (strcmp(uevent->action, "remove") == 0) {
+        _hs_monitor_remove(&monitor->devices, uevent->devpath, f, udata);
+    }
+
+    return 0;
+}
+
+static int refresh_uevents(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    char buf[UEVENT_BUFFER_SIZE];
+    int r;
+
+    for (;;) {
+        struct sockaddr_nl addr;
+        socklen_t addr_len = sizeof(addr);
+        _hs_uevent uevent;
+        ssize_t len;
+
+        len = recvfrom(monitor->uevent_fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&addr,
+                       &addr_len);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            // Not fatal, we can still rely on udev events (see hs_monitor_refresh)
+            if (errno == ENOBUFS) {
+                hs_log(HS_LOG_WARNING,
+                       "Kernel uevent socket overflow, falling back to udev events");
+                monitor->uevent_lost = true;
+                continue;
+            }
+            return hs_error(HS_ERROR_SYSTEM, "recvfrom() failed on uevent socket: %s",
+                            strerror(errno));
+        }
+
+        // Only the kernel (port ID 0) sends real uevents
+        if (addr_len != sizeof(addr) || addr.nl_pid)
+            continue;
+        buf[len] = 0;
+
+        if (!_hs_parse_uevent(buf, (size_t)len, &uevent))
+            continue;
+
+        r = process_uevent(monitor, &uevent, f, udata);
+        if (r)
+            return r;
+    }
+
+    return 0;
+}
+
+/* With the kernel backend, udev events lag behind and may refer to devices that are already
+   gone (or replaced at the same devpath). Only trust them for new devices that still exist,
+   or for everything if we've lost kernel events. */
+bool _hs_monitor_accept_udev_event(const char *action, bool exists, bool trusted)
+{
+    if (strcmp(action, "add") == 0)
+        return trusted || exists;
+
+    return trusted;
+}
+
+static void close_uevent_socket(hs_monitor *monitor)
+{
+    if (monitor->epoll_fd >= 0)
+        close(monitor->epoll_fd);
+    monitor->epoll_fd = -1;
+    if (monitor->uevent_fd >= 0)
+        close(monitor->uevent_fd);
+    monitor->uevent_fd = -1;
+    monitor->uevent_lost = false;
+}
+
+static int start_uevent_socket(hs_monitor *monitor)
+{
+    struct epoll_event ev = {0};
+    int r;
+
+    r = open_uevent_socket(&monitor->uevent_fd);
+    if (r < 0)
+        return r;
+
+    // The poll handle must report both sockets, epoll descriptors are pollable
+    monitor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (monitor->epoll_fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+
+    ev.events = EPOLLIN;
+    if (epoll_ctl(monitor->epoll_fd, EPOLL_CTL_ADD, monitor->uevent_fd, &ev) < 0 ||
+            epoll_ctl(monitor->epoll_fd, EPOLL_CTL_ADD, udev_monitor_get_fd(monitor->udev_mon),
+                      &ev) < 0)
+        return hs_error(HS_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+
+    return 0;
+}
+
 int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor **rmonitor)
 {
     assert(rmonitor);
@@ -516,6 +1282,8 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
     }
+    monitor->uevent_fd = -1;
+    monitor->epoll_fd = -1;
     monitor->wait_fd = -1;
 
     r = _hs_match_helper_init(&monitor->match_helper, matches, count);
@@ -548,6 +1316,10 @@ void hs_monitor_free(hs_monitor *monitor)
 {
     if (monitor) {
         close(monitor->wait_fd);
+        close_uevent_socket(monitor);
+#ifdef _HS_SIMULATOR
+        _hs_simulator_watch_free(monitor->sim_watch);
+#endif
         udev_monitor_unref(monitor->udev_mon);
 
         _hs_monitor_clear_devices(&monitor->devices);
@@ -558,6 +1330,20 @@ void hs_monitor_free(hs_monitor *monitor)
     free(monitor);
 }
 
+int hs_monitor_set_backend(hs_monitor *monitor, hs_monitor_backend backend)
+{
+    assert(monitor);
+
+#ifndef _HS_SIMULATOR
+    if (backend == HS_MONITOR_BACKEND_SIMULATOR)
+        return hs_error(HS_ERROR_SYSTEM,
+                        "Simulator monitor backend is not available in this build");
+#endif
+
+    monitor->backend = backend;
+    return 0;
+}
+
 static int monitor_enumerate_callback(hs_device *dev, void *udata)
 {
     hs_monitor *monitor = (hs_monitor *)udata;
@@ -573,6 +1359,25 @@ int hs_monitor_start(hs_monitor *monitor)
     if (monitor->udev_mon)
         return 0;
 
+#ifdef _HS_SIMULATOR
+    if (monitor->sim_watch)
+        return 0;
+
+    if (monitor->backend == HS_MONITOR_BACKEND_SIMULATOR) {
+        r = _hs_simulator_watch_new(&monitor->sim_watch);
+        if (r < 0)
+            return r;
+
+        r = _hs_simulator_watch_refresh(monitor->sim_watch, &monitor->match_helper,
+                                        &monitor->devices, NULL, NULL);
+        if (r < 0)
+            goto error;
+
+        dup3(_hs_simulator_watch_get_fd(monitor->sim_watch), monitor->wait_fd, O_CLOEXEC);
+        return 0;
+    }
+#endif
+
     monitor->udev_mon = udev_monitor_new_from_netlink(udev, "udev");
     if (!monitor->udev_mon) {
         r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_new_from_netlink() failed");
@@ -595,13 +1400,25 @@ int hs_monitor_start(hs_monitor *monitor)
         goto error;
     }
 
+    /* We keep listening to udev with the kernel backend, it reports the devices that
+       were not accessible yet when the kernel event came in. */
+    if (monitor->backend == HS_MONITOR_BACKEND_KERNEL) {
+        r = start_uevent_socket(monitor);
+        if (r < 0)
+            goto error;
+    }
+
     r = enumerate(&monitor->match_helper, monitor_enumerate_callback, monitor);
     if (r < 0)
         goto error;
 
     /* Given the documentation of dup3() and the kernel code handling it, I'm reasonably sure
        nothing can make this call fail. */
-    dup3(udev_monitor_get_fd(monitor->udev_mon), monitor->wait_fd, O_CLOEXEC);
+    if (monitor->epoll_fd >= 0) {
+        dup3(monitor->epoll_fd, monitor->wait_fd, O_CLOEXEC);
+    } else {
+        dup3(udev_monitor_get_fd(monitor->udev_mon), monitor->wait_fd, O_CLOEXEC);
+    }
 
     return 0;
 
@@ -614,12 +1431,24 @@ void hs_monitor_stop(hs_monitor *monitor)
 {
     assert(monitor);
 
+#ifdef _HS_SIMULATOR
+    if (monitor->sim_watch) {
+        _hs_monitor_clear_devices(&monitor->devices);
+
+        dup3(common_eventfd, monitor->wait_fd, O_CLOEXEC);
+        _hs_simulator_watch_free(monitor->sim_watch);
+        monitor->sim_watch = NULL;
+        return;
+    }
+#endif
+
     if (!monitor->udev_mon)
         return;
 
     _hs_monitor_clear_devices(&monitor->devices);
 
     dup3(common_eventfd, monitor->wait_fd, O_CLOEXEC);
+    close_uevent_socket(monitor);
     udev_monitor_unref(monitor->udev_mon);
     monitor->udev_mon = NULL;
 }
@@ -637,12 +1466,34 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
     struct udev_device *udev_dev;
     int r;
 
+#ifdef _HS_SIMULATOR
+    if (monitor->sim_watch)
+        return _hs_simulator_watch_refresh(monitor->sim_watch, &monitor->match_helper,
+                                           &monitor->devices, f, udata);
+#endif
+
     if (!monitor->udev_mon)
         return 0;
 
+    if (monitor->uevent_fd >= 0) {
+        r = refresh_uevents(monitor, f, udata);
+        if (r)
+            return r;
+    }
+
     errno = 0;
     while ((udev_dev = udev_monitor_receive_device(monitor->udev_mon))) {
         const char *action = udev_device_get_action(udev_dev);
+        bool trusted = monitor->uevent_fd < 0 || monitor->uevent_lost;
+        // Only adds look at the node, and only when udev is not trusted anyway
+        bool exists = !trusted && strcmp(action, "add") == 0 &&
+                      access(udev_device_get_syspath(udev_dev), F_OK) == 0;
+
+        if (!_hs_monitor_accept_udev_event(action, exists, trusted)) {
+            udev_device_unref(udev_dev);
+            errno = 0;
+            continue;
+        }
 
         r = 0;
         if (strcmp(action, "add") == 0) {
@@ -26,4 +26,15 @@ void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func
 
 int _hs_monitor_list(_hs_htable *devices, hs_enumerate_func *f, void *udata);
 
+#ifdef __linux__
+typedef struct _hs_uevent {
+    const char *action;
+    const char *devpath;
+    const char *subsystem;
+} _hs_uevent;
+
+bool _hs_parse_uevent(const char *buf, size_t len, _hs_uevent *ruevent);
+bool _hs_monitor_accept_udev_event(const char *action, bool exists, bool trusted);
+#endif
+
 #endif
@@ -16,12 +16,20 @@
 #include "device_priv.h"
 #include "platform.h"
 #include "serial.h"
+#ifdef _HS_SIMULATOR
+    #include "simulator_priv.h"
+#endif
 
 int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
 {
     assert(port);
     assert(config);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_serial_set_config(port, config);
+#endif
+
     struct termios tio;
     int modem_bits;
     int r;
@@ -178,6 +186,11 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
 {
     assert(port);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_serial_get_config(port, config);
+#endif
+
     struct termios tio;
     int modem_bits;
     int r;
@@ -277,6 +290,11 @@ ssize_t hs_serial_read(hs_port *port, uint8_t *buf, size_t size, int timeout)
     assert(buf);
     assert(size);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_serial_read(port, buf, size, timeout);
+#endif
+
     ssize_t r;
 
     if (timeout) {
@@ -319,6 +337,11 @@ ssize_t hs_serial_write(hs_port *port, const uint8_t *buf, size_t size, int time
     assert(port->mode & HS_PORT_MODE_WRITE);
     assert(buf);
 
+#ifdef _HS_SIMULATOR
+    if (port->sim)
+        return _hs_simulator_serial_write(port, buf, size);
+#endif
+
     struct pollfd pfd;
     uint64_t start;
     int adjusted_timeout;
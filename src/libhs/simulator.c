@@ -0,0 +1,1086 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libraries
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <poll.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include "array.h"
+#include "device_priv.h"
+#include "match_priv.h"
+#include "monitor_priv.h"
+#include "platform.h"
+#include "simulator_priv.h"
+
+// USB identifiers and HID usages used by PJRC for Teensy boards
+#define TEENSY_VID 0x16C0
+#define TEENSY_PID_HALFKAY 0x0478
+#define TEENSY_PID_SEREMU 0x0482
+#define TEENSY_PID_SERIAL 0x0483
+#define HALFKAY_USAGE_PAGE 0xFF9C
+#define SEREMU_USAGE_PAGE 0xFFC9
+#define SEREMU_USAGE 0x04
+
+#define SEREMU_REPORT_SIZE 64
+// Teensyduino sends incomplete Seremu packets when nothing else comes for a short while
+#define SEREMU_FLUSH_DELAY 3000
+// Unread data beyond this is lost, roughly what the tty layer and hidraw keep around
+#define CDC_BUFFER_SIZE 4096
+#define SEREMU_BUFFER_SIZE (64 * SEREMU_REPORT_SIZE)
+
+#define STREAM_LINE_SIZE 32
+#define SERIAL_REBOOT_BAUDRATE 134
+
+enum board_mode {
+    MODE_OFFLINE,
+    MODE_RUNNING,
+    MODE_BOOTLOADER
+};
+
+struct hs_simulator_board {
+    // Protected by sim_lock, like everything else in this file
+    unsigned int refcount;
+    unsigned int id;
+    hs_simulator_config config;
+    bool plugged;
+
+    enum board_mode mode;
+    // Device that shows up at next_time, when mode is MODE_OFFLINE
+    enum board_mode next_mode;
+    uint64_t next_time;
+
+    // Each device gets a new key (and path), ports of the previous one stop working
+    unsigned int device_seq;
+    char key[64];
+
+    uint8_t *flash;
+    bool erased;
+    uint64_t busy_until;
+
+    _HS_ARRAY(hs_port *) ports;
+    hs_simulator_stats stats;
+};
+
+struct _hs_simulator_port {
+    hs_simulator_board *board;
+    unsigned int device_seq;
+    // Expires when the port becomes readable, like a real descriptor would
+    int timer_fd;
+
+    hs_serial_config serial_config;
+    uint64_t open_time;
+    // Stream bytes that were read or dropped, the board starts sending when the port opens
+    uint64_t consumed;
+};
+
+struct _hs_simulator_watch {
+    int timer_fd;
+    uint64_t generation;
+};
+
+typedef _HS_ARRAY(hs_device *) device_array;
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static _HS_ARRAY(hs_simulator_board *) sim_boards;
+static _HS_ARRAY(_hs_simulator_watch *) sim_watches;
+static unsigned int sim_next_id = 1;
+// Changes each time a simulated device appears or goes away
+static uint64_t sim_generation;
+
+// Microseconds are needed to simulate fast streams and USB transfers
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void sleep_us(uint64_t us)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(us / 1000000);
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        continue;
+}
+
+// Any time in the past (such as 1) makes the timer expire right away, 0 disarms it
+static void arm_timer(int fd, uint64_t time)
+{
+    struct itimerspec its = {0};
+
+    its.it_value.tv_sec = (time_t)(time / 1000000);
+    its.it_value.tv_nsec = (long)(time % 1000000) * 1000;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int create_timer(int *rfd)
+{
+    int fd;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "timerfd_create() failed: %s", strerror(errno));
+
+    *rfd = fd;
+    return 0;
+}
+
+static bool is_port_valid(const hs_port *port)
+{
+    const hs_simulator_board *board = port->sim->board;
+
+    return board->plugged && board->mode != MODE_OFFLINE &&
+           board->device_seq == port->sim->device_seq;
+}
+
+static uint64_t get_stream_capacity(const hs_simulator_board *board)
+{
+    return board->config.serial == HS_SIMULATOR_SERIAL_SEREMU ? SEREMU_BUFFER_SIZE
+                                                               : CDC_BUFFER_SIZE;
+}
+
+// Time at which the board has sent count bytes since the port was opened
+static uint64_t get_stream_time(const hs_port *port, uint64_t count)
+{
+    unsigned int rate = port->sim->board->config.serial_rate;
+    return port->sim->open_time + (count * 1000000 + rate - 1) / rate;
+}
+
+static uint64_t get_stream_available(hs_port *port, uint64_t now)
+{
+    hs_simulator_board *board = port->sim->board;
+    uint64_t produced, available, capacity;
+
+    if (board->mode != MODE_RUNNING || !board->config.serial_rate)
+        return 0;
+
+    produced = (now - port->sim->open_time) * board->config.serial_rate / 1000000;
+    available = produced - port->sim->consumed;
+
+    capacity = get_stream_capacity(board);
+    if (available > capacity) {
+        board->stats.serial_dropped += available - capacity;
+        port->sim->consumed += available - capacity;
+        available = capacity;
+    }
+
+    return available;
+}
+
+// Returns 0 when nothing can be read, or when the next read cannot be predicted
+static uint64_t get_stream_ready_time(const hs_port *port)
+{
+    const hs_simulator_board *board = port->sim->board;
+    uint64_t next;
+
+    if (board->mode != MODE_RUNNING || !board->config.serial_rate)
+        return 0;
+
+    next = get_stream_time(port, port->sim->consumed + 1);
+    if (board->config.serial == HS_SIMULATOR_SERIAL_SEREMU) {
+        uint64_t full = get_stream_time(port, port->sim->consumed + SEREMU_REPORT_SIZE);
+
+        next += SEREMU_FLUSH_DELAY;
+        if (full < next)
+            next = full;
+    }
+
+    return next;
+}
+
+static void fill_stream(const hs_simulator_board *board, uint64_t offset, uint8_t *buf,
+                        size_t size)
+{
+    char line[STREAM_LINE_SIZE + 1];
+
+    for (size_t i = 0; i < size;) {
+        uint64_t line_number = (offset + i) / STREAM_LINE_SIZE;
+        size_t col = (size_t)((offset + i) % STREAM_LINE_SIZE);
+        size_t len = STREAM_LINE_SIZE - col;
+
+        snprintf(line, sizeof(line), "%010" PRIu32 " %020" PRIu64 "\n",
+                 board->config.serial_number, line_number);
+
+        if (len > size - i)
+            len = size - i;
+        memcpy(buf + i, line + col, len);
+        i += len;
+    }
+}
+
+static void arm_port(const hs_port *port)
+{
+    if (is_port_valid(port)) {
+        arm_timer(port->sim->timer_fd, get_stream_ready_time(port));
+    } else {
+        // Wake up pollers, the next read fails
+        arm_timer(port->sim->timer_fd, 1);
+    }
+}
+
+static void update_watches(void)
+{
+    uint64_t next = 0;
+
+    for (size_t i = 0; i < sim_boards.count; i++) {
+        const hs_simulator_board *board = sim_boards.values[i];
+
+        if (board->mode == MODE_OFFLINE && board->next_mode != MODE_OFFLINE &&
+                (!next || board->next_time < next))
+            next = board->next_time;
+    }
+
+    for (size_t i = 0; i < sim_watches.count; i++) {
+        _hs_simulator_watch *watch = sim_watches.values[i];
+        arm_timer(watch->timer_fd, watch->generation != sim_generation ? 1 : next);
+    }
+}
+
+static void set_board_mode(hs_simulator_board *board, enum board_mode mode)
+{
+    const char *name = NULL;
+
+    board->mode = mode;
+    board->next_mode = MODE_OFFLINE;
+
+    switch (mode) {
+        case MODE_OFFLINE: {} break;
+
+        case MODE_RUNNING: {
+            switch (board->config.serial) {
+                case HS_SIMULATOR_SERIAL_NONE: { board->mode = MODE_OFFLINE; } break;
+                case HS_SIMULATOR_SERIAL_CDC: { name = "ttyACM"; } break;
+                case HS_SIMULATOR_SERIAL_SEREMU: { name = "seremu"; } break;
+            }
+        } break;
+
+        case MODE_BOOTLOADER: {
+            name = "halfkay";
+
+            board->erased = false;
+            board->busy_until = 0;
+        } break;
+    }
+
+    if (name) {
+        board->device_seq++;
+        snprintf(board->key, sizeof(board->key), "%s%u/%s%u", _HS_SIMULATOR_PATH_PREFIX,
+                 board->id, name, board->device_seq);
+    }
+
+    for (size_t i = 0; i < board->ports.count; i++)
+        arm_port(board->ports.values[i]);
+    sim_generation++;
+}
+
+// The current device goes away now, the new one shows up after delay microseconds
+static void schedule_board_mode(hs_simulator_board *board, enum board_mode mode,
+                                unsigned int delay, uint64_t now)
+{
+    set_board_mode(board, MODE_OFFLINE);
+    board->next_mode = mode;
+    board->next_time = now + delay;
+
+    update_watches();
+}
+
+static void advance_boards(uint64_t now)
+{
+    bool changed = false;
+
+    for (size_t i = 0; i < sim_boards.count; i++) {
+        hs_simulator_board *board = sim_boards.values[i];
+
+        if (board->mode == MODE_OFFLINE && board->next_mode != MODE_OFFLINE &&
+                now >= board->next_time) {
+            set_board_mode(board, board->next_mode);
+            changed = true;
+        }
+    }
+
+    if (changed)
+        update_watches();
+}
+
+static void unref_board(hs_simulator_board *board)
+{
+    if (--board->refcount)
+        return;
+
+    _hs_array_release(&board->ports);
+    free(board->flash);
+    free(board);
+}
+
+int hs_simulator_add_board(const hs_simulator_config *config, hs_simulator_board **rboard)
+{
+    assert(config);
+    assert(config->halfkay_version <= 3);
+    assert(!config->halfkay_version || (config->code_size && config->block_size));
+    assert(rboard);
+
+    hs_simulator_board *board;
+    int r;
+
+    board = (hs_simulator_board *)calloc(1, sizeof(*board));
+    if (!board)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    board->refcount = 1;
+    board->config = *config;
+    board->plugged = true;
+
+    if (config->code_size) {
+        board->flash = (uint8_t *)malloc(config->code_size);
+        if (!board->flash) {
+            free(board);
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        }
+        memset(board->flash, 0xFF, config->code_size);
+    }
+
+    pthread_mutex_lock(&sim_lock);
+
+    r = _hs_array_push(&sim_boards, board);
+    if (r < 0) {
+        pthread_mutex_unlock(&sim_lock);
+        unref_board(board);
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+    board->id = sim_next_id++;
+
+    set_board_mode(board, config->start_in_bootloader && config->halfkay_version
+                          ? MODE_BOOTLOADER : MODE_RUNNING);
+    update_watches();
+
+    pthread_mutex_unlock(&sim_lock);
+
+    *rboard = board;
+    return 0;
+}
+
+void hs_simulator_remove_board(hs_simulator_board *board)
+{
+    if (!board)
+        return;
+
+    pthread_mutex_lock(&sim_lock);
+
+    for (size_t i = 0; i < sim_boards.count; i++) {
+        if (sim_boards.values[i] == board) {
+            _hs_array_remove(&sim_boards, i, 1);
+            break;
+        }
+    }
+
+    set_board_mode(board, MODE_OFFLINE);
+    board->plugged = false;
+    update_watches();
+
+    unref_board(board);
+
+    pthread_mutex_unlock(&sim_lock);
+}
+
+size_t hs_simulator_read_flash(hs_simulator_board *board, size_t offset, uint8_t *buf,
+                               size_t size)
+{
+    assert(board);
+    assert(buf || !size);
+
+    pthread_mutex_lock(&sim_lock);
+
+    if (offset > board->config.code_size)
+        offset = board->config.code_size;
+    if (size > board->config.code_size - offset)
+        size = board->config.code_size - offset;
+    if (size)
+        memcpy(buf, board->flash + offset, size);
+
+    pthread_mutex_unlock(&sim_lock);
+
+    return size;
+}
+
+void hs_simulator_get_stats(hs_simulator_board *board, hs_simulator_stats *rstats)
+{
+    assert(board);
+    assert(rstats);
+
+    pthread_mutex_lock(&sim_lock);
+    *rstats = board->stats;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+static int create_device(const hs_simulator_board *board, hs_device **rdev)
+{
+    uint32_t serial_number = board->config.serial_number;
+    hs_device *dev;
+    int r;
+
+    dev = (hs_device *)calloc(1, sizeof(*dev));
+    if (!dev) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    dev->refcount = 1;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->vid = TEENSY_VID;
+
+    dev->key = strdup(board->key);
+    dev->path = strdup(board->key);
+    // Real root hubs start at 1, this cannot clash with real devices
+    r = asprintf(&dev->location, "usb-0-%u", board->id);
+    if (!dev->key || !dev->path || r < 0) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    if (board->mode == MODE_BOOTLOADER) {
+        dev->type = HS_DEVICE_TYPE_HID;
+        dev->pid = TEENSY_PID_HALFKAY;
+        dev->u.hid.usage_page = HALFKAY_USAGE_PAGE;
+        dev->u.hid.usage = board->config.halfkay_usage;
+
+        r = asprintf(&dev->serial_number_string, "%08" PRIX32, serial_number);
+    } else {
+        dev->manufacturer_string = strdup("Teensyduino");
+        if (board->config.serial == HS_SIMULATOR_SERIAL_SEREMU) {
+            dev->type = HS_DEVICE_TYPE_HID;
+            dev->pid = TEENSY_PID_SEREMU;
+            dev->u.hid.usage_page = SEREMU_USAGE_PAGE;
+            dev->u.hid.usage = SEREMU_USAGE;
+            dev->product_string = strdup("Serial Emulation");
+        } else {
+            dev->type = HS_DEVICE_TYPE_SERIAL;
+            dev->pid = TEENSY_PID_SERIAL;
+            dev->product_string = strdup("USB Serial");
+        }
+        if (!dev->manufacturer_string || !dev->product_string) {
+            r = hs_error(HS_ERROR_MEMORY, NULL);
+            goto error;
+        }
+
+        r = asprintf(&dev->serial_number_string, "%" PRIu64,
+                     serial_number < 10000000 ? (uint64_t)serial_number * 10 : serial_number);
+    }
+    if (r < 0) {
+        dev->serial_number_string = NULL;
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    *rdev = dev;
+    return 0;
+
+error:
+    hs_device_unref(dev);
+    return r;
+}
+
+static void release_devices(device_array *devices)
+{
+    for (size_t i = 0; i < devices->count; i++)
+        hs_device_unref(devices->values[i]);
+    _hs_array_release(devices);
+}
+
+/* Each monitor gets its own device objects, like the real backends, because match_udata
+   is specific to each monitor. */
+static int list_devices(_hs_simulator_watch *watch, device_array *rdevices)
+{
+    device_array devices = {0};
+    int r;
+
+    pthread_mutex_lock(&sim_lock);
+
+    advance_boards(now_us());
+
+    for (size_t i = 0; i < sim_boards.count; i++) {
+        const hs_simulator_board *board = sim_boards.values[i];
+        hs_device *dev;
+
+        if (board->mode == MODE_OFFLINE)
+            continue;
+
+        r = create_device(board, &dev);
+        if (r < 0)
+            goto error;
+        r = _hs_array_push(&devices, dev);
+        if (r < 0) {
+            hs_device_unref(dev);
+            r = hs_error(HS_ERROR_MEMORY, NULL);
+            goto error;
+        }
+    }
+
+    if (watch) {
+        watch->generation = sim_generation;
+        update_watches();
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+
+    *rdevices = devices;
+    return 0;
+
+error:
+    pthread_mutex_unlock(&sim_lock);
+    release_devices(&devices);
+    return r;
+}
+
+int _hs_simulator_enumerate(const _hs_match_helper *match_helper, hs_enumerate_func *f,
+                            void *udata)
+{
+    device_array devices;
+    int r;
+
+    r = list_devices(NULL, &devices);
+    if (r < 0)
+        return r;
+
+    for (size_t i = 0; i < devices.count; i++) {
+        hs_device *dev = devices.values[i];
+
+        if (_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
+            r = (*f)(dev, udata);
+            if (r)
+                break;
+        }
+    }
+
+    release_devices(&devices);
+    return r;
+}
+
+int _hs_simulator_watch_new(_hs_simulator_watch **rwatch)
+{
+    _hs_simulator_watch *watch;
+    int r;
+
+    watch = (_hs_simulator_watch *)calloc(1, sizeof(*watch));
+    if (!watch)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    watch->timer_fd = -1;
+
+    r = create_timer(&watch->timer_fd);
+    if (r < 0)
+        goto error;
+
+    pthread_mutex_lock(&sim_lock);
+    r = _hs_array_push(&sim_watches, watch);
+    if (r < 0) {
+        pthread_mutex_unlock(&sim_lock);
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    // The first refresh lists everything
+    watch->generation = sim_generation - 1;
+    update_watches();
+    pthread_mutex_unlock(&sim_lock);
+
+    *rwatch = watch;
+    return 0;
+
+error:
+    if (watch->timer_fd >= 0)
+        close(watch->timer_fd);
+    free(watch);
+    return r;
+}
+
+void _hs_simulator_watch_free(_hs_simulator_watch *watch)
+{
+    if (!watch)
+        return;
+
+    pthread_mutex_lock(&sim_lock);
+    for (size_t i = 0; i < sim_watches.count; i++) {
+        if (sim_watches.values[i] == watch) {
+            _hs_array_remove(&sim_watches, i, 1);
+            break;
+        }
+    }
+    if (!sim_watches.count)
+        _hs_array_release(&sim_watches);
+    pthread_mutex_unlock(&sim_lock);
+
+    close(watch->timer_fd);
+    free(watch);
+}
+
+int _hs_simulator_watch_get_fd(const _hs_simulator_watch *watch)
+{
+    return watch->timer_fd;
+}
+
+static bool has_device_key(const device_array *devices, const char *key)
+{
+    for (size_t i = 0; i < devices->count; i++) {
+        if (strcmp(devices->values[i]->key, key) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int _hs_simulator_watch_refresh(_hs_simulator_watch *watch, const _hs_match_helper *match_helper,
+                                _hs_htable *devices, hs_enumerate_func *f, void *udata)
+{
+    device_array current = {0}, removed = {0};
+    int r;
+
+    r = list_devices(watch, &current);
+    if (r < 0)
+        return r;
+
+    // Keys are never reused, so a simple difference is enough to find what changed
+    _hs_htable_foreach(cur, devices) {
+        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+
+        if (!has_device_key(&current, dev->key)) {
+            r = _hs_array_push(&removed, hs_device_ref(dev));
+            if (r < 0) {
+                hs_device_unref(dev);
+                r = hs_error(HS_ERROR_MEMORY, NULL);
+                goto cleanup;
+            }
+        }
+    }
+    for (size_t i = 0; i < removed.count; i++)
+        _hs_monitor_remove(devices, removed.values[i]->key, f, udata);
+
+    for (size_t i = 0; i < current.count; i++) {
+        hs_device *dev = current.values[i];
+
+        if (_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
+            r = _hs_monitor_add(devices, dev, f, udata);
+            if (r)
+                goto cleanup;
+        }
+    }
+
+    r = 0;
+cleanup:
+    release_devices(&removed);
+    release_devices(&current);
+    return r;
+}
+
+bool _hs_simulator_is_device(const hs_device *dev)
+{
+    return strncmp(dev->path, _HS_SIMULATOR_PATH_PREFIX,
+                   strlen(_HS_SIMULATOR_PATH_PREFIX)) == 0;
+}
+
+int _hs_simulator_open_port(hs_device *dev, hs_port_mode mode, hs_port **rport)
+{
+    hs_simulator_board *board = NULL;
+    hs_port *port;
+    int r;
+
+    port = (hs_port *)calloc(1, sizeof(*port));
+    if (!port)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    port->type = dev->type;
+    port->mode = mode;
+    port->path = dev->path;
+    port->sim = (struct _hs_simulator_port *)calloc(1, sizeof(*port->sim));
+    if (!port->sim) {
+        free(port);
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+    port->sim->timer_fd = -1;
+
+    r = create_timer(&port->sim->timer_fd);
+    if (r < 0)
+        goto error;
+
+    pthread_mutex_lock(&sim_lock);
+
+    advance_boards(now_us());
+    for (size_t i = 0; i < sim_boards.count; i++) {
+        if (sim_boards.values[i]->mode != MODE_OFFLINE &&
+                strcmp(sim_boards.values[i]->key, dev->key) == 0) {
+            board = sim_boards.values[i];
+            break;
+        }
+    }
+    if (!board || _hs_array_push(&board->ports, port) < 0) {
+        pthread_mutex_unlock(&sim_lock);
+        if (board) {
+            r = hs_error(HS_ERROR_MEMORY, NULL);
+        } else {
+            r = hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
+        }
+        goto error;
+    }
+
+    board->refcount++;
+    port->sim->board = board;
+    port->sim->device_seq = board->device_seq;
+    port->sim->open_time = now_us();
+    port->sim->serial_config.baudrate = 115200;
+    port->sim->serial_config.databits = 8;
+    port->sim->serial_config.stopbits = 1;
+    port->sim->serial_config.parity = HS_SERIAL_CONFIG_PARITY_OFF;
+    port->sim->serial_config.rts = HS_SERIAL_CONFIG_RTS_ON;
+    port->sim->serial_config.dtr = HS_SERIAL_CONFIG_DTR_ON;
+    port->sim->serial_config.xonxoff = HS_SERIAL_CONFIG_XONXOFF_OFF;
+    arm_port(port);
+
+    pthread_mutex_unlock(&sim_lock);
+
+    port->dev = hs_device_ref(dev);
+
+    *rport = port;
+    return 0;
+
+error:
+    if (port->sim->timer_fd >= 0)
+        close(port->sim->timer_fd);
+    free(port->sim);
+    free(port);
+    return r;
+}
+
+void _hs_simulator_close_port(hs_port *port)
+{
+    hs_simulator_board *board = port->sim->board;
+
+    pthread_mutex_lock(&sim_lock);
+    for (size_t i = 0; i < board->ports.count; i++) {
+        if (board->ports.values[i] == port) {
+            _hs_array_remove(&board->ports, i, 1);
+            break;
+        }
+    }
+    unref_board(board);
+    pthread_mutex_unlock(&sim_lock);
+
+    close(port->sim->timer_fd);
+    free(port->sim);
+    hs_device_unref(port->dev);
+    free(port);
+}
+
+hs_handle _hs_simulator_get_port_poll_handle(const hs_port *port)
+{
+    return port->sim->timer_fd;
+}
+
+/* Wait until the stream has data, or the device goes away. Returns with sim_lock held
+   when r > 0. */
+static int wait_stream(hs_port *port, int timeout, uint64_t *ravailable)
+{
+    uint64_t start = hs_millis();
+
+    for (;;) {
+        struct pollfd pfd;
+        uint64_t now = now_us();
+        int r;
+
+        pthread_mutex_lock(&sim_lock);
+
+        advance_boards(now);
+        if (!is_port_valid(port)) {
+            pthread_mutex_unlock(&sim_lock);
+            return hs_error(HS_ERROR_IO, "I/O error while reading from '%s': %s", port->path,
+                            strerror(ENODEV));
+        }
+
+        *ravailable = get_stream_available(port, now);
+        if (*ravailable) {
+            const hs_simulator_board *board = port->sim->board;
+
+            // Seremu only sends complete reports, unless the board has stopped sending
+            if (board->config.serial != HS_SIMULATOR_SERIAL_SEREMU ||
+                    *ravailable >= SEREMU_REPORT_SIZE ||
+                    now >= get_stream_time(port, port->sim->consumed + 1) + SEREMU_FLUSH_DELAY)
+                return 1;
+        }
+
+        arm_port(port);
+        pthread_mutex_unlock(&sim_lock);
+
+        if (!timeout)
+            return 0;
+
+        pfd.fd = port->sim->timer_fd;
+        pfd.events = POLLIN;
+restart:
+        r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
+        if (r < 0) {
+            if (errno == EINTR)
+                goto restart;
+
+            return hs_error(HS_ERROR_IO, "I/O error while reading from '%s': %s", port->path,
+                            strerror(errno));
+        }
+        if (!r)
+            return 0;
+    }
+}
+
+static size_t consume_stream(hs_port *port, uint8_t *buf, size_t size)
+{
+    hs_simulator_board *board = port->sim->board;
+
+    fill_stream(board, port->sim->consumed, buf, size);
+    port->sim->consumed += size;
+    board->stats.serial_sent += size;
+
+    arm_port(port);
+
+    return size;
+}
+
+ssize_t _hs_simulator_hid_read(hs_port *port, uint8_t *buf, size_t size, int timeout)
+{
+    uint8_t report[SEREMU_REPORT_SIZE + 1] = {0};
+    uint64_t available;
+    size_t len;
+    int r;
+
+    r = wait_stream(port, timeout, &available);
+    if (r <= 0)
+        return r;
+
+    len = available < SEREMU_REPORT_SIZE ? (size_t)available : SEREMU_REPORT_SIZE;
+    consume_stream(port, report + 1, len);
+
+    pthread_mutex_unlock(&sim_lock);
+
+    // Like hidraw, the end of the report is lost if the buffer is too small
+    if (size > sizeof(report))
+        size = sizeof(report);
+    memcpy(buf, report, size);
+
+    return (ssize_t)size;
+}
+
+static ssize_t write_halfkay(hs_port *port, const uint8_t *buf, size_t size, uint64_t now)
+{
+    hs_simulator_board *board = port->sim->board;
+    const hs_simulator_config *config = &board->config;
+    size_t header_size, addr, len;
+    unsigned int delay;
+
+    if (now < board->busy_until) {
+        board->stats.stalls++;
+        return -1;
+    }
+
+    // Byte 0 is the HID report ID, the header follows
+    header_size = (config->halfkay_version == 1 || config->halfkay_version == 2) ? 3 : 65;
+    if (size < header_size)
+        return -1;
+
+    switch (config->halfkay_version) {
+        case 1: {
+            addr = (size_t)buf[1] | ((size_t)buf[2] << 8);
+        } break;
+        case 2: {
+            addr = ((size_t)buf[1] << 8) | ((size_t)buf[2] << 16);
+        } break;
+        default: {
+            addr = (size_t)buf[1] | ((size_t)buf[2] << 8) | ((size_t)buf[3] << 16);
+        } break;
+    }
+
+    // Teensy loaders send 0xFFFFFF (truncated to fit older versions) to reset the board
+    if (addr >= config->code_size) {
+        board->stats.resets++;
+        schedule_board_mode(board, MODE_RUNNING, config->boot_time, now);
+        return 0;
+    }
+
+    if (!board->erased) {
+        memset(board->flash, 0xFF, config->code_size);
+        board->erased = true;
+        board->stats.erases++;
+        delay = config->erase_time;
+    } else {
+        delay = config->program_time;
+    }
+
+    len = size - header_size;
+    if (len > config->block_size)
+        len = config->block_size;
+    if (len > config->code_size - addr)
+        len = config->code_size - addr;
+    memcpy(board->flash + addr, buf + header_size, len);
+    board->stats.blocks++;
+
+    board->busy_until = now + config->transfer_time + delay;
+    return config->transfer_time;
+}
+
+ssize_t _hs_simulator_hid_write(hs_port *port, const uint8_t *buf, size_t size)
+{
+    hs_simulator_board *board = port->sim->board;
+    ssize_t transfer_time = 0;
+
+    pthread_mutex_lock(&sim_lock);
+
+    advance_boards(now_us());
+    if (!is_port_valid(port)) {
+        pthread_mutex_unlock(&sim_lock);
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s", port->path,
+                        strerror(ENODEV));
+    }
+
+    if (board->mode == MODE_BOOTLOADER) {
+        transfer_time = write_halfkay(port, buf, size, now_us());
+    } else {
+        // Seremu reports are NUL-terminated
+        board->stats.serial_received += strnlen((const char *)buf + 1, size - 1);
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+
+    // HalfKay generates STALL when it is busy or when it does not like what it gets
+    if (transfer_time < 0)
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s", port->path,
+                        strerror(EPIPE));
+    if (transfer_time)
+        sleep_us((uint64_t)transfer_time);
+
+    return (ssize_t)size;
+}
+
+ssize_t _hs_simulator_hid_get_feature_report(hs_port *port, uint8_t report_id, uint8_t *buf,
+                                             size_t size)
+{
+    _HS_UNUSED(report_id);
+    _HS_UNUSED(buf);
+    _HS_UNUSED(size);
+
+    // None of the simulated devices have feature reports to give
+    return hs_error(HS_ERROR_IO, "I/O error while reading from '%s': %s", port->path,
+                    strerror(EPIPE));
+}
+
+ssize_t _hs_simulator_hid_send_feature_report(hs_port *port, const uint8_t *buf, size_t size)
+{
+    static const uint8_t seremu_magic[] = {0xA9, 0x45, 0xC2, 0x6B};
+
+    hs_simulator_board *board = port->sim->board;
+
+    pthread_mutex_lock(&sim_lock);
+
+    advance_boards(now_us());
+    if (!is_port_valid(port)) {
+        pthread_mutex_unlock(&sim_lock);
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s", port->path,
+                        strerror(ENODEV));
+    }
+
+    if (board->mode == MODE_RUNNING && board->config.halfkay_version &&
+            size >= sizeof(seremu_magic) + 1 &&
+            memcmp(buf + 1, seremu_magic, sizeof(seremu_magic)) == 0) {
+        board->stats.reboots++;
+        schedule_board_mode(board, MODE_BOOTLOADER, board->config.reboot_time, now_us());
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+
+    return (ssize_t)size;
+}
+
+int _hs_simulator_serial_set_config(hs_port *port, const hs_serial_config *config)
+{
+    hs_simulator_board *board = port->sim->board;
+    hs_serial_config *port_config = &port->sim->serial_config;
+
+    pthread_mutex_lock(&sim_lock);
+
+    advance_boards(now_us());
+    if (!is_port_valid(port)) {
+        pthread_mutex_unlock(&sim_lock);
+        return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings on '%s': %s",
+                        port->path, strerror(EIO));
+    }
+
+    if (config->baudrate)
+        port_config->baudrate = config->baudrate;
+    if (config->databits)
+        port_config->databits = config->databits;
+    if (config->stopbits)
+        port_config->stopbits = config->stopbits;
+    if (config->parity)
+        port_config->parity = config->parity;
+    if (config->rts)
+        port_config->rts = config->rts;
+    if (config->dtr)
+        port_config->dtr = config->dtr;
+    if (config->xonxoff)
+        port_config->xonxoff = config->xonxoff;
+
+    if (config->baudrate == SERIAL_REBOOT_BAUDRATE && board->config.halfkay_version) {
+        board->stats.reboots++;
+        schedule_board_mode(board, MODE_BOOTLOADER, board->config.reboot_time, now_us());
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+
+    return 0;
+}
+
+int _hs_simulator_serial_get_config(hs_port *port, hs_serial_config *config)
+{
+    pthread_mutex_lock(&sim_lock);
+    *config = port->sim->serial_config;
+    pthread_mutex_unlock(&sim_lock);
+
+    return 0;
+}
+
+ssize_t _hs_simulator_serial_read(hs_port *port, uint8_t *buf, size_t size, int timeout)
+{
+    uint64_t available;
+    int r;
+
+    r = wait_stream(port, timeout, &available);
+    if (r <= 0)
+        return r;
+
+    if (size > available)
+        size = (size_t)available;
+    consume_stream(port, buf, size);
+
+    pthread_mutex_unlock(&sim_lock);
+
+    return (ssize_t)size;
+}
+
+ssize_t _hs_simulator_serial_write(hs_port *port, const uint8_t *buf, size_t size)
+{
+    _HS_UNUSED(buf);
+
+    pthread_mutex_lock(&sim_lock);
+
+    advance_boards(now_us());
+    if (!is_port_valid(port)) {
+        pthread_mutex_unlock(&sim_lock);
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s", port->path,
+                        strerror(ENODEV));
+    }
+    port->sim->board->stats.serial_received += size;
+
+    pthread_mutex_unlock(&sim_lock);
+
+    return (ssize_t)size;
+}
@@ -0,0 +1,178 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libraries
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef HS_SIMULATOR_H
+#define HS_SIMULATOR_H
+
+#include "common.h"
+
+HS_BEGIN_C
+
+/**
+ * @defgroup simulator Simulated devices
+ * @brief Emulate Teensy boards (HalfKay bootloader, Seremu and CDC serial) in-process.
+ *
+ * Simulated boards are only available when libhs is built with the simulator (_HS_SIMULATOR
+ * is defined), and only on Linux. They can be used to test and benchmark code using libhs
+ * without any USB hardware.
+ *
+ * Simulated devices are reported by hs_enumerate() after the real devices, and by monitors
+ * using @ref HS_MONITOR_BACKEND_SIMULATOR (which report nothing else). They are opened and
+ * used like any other device with hs_port_open(), the HID functions and the serial functions.
+ *
+ * Each board has a running mode (exposed as a Seremu HID device or a CDC serial device) and a
+ * bootloader mode (HalfKay HID device). The reboot magics used by Teensyduino (134 bauds on
+ * serial devices, Seremu feature report) switch to the bootloader, and the HalfKay reset
+ * command goes back to the running mode. Transitions are not immediate: the device goes away
+ * and the new one shows up after a delay.
+ */
+
+/**
+ * @ingroup simulator
+ * @typedef hs_simulator_board
+ * @brief Opaque structure representing a simulated board.
+ */
+struct hs_simulator_board;
+typedef struct hs_simulator_board hs_simulator_board;
+
+/**
+ * @ingroup simulator
+ * @brief Interface exposed by a simulated board in running mode.
+ */
+typedef enum hs_simulator_serial {
+    /** No interface at all, the board disappears when it leaves the bootloader. */
+    HS_SIMULATOR_SERIAL_NONE,
+    /** CDC ACM serial device. */
+    HS_SIMULATOR_SERIAL_CDC,
+    /** Seremu HID device, 64-byte input reports with NUL padding. */
+    HS_SIMULATOR_SERIAL_SEREMU
+} hs_simulator_serial;
+
+/**
+ * @ingroup simulator
+ * @brief Simulated board settings.
+ *
+ * Durations are in microseconds. Zero-initialize the structure and change what you need, the
+ * defaults describe an instant board without bootloader.
+ */
+typedef struct hs_simulator_config {
+    /**
+     * Hardware serial number. Running mode reports it in decimal (multiplied by 10 when it
+     * is below 10000000, like Teensyduino does) and HalfKay reports it in hexadecimal.
+     */
+    uint32_t serial_number;
+
+    /** HalfKay protocol version (1, 2 or 3), or 0 if the board has no bootloader. */
+    unsigned int halfkay_version;
+    /** HID usage value of the bootloader, it identifies the model (e.g. 0x1E for Teensy 3.1). */
+    uint16_t halfkay_usage;
+    /** Size of the flash memory, in bytes. */
+    size_t code_size;
+    /** Size of HalfKay blocks, in bytes. */
+    size_t block_size;
+
+    /** Time spent in hs_hid_write() for each HalfKay block (USB transfer). */
+    unsigned int transfer_time;
+    /** Time the bootloader is busy (and STALLs) after each block. */
+    unsigned int program_time;
+    /** Time the bootloader is busy after the first block, which erases the whole flash. */
+    unsigned int erase_time;
+    /** Time between the reboot request and the bootloader device showing up. */
+    unsigned int reboot_time;
+    /** Time between the reset command and the running mode device showing up. */
+    unsigned int boot_time;
+
+    /** Running mode interface. */
+    hs_simulator_serial serial;
+    /**
+     * Bytes per second sent by the board while a port is open, 0 to stay quiet. Unread data
+     * beyond the size of the host buffer is dropped.
+     */
+    unsigned int serial_rate;
+
+    /** Start in bootloader mode instead of running mode. */
+    bool start_in_bootloader;
+} hs_simulator_config;
+
+/**
+ * @ingroup simulator
+ * @brief Simulated board activity counters.
+ */
+typedef struct hs_simulator_stats {
+    /** Number of times the board has entered the bootloader. */
+    unsigned int reboots;
+    /** Number of times the board has left the bootloader. */
+    unsigned int resets;
+    /** Number of flash erasures. */
+    unsigned int erases;
+    /** Number of HalfKay blocks written. */
+    unsigned int blocks;
+    /** Number of HalfKay writes rejected (STALL) because the bootloader was busy. */
+    unsigned int stalls;
+
+    /** Serial bytes read by the host. */
+    uint64_t serial_sent;
+    /** Serial bytes dropped because the host did not read them in time. */
+    uint64_t serial_dropped;
+    /** Serial bytes written by the host. */
+    uint64_t serial_received;
+} hs_simulator_stats;
+
+/**
+ * @ingroup simulator
+ * @brief Plug a new simulated board.
+ *
+ * The board device is reported by hs_enumerate() and simulator monitors until
+ * hs_simulator_remove_board() is called. The flash memory starts erased (0xFF).
+ *
+ * Serial data sent by the board is made of 32-byte lines with a counter, lines are formatted
+ * with <tt>"%010u %020llu\n"</tt> (serial number and line number).
+ *
+ * @param      config Board settings.
+ * @param[out] rboard A pointer to the variable that receives the simulated board, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+int hs_simulator_add_board(const hs_simulator_config *config, hs_simulator_board **rboard);
+/**
+ * @ingroup simulator
+ * @brief Unplug a simulated board.
+ *
+ * Ports that are still open fail with I/O errors, like real unplugged devices.
+ *
+ * @param board Simulated board.
+ */
+void hs_simulator_remove_board(hs_simulator_board *board);
+
+/**
+ * @ingroup simulator
+ * @brief Read the flash memory of a simulated board.
+ *
+ * @param      board  Simulated board.
+ * @param      offset Start offset in the flash memory.
+ * @param[out] buf    Destination buffer.
+ * @param      size   Number of bytes to read.
+ * @return This function returns the number of bytes copied, which is less than @p size if the
+ *     range goes beyond the end of the flash memory.
+ */
+size_t hs_simulator_read_flash(hs_simulator_board *board, size_t offset, uint8_t *buf,
+                               size_t size);
+/**
+ * @ingroup simulator
+ * @brief Get the activity counters of a simulated board.
+ *
+ * @param      board  Simulated board.
+ * @param[out] rstats Activity counters.
+ */
+void hs_simulator_get_stats(hs_simulator_board *board, hs_simulator_stats *rstats);
+
+HS_END_C
+
+#endif
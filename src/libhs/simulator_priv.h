@@ -0,0 +1,54 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libraries
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _HS_SIMULATOR_PRIV_H
+#define _HS_SIMULATOR_PRIV_H
+
+#include "common_priv.h"
+#include "device.h"
+#include "htable.h"
+#include "monitor.h"
+#include "serial.h"
+#include "simulator.h"
+
+struct _hs_match_helper;
+
+// Paths (and keys) of simulated devices start with this prefix
+#define _HS_SIMULATOR_PATH_PREFIX "simulator:"
+
+typedef struct _hs_simulator_watch _hs_simulator_watch;
+
+int _hs_simulator_enumerate(const struct _hs_match_helper *match_helper, hs_enumerate_func *f,
+                            void *udata);
+
+int _hs_simulator_watch_new(_hs_simulator_watch **rwatch);
+void _hs_simulator_watch_free(_hs_simulator_watch *watch);
+int _hs_simulator_watch_get_fd(const _hs_simulator_watch *watch);
+int _hs_simulator_watch_refresh(_hs_simulator_watch *watch,
+                                const struct _hs_match_helper *match_helper,
+                                _hs_htable *devices, hs_enumerate_func *f, void *udata);
+
+bool _hs_simulator_is_device(const hs_device *dev);
+int _hs_simulator_open_port(hs_device *dev, hs_port_mode mode, hs_port **rport);
+void _hs_simulator_close_port(hs_port *port);
+hs_handle _hs_simulator_get_port_poll_handle(const hs_port *port);
+
+ssize_t _hs_simulator_hid_read(hs_port *port, uint8_t *buf, size_t size, int timeout);
+ssize_t _hs_simulator_hid_write(hs_port *port, const uint8_t *buf, size_t size);
+ssize_t _hs_simulator_hid_get_feature_report(hs_port *port, uint8_t report_id, uint8_t *buf,
+                                             size_t size);
+ssize_t _hs_simulator_hid_send_feature_report(hs_port *port, const uint8_t *buf, size_t size);
+
+int _hs_simulator_serial_set_config(hs_port *port, const hs_serial_config *config);
+int _hs_simulator_serial_get_config(hs_port *port, hs_serial_config *config);
+ssize_t _hs_simulator_serial_read(hs_port *port, uint8_t *buf, size_t size, int timeout);
+ssize_t _hs_simulator_serial_write(hs_port *port, const uint8_t *buf, size_t size);
+
+#endif
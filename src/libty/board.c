@@ -20,6 +20,7 @@
 #include "system.h"
 #include "task.h"
 #include "timer.h"
+#include "trace.h"
 
 static const char *capability_names[] = {
     "unique",
@@ -298,6 +299,7 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
 
     ty_monitor *monitor = board->monitor;
     struct wait_for_context ctx;
+    int r;
 
     if (board->status == TY_BOARD_STATUS_DROPPED)
         return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' has disappeared", board->tag);
@@ -307,7 +309,11 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
     ctx.board = board;
     ctx.capability = capability;
 
-    return ty_monitor_wait(monitor, wait_for_callback, &ctx, timeout);
+    ty_trace_begin("board_wait_for");
+    r = ty_monitor_wait(monitor, wait_for_callback, &ctx, timeout);
+    ty_trace_end();
+
+    return r;
 }
 
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout)
@@ -351,7 +357,8 @@ ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size)
     return r;
 }
 
-int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_func *pf, void *udata)
+int ty_board_upload(ty_board *board, ty_firmware *fw, int flags,
+                    ty_board_upload_progress_func *pf, void *udata)
 {
     assert(board);
     assert(fw);
@@ -368,7 +375,9 @@ int ty_board_upload(ty_board *board, ty_firmware *fw, ty_board_upload_progress_f
     }
     assert(board->model);
 
-    r = (*iface->class_vtable->upload)(iface, fw, pf, udata);
+    ty_trace_begin("board_upload");
+    r = (*iface->class_vtable->upload)(iface, fw, flags, pf, udata);
+    ty_trace_end();
 
 cleanup:
     ty_board_interface_close(iface);
@@ -388,7 +397,9 @@ int ty_board_reset(ty_board *board)
     if (!r)
         return ty_error(TY_ERROR_MODE, "Cannot reset board '%s'", board->tag);
 
+    ty_trace_begin("board_reset");
     r = (*iface->class_vtable->reset)(iface);
+    ty_trace_end();
 
     ty_board_interface_close(iface);
     return r;
@@ -407,7 +418,9 @@ int ty_board_reboot(ty_board *board)
     if (!r)
         return ty_error(TY_ERROR_MODE, "Cannot reboot board '%s'", board->tag);
 
+    ty_trace_begin("board_reboot");
     r = (*iface->class_vtable->reboot)(iface);
+    ty_trace_end();
 
     ty_board_interface_close(iface);
     return r;
@@ -445,7 +458,9 @@ int ty_board_interface_open(ty_board_interface *iface)
     ty_mutex_lock(&iface->open_lock);
 
     if (!iface->port) {
+        ty_trace_begin("open_interface");
         r = (*iface->class_vtable->open_interface)(iface);
+        ty_trace_end();
         if (r < 0)
             goto cleanup;
     }
@@ -465,8 +480,11 @@ void ty_board_interface_close(ty_board_interface *iface)
         return;
 
     ty_mutex_lock(&iface->open_lock);
-    if (!--iface->open_count)
+    if (!--iface->open_count) {
+        ty_trace_begin("close_interface");
         (*iface->class_vtable->close_interface)(iface);
+        ty_trace_end();
+    }
     ty_mutex_unlock(&iface->open_lock);
 
     ty_board_interface_unref(iface);
@@ -517,23 +535,20 @@ void ty_board_interface_get_descriptors(const ty_board_interface *iface, struct
         ty_descriptor_set_add(set, hs_port_get_poll_handle(iface->port), id);
 }
 
-static int new_board_task(ty_board *board, const char *action, int (*run)(ty_task *task),
-                          ty_task **rtask)
+// Tasks of the same board are serialized by the pool, see ty_task.serial_key
+static int new_board_task(ty_board *board, const char *action, ty_task_priority priority,
+                          int (*run)(ty_task *task), ty_task **rtask)
 {
     char task_name_buf[64];
     ty_task *task = NULL;
     int r;
 
-    if (board->current_task)
-        return ty_error(TY_ERROR_BUSY, "Board '%s' is busy on task '%s'", board->tag,
-                        board->current_task->name);
-
     snprintf(task_name_buf, sizeof(task_name_buf), "%s@%s", action, board->tag);
     r = ty_task_new(task_name_buf, run, &task);
     if (r < 0)
         return r;
-
-    board->current_task = ty_task_ref(task);
+    task->priority = priority;
+    task->serial_key = board;
 
     *rtask = task;
     return 0;
@@ -541,8 +556,6 @@ static int new_board_task(ty_board *board, const char *action, int (*run)(ty_tas
 
 static void cleanup_task_board(ty_board **board_ptr)
 {
-    ty_task_unref((*board_ptr)->current_task);
-    (*board_ptr)->current_task = NULL;
     ty_board_unref(*board_ptr);
     *board_ptr = NULL;
 }
@@ -585,7 +598,8 @@ static int select_compatible_firmware(ty_board *board, ty_firmware **fws, unsign
 }
 
 static int upload_progress_callback(const ty_board *board, const ty_firmware *fw,
-                                    size_t uploaded_size, size_t flash_size, void *udata)
+                                    size_t uploaded_size, size_t flash_size,
+                                    const ty_board_upload_stats *stats, void *udata)
 {
     TY_UNUSED(board);
     TY_UNUSED(udata);
@@ -604,6 +618,13 @@ static int upload_progress_callback(const ty_board *board, const ty_firmware *fw
     }
     ty_progress("Uploading", uploaded_size, fw->size);
 
+    if (uploaded_size == fw->size && stats->elapsed) {
+        ty_log(TY_LOG_DEBUG, "Sent %u blocks (%zu bytes) in %"PRIu64" ms (%.1f blocks/s, %u us/block, %u retries)",
+               stats->blocks, stats->sent_size, stats->elapsed,
+               (double)stats->blocks * 1000.0 / (double)stats->elapsed,
+               stats->block_latency, stats->retries);
+    }
+
     return 0;
 }
 
@@ -618,12 +639,14 @@ static int run_upload(ty_task *task)
     ty_firmware *fw;
     int flags = task->u.upload.flags, r;
 
+    ty_trace_begin("run_upload");
+
     if (flags & TY_UPLOAD_NOCHECK) {
         fw = task->u.upload.fws[0];
     } else if (ty_models[board->model].mcu) {
         r = select_compatible_firmware(board, task->u.upload.fws, task->u.upload.fws_count, &fw);
         if (r < 0)
-            return r;
+            goto cleanup;
     } else {
         // Maybe we can identify the board and test the firmwares in bootloader mode?
         fw = NULL;
@@ -639,7 +662,7 @@ static int run_upload(ty_task *task)
             ty_log(TY_LOG_INFO, "Triggering board reboot");
             r = ty_board_reboot(board);
             if (r < 0)
-                return r;
+                goto cleanup;
         }
     }
 
@@ -647,7 +670,7 @@ wait:
     r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD,
                            flags & TY_UPLOAD_WAIT ? -1 : MANUAL_REBOOT_DELAY);
     if (r < 0)
-        return r;
+        goto cleanup;
     if (!r) {
         ty_log(TY_LOG_INFO, "Reboot didn't work, press button manually");
         flags |= TY_UPLOAD_WAIT;
@@ -658,31 +681,36 @@ wait:
     if (!fw) {
         r = select_compatible_firmware(board, task->u.upload.fws, task->u.upload.fws_count, &fw);
         if (r < 0)
-            return r;
+            goto cleanup;
     }
 
-    r = ty_board_upload(board, fw, upload_progress_callback, NULL);
+    r = ty_board_upload(board, fw, flags, upload_progress_callback, NULL);
     if (r < 0)
-        return r;
+        goto cleanup;
 
     if (!(flags & TY_UPLOAD_NORESET)) {
         ty_log(TY_LOG_INFO, "Sending reset command");
         r = ty_board_reset(board);
         if (r < 0)
-            return r;
+            goto cleanup;
 
         r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT);
         if (r < 0)
-            return r;
-        if (!r)
-            return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+            goto cleanup;
+        if (!r) {
+            r = ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+            goto cleanup;
+        }
     } else {
         ty_log(TY_LOG_INFO, "Firmware uploaded, reset the board to use it");
     }
 
     task->result = ty_firmware_ref(fw);
     task->result_cleanup = unref_upload_firmware;
-    return 0;
+    r = 0;
+cleanup:
+    ty_trace_end();
+    return r;
 }
 
 static void finalize_upload(ty_task *task)
@@ -705,7 +733,7 @@ int ty_upload(ty_board *board, ty_firmware **fws, unsigned int fws_count, int fl
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "upload", run_upload, &task);
+    r = new_board_task(board, "upload", TY_TASK_PRIORITY_NORMAL, run_upload, &task);
     if (r < 0)
         goto error;
     task->u.upload.board = ty_board_ref(board);
@@ -742,6 +770,8 @@ static int run_reset(ty_task *task)
     ty_board *board = task->u.reset.board;
     int r;
 
+    ty_trace_begin("run_reset");
+
     ty_log(TY_LOG_INFO, "Resetting board '%s' (%s)", board->tag, ty_models[board->model].name);
 
     if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RESET) &&
@@ -749,25 +779,32 @@ static int run_reset(ty_task *task)
         ty_log(TY_LOG_INFO, "Triggering board reboot");
         r = ty_board_reboot(board);
         if (r < 0)
-            return r;
+            goto cleanup;
 
         r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RESET, MANUAL_REBOOT_DELAY);
-        if (r <= 0)
-            return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s'", board->tag);
+        if (r <= 0) {
+            r = ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s'", board->tag);
+            goto cleanup;
+        }
     }
 
     ty_log(TY_LOG_INFO, "Sending reset command");
     r = ty_board_reset(board);
     if (r < 0)
-        return r;
+        goto cleanup;
 
     r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT);
     if (r < 0)
-        return r;
-    if (!r)
-        return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+        goto cleanup;
+    if (!r) {
+        r = ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+        goto cleanup;
+    }
 
-    return 0;
+    r = 0;
+cleanup:
+    ty_trace_end();
+    return r;
 }
 
 static void finalize_reset(ty_task *task)
@@ -783,7 +820,7 @@ int ty_reset(ty_board *board, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "reset", run_reset, &task);
+    r = new_board_task(board, "reset", TY_TASK_PRIORITY_HIGH, run_reset, &task);
     if (r < 0)
         return r;
     task->u.reset.board = ty_board_ref(board);
@@ -798,25 +835,33 @@ static int run_reboot(ty_task *task)
     ty_board *board = task->u.reboot.board;
     int r;
 
+    ty_trace_begin("run_reboot");
+
     ty_log(TY_LOG_INFO, "Rebooting board '%s' (%s)", board->tag, ty_models[board->model].name);
 
     if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
         ty_log(TY_LOG_INFO, "Board is already in bootloader mode");
-        return 0;
+        r = 0;
+        goto cleanup;
     }
 
     ty_log(TY_LOG_INFO, "Triggering board reboot");
     r = ty_board_reboot(board);
     if (r < 0)
-        return r;
+        goto cleanup;
 
     r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD, FINAL_TASK_TIMEOUT);
     if (r < 0)
-        return r;
-    if (!r)
-        return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s", board->tag);
+        goto cleanup;
+    if (!r) {
+        r = ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s", board->tag);
+        goto cleanup;
+    }
 
-    return 0;
+    r = 0;
+cleanup:
+    ty_trace_end();
+    return r;
 }
 
 static void finalize_reboot(ty_task *task)
@@ -832,7 +877,7 @@ int ty_reboot(ty_board *board, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "reboot", run_reboot, &task);
+    r = new_board_task(board, "reboot", TY_TASK_PRIORITY_HIGH, run_reboot, &task);
     if (r < 0)
         return r;
     task->u.reboot.board = ty_board_ref(board);
@@ -881,7 +926,7 @@ int ty_send(ty_board *board, const char *buf, size_t size, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "send", run_send, &task);
+    r = new_board_task(board, "send", TY_TASK_PRIORITY_NORMAL, run_send, &task);
     if (r < 0)
         goto error;
     task->u.send.board = ty_board_ref(board);
@@ -961,7 +1006,7 @@ int ty_send_file(ty_board *board, const char *filename, ty_task **rtask)
     ty_task *task = NULL;
     int r;
 
-    r = new_board_task(board, "send", run_send_file, &task);
+    r = new_board_task(board, "send", TY_TASK_PRIORITY_NORMAL, run_send_file, &task);
     if (r < 0)
         goto error;
     task->u.send_file.board = ty_board_ref(board);
@@ -47,14 +47,27 @@ typedef enum ty_board_status {
 enum {
     TY_UPLOAD_WAIT = 1,
     TY_UPLOAD_NORESET = 2,
-    TY_UPLOAD_NOCHECK = 4
+    TY_UPLOAD_NOCHECK = 4,
+    TY_UPLOAD_SPARSE = 8
 };
 
 #define TY_UPLOAD_MAX_FIRMWARES 256
 
+typedef struct ty_board_upload_stats {
+    // Bytes actually sent to the bootloader so far
+    size_t sent_size;
+    unsigned int blocks;
+    // Number of writes retried because the bootloader was busy (STALL)
+    unsigned int retries;
+    // Average write latency per block, in microseconds
+    unsigned int block_latency;
+    uint64_t elapsed;
+} ty_board_upload_stats;
+
 typedef int ty_board_list_interfaces_func(ty_board_interface *iface, void *udata);
 typedef int ty_board_upload_progress_func(const ty_board *board, const struct ty_firmware *fw,
-                                          size_t uploaded_size, size_t flash_size, void *udata);
+                                          size_t uploaded_size, size_t flash_size,
+                                          const ty_board_upload_stats *stats, void *udata);
 
 const char *ty_board_capability_get_name(ty_board_capability cap);
 
@@ -92,7 +105,8 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout);
 ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size);
 
-int ty_board_upload(ty_board *board, struct ty_firmware *fw, ty_board_upload_progress_func *pf, void *udata);
+int ty_board_upload(ty_board *board, struct ty_firmware *fw, int flags,
+                    ty_board_upload_progress_func *pf, void *udata);
 int ty_board_reset(ty_board *board);
 int ty_board_reboot(ty_board *board);
 
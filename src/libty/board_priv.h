@@ -43,9 +43,12 @@ struct ty_board {
     unsigned int refcount;
 
     struct ty_monitor *monitor;
+    _hs_htable_head monitor_hnode;
 
     ty_board_status status;
     uint64_t missing_since;
+    // Position in the monitor heap of missing boards, starting at 1 (0 if not missing)
+    size_t missing_slot;
 
     ty_model model;
     char *id;
@@ -60,10 +63,11 @@ struct ty_board {
     _HS_ARRAY(ty_board_interface *) ifaces;
     int capabilities;
     ty_board_interface *cap2iface[16];
-
-    ty_task *current_task;
 };
 
+// Handles a device event as if it came from libhs, for tests and benchmarks
+int _ty_monitor_inject_device(struct ty_monitor *monitor, hs_device *dev);
+
 TY_C_END
 
 #endif
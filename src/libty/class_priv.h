@@ -28,7 +28,7 @@ struct _ty_class_vtable {
     void (*close_interface)(ty_board_interface *iface);
     ssize_t (*serial_read)(ty_board_interface *iface, char *buf, size_t size, int timeout);
     ssize_t (*serial_write)(ty_board_interface *iface, const char *buf, size_t size);
-    int (*upload)(ty_board_interface *iface, struct ty_firmware *fw,
+    int (*upload)(ty_board_interface *iface, struct ty_firmware *fw, int flags,
                   ty_board_upload_progress_func *pf, void *udata);
     int (*reset)(ty_board_interface *iface);
     int (*reboot)(ty_board_interface *iface);
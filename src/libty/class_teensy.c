@@ -17,6 +17,7 @@
 #include "class_priv.h"
 #include "firmware.h"
 #include "system.h"
+#include "trace.h"
 
 #define SEREMU_TX_SIZE 32
 #define SEREMU_RX_SIZE 64
@@ -300,6 +301,31 @@ static uint64_t read_uint64_le(const uint8_t *ptr)
            ((uint64_t)ptr[7] << 56);
 }
 
+/* The AVR magic values only differ by their 4th byte, and all of them contain 0xF8 (from the
+   CLI instruction) at offset 6. memchr() is vectorized by most C libraries, so we use it to
+   jump between 0xF8 bytes and only check these candidates. */
+static ty_model find_avr_model(const uint8_t *image, size_t start, size_t end)
+{
+    const uint8_t *ptr = image + start + 6;
+    const uint8_t *last = image + end + 6;
+
+    while (ptr < last && (ptr = memchr(ptr, 0xF8, (size_t)(last - ptr)))) {
+        uint64_t magic_value = read_uint64_le(ptr - 6);
+
+        if ((magic_value & 0xFFFFFFFF00FFFFFF) == 0x94F8CFFF0000940C) {
+            switch ((magic_value >> 24) & 0xFF) {
+                case 0x7E: { return TY_MODEL_TEENSY_PP_10; } break;
+                case 0x3F: { return TY_MODEL_TEENSY_20; } break;
+                case 0xFE: { return TY_MODEL_TEENSY_PP_20; } break;
+            }
+        }
+
+        ptr++;
+    }
+
+    return 0;
+}
+
 static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmodels,
                                            unsigned int max_models)
 {
@@ -314,16 +340,20 @@ static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmod
        0xFF bytes after _VectorsFlash[], which we can use to detect the size of _VectorsFlash[].
 
        We combine the size of _VectorsFlash[] and the initial stack pointer value to
-       differenciate models. */
+       differenciate models. When the firmware comes from an ELF file with a symbol table,
+       we get the size of _VectorsFlash[] directly. */
     const uint32_t teensy3_startup_size = 0x400;
     if (fw->size >= teensy3_startup_size) {
+        const ty_firmware_symbol *vectors = ty_firmware_find_symbol(fw, "_VectorsFlash");
         uint32_t stack_addr;
         uint32_t end_vector_addr;
         unsigned int arm_models_count = 0;
 
         stack_addr = read_uint32_le(fw->image);
         end_vector_addr = read_uint32_le(fw->image + 4) & ~1u;
-        if (end_vector_addr >= teensy3_startup_size) {
+        if (vectors && !vectors->address && vectors->size) {
+            end_vector_addr = vectors->size;
+        } else if (end_vector_addr >= teensy3_startup_size) {
             for (uint32_t i = 0; i < teensy3_startup_size - sizeof(uint64_t); i += 4) {
                 if (read_uint64_le(fw->image + i) == 0xFFFFFFFFFFFFFFFF) {
                     end_vector_addr = i;
@@ -358,24 +388,21 @@ static unsigned int teensy_identify_models(const ty_firmware *fw, ty_model *rmod
     }
 
     /* Now try AVR Teensies. We search for machine code that matches model-specific code in
-       _reboot_Teensyduino_(). Not elegant, but it does the work. */
+       _reboot_Teensyduino_(). Not elegant, but it does the work. If we know where this
+       function is, only look there. */
     if (fw->size > sizeof(uint64_t) && fw->size <= 130048) {
-        for (size_t i = 0; i < fw->size - sizeof(uint64_t); i++) {
-            uint64_t magic_value = read_uint64_le(fw->image + i);
-            switch (magic_value) {
-                case 0x94F8CFFF7E00940C: {
-                    rmodels[0] = TY_MODEL_TEENSY_PP_10;
-                    return 1;
-                } break;
-                case 0x94F8CFFF3F00940C: {
-                    rmodels[0] = TY_MODEL_TEENSY_20;
-                    return 1;
-                } break;
-                case 0x94F8CFFFFE00940C: {
-                    rmodels[0] = TY_MODEL_TEENSY_PP_20;
-                    return 1;
-                } break;
-            }
+        const ty_firmware_symbol *reboot = ty_firmware_find_symbol(fw, "_reboot_Teensyduino_");
+        size_t start = 0, end = fw->size - sizeof(uint64_t);
+
+        if (reboot && reboot->size && reboot->address < end) {
+            start = reboot->address;
+            end = TY_MIN(end, (size_t)reboot->address + reboot->size);
+        }
+
+        ty_model model = find_avr_model(fw->image, start, end);
+        if (model) {
+            rmodels[0] = model;
+            return 1;
         }
     }
 
@@ -455,11 +482,28 @@ static ssize_t teensy_serial_write(ty_board_interface *iface, const char *buf, s
     return 0;
 }
 
+struct halfkay_pacer {
+    unsigned int erase_delay;
+    uint64_t erase_done;
+
+    unsigned int blocks;
+    unsigned int retries;
+    // In microseconds, most writes take less than a millisecond
+    unsigned int latency;
+};
+
+#define HALFKAY_MIN_BACKOFF 1
+#define HALFKAY_MAX_BACKOFF 32
+#define HALFKAY_MIN_ERASE_DELAY 8
+#define HALFKAY_MAX_ERASE_DELAY 200
+
 static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t block_size,
-                        size_t addr, const void *data, size_t size, unsigned int timeout)
+                        size_t addr, const void *data, size_t size, unsigned int timeout,
+                        struct halfkay_pacer *pacer)
 {
     uint8_t buf[2048] = {0};
-    uint64_t start;
+    uint64_t start, write_start;
+    unsigned int backoff;
 
     ssize_t r;
 
@@ -500,27 +544,60 @@ static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t bloc
         } break;
     }
 
-    /* We may get errors along the way (while the bootloader works) so try again
-       until timeout expires. */
+    /* Don't hit the bootloader while it is still erasing the flash, the estimated erase
+       time is computed after the first block (see below). */
+    if (pacer && pacer->erase_done) {
+        uint64_t now = ty_millis();
+        if (pacer->erase_done > now) {
+            ty_trace_begin("halfkay_erase_wait");
+            ty_delay((unsigned int)(pacer->erase_done - now));
+            ty_trace_end();
+        }
+        pacer->erase_done = 0;
+    }
+
+    /* HalfKay generates STALL if you go too fast (translates to EPIPE on Linux), so we may
+       get errors along the way while the bootloader works. Try again with an exponential
+       backoff until timeout expires, instead of waiting a fixed time after each error. */
+    ty_trace_begin("halfkay_write");
     start = ty_millis();
+    backoff = HALFKAY_MIN_BACKOFF;
     hs_error_mask(HS_ERROR_IO);
 restart:
+    write_start = ty_micros();
     r = hs_hid_write(port, buf, size);
     if (r == HS_ERROR_IO && ty_millis() - start < timeout) {
-        ty_delay(20);
+        ty_delay(backoff);
+        backoff = TY_MIN(backoff * 2, HALFKAY_MAX_BACKOFF);
+        if (pacer)
+            pacer->retries++;
         goto restart;
     }
     hs_error_unmask();
+    ty_trace_end();
     if (r < 0) {
         if (r == HS_ERROR_IO)
             return ty_error(TY_ERROR_IO, "%s", hs_error_last_message());
         return ty_libhs_translate_error((int)r);
     }
 
-    /* HalfKay generates STALL if you go too fast (translates to EPIPE on Linux), and the
-       first write takes longer because it triggers a complete erase of all blocks. */
-    if (!addr)
-        ty_delay(200);
+    if (pacer) {
+        unsigned int latency = (unsigned int)(ty_micros() - write_start);
+
+        // Exponential moving average, weighted 1/4 on the last block
+        if (pacer->blocks) {
+            pacer->latency = (pacer->latency * 3 + latency) / 4;
+        } else {
+            pacer->latency = latency;
+        }
+        pacer->blocks++;
+
+        /* The first write takes longer because it triggers a complete erase of all blocks.
+           Instead of sleeping a fixed 200 ms, give the bootloader a head start that depends
+           on the size of the flash, and let the STALL backoff absorb the rest. */
+        if (!addr)
+            pacer->erase_done = ty_millis() + pacer->erase_delay;
+    }
 
     return 0;
 }
@@ -589,11 +666,48 @@ static int get_halfkay_settings(ty_model model, unsigned int *rhalfkay_version,
     return 0;
 }
 
-static int teensy_upload(ty_board_interface *iface, ty_firmware *fw,
+/* HalfKay erases the whole flash when the first block is written, so blocks that only
+   contain erased-state bytes (0xFF) do not need to be sent. Compare 8 bytes at a time,
+   compilers turn this into SIMD code where available. */
+static bool is_blank_block(const uint8_t *ptr, size_t size)
+{
+    uint64_t acc = UINT64_MAX;
+    size_t i = 0;
+
+    for (; i + 32 <= size; i += 32) {
+        uint64_t words[4];
+        memcpy(words, ptr + i, sizeof(words));
+        acc &= words[0] & words[1] & words[2] & words[3];
+        if (acc != UINT64_MAX)
+            return false;
+    }
+    for (; i < size; i++) {
+        if (ptr[i] != 0xFF)
+            return false;
+    }
+
+    return acc == UINT64_MAX;
+}
+
+static void fill_upload_stats(const struct halfkay_pacer *pacer, uint64_t start,
+                              size_t sent_size, ty_board_upload_stats *rstats)
+{
+    rstats->sent_size = sent_size;
+    rstats->blocks = pacer->blocks;
+    rstats->retries = pacer->retries;
+    rstats->block_latency = pacer->latency;
+    rstats->elapsed = ty_millis() - start;
+}
+
+static int teensy_upload(ty_board_interface *iface, ty_firmware *fw, int flags,
                          ty_board_upload_progress_func *pf, void *udata)
 {
     unsigned int halfkay_version;
     size_t code_size, block_size;
+    struct halfkay_pacer pacer = {0};
+    ty_board_upload_stats stats = {0};
+    size_t sent_size = 0;
+    uint64_t start;
     int r;
 
     r = get_halfkay_settings(iface->model, &halfkay_version, &code_size, &block_size);
@@ -604,22 +718,34 @@ static int teensy_upload(ty_board_interface *iface, ty_firmware *fw,
         return ty_error(TY_ERROR_RANGE, "Firmware is too big for %s",
                         ty_models[iface->model].name);
 
+    // Roughly 1 ms per 8 kiB of flash, bigger chips take longer to erase
+    pacer.erase_delay = (unsigned int)(code_size / 8192);
+    pacer.erase_delay = TY_MAX(pacer.erase_delay, HALFKAY_MIN_ERASE_DELAY);
+    pacer.erase_delay = TY_MIN(pacer.erase_delay, HALFKAY_MAX_ERASE_DELAY);
+
     if (pf) {
-        r = (*pf)(iface->board, fw, 0, code_size, udata);
+        r = (*pf)(iface->board, fw, 0, code_size, &stats, udata);
         if (r)
             return r;
     }
 
+    start = ty_millis();
     for (size_t addr = 0; addr < fw->size; addr += block_size) {
         size_t write_size = TY_MIN(block_size, (size_t)(fw->size - addr));
 
-        r = halfkay_send(iface->port, halfkay_version, block_size,
-                         addr, fw->image + addr, write_size, 3000);
-        if (r < 0)
-            return r;
+        // The first block must always be sent, it triggers the erase
+        if (!(flags & TY_UPLOAD_SPARSE) || !addr ||
+                !is_blank_block(fw->image + addr, write_size)) {
+            r = halfkay_send(iface->port, halfkay_version, block_size,
+                             addr, fw->image + addr, write_size, 3000, &pacer);
+            if (r < 0)
+                return r;
+            sent_size += write_size;
+        }
 
         if (pf) {
-            r = (*pf)(iface->board, fw, addr + write_size, code_size, udata);
+            fill_upload_stats(&pacer, start, sent_size, &stats);
+            r = (*pf)(iface->board, fw, addr + write_size, code_size, &stats, udata);
             if (r)
                 return r;
         }
@@ -637,7 +763,8 @@ static int teensy_reset(ty_board_interface *iface)
     if (r < 0)
         return r;
 
-    return halfkay_send(iface->port, halfkay_version, block_size, 0xFFFFFF, NULL, 0, 250);
+    return halfkay_send(iface->port, halfkay_version, block_size, 0xFFFFFF, NULL, 0, 250,
+                        NULL);
 }
 
 static int teensy_reboot(ty_board_interface *iface)
@@ -9,18 +9,48 @@
    See the LICENSE file for more details. */
 
 #include "common_priv.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+    #include <sys/mman.h>
+#endif
 #include "../libhs/array.h"
 #include "class_priv.h"
 #include "firmware.h"
 #include "system.h"
+#include "thread.h"
+
+struct firmware_cache_key {
+    char *path;
+    const ty_firmware_format *format;
+    uint64_t size;
+    int64_t mtime;
+};
+
+struct firmware_cache_entry {
+    struct firmware_cache_key key;
+    uint64_t last_use;
+
+    ty_firmware *fw;
+};
 
 const ty_firmware_format ty_firmware_formats[] = {
-    {"elf",  ".elf", ty_firmware_load_elf},
-    {"ihex", ".hex", ty_firmware_load_ihex}
+    // The ELF loader only touches the headers and loadable segments, debug info can be huge
+    {"elf",  ".elf", ty_firmware_load_elf,  0},
+    {"ihex", ".hex", ty_firmware_load_ihex, 8 * 1024 * 1024}
 };
 const unsigned int ty_firmware_formats_count = TY_COUNTOF(ty_firmware_formats);
 
 #define FIRMWARE_STEP_SIZE 32768
+#define FIRMWARE_CACHE_SIZE 16
+#define FIRMWARE_CACHE_MAX_BYTES (8 * 1024 * 1024)
+
+static ty_once cache_once = TY_ONCE_INIT;
+static bool cache_init;
+static ty_mutex cache_mutex;
+static struct firmware_cache_entry cache_entries[FIRMWARE_CACHE_SIZE];
+static size_t cache_bytes;
+static uint64_t cache_clock;
 
 static const char *get_basename(const char *filename)
 {
@@ -108,6 +138,203 @@ static int find_format(const char *filename, const char *format_name,
     return 0;
 }
 
+static unsigned int identify_models(const ty_firmware *fw, ty_model *rmodels,
+                                    unsigned int max_models)
+{
+    unsigned int guesses_count = 0;
+
+    for (unsigned int i = 0; i < _ty_classes_count; i++) {
+        ty_model partial_guesses[16];
+        unsigned int partial_count;
+
+        if (!_ty_classes[i].vtable->identify_models)
+            continue;
+
+        partial_count = (*_ty_classes[i].vtable->identify_models)(fw, partial_guesses,
+                                                                  TY_COUNTOF(partial_guesses));
+
+        for (unsigned int j = 0; j < partial_count; j++) {
+            if (rmodels && guesses_count < max_models)
+                rmodels[guesses_count++] = partial_guesses[j];
+        }
+    }
+
+    return guesses_count;
+}
+
+static void memoize_models(ty_firmware *fw)
+{
+    fw->models_count = identify_models(fw, fw->models, TY_COUNTOF(fw->models));
+    fw->identified = true;
+}
+
+static bool get_cache_key(const char *filename, const ty_firmware_format *format,
+                          struct firmware_cache_key *rkey)
+{
+#ifdef _WIN32
+    struct _stat64 sb;
+    int r;
+
+    r = _stat64(filename, &sb);
+    if (r < 0)
+        return false;
+    rkey->mtime = (int64_t)sb.st_mtime * 1000000000;
+
+    rkey->path = _fullpath(NULL, filename, 0);
+#else
+    struct stat sb;
+    int r;
+
+    r = stat(filename, &sb);
+    if (r < 0 || !S_ISREG(sb.st_mode))
+        return false;
+    #if defined(__APPLE__)
+    rkey->mtime = (int64_t)sb.st_mtimespec.tv_sec * 1000000000 + sb.st_mtimespec.tv_nsec;
+    #else
+    rkey->mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+    #endif
+
+    rkey->path = realpath(filename, NULL);
+#endif
+    if (!rkey->path)
+        return false;
+    rkey->format = format;
+    rkey->size = (uint64_t)sb.st_size;
+
+    return true;
+}
+
+static void init_cache_once(void)
+{
+    cache_init = ty_mutex_init(&cache_mutex) >= 0;
+}
+
+static bool init_cache(void)
+{
+    ty_once_run(&cache_once, init_cache_once);
+    return cache_init;
+}
+
+// Call with cache_mutex locked
+static void drop_cache_entry(struct firmware_cache_entry *entry)
+{
+    if (entry->fw)
+        cache_bytes -= entry->fw->alloc_size;
+
+    free(entry->key.path);
+    ty_firmware_unref(entry->fw);
+    memset(entry, 0, sizeof(*entry));
+}
+
+static ty_firmware *find_cached_firmware(const struct firmware_cache_key *key)
+{
+    ty_firmware *fw = NULL;
+
+    ty_mutex_lock(&cache_mutex);
+    for (unsigned int i = 0; i < FIRMWARE_CACHE_SIZE; i++) {
+        struct firmware_cache_entry *entry = &cache_entries[i];
+
+        if (entry->fw && entry->key.format == key->format && entry->key.size == key->size &&
+                entry->key.mtime == key->mtime && strcmp(entry->key.path, key->path) == 0) {
+            entry->last_use = ++cache_clock;
+            fw = ty_firmware_ref(entry->fw);
+            break;
+        }
+    }
+    ty_mutex_unlock(&cache_mutex);
+
+    return fw;
+}
+
+/* Takes ownership of key->path. The cache keeps at most FIRMWARE_CACHE_SIZE firmwares and
+   FIRMWARE_CACHE_MAX_BYTES of images, least recently used entries go first. */
+static void cache_firmware(struct firmware_cache_key *key, ty_firmware *fw)
+{
+    struct firmware_cache_entry *entry = NULL;
+
+    if (fw->alloc_size > FIRMWARE_CACHE_MAX_BYTES)
+        return;
+
+    ty_mutex_lock(&cache_mutex);
+
+    // Reuse the entry for this path if the file changed, or evict the least recently used
+    for (unsigned int i = 0; i < FIRMWARE_CACHE_SIZE; i++) {
+        struct firmware_cache_entry *entry_it = &cache_entries[i];
+
+        if (entry_it->fw && entry_it->key.format == key->format &&
+                strcmp(entry_it->key.path, key->path) == 0) {
+            entry = entry_it;
+            break;
+        }
+        if (!entry || entry_it->last_use < entry->last_use)
+            entry = entry_it;
+    }
+
+    drop_cache_entry(entry);
+
+    while (cache_bytes + fw->alloc_size > FIRMWARE_CACHE_MAX_BYTES) {
+        struct firmware_cache_entry *lru = NULL;
+
+        for (unsigned int i = 0; i < FIRMWARE_CACHE_SIZE; i++) {
+            struct firmware_cache_entry *entry_it = &cache_entries[i];
+
+            if (entry_it->fw && (!lru || entry_it->last_use < lru->last_use))
+                lru = entry_it;
+        }
+        drop_cache_entry(lru);
+    }
+
+    entry->key = *key;
+    key->path = NULL;
+    entry->last_use = ++cache_clock;
+    entry->fw = ty_firmware_ref(fw);
+    cache_bytes += fw->alloc_size;
+
+    ty_mutex_unlock(&cache_mutex);
+}
+
+/* Drops every cached firmware, call it when the cached files are unlikely to be needed
+   again (e.g. before exiting) to release their memory. */
+void ty_firmware_cache_clear(void)
+{
+    if (!init_cache())
+        return;
+
+    ty_mutex_lock(&cache_mutex);
+    for (unsigned int i = 0; i < FIRMWARE_CACHE_SIZE; i++)
+        drop_cache_entry(&cache_entries[i]);
+    ty_mutex_unlock(&cache_mutex);
+}
+
+#ifndef _WIN32
+
+// Returns 1 if the file was mapped, 0 if the caller should read it instead
+static int map_file(FILE *fp, const char *filename, const uint8_t **rmem, size_t *rlen)
+{
+    struct stat sb;
+    void *addr;
+
+    if (fstat(fileno(fp), &sb) < 0 || !S_ISREG(sb.st_mode) || !sb.st_size)
+        return 0;
+    if ((uint64_t)sb.st_size > SIZE_MAX)
+        return 0;
+
+    addr = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (addr == MAP_FAILED) {
+        ty_log(TY_LOG_DEBUG, "Failed to map '%s', reading it instead: %s", filename,
+               strerror(errno));
+        return 0;
+    }
+
+    *rmem = addr;
+    *rlen = (size_t)sb.st_size;
+    return 1;
+}
+
+#endif
+
+/* When fp is NULL, decoded firmwares are cached by canonical path, size and modification
+   time. Subsequent loads of the same unchanged file return the same (shared) firmware. */
 int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_name,
                           ty_firmware **rfw)
 {
@@ -115,8 +342,12 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
     assert(rfw);
 
     const ty_firmware_format *format;
+    struct firmware_cache_key key = {0};
     bool close_fp = false;
+    bool mapped = false;
     _HS_ARRAY(uint8_t) buf = {0};
+    const uint8_t *mem;
+    size_t len;
     ty_firmware *fw = NULL;
     int r;
 
@@ -124,6 +355,19 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
     if (r < 0)
         goto cleanup;
 
+    if (!fp && init_cache() && get_cache_key(filename, format, &key)) {
+        fw = find_cached_firmware(&key);
+        if (fw) {
+            ty_log(TY_LOG_DEBUG, "Using cached firmware '%s'", key.path);
+
+            *rfw = fw;
+            fw = NULL;
+
+            r = 0;
+            goto cleanup;
+        }
+    }
+
     if (!fp) {
 #ifdef _WIN32
         fp = fopen(filename, "rb");
@@ -153,8 +397,13 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
         close_fp = true;
     }
 
-    // Load file to memory
-    while (!feof(fp)) {
+    /* Map files we opened ourselves when possible, the format loader only touches what
+       it needs. Fall back to reading the whole file otherwise (pipes, mmap failures). */
+#ifndef _WIN32
+    if (close_fp)
+        mapped = map_file(fp, filename, &mem, &len);
+#endif
+    while (!mapped && !feof(fp)) {
         r = _hs_array_grow(&buf, 128 * 1024);
         if (r < 0)
             goto cleanup;
@@ -168,29 +417,44 @@ int ty_firmware_load_file(const char *filename, FILE *fp, const char *format_nam
             }
             goto cleanup;
         }
-        if (buf.count > 8 * 1024 * 1024) {
-            r = ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", filename);
-            goto cleanup;
-        }
+        if (format->max_input_size && buf.count > format->max_input_size)
+            break;
+    }
+    if (!mapped) {
+        _hs_array_shrink(&buf);
+        mem = buf.values;
+        len = buf.count;
+    }
+    if (format->max_input_size && len > format->max_input_size) {
+        r = ty_error(TY_ERROR_RANGE, "Firmware '%s' is too big to load", filename);
+        goto cleanup;
     }
-    _hs_array_shrink(&buf);
 
     r = ty_firmware_new(filename, &fw);
     if (r < 0)
         goto cleanup;
 
-    r = (*format->load)(fw, buf.values, buf.count);
+    r = (*format->load)(fw, mem, len);
     if (r < 0)
         goto cleanup;
+    memoize_models(fw);
+
+    if (key.path)
+        cache_firmware(&key, fw);
 
     *rfw = fw;
     fw = NULL;
 
 cleanup:
     ty_firmware_unref(fw);
+#ifndef _WIN32
+    if (mapped)
+        munmap((void *)mem, len);
+#endif
     if (close_fp)
         fclose(fp);
     _hs_array_release(&buf);
+    free(key.path);
     return r;
 }
 
@@ -216,6 +480,7 @@ int ty_firmware_load_mem(const char *filename, const uint8_t *mem, size_t len,
     r = (*format->load)(fw, mem, len);
     if (r < 0)
         goto cleanup;
+    memoize_models(fw);
 
     *rfw = fw;
     fw = NULL;
@@ -239,6 +504,9 @@ void ty_firmware_unref(ty_firmware *fw)
         if (_ty_refcount_decrease(&fw->refcount))
             return;
 
+        free(fw->strings);
+        free(fw->symbols);
+        free(fw->sections);
         free(fw->image);
         free(fw->name);
         free(fw->filename);
@@ -269,6 +537,23 @@ int ty_firmware_expand_image(ty_firmware *fw, size_t size)
     return 0;
 }
 
+static int compare_symbol_name(const void *key, const void *sym)
+{
+    return strcmp((const char *)key, ((const ty_firmware_symbol *)sym)->name);
+}
+
+const ty_firmware_symbol *ty_firmware_find_symbol(const ty_firmware *fw, const char *name)
+{
+    assert(fw);
+    assert(name);
+
+    if (!fw->symbols_count)
+        return NULL;
+
+    return bsearch(name, fw->symbols, fw->symbols_count, sizeof(*fw->symbols),
+                   compare_symbol_name);
+}
+
 unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
                                   unsigned int max_models)
 {
@@ -276,23 +561,11 @@ unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
     assert(rmodels);
     assert(max_models);
 
-    unsigned int guesses_count = 0;
-
-    for (unsigned int i = 0; i < _ty_classes_count; i++) {
-        ty_model partial_guesses[16];
-        unsigned int partial_count;
-
-        if (!_ty_classes[i].vtable->identify_models)
-            continue;
-
-        partial_count = (*_ty_classes[i].vtable->identify_models)(fw, partial_guesses,
-                                                                  TY_COUNTOF(partial_guesses));
-
-        for (unsigned int j = 0; j < partial_count; j++) {
-            if (rmodels && guesses_count < max_models)
-                rmodels[guesses_count++] = partial_guesses[j];
-        }
+    if (fw->identified) {
+        unsigned int count = TY_MIN(fw->models_count, max_models);
+        memcpy(rmodels, fw->models, count * sizeof(*rmodels));
+        return count;
     }
 
-    return guesses_count;
+    return identify_models(fw, rmodels, max_models);
 }
@@ -16,6 +16,22 @@
 
 TY_C_BEGIN
 
+typedef struct ty_firmware_section {
+    const char *name;
+    uint32_t address;
+    uint32_t size;
+
+    // Contents stored in flash (initialized code and data), and space taken in RAM
+    bool flash;
+    bool ram;
+} ty_firmware_section;
+
+typedef struct ty_firmware_symbol {
+    const char *name;
+    uint32_t address;
+    uint32_t size;
+} ty_firmware_symbol;
+
 typedef struct ty_firmware {
     unsigned int refcount;
 
@@ -25,6 +41,18 @@ typedef struct ty_firmware {
     uint8_t *image;
     size_t size;
     size_t alloc_size;
+
+    // Memoized result of ty_firmware_identify(), filled when the firmware is loaded
+    bool identified;
+    ty_model models[16];
+    unsigned int models_count;
+
+    // Allocated sections and defined symbols (sorted by name), only filled for ELF files
+    ty_firmware_section *sections;
+    unsigned int sections_count;
+    ty_firmware_symbol *symbols;
+    unsigned int symbols_count;
+    char *strings;
 } ty_firmware;
 
 typedef struct ty_firmware_format {
@@ -32,6 +60,8 @@ typedef struct ty_firmware_format {
     const char *ext;
 
     int (*load)(ty_firmware *fw, const uint8_t *mem, size_t len);
+    // Maximum size of input files, or 0 for no limit
+    size_t max_input_size;
 } ty_firmware_format;
 
 extern const ty_firmware_format ty_firmware_formats[];
@@ -53,9 +83,13 @@ void ty_firmware_unref(ty_firmware *fw);
 
 int ty_firmware_expand_image(ty_firmware *fw, size_t size);
 
+const ty_firmware_symbol *ty_firmware_find_symbol(const ty_firmware *fw, const char *name);
+
 unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
                                   unsigned int max_models);
 
+void ty_firmware_cache_clear(void);
+
 TY_C_END
 
 #endif
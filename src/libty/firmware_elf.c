@@ -56,6 +56,44 @@ typedef struct Elf32_Phdr {
 #define PT_NULL 0
 #define PT_LOAD 1
 
+typedef struct Elf32_Shdr {
+    uint32_t sh_name;
+    uint32_t sh_type;
+    uint32_t sh_flags;
+    uint32_t sh_addr;
+    uint32_t sh_offset;
+    uint32_t sh_size;
+    uint32_t sh_link;
+    uint32_t sh_info;
+    uint32_t sh_addralign;
+    uint32_t sh_entsize;
+} Elf32_Shdr;
+
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB 2
+#define SHT_NOBITS 8
+
+#define SHF_WRITE 0x1
+#define SHF_ALLOC 0x2
+
+#define SHN_UNDEF 0
+#define SHN_LORESERVE 0xFF00
+
+typedef struct Elf32_Sym {
+    uint32_t st_name;
+    uint32_t st_value;
+    uint32_t st_size;
+    unsigned char st_info;
+    unsigned char st_other;
+    uint16_t st_shndx;
+} Elf32_Sym;
+
+#define ELF32_ST_TYPE(info) ((info) & 0xF)
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+
 struct loader_context {
     ty_firmware *fw;
 
@@ -86,9 +124,14 @@ static inline void reverse_uint32(uint32_t *u)
             | ((*u & 0xFF0000) >> 8) | ((*u & 0xFF000000) >> 24);
 }
 
+static bool is_chunk_valid(struct loader_context *ctx, off_t offset, size_t size)
+{
+    return offset >= 0 && size <= ctx->len && (size_t)offset <= ctx->len - size;
+}
+
 static int read_chunk(struct loader_context *ctx, off_t offset, size_t size, void *buf)
 {
-    if (offset < 0 || (size_t)offset > ctx->len - size)
+    if (!is_chunk_valid(ctx, offset, size))
         return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated",
                         ctx->fw->filename);
 
@@ -140,6 +183,185 @@ static int load_segment(struct loader_context *ctx, unsigned int i)
     return 1;
 }
 
+static int load_section_header(struct loader_context *ctx, unsigned int i, Elf32_Shdr *rshdr)
+{
+    int r;
+
+    r = read_chunk(ctx, (off_t)(ctx->ehdr.e_shoff + i * ctx->ehdr.e_shentsize), sizeof(*rshdr), rshdr);
+    if (r < 0)
+        return r;
+
+    if (is_endianness_reversed(ctx)) {
+        reverse_uint32(&rshdr->sh_name);
+        reverse_uint32(&rshdr->sh_type);
+        reverse_uint32(&rshdr->sh_flags);
+        reverse_uint32(&rshdr->sh_addr);
+        reverse_uint32(&rshdr->sh_offset);
+        reverse_uint32(&rshdr->sh_size);
+        reverse_uint32(&rshdr->sh_link);
+        reverse_uint32(&rshdr->sh_info);
+        reverse_uint32(&rshdr->sh_addralign);
+        reverse_uint32(&rshdr->sh_entsize);
+    }
+
+    return 0;
+}
+
+static int load_symbol(struct loader_context *ctx, const Elf32_Shdr *symtab, unsigned int i,
+                       Elf32_Sym *rsym)
+{
+    int r;
+
+    r = read_chunk(ctx, (off_t)symtab->sh_offset + (off_t)i * (off_t)sizeof(Elf32_Sym), sizeof(*rsym), rsym);
+    if (r < 0)
+        return r;
+
+    if (is_endianness_reversed(ctx)) {
+        reverse_uint32(&rsym->st_name);
+        reverse_uint32(&rsym->st_value);
+        reverse_uint32(&rsym->st_size);
+        reverse_uint16(&rsym->st_shndx);
+    }
+
+    return 0;
+}
+
+// Copy a string table to fw->strings (at offset), with a guaranteed final NUL character
+static int copy_strings(struct loader_context *ctx, const Elf32_Shdr *shdr, size_t offset)
+{
+    int r;
+
+    r = read_chunk(ctx, (off_t)shdr->sh_offset, shdr->sh_size, ctx->fw->strings + offset);
+    if (r < 0)
+        return r;
+    ctx->fw->strings[offset + shdr->sh_size] = 0;
+
+    return 0;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+    return strcmp(((const ty_firmware_symbol *)a)->name, ((const ty_firmware_symbol *)b)->name);
+}
+
+static void release_sections(ty_firmware *fw)
+{
+    free(fw->strings);
+    fw->strings = NULL;
+    free(fw->sections);
+    fw->sections = NULL;
+    fw->sections_count = 0;
+    free(fw->symbols);
+    fw->symbols = NULL;
+    fw->symbols_count = 0;
+}
+
+/* Index allocated sections and the symbol table, which let class code find things such as
+   _VectorsFlash without scanning the image. Names point into fw->strings, where we copy the
+   section name table followed by the symbol name table. */
+static int load_sections(struct loader_context *ctx)
+{
+    ty_firmware *fw = ctx->fw;
+    Elf32_Shdr shstrtab = {0}, symtab = {0}, strtab = {0};
+    unsigned int symbols_count;
+    int r;
+
+    if (!ctx->ehdr.e_shoff || !ctx->ehdr.e_shnum || ctx->ehdr.e_shnum >= SHN_LORESERVE)
+        return 0;
+    if (ctx->ehdr.e_shentsize < sizeof(Elf32_Shdr))
+        return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated", fw->filename);
+
+    if (ctx->ehdr.e_shstrndx != SHN_UNDEF && ctx->ehdr.e_shstrndx < ctx->ehdr.e_shnum) {
+        r = load_section_header(ctx, ctx->ehdr.e_shstrndx, &shstrtab);
+        if (r < 0)
+            return r;
+    }
+    for (unsigned int i = 0; i < ctx->ehdr.e_shnum; i++) {
+        r = load_section_header(ctx, i, &symtab);
+        if (r < 0)
+            return r;
+
+        if (symtab.sh_type == SHT_SYMTAB) {
+            if (symtab.sh_link >= ctx->ehdr.e_shnum)
+                return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated",
+                                fw->filename);
+            r = load_section_header(ctx, symtab.sh_link, &strtab);
+            if (r < 0)
+                return r;
+            break;
+        }
+    }
+    if (symtab.sh_type != SHT_SYMTAB)
+        memset(&symtab, 0, sizeof(symtab));
+    symbols_count = symtab.sh_size / (uint32_t)sizeof(Elf32_Sym);
+
+    // Don't trust the sizes to allocate memory before we know the tables are in the file
+    if (!is_chunk_valid(ctx, (off_t)shstrtab.sh_offset, shstrtab.sh_size) ||
+            !is_chunk_valid(ctx, (off_t)strtab.sh_offset, strtab.sh_size) ||
+            !is_chunk_valid(ctx, (off_t)symtab.sh_offset, symtab.sh_size))
+        return ty_error(TY_ERROR_PARSE, "ELF file '%s' is malformed or truncated", fw->filename);
+
+    fw->strings = malloc((size_t)shstrtab.sh_size + (size_t)strtab.sh_size + 2);
+    fw->sections = malloc(ctx->ehdr.e_shnum * sizeof(*fw->sections));
+    if (!fw->strings || !fw->sections)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    if (symbols_count) {
+        fw->symbols = malloc(symbols_count * sizeof(*fw->symbols));
+        if (!fw->symbols)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+
+    r = copy_strings(ctx, &shstrtab, 0);
+    if (r < 0)
+        return r;
+    r = copy_strings(ctx, &strtab, shstrtab.sh_size + 1);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < ctx->ehdr.e_shnum; i++) {
+        Elf32_Shdr shdr;
+        ty_firmware_section *section;
+
+        r = load_section_header(ctx, i, &shdr);
+        if (r < 0)
+            return r;
+        if (!(shdr.sh_flags & SHF_ALLOC) || !shdr.sh_size)
+            continue;
+
+        section = &fw->sections[fw->sections_count++];
+        section->name = fw->strings + (shdr.sh_name < shstrtab.sh_size ? shdr.sh_name : shstrtab.sh_size);
+        section->address = shdr.sh_addr;
+        section->size = shdr.sh_size;
+        section->flash = (shdr.sh_type != SHT_NOBITS);
+        section->ram = (shdr.sh_flags & SHF_WRITE);
+    }
+
+    for (unsigned int i = 0; i < symbols_count; i++) {
+        Elf32_Sym sym;
+        unsigned int type;
+        ty_firmware_symbol *symbol;
+
+        r = load_symbol(ctx, &symtab, i, &sym);
+        if (r < 0)
+            return r;
+
+        type = ELF32_ST_TYPE(sym.st_info);
+        if (!sym.st_name || sym.st_name >= strtab.sh_size || sym.st_shndx == SHN_UNDEF)
+            continue;
+        if (type != STT_NOTYPE && type != STT_OBJECT && type != STT_FUNC)
+            continue;
+
+        symbol = &fw->symbols[fw->symbols_count++];
+        symbol->name = fw->strings + shstrtab.sh_size + 1 + sym.st_name;
+        symbol->address = sym.st_value;
+        symbol->size = sym.st_size;
+    }
+    if (fw->symbols_count)
+        qsort(fw->symbols, fw->symbols_count, sizeof(*fw->symbols), compare_symbols);
+
+    return 0;
+}
+
 int ty_firmware_load_elf(ty_firmware *fw, const uint8_t *mem, size_t len)
 {
     assert(fw);
@@ -188,5 +410,19 @@ int ty_firmware_load_elf(ty_firmware *fw, const uint8_t *mem, size_t len)
             return r;
     }
 
+    /* Sections and symbols are optional metadata, firmwares with a broken section table
+       still load fine from their program headers. */
+    ty_error_mask(TY_ERROR_PARSE);
+    r = load_sections(&ctx);
+    ty_error_unmask();
+    if (r < 0) {
+        if (r != TY_ERROR_PARSE)
+            return r;
+
+        ty_log(TY_LOG_WARNING, "Ignoring malformed section table in ELF file '%s'",
+               fw->filename);
+        release_sections(fw);
+    }
+
     return 0;
 }
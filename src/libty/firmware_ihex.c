@@ -15,44 +15,144 @@ struct parser_context {
     ty_firmware *fw;
     unsigned int line;
 
-    const char *ptr;
-    const char *end;
-    uint8_t sum;
-    bool error;
+    const uint8_t *ptr;
+    const uint8_t *end;
 
     uint32_t base_offset;
 };
 
-static uint32_t parse_hex_value(struct parser_context *ctx, size_t size)
+#define HEX_VALID 0x10
+
+// Valid digits have HEX_VALID set, so ANDing digits together tells us if one was invalid
+static const uint8_t hex_digits[256] = {
+    ['0'] = HEX_VALID | 0x0, ['1'] = HEX_VALID | 0x1, ['2'] = HEX_VALID | 0x2,
+    ['3'] = HEX_VALID | 0x3, ['4'] = HEX_VALID | 0x4, ['5'] = HEX_VALID | 0x5,
+    ['6'] = HEX_VALID | 0x6, ['7'] = HEX_VALID | 0x7, ['8'] = HEX_VALID | 0x8,
+    ['9'] = HEX_VALID | 0x9,
+    ['A'] = HEX_VALID | 0xA, ['B'] = HEX_VALID | 0xB, ['C'] = HEX_VALID | 0xC,
+    ['D'] = HEX_VALID | 0xD, ['E'] = HEX_VALID | 0xE, ['F'] = HEX_VALID | 0xF,
+    ['a'] = HEX_VALID | 0xA, ['b'] = HEX_VALID | 0xB, ['c'] = HEX_VALID | 0xC,
+    ['d'] = HEX_VALID | 0xD, ['e'] = HEX_VALID | 0xE, ['f'] = HEX_VALID | 0xF
+};
+
+static inline uint8_t decode_byte(const uint8_t *ptr, unsigned int *valid)
+{
+    uint8_t hi = hex_digits[ptr[0]];
+    uint8_t lo = hex_digits[ptr[1]];
+
+    *valid &= (unsigned int)(hi & lo);
+    return (uint8_t)((hi << 4) | (lo & 0xF));
+}
+
+static unsigned int decode_bytes(const uint8_t *ptr, uint8_t *dest, size_t len, uint8_t *sum)
+{
+    unsigned int valid = HEX_VALID;
+    uint8_t acc = *sum;
+
+    for (size_t i = 0; i < len; i++) {
+        dest[i] = decode_byte(ptr + 2 * i, &valid);
+        acc = (uint8_t)(acc + dest[i]);
+    }
+    *sum = acc;
+
+    return valid;
+}
+
+static bool next_line(struct parser_context *ctx, const uint8_t **rline, size_t *rlen)
 {
-    if (ctx->error)
+    const uint8_t *ptr = ctx->ptr;
+    const uint8_t *start;
+
+    // Count CRLF and lone CR or LF as one line break, to report exact line numbers
+    while (ptr < ctx->end && (*ptr == '\r' || *ptr == '\n')) {
+        if (*ptr == '\n' || ptr + 1 == ctx->end || ptr[1] != '\n')
+            ctx->line++;
+        ptr++;
+    }
+    if (ptr == ctx->end)
+        return false;
+
+    start = ptr;
+    while (ptr < ctx->end && *ptr != '\r' && *ptr != '\n')
+        ptr++;
+
+    *rline = start;
+    *rlen = (size_t)(ptr - start);
+    ctx->ptr = ptr;
+
+    return true;
+}
+
+// The image must not be shrunk by records with lower addresses, and gaps look like erased flash
+static int grow_image(ty_firmware *fw, uint64_t size)
+{
+    size_t prev_size = fw->size;
+    int r;
+
+    if (size <= prev_size)
         return 0;
 
-    uint32_t value = 0;
-    while (size--) {
-        char buf[3];
-        char *end;
-        unsigned long byte;
+    r = ty_firmware_expand_image(fw, (size_t)TY_MIN(size, (uint64_t)SIZE_MAX));
+    if (r < 0)
+        return r;
+    memset(fw->image + prev_size, 0xFF, fw->size - prev_size);
 
-        if (ctx->ptr > ctx->end - 2) {
-            ctx->error = true;
-            return 0;
-        }
-        memcpy(buf, ctx->ptr, 2);
-        buf[2] = 0;
+    return 0;
+}
+
+/* Quick pass over record headers to find the final image size, so the image is allocated
+   once. Records are fixed-size so we can jump from one to the next. Malformed input stops
+   the measurement, parse_line() will report the error with the correct line number. */
+static size_t measure_image(const uint8_t *mem, size_t len)
+{
+    const uint8_t *ptr = mem;
+    const uint8_t *end = mem + len;
+    uint32_t base_offset = 0;
+    uint64_t size = 0;
+
+    for (;;) {
+        unsigned int valid = HEX_VALID;
+        uint8_t header[4];
+        uint8_t unused = 0;
+        size_t record_len;
+
+        while (ptr < end && (*ptr == '\r' || *ptr == '\n'))
+            ptr++;
+        if (end - ptr < 11 || *ptr != ':')
+            break;
+
+        valid &= decode_bytes(ptr + 1, header, 4, &unused);
+        record_len = 11 + 2 * (size_t)header[0];
+        if (!valid || (size_t)(end - ptr) < record_len)
+            break;
+
+        switch (header[3]) {
+            case 0: {
+                uint64_t record_end = (uint64_t)base_offset +
+                                      (uint32_t)((header[1] << 8) | header[2]) + header[0];
+                size = TY_MAX(size, record_end);
+            } break;
 
-        byte = strtoul(buf, &end, 16);
-        if (end == buf || end[0]) {
-            ctx->error = true;
-            return 0;
+            case 1: {
+                goto done;
+            } break;
+
+            case 2:
+            case 4: {
+                uint8_t offset[2];
+
+                if (header[0] != 2 || !decode_bytes(ptr + 9, offset, 2, &unused))
+                    goto done;
+                base_offset = (uint32_t)((offset[0] << 8) | offset[1]) <<
+                              (header[3] == 2 ? 4 : 16);
+            } break;
         }
 
-        value = (value << 8) | (uint8_t)byte;
-        ctx->sum = (uint8_t)(ctx->sum + byte);
-        ctx->ptr += 2;
+        ptr += record_len;
     }
 
-    return value;
+done:
+    return (size_t)TY_MIN(size, (uint64_t)TY_FIRMWARE_MAX_SIZE);
 }
 
 static int ihex_parse_error(struct parser_context *ctx)
@@ -61,35 +161,45 @@ static int ihex_parse_error(struct parser_context *ctx)
                     ctx->fw->filename);
 }
 
-static int parse_line(struct parser_context *ctx, const char *line, size_t line_len)
+static int parse_line(struct parser_context *ctx, const uint8_t *line, size_t line_len)
 {
+    uint8_t header[4];
     unsigned int data_len, type;
-    uint32_t address;
-    uint8_t sum, checksum;
+    uint8_t buf[255];
+    uint8_t *data;
+    uint8_t sum = 0, checksum;
+    unsigned int valid;
     int r;
 
-    ctx->ptr = line;
-    ctx->end = line + line_len;
-    ctx->sum = 0;
-    ctx->error = false;
+    if (line_len < 11 || line[0] != ':')
+        return ihex_parse_error(ctx);
+    valid = decode_bytes(line + 1, header, 4, &sum);
+    data_len = header[0];
+    type = header[3];
+    if (!valid || 11 + 2 * data_len != line_len)
+        return ihex_parse_error(ctx);
+
+    // Data records are decoded straight into the image
+    if (type == 0) {
+        uint64_t address = (uint64_t)ctx->base_offset + (uint32_t)((header[1] << 8) | header[2]);
 
-    if (!line_len || *ctx->ptr++ != ':')
+        r = grow_image(ctx->fw, address + data_len);
+        if (r < 0)
+            return r;
+        data = ctx->fw->image + address;
+    } else {
+        data = buf;
+    }
+    valid &= decode_bytes(line + 9, data, data_len, &sum);
+    checksum = decode_byte(line + 9 + 2 * data_len, &valid);
+
+    if (!valid)
         return ihex_parse_error(ctx);
-    data_len = parse_hex_value(ctx, 1);
-    if (11 + 2 * data_len != line_len)
+    if ((sum + checksum) & 0xFF)
         return ihex_parse_error(ctx);
-    address = parse_hex_value(ctx, 2);
-    type = parse_hex_value(ctx, 1);
 
     switch (type) {
-        case 0: { // data record
-            address += ctx->base_offset;
-            r = ty_firmware_expand_image(ctx->fw, address + data_len);
-            if (r < 0)
-                return r;
-            for (unsigned int i = 0; i < data_len; i++)
-                ctx->fw->image[address + i] = (uint8_t)parse_hex_value(ctx, 1);
-        } break;
+        case 0: {} break; // data record
 
         case 1: { // EOF record
             if (data_len)
@@ -99,20 +209,19 @@ static int parse_line(struct parser_context *ctx, const char *line, size_t line_
         case 2: { // extended segment address record
             if (data_len != 2)
                 return ihex_parse_error(ctx);
-            ctx->base_offset = (uint32_t)parse_hex_value(ctx, 2) << 4;
+            ctx->base_offset = (uint32_t)((data[0] << 8) | data[1]) << 4;
         } break;
 
         case 4: { // extended linear address record
             if (data_len != 2)
                 return ihex_parse_error(ctx);
-            ctx->base_offset = (uint32_t)parse_hex_value(ctx, 2) << 16;
+            ctx->base_offset = (uint32_t)((data[0] << 8) | data[1]) << 16;
         } break;
 
         case 3:   // start segment address record
         case 5: { // start linear address record
             if (data_len != 4)
                 return ihex_parse_error(ctx);
-            parse_hex_value(ctx, 4);
         } break;
 
         default: {
@@ -120,15 +229,6 @@ static int parse_line(struct parser_context *ctx, const char *line, size_t line_
         } break;
     }
 
-    // Don't checksum the checksum :)
-    sum = ctx->sum;
-    checksum = (uint8_t)parse_hex_value(ctx, 1);
-
-    if (ctx->error)
-        return ihex_parse_error(ctx);
-    if ((sum + checksum) & 0xFF)
-        return ihex_parse_error(ctx);
-
     // Return 1 for EOF records, to end the parsing
     return (type == 1);
 }
@@ -143,21 +243,23 @@ int ty_firmware_load_ihex(ty_firmware *fw, const uint8_t *mem, size_t len)
     int r;
 
     ctx.fw = fw;
+    ctx.line = 1;
+    ctx.ptr = mem;
+    ctx.end = mem + len;
+
+    r = grow_image(fw, measure_image(mem, len));
+    if (r < 0)
+        return r;
 
-    size_t start, end = 0;
     do {
-        start = end;
-        while (start < len && (mem[start] == '\r' || mem[start] == '\n'))
-            start++;
-        if (start >= len)
+        const uint8_t *line;
+        size_t line_len;
+
+        if (!next_line(&ctx, &line, &line_len))
             return ty_error(TY_ERROR_PARSE, "Missing EOF record in '%s' (IHEX)", fw->filename);
-        end = start;
-        while (end < len && mem[end] != '\r' && mem[end] != '\n')
-            end++;
-        ctx.line++;
 
         // Returns 1 when EOF record is detected
-        r = parse_line(&ctx, (const char *)mem + start, end - start);
+        r = parse_line(&ctx, line, line_len);
         if (r < 0)
             return r;
     } while (!r);
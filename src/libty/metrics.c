@@ -0,0 +1,513 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#ifdef _WIN32
+    // Need that for InterlockedX functions
+    #include <windows.h>
+#endif
+#include <locale.h>
+#include <math.h>
+#include <stdarg.h>
+#include "../libhs/array.h"
+#include "metrics.h"
+#include "thread.h"
+
+struct ty_metric_series {
+    const ty_metric *metric;
+    char *label_value;
+
+    // Counter or gauge value (gauges store the int64_t bits), or observation count
+    uint64_t value;
+    // Histogram only, sum is stored as the bits of a double
+    uint64_t sum;
+    // Non-cumulative, observations above the last bound are only counted in value
+    uint64_t buckets[TY_METRIC_MAX_BUCKETS];
+};
+
+struct ty_metric {
+    ty_metrics *metrics;
+
+    char *name;
+    char *help;
+    ty_metric_type type;
+    char *label;
+    double buckets[TY_METRIC_MAX_BUCKETS];
+    unsigned int buckets_count;
+
+    _HS_ARRAY(ty_metric_series *) series;
+};
+
+struct ty_metrics {
+    ty_mutex mutex;
+    _HS_ARRAY(ty_metric *) families;
+};
+
+static void atomic_add_uint64(uint64_t *ptr, uint64_t value)
+{
+#ifdef _MSC_VER
+    InterlockedExchangeAdd64((volatile LONG64 *)ptr, (LONG64)value);
+#else
+    __atomic_add_fetch(ptr, value, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t atomic_load_uint64(const uint64_t *ptr)
+{
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, 0, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+#endif
+}
+
+static void atomic_store_uint64(uint64_t *ptr, uint64_t value)
+{
+#ifdef _MSC_VER
+    InterlockedExchange64((volatile LONG64 *)ptr, (LONG64)value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+#endif
+}
+
+static bool atomic_cas_uint64(uint64_t *ptr, uint64_t expected, uint64_t value)
+{
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, (LONG64)value,
+                                                  (LONG64)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(ptr, &expected, value, false, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t double_to_bits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static double bits_to_double(uint64_t bits)
+{
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+int ty_metrics_new(ty_metrics **rmetrics)
+{
+    assert(rmetrics);
+
+    ty_metrics *metrics;
+    int r;
+
+    metrics = calloc(1, sizeof(*metrics));
+    if (!metrics)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    r = ty_mutex_init(&metrics->mutex);
+    if (r < 0) {
+        free(metrics);
+        return r;
+    }
+
+    *rmetrics = metrics;
+    return 0;
+}
+
+static void free_metric(ty_metric *metric)
+{
+    for (size_t i = 0; i < metric->series.count; i++) {
+        ty_metric_series *series = metric->series.values[i];
+
+        free(series->label_value);
+        free(series);
+    }
+    _hs_array_release(&metric->series);
+
+    free(metric->label);
+    free(metric->help);
+    free(metric->name);
+    free(metric);
+}
+
+void ty_metrics_free(ty_metrics *metrics)
+{
+    if (metrics) {
+        for (size_t i = 0; i < metrics->families.count; i++)
+            free_metric(metrics->families.values[i]);
+        _hs_array_release(&metrics->families);
+
+        ty_mutex_release(&metrics->mutex);
+    }
+
+    free(metrics);
+}
+
+int ty_metrics_add(ty_metrics *metrics, const char *name, const char *help, ty_metric_type type,
+                   const char *label, const double *buckets, unsigned int buckets_count,
+                   ty_metric **rmetric)
+{
+    assert(metrics);
+    assert(name);
+    assert(help);
+    assert(type != TY_METRIC_HISTOGRAM || buckets_count);
+    assert(buckets_count <= TY_METRIC_MAX_BUCKETS);
+
+    ty_metric *metric;
+    int r;
+
+    metric = calloc(1, sizeof(*metric));
+    if (!metric)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    metric->metrics = metrics;
+    metric->type = type;
+
+    metric->name = strdup(name);
+    metric->help = strdup(help);
+    if (!metric->name || !metric->help) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    if (label) {
+        metric->label = strdup(label);
+        if (!metric->label) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto error;
+        }
+    }
+    if (type == TY_METRIC_HISTOGRAM) {
+        memcpy(metric->buckets, buckets, buckets_count * sizeof(*buckets));
+        metric->buckets_count = buckets_count;
+    }
+
+    ty_mutex_lock(&metrics->mutex);
+    r = _hs_array_push(&metrics->families, metric);
+    ty_mutex_unlock(&metrics->mutex);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    if (rmetric)
+        *rmetric = metric;
+    return 0;
+
+error:
+    free_metric(metric);
+    return r;
+}
+
+int ty_metric_get_series(ty_metric *metric, const char *label_value, ty_metric_series **rseries)
+{
+    assert(metric);
+    assert(rseries);
+
+    ty_metric_series *series = NULL;
+    int r;
+
+    if (!metric->label || !label_value)
+        label_value = "";
+
+    ty_mutex_lock(&metric->metrics->mutex);
+
+    for (size_t i = 0; i < metric->series.count; i++) {
+        if (!strcmp(metric->series.values[i]->label_value, label_value)) {
+            *rseries = metric->series.values[i];
+            r = 0;
+            goto cleanup;
+        }
+    }
+
+    series = calloc(1, sizeof(*series));
+    if (!series) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    series->metric = metric;
+    series->label_value = strdup(label_value);
+    if (!series->label_value) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    r = _hs_array_push(&metric->series, series);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    *rseries = series;
+    series = NULL;
+    r = 0;
+
+cleanup:
+    ty_mutex_unlock(&metric->metrics->mutex);
+    if (series) {
+        free(series->label_value);
+        free(series);
+    }
+    return r;
+}
+
+void ty_metric_series_add(ty_metric_series *series, uint64_t value)
+{
+    assert(series);
+    atomic_add_uint64(&series->value, value);
+}
+
+void ty_metric_series_set(ty_metric_series *series, int64_t value)
+{
+    assert(series);
+    atomic_store_uint64(&series->value, (uint64_t)value);
+}
+
+void ty_metric_series_observe(ty_metric_series *series, double value)
+{
+    assert(series);
+    assert(series->metric->type == TY_METRIC_HISTOGRAM);
+
+    // Bounds never change once the family exists, no need for the lock
+    const ty_metric *metric = series->metric;
+    uint64_t sum;
+
+    for (unsigned int i = 0; i < metric->buckets_count; i++) {
+        if (value <= metric->buckets[i]) {
+            atomic_add_uint64(&series->buckets[i], 1);
+            break;
+        }
+    }
+
+    do {
+        sum = atomic_load_uint64(&series->sum);
+    } while (!atomic_cas_uint64(&series->sum, sum, double_to_bits(bits_to_double(sum) + value)));
+    atomic_add_uint64(&series->value, 1);
+}
+
+uint64_t ty_metric_series_get_count(const ty_metric_series *series)
+{
+    assert(series);
+    return atomic_load_uint64(&series->value);
+}
+
+// Same layout as _HS_ARRAY(char), but named so we can pass it around
+struct text_buffer {
+    char *values;
+    size_t allocated;
+    size_t count;
+};
+
+static int append_text(struct text_buffer *buf, const char *fmt, ...) TY_PRINTF_FORMAT(2, 3);
+static int append_text(struct text_buffer *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to format metrics");
+
+    // Keep room for the NUL byte vsnprintf() wants to write
+    if (_hs_array_grow(buf, (size_t)len + 1) < 0)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    va_start(ap, fmt);
+    vsnprintf(buf->values + buf->count, (size_t)len + 1, fmt, ap);
+    va_end(ap);
+    buf->count += (size_t)len;
+
+    return 0;
+}
+
+// Prometheus wants backslashes, double quotes and line feeds escaped in label values
+static int append_label(struct text_buffer *buf, const char *label, const char *value,
+                        const char *extra)
+{
+    int r;
+
+    if (!label && !extra)
+        return 0;
+
+    r = append_text(buf, "{");
+    if (r < 0)
+        return r;
+    if (label) {
+        r = append_text(buf, "%s=\"", label);
+        if (r < 0)
+            return r;
+        for (const char *ptr = value; *ptr; ptr++) {
+            switch (*ptr) {
+                case '\\': { r = append_text(buf, "\\\\"); } break;
+                case '"': { r = append_text(buf, "\\\""); } break;
+                case '\n': { r = append_text(buf, "\\n"); } break;
+                default: { r = append_text(buf, "%c", *ptr); } break;
+            }
+            if (r < 0)
+                return r;
+        }
+        r = append_text(buf, "\"%s", extra ? "," : "");
+        if (r < 0)
+            return r;
+    }
+    if (extra) {
+        r = append_text(buf, "%s", extra);
+        if (r < 0)
+            return r;
+    }
+
+    return append_text(buf, "}");
+}
+
+/* snprintf() uses the decimal point of the current locale, which QApplication sets from the
+   environment on Unix. The Prometheus text format always wants a dot. */
+static void format_double(double value, int precision, char *buf, size_t size)
+{
+    const char *point = localeconv()->decimal_point;
+    char *ptr;
+
+    snprintf(buf, size, "%.*g", precision, value);
+
+    if (point && point[0] && strcmp(point, ".") && (ptr = strstr(buf, point))) {
+        size_t point_len = strlen(point);
+
+        *ptr = '.';
+        memmove(ptr + 1, ptr + point_len, strlen(ptr + point_len) + 1);
+    }
+}
+
+static void format_bound(double bound, char *buf, size_t size)
+{
+    char value[32];
+
+    if (isinf(bound)) {
+        snprintf(buf, size, "le=\"+Inf\"");
+    } else {
+        format_double(bound, 6, value, sizeof(value));
+        snprintf(buf, size, "le=\"%s\"", value);
+    }
+}
+
+static int format_series(struct text_buffer *buf, const ty_metric *metric,
+                         const ty_metric_series *series)
+{
+    uint64_t value = atomic_load_uint64(&series->value);
+    int r;
+
+    switch (metric->type) {
+        case TY_METRIC_COUNTER:
+        case TY_METRIC_GAUGE: {
+            r = append_text(buf, "%s", metric->name);
+            if (r < 0)
+                return r;
+            r = append_label(buf, metric->label, series->label_value, NULL);
+            if (r < 0)
+                return r;
+            if (metric->type == TY_METRIC_COUNTER) {
+                r = append_text(buf, " %"PRIu64"\n", value);
+            } else {
+                r = append_text(buf, " %"PRId64"\n", (int64_t)value);
+            }
+        } break;
+
+        case TY_METRIC_HISTOGRAM: {
+            uint64_t cumulative = 0;
+            char bound[64], sum[32];
+
+            for (unsigned int i = 0; i <= metric->buckets_count; i++) {
+                if (i < metric->buckets_count) {
+                    cumulative += atomic_load_uint64(&series->buckets[i]);
+                    format_bound(metric->buckets[i], bound, sizeof(bound));
+                } else {
+                    // Updates are not atomic as a whole, don't let +Inf go below the rest
+                    cumulative = TY_MAX(cumulative, value);
+                    format_bound(INFINITY, bound, sizeof(bound));
+                }
+
+                r = append_text(buf, "%s_bucket", metric->name);
+                if (r < 0)
+                    return r;
+                r = append_label(buf, metric->label, series->label_value, bound);
+                if (r < 0)
+                    return r;
+                r = append_text(buf, " %"PRIu64"\n", cumulative);
+                if (r < 0)
+                    return r;
+            }
+
+            r = append_text(buf, "%s_sum", metric->name);
+            if (r < 0)
+                return r;
+            r = append_label(buf, metric->label, series->label_value, NULL);
+            if (r < 0)
+                return r;
+            format_double(bits_to_double(atomic_load_uint64(&series->sum)), 17, sum, sizeof(sum));
+            r = append_text(buf, " %s\n%s_count", sum, metric->name);
+            if (r < 0)
+                return r;
+            r = append_label(buf, metric->label, series->label_value, NULL);
+            if (r < 0)
+                return r;
+            r = append_text(buf, " %"PRIu64"\n", cumulative);
+        } break;
+    }
+
+    return r;
+}
+
+int ty_metrics_format(ty_metrics *metrics, char **rbuf, size_t *rsize)
+{
+    assert(metrics);
+    assert(rbuf);
+
+    static const char *const type_names[] = {
+        "counter",
+        "gauge",
+        "histogram"
+    };
+
+    struct text_buffer buf = {0};
+    int r;
+
+    ty_mutex_lock(&metrics->mutex);
+
+    for (size_t i = 0; i < metrics->families.count; i++) {
+        const ty_metric *metric = metrics->families.values[i];
+
+        r = append_text(&buf, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help,
+                        metric->name, type_names[metric->type]);
+        if (r < 0)
+            goto error;
+
+        for (size_t j = 0; j < metric->series.count; j++) {
+            r = format_series(&buf, metric, metric->series.values[j]);
+            if (r < 0)
+                goto error;
+        }
+    }
+
+    // Make sure we return a valid string, even if there is nothing to show
+    r = append_text(&buf, "%s", "");
+    if (r < 0)
+        goto error;
+
+    ty_mutex_unlock(&metrics->mutex);
+
+    *rbuf = buf.values;
+    if (rsize)
+        *rsize = buf.count;
+    return 0;
+
+error:
+    ty_mutex_unlock(&metrics->mutex);
+    _hs_array_release(&buf);
+    return r;
+}
@@ -0,0 +1,56 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_METRICS_H
+#define TY_METRICS_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+/* Metric families are declared once, with zero or one label (such as "board"). Each label
+   value gets its own series, created on first use and kept as long as the registry exists.
+   Series updates are lock-free and can be done from any thread, only series creation and
+   formatting take the registry lock. */
+
+#define TY_METRIC_MAX_BUCKETS 16
+
+typedef struct ty_metrics ty_metrics;
+typedef struct ty_metric ty_metric;
+typedef struct ty_metric_series ty_metric_series;
+
+typedef enum ty_metric_type {
+    TY_METRIC_COUNTER,
+    TY_METRIC_GAUGE,
+    TY_METRIC_HISTOGRAM
+} ty_metric_type;
+
+int ty_metrics_new(ty_metrics **rmetrics);
+void ty_metrics_free(ty_metrics *metrics);
+
+// Histogram buckets are upper bounds in ascending order, the +Inf bucket is implicit
+int ty_metrics_add(ty_metrics *metrics, const char *name, const char *help, ty_metric_type type,
+                   const char *label, const double *buckets, unsigned int buckets_count,
+                   ty_metric **rmetric);
+// Use NULL (or anything) for families without label
+int ty_metric_get_series(ty_metric *metric, const char *label_value, ty_metric_series **rseries);
+
+void ty_metric_series_add(ty_metric_series *series, uint64_t value);
+void ty_metric_series_set(ty_metric_series *series, int64_t value);
+void ty_metric_series_observe(ty_metric_series *series, double value);
+
+uint64_t ty_metric_series_get_count(const ty_metric_series *series);
+
+// Prometheus text exposition format (version 0.0.4), release the buffer with free()
+int ty_metrics_format(ty_metrics *metrics, char **rbuf, size_t *rsize);
+
+TY_C_END
+
+#endif
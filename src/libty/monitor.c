@@ -15,8 +15,10 @@
 #include "board_priv.h"
 #include "class_priv.h"
 #include "monitor.h"
+#include "reactor.h"
 #include "system.h"
 #include "timer.h"
+#include "trace.h"
 
 struct callback {
     int id;
@@ -31,6 +33,9 @@ struct ty_monitor {
     hs_monitor *device_monitor;
     ty_timer *timer;
     bool timer_running;
+    /* Created by the first ty_monitor_wait() call. On Linux, starting or stopping the device
+       monitor swaps the file behind its descriptor so we have to register it again. */
+    ty_reactor *reactor;
 
     _HS_ARRAY(struct callback) callbacks;
     int current_callback_id;
@@ -40,12 +45,120 @@ struct ty_monitor {
     int refresh_callback_ret;
 
     _HS_ARRAY(ty_board *) boards;
+    // Boards by location, and min-heap of missing boards ordered by missing_since
+    _hs_htable boards_index;
+    _HS_ARRAY(ty_board *) missing_boards;
     _hs_htable ifaces;
 
     ty_thread_id main_thread_id;
 };
 
 #define DROP_BOARD_DELAY 15000
+#define BOARDS_INDEX_SIZE 256
+#define IFACES_INDEX_SIZE 256
+
+static void set_missing_board(ty_monitor *monitor, size_t idx, ty_board *board)
+{
+    monitor->missing_boards.values[idx] = board;
+    board->missing_slot = idx + 1;
+}
+
+static void sift_missing_board_up(ty_monitor *monitor, size_t idx)
+{
+    ty_board *board = monitor->missing_boards.values[idx];
+
+    while (idx) {
+        size_t parent = (idx - 1) / 2;
+        ty_board *parent_board = monitor->missing_boards.values[parent];
+
+        if (parent_board->missing_since <= board->missing_since)
+            break;
+
+        set_missing_board(monitor, idx, parent_board);
+        idx = parent;
+    }
+    set_missing_board(monitor, idx, board);
+}
+
+static void sift_missing_board_down(ty_monitor *monitor, size_t idx)
+{
+    ty_board *board = monitor->missing_boards.values[idx];
+    size_t count = monitor->missing_boards.count;
+
+    for (;;) {
+        size_t child = idx * 2 + 1;
+        ty_board *child_board;
+
+        if (child >= count)
+            break;
+        if (child + 1 < count && monitor->missing_boards.values[child + 1]->missing_since <
+                                 monitor->missing_boards.values[child]->missing_since)
+            child++;
+        child_board = monitor->missing_boards.values[child];
+
+        if (board->missing_since <= child_board->missing_since)
+            break;
+
+        set_missing_board(monitor, idx, child_board);
+        idx = child;
+    }
+    set_missing_board(monitor, idx, board);
+}
+
+// Arm the timer for the board that expires first, if any
+static int update_drop_timer(ty_monitor *monitor)
+{
+    int timer_delay = -1;
+    int r;
+
+    if (monitor->missing_boards.count) {
+        ty_board *board = monitor->missing_boards.values[0];
+        timer_delay = ty_adjust_timeout(monitor->drop_delay, board->missing_since);
+    }
+
+    r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
+    if (r < 0)
+        return r;
+    monitor->timer_running = (timer_delay >= 0);
+
+    return 0;
+}
+
+static int add_missing_board(ty_monitor *monitor, ty_board *board)
+{
+    int r;
+
+    r = _hs_array_grow(&monitor->missing_boards, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    monitor->missing_boards.count++;
+    set_missing_board(monitor, monitor->missing_boards.count - 1, board);
+    sift_missing_board_up(monitor, monitor->missing_boards.count - 1);
+
+    /* missing_since only grows, so a running timer is already armed for a board that
+       expires before this one (or for one that came back, see remove_missing_board). */
+    if (!monitor->timer_running)
+        return update_drop_timer(monitor);
+
+    return 0;
+}
+
+static void remove_missing_board(ty_monitor *monitor, ty_board *board)
+{
+    size_t idx = board->missing_slot - 1;
+    ty_board *last;
+
+    board->missing_slot = 0;
+
+    last = monitor->missing_boards.values[--monitor->missing_boards.count];
+    if (last != board) {
+        set_missing_board(monitor, idx, last);
+        sift_missing_board_up(monitor, idx);
+        sift_missing_board_down(monitor, last->missing_slot - 1);
+    }
+
+    // The timer may fire for nothing, drop_expired_boards() takes care of that
+}
 
 static int change_board_status(ty_board *board, ty_board_status status, ty_monitor_event event)
 {
@@ -57,14 +170,12 @@ static int change_board_status(ty_board *board, ty_board_status status, ty_monit
         board->status = TY_BOARD_STATUS_MISSING;
         board->missing_since = ty_millis();
 
-        if (!monitor->timer_running) {
-            int timer_delay = ty_adjust_timeout(monitor->drop_delay, board->missing_since);
-            r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
-            if (r < 0)
-                return r;
-            monitor->timer_running = true;
-        }
+        r = add_missing_board(monitor, board);
+        if (r < 0)
+            return r;
     } else {
+        if (board->missing_slot)
+            remove_missing_board(monitor, board);
         board->status = status;
     }
 
@@ -126,6 +237,8 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
         r = ty_libhs_translate_error(r);
         goto error;
     }
+    _hs_htable_add(&monitor->boards_index, _hs_htable_hash_str(board->location),
+                   &board->monitor_hnode);
 
     *rboard = board;
     return 1;
@@ -172,19 +285,22 @@ static void drop_board(ty_board *board)
 
     // Remove this board from the monitor list
     board->monitor = NULL;
+    _hs_htable_remove(&board->monitor_hnode);
     for (size_t i = 0; i < monitor->boards.count; i++) {
-        if (monitor->boards.values[i] == board)
+        if (monitor->boards.values[i] == board) {
             _hs_array_remove(&monitor->boards, i, 1);
+            break;
+        }
     }
 }
 
 static ty_board *find_monitor_board(ty_monitor *monitor, const char *location)
 {
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        ty_board *board_it = monitor->boards.values[i];
+    _hs_htable_foreach_hash(cur, &monitor->boards_index, _hs_htable_hash_str(location)) {
+        ty_board *board = ty_container_of(cur, ty_board, monitor_hnode);
 
-        if (strcmp(board_it->location, location) == 0)
-            return board_it;
+        if (strcmp(board->location, location) == 0)
+            return board;
     }
 
     return NULL;
@@ -430,6 +546,22 @@ static int device_callback(hs_device *dev, void *udata)
     return 0;
 }
 
+int _ty_monitor_inject_device(ty_monitor *monitor, hs_device *dev)
+{
+    assert(monitor);
+    assert(dev);
+
+    int r;
+
+    r = device_callback(dev, monitor);
+    if (r) {
+        r = monitor->refresh_callback_ret;
+        monitor->refresh_callback_ret = 0;
+    }
+
+    return r;
+}
+
 int ty_monitor_new(ty_monitor **rmonitor)
 {
     assert(rmonitor);
@@ -449,12 +581,44 @@ int ty_monitor_new(ty_monitor **rmonitor)
         monitor->drop_delay = DROP_BOARD_DELAY;
     }
 
+    // Opt-in for now, the cache is shared by all monitors (and hs_enumerate) of the process
+    if (getenv("TYTOOLS_DEVICE_CACHE")) {
+        r = hs_enumerate_set_cache_file(getenv("TYTOOLS_DEVICE_CACHE"));
+        if (r < 0) {
+            r = ty_libhs_translate_error(r);
+            goto error;
+        }
+    }
+
     r = hs_monitor_new(_ty_class_match_specs, _ty_class_match_specs_count, &monitor->device_monitor);
     if (r < 0) {
         r = ty_libhs_translate_error(r);
         goto error;
     }
 
+    /* "kernel" reports boards sooner on Linux, see HS_MONITOR_BACKEND_KERNEL. "simulator"
+       only sees the boards simulated in-process by libhs, for tests and benchmarks. */
+    if (getenv("TYTOOLS_MONITOR_BACKEND")) {
+        const char *name = getenv("TYTOOLS_MONITOR_BACKEND");
+        int backend = -1;
+
+        if (strcmp(name, "kernel") == 0) {
+            backend = HS_MONITOR_BACKEND_KERNEL;
+        } else if (strcmp(name, "simulator") == 0) {
+            backend = HS_MONITOR_BACKEND_SIMULATOR;
+        } else if (strcmp(name, "default") != 0) {
+            ty_log(TY_LOG_WARNING, "Ignoring unknown monitor backend '%s'", name);
+        }
+
+        if (backend >= 0) {
+            r = hs_monitor_set_backend(monitor->device_monitor, (hs_monitor_backend)backend);
+            if (r < 0) {
+                r = ty_libhs_translate_error(r);
+                goto error;
+            }
+        }
+    }
+
     r = ty_timer_new(&monitor->timer);
     if (r < 0)
         goto error;
@@ -467,7 +631,10 @@ int ty_monitor_new(ty_monitor **rmonitor)
     if (r < 0)
         goto error;
 
-    r = _hs_htable_init(&monitor->ifaces, 64);
+    r = _hs_htable_init(&monitor->boards_index, BOARDS_INDEX_SIZE);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_init(&monitor->ifaces, IFACES_INDEX_SIZE);
     if (r < 0)
         goto error;
 
@@ -487,10 +654,13 @@ void ty_monitor_free(ty_monitor *monitor)
         ty_monitor_stop(monitor);
 
         _hs_array_release(&monitor->callbacks);
+        _hs_htable_release(&monitor->boards_index);
+        _hs_array_release(&monitor->missing_boards);
         _hs_htable_release(&monitor->ifaces);
 
         ty_cond_release(&monitor->refresh_cond);
         ty_mutex_release(&monitor->refresh_mutex);
+        ty_reactor_free(monitor->reactor);
         hs_monitor_free(monitor->device_monitor);
         ty_timer_free(monitor->timer);
     }
@@ -514,6 +684,9 @@ int ty_monitor_start(ty_monitor *monitor)
     }
     monitor->started = true;
 
+    ty_reactor_free(monitor->reactor);
+    monitor->reactor = NULL;
+
     r = hs_monitor_list(monitor->device_monitor, device_callback, monitor);
     if (r < 0)
         goto error;
@@ -542,9 +715,12 @@ void ty_monitor_stop(ty_monitor *monitor)
         ty_board *board_it = monitor->boards.values[i];
 
         board_it->monitor = NULL;
+        board_it->missing_slot = 0;
         ty_board_unref(board_it);
     }
     _hs_array_release(&monitor->boards);
+    _hs_htable_clear(&monitor->boards_index);
+    _hs_array_release(&monitor->missing_boards);
 
     // Clear registered interfaces
     _hs_htable_foreach(cur, &monitor->ifaces) {
@@ -556,6 +732,9 @@ void ty_monitor_stop(ty_monitor *monitor)
     }
     _hs_htable_clear(&monitor->ifaces);
 
+    ty_reactor_free(monitor->reactor);
+    monitor->reactor = NULL;
+
     monitor->started = false;
 }
 
@@ -578,7 +757,13 @@ int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *
         .f = f,
         .udata = udata
     };
-    return ty_libhs_translate_error(_hs_array_push(&monitor->callbacks, callback));
+    int r;
+
+    r = _hs_array_push(&monitor->callbacks, callback);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    return callback.id;
 }
 
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
@@ -594,35 +779,36 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
     }
 }
 
+static int drop_expired_boards(ty_monitor *monitor)
+{
+    while (monitor->missing_boards.count) {
+        ty_board *board = monitor->missing_boards.values[0];
+        int board_timeout = ty_adjust_timeout(monitor->drop_delay, board->missing_since);
+
+        /* Drop boards that are about to expire (< 20 ms) to deal with limited timer
+           resolution (e.g. TickCount64() on Windows). */
+        if (board_timeout >= 20)
+            break;
+
+        drop_board(board);
+        ty_board_unref(board);
+    }
+
+    return update_drop_timer(monitor);
+}
+
 int ty_monitor_refresh(ty_monitor *monitor)
 {
     assert(monitor);
 
     int r;
 
-    if (ty_timer_rearm(monitor->timer)) {
-        int timer_delay = -1;
-
-        for (size_t i = 0; i < monitor->boards.count; i++) {
-            ty_board *board_it = monitor->boards.values[i];
-
-            if (board_it->status == TY_BOARD_STATUS_MISSING) {
-                int board_timeout = ty_adjust_timeout(monitor->drop_delay, board_it->missing_since);
-                /* Drop boards that are about to expire (< 20 ms) to deal with limited timer
-                   resolution (e.g. TickCount64() on Windows). */
-                if (board_timeout < 20) {
-                    drop_board(board_it);
-                    ty_board_unref(board_it);
-                } else if (board_timeout < timer_delay || timer_delay == -1) {
-                    timer_delay = board_timeout;
-                }
-            }
-        }
+    ty_trace_begin("monitor_refresh");
 
-        r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
+    if (ty_timer_rearm(monitor->timer)) {
+        r = drop_expired_boards(monitor);
         if (r < 0)
-            return r;
-        monitor->timer_running = (timer_delay >= 0);
+            goto cleanup;
     }
 
     r = hs_monitor_refresh(monitor->device_monitor, device_callback, monitor);
@@ -632,17 +818,21 @@ int ty_monitor_refresh(ty_monitor *monitor)
         if (monitor->refresh_callback_ret) {
             r = monitor->refresh_callback_ret;
             monitor->refresh_callback_ret = 0;
-            return r;
+            goto cleanup;
         }
 
-        return ty_libhs_translate_error(r);
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
     }
 
     ty_mutex_lock(&monitor->refresh_mutex);
     ty_cond_broadcast(&monitor->refresh_cond);
     ty_mutex_unlock(&monitor->refresh_mutex);
 
-    return 0;
+    r = 0;
+cleanup:
+    ty_trace_end();
+    return r;
 }
 
 int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
@@ -650,7 +840,6 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
     assert(monitor);
     assert(f || (monitor->main_thread_id == ty_thread_get_self_id()));
 
-    ty_descriptor_set set = {0};
     uint64_t start;
     int r;
 
@@ -667,7 +856,21 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
 
         return r;
     } else {
-        ty_monitor_get_descriptors(monitor, &set, 1);
+        if (!monitor->reactor) {
+            ty_descriptor_set set = {0};
+
+            r = ty_reactor_new(&monitor->reactor);
+            if (r < 0)
+                return r;
+
+            ty_monitor_get_descriptors(monitor, &set, 1);
+            r = ty_reactor_add_set(monitor->reactor, &set);
+            if (r < 0) {
+                ty_reactor_free(monitor->reactor);
+                monitor->reactor = NULL;
+                return r;
+            }
+        }
 
         do {
             r = ty_monitor_refresh(monitor);
@@ -680,7 +883,7 @@ int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, i
                     return r;
             }
 
-            r = ty_poll(&set, ty_adjust_timeout(timeout, start));
+            r = ty_reactor_wait(monitor->reactor, ty_adjust_timeout(timeout, start));
         } while (r > 0);
         return r;
     }
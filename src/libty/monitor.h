@@ -16,6 +16,7 @@
 TY_C_BEGIN
 
 struct ty_board;
+struct ty_descriptor_set;
 
 typedef struct ty_monitor ty_monitor;
 
@@ -37,6 +38,7 @@ void ty_monitor_stop(ty_monitor *monitor);
 
 void ty_monitor_get_descriptors(const ty_monitor *monitor, struct ty_descriptor_set *set, int id);
 
+// Returns the callback id, to use with ty_monitor_deregister_callback()
 int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id);
 
@@ -0,0 +1,42 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_REACTOR_H
+#define TY_REACTOR_H
+
+#include "common.h"
+#include "system.h"
+
+TY_C_BEGIN
+
+/* Persistent set of descriptors to wait on, unlike ty_poll() the descriptors are registered
+   once and the kernel keeps track of them between calls (epoll on Linux). Descriptors must
+   stay open while they are registered. Several descriptors can share the same id.
+
+   There is no limit on the number of descriptors, except on Windows where
+   WaitForMultipleObjects() cannot wait on more than 64 handles. */
+typedef struct ty_reactor ty_reactor;
+
+int ty_reactor_new(ty_reactor **rreactor);
+void ty_reactor_free(ty_reactor *reactor);
+
+int ty_reactor_add(ty_reactor *reactor, ty_descriptor desc, int id);
+int ty_reactor_add_set(ty_reactor *reactor, const ty_descriptor_set *set);
+void ty_reactor_remove(ty_reactor *reactor, int id);
+void ty_reactor_clear(ty_reactor *reactor);
+
+unsigned int ty_reactor_get_count(const ty_reactor *reactor);
+
+// Returns the id of a ready descriptor, 0 on timeout
+int ty_reactor_wait(ty_reactor *reactor, int timeout);
+
+TY_C_END
+
+#endif
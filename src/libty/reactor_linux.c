@@ -0,0 +1,206 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "../libhs/array.h"
+#include "reactor.h"
+
+struct registration {
+    int fd;
+    int id;
+    // Regular files cannot be used with epoll, poll() reports them as always ready
+    bool always_ready;
+};
+
+struct ty_reactor {
+    int epfd;
+    _HS_ARRAY(struct registration) registrations;
+    unsigned int always_ready_count;
+};
+
+int ty_reactor_new(ty_reactor **rreactor)
+{
+    assert(rreactor);
+
+    ty_reactor *reactor;
+    int r;
+
+    reactor = calloc(1, sizeof(*reactor));
+    if (!reactor) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epfd < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    *rreactor = reactor;
+    return 0;
+
+error:
+    ty_reactor_free(reactor);
+    return r;
+}
+
+void ty_reactor_free(ty_reactor *reactor)
+{
+    if (reactor) {
+        if (reactor->epfd >= 0)
+            close(reactor->epfd);
+        _hs_array_release(&reactor->registrations);
+    }
+
+    free(reactor);
+}
+
+int ty_reactor_add(ty_reactor *reactor, ty_descriptor desc, int id)
+{
+    assert(reactor);
+    assert(desc >= 0);
+    assert(id > 0);
+
+    struct epoll_event ev = {0};
+    struct registration reg = {0};
+    int r;
+
+    r = _hs_array_grow(&reactor->registrations, 1);
+    if (r < 0)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = (uint32_t)id;
+
+    r = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, desc, &ev);
+    if (r < 0) {
+        switch (errno) {
+            case EPERM: {
+                reg.always_ready = true;
+                reactor->always_ready_count++;
+            } break;
+            case EEXIST: {
+                return ty_error(TY_ERROR_EXISTS, "Descriptor %d is already registered", desc);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "epoll_ctl(EPOLL_CTL_ADD) failed: %s",
+                                strerror(errno));
+            } break;
+        }
+    }
+
+    reg.fd = desc;
+    reg.id = id;
+    reactor->registrations.values[reactor->registrations.count++] = reg;
+
+    return 0;
+}
+
+int ty_reactor_add_set(ty_reactor *reactor, const ty_descriptor_set *set)
+{
+    assert(reactor);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_reactor_add(reactor, set->desc[i], set->id[i]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+void ty_reactor_remove(ty_reactor *reactor, int id)
+{
+    assert(reactor);
+
+    size_t count = 0;
+    for (size_t i = 0; i < reactor->registrations.count; i++) {
+        struct registration *reg = &reactor->registrations.values[i];
+
+        if (reg->id == id) {
+            /* The kernel drops closed descriptors by itself, and the descriptor number may
+               have been reused since then, so ignore errors. */
+            if (reg->always_ready) {
+                reactor->always_ready_count--;
+            } else {
+                epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, reg->fd, NULL);
+            }
+        } else {
+            reactor->registrations.values[count++] = *reg;
+        }
+    }
+
+    reactor->registrations.count = count;
+}
+
+void ty_reactor_clear(ty_reactor *reactor)
+{
+    assert(reactor);
+
+    for (size_t i = 0; i < reactor->registrations.count; i++) {
+        const struct registration *reg = &reactor->registrations.values[i];
+
+        if (!reg->always_ready)
+            epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, reg->fd, NULL);
+    }
+    reactor->registrations.count = 0;
+    reactor->always_ready_count = 0;
+}
+
+unsigned int ty_reactor_get_count(const ty_reactor *reactor)
+{
+    assert(reactor);
+    return (unsigned int)reactor->registrations.count;
+}
+
+int ty_reactor_wait(ty_reactor *reactor, int timeout)
+{
+    assert(reactor);
+    assert(reactor->registrations.count);
+
+    struct epoll_event ev;
+    uint64_t start;
+    int r;
+
+    // Don't block if a regular file is registered, but give priority to the other descriptors
+    if (reactor->always_ready_count)
+        timeout = 0;
+
+    /* One event at a time, the caller may remove descriptors or drain several of them
+       before the next call. The kernel rotates its ready list, so a busy descriptor
+       cannot starve the others. */
+    start = ty_millis();
+restart:
+    r = epoll_wait(reactor->epfd, &ev, 1, ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "epoll_wait() failed: %s", strerror(errno));
+    }
+    if (r)
+        return (int)ev.data.u32;
+
+    if (reactor->always_ready_count) {
+        for (size_t i = 0; i < reactor->registrations.count; i++) {
+            const struct registration *reg = &reactor->registrations.values[i];
+
+            if (reg->always_ready)
+                return reg->id;
+        }
+    }
+
+    return 0;
+}
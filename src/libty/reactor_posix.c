@@ -0,0 +1,257 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#ifdef __APPLE__
+    #include <sys/select.h>
+#else
+    #include <poll.h>
+#endif
+#include "../libhs/array.h"
+#include "reactor.h"
+
+/* Same as ty_poll(), select() on macOS because poll() does not work with devices there,
+   poll() elsewhere. The descriptor arrays are kept between calls and grow as needed. */
+
+struct ty_reactor {
+#ifdef __APPLE__
+    fd_set fds;
+    int max_fd;
+    _HS_ARRAY(int) descs;
+#else
+    _HS_ARRAY(struct pollfd) pfds;
+#endif
+    _HS_ARRAY(int) ids;
+
+    // Start the scan where the last one stopped, so that a busy descriptor does not starve the others
+    size_t next;
+};
+
+int ty_reactor_new(ty_reactor **rreactor)
+{
+    assert(rreactor);
+
+    ty_reactor *reactor;
+
+    reactor = calloc(1, sizeof(*reactor));
+    if (!reactor)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+#ifdef __APPLE__
+    FD_ZERO(&reactor->fds);
+    reactor->max_fd = -1;
+#endif
+
+    *rreactor = reactor;
+    return 0;
+}
+
+void ty_reactor_free(ty_reactor *reactor)
+{
+    if (reactor) {
+#ifdef __APPLE__
+        _hs_array_release(&reactor->descs);
+#else
+        _hs_array_release(&reactor->pfds);
+#endif
+        _hs_array_release(&reactor->ids);
+    }
+
+    free(reactor);
+}
+
+int ty_reactor_add(ty_reactor *reactor, ty_descriptor desc, int id)
+{
+    assert(reactor);
+    assert(desc >= 0);
+    assert(id > 0);
+
+    int r;
+
+#ifdef __APPLE__
+    if (desc >= FD_SETSIZE)
+        return ty_error(TY_ERROR_RANGE, "Descriptor %d is too high for select()", desc);
+#endif
+
+    // Grow the id array first, so we don't have to undo anything if that fails
+    r = _hs_array_grow(&reactor->ids, 1);
+    if (r < 0)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+#ifdef __APPLE__
+    r = _hs_array_push(&reactor->descs, desc);
+    if (r < 0)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    FD_SET(desc, &reactor->fds);
+    reactor->max_fd = TY_MAX(reactor->max_fd, desc);
+#else
+    struct pollfd pfd = {0};
+
+    pfd.fd = desc;
+    pfd.events = POLLIN;
+
+    r = _hs_array_push(&reactor->pfds, pfd);
+    if (r < 0)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+#endif
+    reactor->ids.values[reactor->ids.count++] = id;
+
+    return 0;
+}
+
+int ty_reactor_add_set(ty_reactor *reactor, const ty_descriptor_set *set)
+{
+    assert(reactor);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_reactor_add(reactor, set->desc[i], set->id[i]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+void ty_reactor_remove(ty_reactor *reactor, int id)
+{
+    assert(reactor);
+
+    size_t count = 0;
+    for (size_t i = 0; i < reactor->ids.count; i++) {
+        if (reactor->ids.values[i] != id) {
+#ifdef __APPLE__
+            reactor->descs.values[count] = reactor->descs.values[i];
+#else
+            reactor->pfds.values[count] = reactor->pfds.values[i];
+#endif
+            reactor->ids.values[count] = reactor->ids.values[i];
+            count++;
+        }
+    }
+#ifdef __APPLE__
+    reactor->descs.count = count;
+#else
+    reactor->pfds.count = count;
+#endif
+    reactor->ids.count = count;
+    reactor->next = 0;
+
+#ifdef __APPLE__
+    FD_ZERO(&reactor->fds);
+    reactor->max_fd = -1;
+    for (size_t i = 0; i < reactor->descs.count; i++) {
+        FD_SET(reactor->descs.values[i], &reactor->fds);
+        reactor->max_fd = TY_MAX(reactor->max_fd, reactor->descs.values[i]);
+    }
+#endif
+}
+
+void ty_reactor_clear(ty_reactor *reactor)
+{
+    assert(reactor);
+
+#ifdef __APPLE__
+    FD_ZERO(&reactor->fds);
+    reactor->max_fd = -1;
+    reactor->descs.count = 0;
+#else
+    reactor->pfds.count = 0;
+#endif
+    reactor->ids.count = 0;
+    reactor->next = 0;
+}
+
+unsigned int ty_reactor_get_count(const ty_reactor *reactor)
+{
+    assert(reactor);
+    return (unsigned int)reactor->ids.count;
+}
+
+#ifdef __APPLE__
+
+int ty_reactor_wait(ty_reactor *reactor, int timeout)
+{
+    assert(reactor);
+    assert(reactor->ids.count);
+
+    fd_set fds;
+    uint64_t start;
+    struct timeval tv;
+    int r;
+
+    start = ty_millis();
+restart:
+    fds = reactor->fds;
+    if (timeout >= 0) {
+        int adjusted_timeout = ty_adjust_timeout(timeout, start);
+        tv.tv_sec = adjusted_timeout / 1000;
+        tv.tv_usec = (adjusted_timeout % 1000) * 1000;
+        r = select(reactor->max_fd + 1, &fds, NULL, NULL, &tv);
+    } else {
+        r = select(reactor->max_fd + 1, &fds, NULL, NULL, NULL);
+    }
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "select() failed: %s", strerror(errno));
+    }
+    if (!r)
+        return 0;
+
+    for (size_t i = 0; i < reactor->ids.count; i++) {
+        size_t idx = (reactor->next + i) % reactor->ids.count;
+
+        if (FD_ISSET(reactor->descs.values[idx], &fds)) {
+            reactor->next = idx + 1;
+            return reactor->ids.values[idx];
+        }
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+#else
+
+int ty_reactor_wait(ty_reactor *reactor, int timeout)
+{
+    assert(reactor);
+    assert(reactor->ids.count);
+
+    uint64_t start;
+    int r;
+
+    start = ty_millis();
+restart:
+    r = poll(reactor->pfds.values, (nfds_t)reactor->pfds.count, ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        return ty_error(TY_ERROR_SYSTEM, "poll() failed: %s", strerror(errno));
+    }
+    if (!r)
+        return 0;
+
+    for (size_t i = 0; i < reactor->ids.count; i++) {
+        size_t idx = (reactor->next + i) % reactor->ids.count;
+
+        if (reactor->pfds.values[idx].revents & (POLLIN | POLLERR | POLLHUP | POLLNVAL)) {
+            reactor->next = idx + 1;
+            return reactor->ids.values[idx];
+        }
+    }
+
+    assert(false);
+    __builtin_unreachable();
+}
+
+#endif
@@ -0,0 +1,135 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include "reactor.h"
+
+struct ty_reactor {
+    unsigned int count;
+    /* The handles are stored twice in a row, waiting on the window that starts after the last
+       signaled handle keeps a busy handle from starving the others. */
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS * 2];
+    int ids[MAXIMUM_WAIT_OBJECTS];
+
+    unsigned int next;
+};
+
+int ty_reactor_new(ty_reactor **rreactor)
+{
+    assert(rreactor);
+
+    ty_reactor *reactor;
+
+    reactor = calloc(1, sizeof(*reactor));
+    if (!reactor)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    *rreactor = reactor;
+    return 0;
+}
+
+void ty_reactor_free(ty_reactor *reactor)
+{
+    free(reactor);
+}
+
+static void update_handles(ty_reactor *reactor)
+{
+    memcpy(reactor->handles + reactor->count, reactor->handles,
+           reactor->count * sizeof(*reactor->handles));
+    reactor->next = 0;
+}
+
+int ty_reactor_add(ty_reactor *reactor, ty_descriptor desc, int id)
+{
+    assert(reactor);
+    assert(desc);
+    assert(id > 0);
+
+    if (reactor->count == MAXIMUM_WAIT_OBJECTS)
+        return ty_error(TY_ERROR_RANGE, "Cannot wait on more than %d handles",
+                        MAXIMUM_WAIT_OBJECTS);
+
+    reactor->handles[reactor->count] = desc;
+    reactor->ids[reactor->count] = id;
+    reactor->count++;
+    update_handles(reactor);
+
+    return 0;
+}
+
+int ty_reactor_add_set(ty_reactor *reactor, const ty_descriptor_set *set)
+{
+    assert(reactor);
+    assert(set);
+
+    for (unsigned int i = 0; i < set->count; i++) {
+        int r = ty_reactor_add(reactor, set->desc[i], set->id[i]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+void ty_reactor_remove(ty_reactor *reactor, int id)
+{
+    assert(reactor);
+
+    unsigned int count = 0;
+    for (unsigned int i = 0; i < reactor->count; i++) {
+        if (reactor->ids[i] != id) {
+            reactor->handles[count] = reactor->handles[i];
+            reactor->ids[count] = reactor->ids[i];
+            count++;
+        }
+    }
+    reactor->count = count;
+    update_handles(reactor);
+}
+
+void ty_reactor_clear(ty_reactor *reactor)
+{
+    assert(reactor);
+
+    reactor->count = 0;
+    reactor->next = 0;
+}
+
+unsigned int ty_reactor_get_count(const ty_reactor *reactor)
+{
+    assert(reactor);
+    return reactor->count;
+}
+
+int ty_reactor_wait(ty_reactor *reactor, int timeout)
+{
+    assert(reactor);
+    assert(reactor->count);
+
+    DWORD ret = WaitForMultipleObjects((DWORD)reactor->count, reactor->handles + reactor->next,
+                                       FALSE, timeout < 0 ? INFINITE : (DWORD)timeout);
+    switch (ret) {
+        case WAIT_FAILED: {
+            return ty_error(TY_ERROR_SYSTEM, "WaitForMultipleObjects() failed: %s",
+                            ty_win32_strerror(0));
+        } break;
+        case WAIT_TIMEOUT: {
+            return 0;
+        } break;
+    }
+
+    unsigned int idx = (reactor->next + (unsigned int)(ret - WAIT_OBJECT_0)) % reactor->count;
+    reactor->next = (idx + 1) % reactor->count;
+
+    return reactor->ids[idx];
+}
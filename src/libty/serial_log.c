@@ -0,0 +1,420 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <errno.h>
+#include "../libhs/array.h"
+#include "serial_log.h"
+
+struct segment {
+    uint64_t start;
+    uint64_t size;
+};
+
+struct ty_serial_log {
+    char *filename;
+    FILE *fp;
+
+    bool indexed;
+    // Old data first, then the most recent data
+    struct segment segments[2];
+    unsigned int segments_count;
+    uint64_t size;
+
+    // Sorted by offset, the first one is always the start of the data
+    _HS_ARRAY(ty_serial_log_position) positions;
+};
+
+#ifdef _WIN32
+    #define fseek64 _fseeki64
+    #define ftell64 _ftelli64
+#else
+    #define fseek64 fseeko
+    #define ftell64 ftello
+#endif
+
+static int read_file(ty_serial_log *log, uint64_t offset, void *buf, size_t size,
+                     size_t *rlen)
+{
+    if (fseek64(log->fp, (int64_t)offset, SEEK_SET) < 0)
+        return ty_error(TY_ERROR_IO, "I/O error while reading '%s'", log->filename);
+
+    *rlen = fread(buf, 1, size, log->fp);
+    if (ferror(log->fp))
+        return ty_error(TY_ERROR_IO, "I/O error while reading '%s'", log->filename);
+
+    return 0;
+}
+
+static int count_lines(ty_serial_log *log, uint64_t start, uint64_t end, uint64_t *rcount)
+{
+    char buf[65536];
+    uint64_t count = 0;
+
+    while (start < end) {
+        ssize_t r = ty_serial_log_read(log, start, buf,
+                                       (size_t)TY_MIN(end - start, sizeof(buf)));
+        if (r < 0)
+            return (int)r;
+        if (!r)
+            break;
+
+        for (const char *ptr = buf; (ptr = memchr(ptr, '\n', (size_t)(buf + r - ptr))); ptr++)
+            count++;
+        start += (uint64_t)r;
+    }
+
+    *rcount = count;
+    return 0;
+}
+
+// Logs written before the index existed, the delimiter tells where the oldest data starts
+static int find_delimiter(ty_serial_log *log, uint64_t file_size)
+{
+    const size_t delimiter_len = strlen(TY_SERIAL_LOG_DELIMITER);
+    char buf[65536];
+    uint64_t offset = 0;
+
+    while (offset < file_size) {
+        size_t len;
+        int r;
+
+        r = read_file(log, offset, buf, sizeof(buf), &len);
+        if (r < 0)
+            return r;
+        if (len < delimiter_len)
+            break;
+
+        for (const char *ptr = buf; (ptr = memchr(ptr, '\n', (size_t)(buf + len - ptr))); ptr++) {
+            if ((size_t)(buf + len - ptr) < delimiter_len)
+                break;
+
+            if (!memcmp(ptr, TY_SERIAL_LOG_DELIMITER, delimiter_len)) {
+                uint64_t pos = offset + (uint64_t)(ptr - buf);
+
+                log->segments[0].start = pos + delimiter_len;
+                log->segments[0].size = file_size - log->segments[0].start;
+                log->segments[1].start = 0;
+                log->segments[1].size = pos;
+                log->segments_count = 2;
+
+                return 1;
+            }
+        }
+
+        // Overlap the chunks so that we don't miss a delimiter split between them
+        offset += len - delimiter_len + 1;
+    }
+
+    return 0;
+}
+
+static int load_index(ty_serial_log *log, FILE *fp, uint64_t file_size)
+{
+    ty_serial_log_index_header header;
+    ty_serial_log_index_entry *entries = NULL;
+    int r;
+
+    if (fread(&header, 1, sizeof(header), fp) != sizeof(header) ||
+            memcmp(header.magic, TY_SERIAL_LOG_INDEX_MAGIC, sizeof(header.magic)) ||
+            header.version != TY_SERIAL_LOG_INDEX_VERSION) {
+        r = ty_error(TY_ERROR_PARSE, "Invalid index for serial log '%s'", log->filename);
+        goto cleanup;
+    }
+
+    // The writer may be ahead of us, or the file may have been truncated behind its back
+    header.write_offset = TY_MIN(header.write_offset, file_size);
+    header.old_end = TY_MIN(header.old_end, file_size);
+    header.old_offset = TY_MIN(header.old_offset, header.old_end);
+
+    log->segments[0].start = header.old_offset;
+    log->segments[0].size = header.old_end - header.old_offset;
+    log->segments[1].start = 0;
+    log->segments[1].size = header.write_offset;
+    log->segments_count = 2;
+    log->size = log->segments[0].size + log->segments[1].size;
+
+    if (header.capacity) {
+        entries = malloc(header.capacity * sizeof(*entries));
+        if (!entries) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        // Slots beyond the end of a short index are simply missing
+        header.capacity = (uint32_t)fread(entries, sizeof(*entries), header.capacity, fp);
+    }
+
+    for (uint32_t i = 0; i < header.capacity; i++) {
+        const ty_serial_log_index_entry *entry = &entries[i];
+        ty_serial_log_position pos;
+
+        if (!entry->generation) {
+            continue;
+        } else if (entry->generation == header.generation &&
+                   entry->offset < header.write_offset) {
+            pos.offset = log->segments[0].size + entry->offset;
+        } else if (entry->generation + 1 == header.generation &&
+                   entry->offset >= header.old_offset && entry->offset < header.old_end) {
+            pos.offset = entry->offset - header.old_offset;
+        } else {
+            continue;
+        }
+        pos.line = entry->line;
+        pos.time = entry->time;
+
+        r = _hs_array_grow(&log->positions, 1);
+        if (r < 0) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        log->positions.values[log->positions.count++] = pos;
+    }
+
+    r = 0;
+cleanup:
+    free(entries);
+    return r;
+}
+
+static int compare_positions(const void *a, const void *b)
+{
+    const ty_serial_log_position *pos1 = a;
+    const ty_serial_log_position *pos2 = b;
+
+    return (pos1->offset > pos2->offset) - (pos1->offset < pos2->offset);
+}
+
+int ty_serial_log_open(const char *filename, ty_serial_log **rlog)
+{
+    assert(filename);
+    assert(rlog);
+
+    ty_serial_log *log;
+    char *index_filename = NULL;
+    FILE *index_fp = NULL;
+    uint64_t file_size;
+    int r;
+
+    log = calloc(1, sizeof(*log));
+    if (!log) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    log->filename = strdup(filename);
+    if (!log->filename) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    log->fp = fopen(filename, "rb");
+    if (!log->fp) {
+        switch (errno) {
+            case EACCES: {
+                r = ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case EIO: {
+                r = ty_error(TY_ERROR_IO, "I/O error while opening '%s' for reading", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                r = ty_error(TY_ERROR_NOT_FOUND, "File '%s' does not exist", filename);
+            } break;
+
+            default: {
+                r = ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename, strerror(errno));
+            } break;
+        }
+        goto error;
+    }
+    if (fseek64(log->fp, 0, SEEK_END) < 0) {
+        r = ty_error(TY_ERROR_IO, "I/O error while reading '%s'", filename);
+        goto error;
+    }
+    file_size = (uint64_t)ftell64(log->fp);
+
+    r = asprintf(&index_filename, "%s%s", filename, TY_SERIAL_LOG_INDEX_SUFFIX);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    index_fp = fopen(index_filename, "rb");
+
+    if (index_fp) {
+        r = load_index(log, index_fp, file_size);
+        if (r < 0)
+            goto error;
+        log->indexed = true;
+    } else {
+        r = find_delimiter(log, file_size);
+        if (r < 0)
+            goto error;
+        if (!r) {
+            log->segments[0].start = 0;
+            log->segments[0].size = file_size;
+            log->segments_count = 1;
+        }
+        log->size = log->segments[0].size + log->segments[1].size;
+    }
+
+    qsort(log->positions.values, log->positions.count, sizeof(*log->positions.values),
+          compare_positions);
+
+    // Number the lines that precede the first indexed position
+    {
+        ty_serial_log_position start = {0, 0, -1};
+
+        if (log->positions.count) {
+            uint64_t count;
+
+            r = count_lines(log, 0, log->positions.values[0].offset, &count);
+            if (r < 0)
+                goto error;
+            start.line = log->positions.values[0].line - TY_MIN(count, log->positions.values[0].line);
+        }
+
+        if (!log->positions.count || log->positions.values[0].offset) {
+            r = _hs_array_grow(&log->positions, 1);
+            if (r < 0) {
+                r = ty_error(TY_ERROR_MEMORY, NULL);
+                goto error;
+            }
+            memmove(log->positions.values + 1, log->positions.values,
+                    log->positions.count * sizeof(*log->positions.values));
+            log->positions.values[0] = start;
+            log->positions.count++;
+        }
+    }
+
+    if (index_fp)
+        fclose(index_fp);
+    free(index_filename);
+
+    *rlog = log;
+    return 0;
+
+error:
+    if (index_fp)
+        fclose(index_fp);
+    free(index_filename);
+    ty_serial_log_close(log);
+    return r;
+}
+
+void ty_serial_log_close(ty_serial_log *log)
+{
+    if (!log)
+        return;
+
+    if (log->fp)
+        fclose(log->fp);
+    _hs_array_release(&log->positions);
+    free(log->filename);
+
+    free(log);
+}
+
+const char *ty_serial_log_get_filename(const ty_serial_log *log)
+{
+    assert(log);
+    return log->filename;
+}
+
+bool ty_serial_log_is_indexed(const ty_serial_log *log)
+{
+    assert(log);
+    return log->indexed;
+}
+
+uint64_t ty_serial_log_get_size(const ty_serial_log *log)
+{
+    assert(log);
+    return log->size;
+}
+
+unsigned int ty_serial_log_get_positions(const ty_serial_log *log,
+                                         const ty_serial_log_position **rpositions)
+{
+    assert(log);
+    assert(rpositions);
+
+    *rpositions = log->positions.values;
+    return (unsigned int)log->positions.count;
+}
+
+// Index of the last position whose key is at or before the target
+#define FIND_POSITION(Log, Key, Target) \
+    do { \
+        size_t start = 0, end = (Log)->positions.count; \
+        \
+        while (end - start > 1) { \
+            size_t mid = start + (end - start) / 2; \
+            \
+            if ((Log)->positions.values[mid].Key <= (Target)) { \
+                start = mid; \
+            } else { \
+                end = mid; \
+            } \
+        } \
+        \
+        *rpos = (Log)->positions.values[start]; \
+    } while (false)
+
+/* Times come from the wall clock of the writer, assume they increase with the offsets
+   (a clock adjusted backwards only makes the seek less precise). */
+int ty_serial_log_seek_time(ty_serial_log *log, int64_t time, ty_serial_log_position *rpos)
+{
+    assert(log);
+    assert(rpos);
+
+    FIND_POSITION(log, time, time);
+    return 0;
+}
+
+int ty_serial_log_seek_line(ty_serial_log *log, uint64_t line, ty_serial_log_position *rpos)
+{
+    assert(log);
+    assert(rpos);
+
+    FIND_POSITION(log, line, line);
+    return 0;
+}
+
+#undef FIND_POSITION
+
+ssize_t ty_serial_log_read(ty_serial_log *log, uint64_t offset, char *buf, size_t size)
+{
+    assert(log);
+    assert(buf || !size);
+
+    size_t total = 0;
+
+    for (unsigned int i = 0; i < log->segments_count && total < size; i++) {
+        const struct segment *segment = &log->segments[i];
+        size_t part_size, len;
+        int r;
+
+        if (offset >= segment->size) {
+            offset -= segment->size;
+            continue;
+        }
+
+        part_size = (size_t)TY_MIN(segment->size - offset, size - total);
+        r = read_file(log, segment->start + offset, buf + total, part_size, &len);
+        if (r < 0)
+            return r;
+        total += len;
+        // Truncated file, don't glue the next segment to the wrong place
+        if (len < part_size)
+            break;
+        offset = 0;
+    }
+
+    return (ssize_t)total;
+}
@@ -0,0 +1,93 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_SERIAL_LOG_H
+#define TY_SERIAL_LOG_H
+
+#include "common.h"
+#include <sys/types.h>
+
+TY_C_BEGIN
+
+/* Serial logs are circular text files: once the maximum size is reached, writing wraps
+   around to the beginning and TY_SERIAL_LOG_DELIMITER marks the end of the most recent data.
+   An index file (same name with TY_SERIAL_LOG_INDEX_SUFFIX appended) describes where the
+   valid data is, and contains a sparse set of entries mapping line starts to line numbers
+   and wall clock times. Entries are stored in a fixed number of slots, reused in a circular
+   way, so the index does not grow with the log either. All integers use the native byte
+   order of the writer. */
+
+#define TY_SERIAL_LOG_DELIMITER "\n@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
+#define TY_SERIAL_LOG_INDEX_SUFFIX ".idx"
+#define TY_SERIAL_LOG_INDEX_MAGIC "TYLOGIDX"
+#define TY_SERIAL_LOG_INDEX_VERSION 1
+
+typedef struct ty_serial_log_index_header {
+    char magic[8];
+    uint32_t version;
+    // Number of entry slots following the header
+    uint32_t capacity;
+    // Incremented each time writing wraps around, starts at 1
+    uint32_t generation;
+    uint32_t reserved;
+    // Slot of the next entry, modulo capacity
+    uint64_t next_slot;
+
+    // Data of the current generation lies in [0, write_offset), data of the previous
+    // generation lies in [old_offset, old_end)
+    uint64_t write_offset;
+    uint64_t old_offset;
+    uint64_t old_end;
+    // Number of lines ended before write_offset, since the log was created
+    uint64_t lines;
+} ty_serial_log_index_header;
+
+typedef struct ty_serial_log_index_entry {
+    // Generation of the data at offset, or 0 for unused slots
+    uint32_t generation;
+    uint32_t reserved;
+    // Offset of a line start in the log file
+    uint64_t offset;
+    // Number of that line since the log was created (zero-based)
+    uint64_t line;
+    // Time at which the line was received, in milliseconds since the Unix epoch
+    int64_t time;
+} ty_serial_log_index_entry;
+
+typedef struct ty_serial_log ty_serial_log;
+
+typedef struct ty_serial_log_position {
+    // Offset in the log data, from the oldest byte still available
+    uint64_t offset;
+    uint64_t line;
+    // Only valid for indexed positions, -1 otherwise
+    int64_t time;
+} ty_serial_log_position;
+
+int ty_serial_log_open(const char *filename, ty_serial_log **rlog);
+void ty_serial_log_close(ty_serial_log *log);
+
+const char *ty_serial_log_get_filename(const ty_serial_log *log);
+bool ty_serial_log_is_indexed(const ty_serial_log *log);
+// Size of the valid data, in chronological order, without the delimiter
+uint64_t ty_serial_log_get_size(const ty_serial_log *log);
+unsigned int ty_serial_log_get_positions(const ty_serial_log *log,
+                                         const ty_serial_log_position **rpositions);
+
+/* Both functions give the last indexed position at or before the target, or the start of
+   the data when there is none. Read and count lines from there to reach the exact place. */
+int ty_serial_log_seek_time(ty_serial_log *log, int64_t time, ty_serial_log_position *rpos);
+int ty_serial_log_seek_line(ty_serial_log *log, uint64_t line, ty_serial_log_position *rpos);
+
+ssize_t ty_serial_log_read(ty_serial_log *log, uint64_t offset, char *buf, size_t size);
+
+TY_C_END
+
+#endif
@@ -63,6 +63,10 @@ char *ty_win32_strerror(unsigned long err);
 #endif
 
 uint64_t ty_millis(void);
+// Monotonic time in microseconds, meant for fine measurements such as traces
+uint64_t ty_micros(void);
+// Wall clock time in milliseconds since the Unix epoch, unlike ty_millis() it can jump
+int64_t ty_unix_millis(void);
 void ty_delay(unsigned int ms);
 
 int ty_adjust_timeout(int timeout, uint64_t start);
@@ -84,6 +88,8 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
 int ty_poll(const ty_descriptor_set *set, int timeout);
 
 bool ty_compare_paths(const char *path1, const char *path2);
+// Calls f for each entry in the directory, stops early if f returns non-zero
+int ty_list_directory(const char *path, int (*f)(const char *name, void *udata), void *udata);
 
 int ty_terminal_setup(int flags);
 void ty_terminal_restore(void);
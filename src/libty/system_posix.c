@@ -9,9 +9,11 @@
    See the LICENSE file for more details. */
 
 #include "common_priv.h"
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
@@ -44,6 +46,15 @@ uint64_t ty_millis(void)
     return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000000;
 }
 
+uint64_t ty_micros(void)
+{
+    static mach_timebase_info_data_t tb;
+    if (!tb.numer)
+        mach_timebase_info(&tb);
+
+    return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000;
+}
+
 #else
 
 uint64_t ty_millis(void)
@@ -61,11 +72,38 @@ uint64_t ty_millis(void)
         return 0;
     }
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t ty_micros(void)
+{
+    struct timespec ts;
+    int r;
+
+#ifdef CLOCK_MONOTONIC_RAW
+    r = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    r = clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    if (r < 0) {
+        ty_log(TY_LOG_WARNING, "clock_gettime() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
 #endif
 
+int64_t ty_unix_millis(void)
+{
+    struct timeval tv;
+
+    // Available everywhere, unlike clock_gettime(CLOCK_REALTIME) on older macOS versions
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 void ty_delay(unsigned int ms)
 {
     struct timespec t, rem;
@@ -372,6 +410,48 @@ bool ty_compare_paths(const char *path1, const char *path2)
     return sb1.st_dev == sb2.st_dev && sb1.st_ino == sb2.st_ino;
 }
 
+int ty_list_directory(const char *path, int (*f)(const char *name, void *udata), void *udata)
+{
+    assert(path);
+    assert(f);
+
+    DIR *dp;
+    struct dirent *dent;
+    int r;
+
+    dp = opendir(path);
+    if (!dp) {
+        switch (errno) {
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", path);
+            } break;
+            case ENOENT: {
+                return ty_error(TY_ERROR_NOT_FOUND, "Directory '%s' does not exist", path);
+            } break;
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_MODE, "Path '%s' is not a directory", path);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "opendir('%s') failed: %s", path, strerror(errno));
+            } break;
+        }
+    }
+
+    r = 0;
+    while ((dent = readdir(dp))) {
+        if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+            continue;
+
+        r = (*f)(dent->d_name, udata);
+        if (r)
+            break;
+    }
+
+    closedir(dp);
+    return r;
+}
+
 int ty_terminal_setup(int flags)
 {
     struct termios tio;
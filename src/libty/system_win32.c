@@ -80,6 +80,37 @@ uint64_t ty_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t ty_micros(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    BOOL success TY_POSSIBLY_UNUSED;
+
+    if (!freq.QuadPart) {
+        success = QueryPerformanceFrequency(&freq);
+        assert(success);
+    }
+    success = QueryPerformanceCounter(&now);
+    assert(success);
+
+    // Split the conversion to avoid overflows with high-frequency counters
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+}
+
+int64_t ty_unix_millis(void)
+{
+    FILETIME ft;
+    ULARGE_INTEGER ticks;
+
+    GetSystemTimeAsFileTime(&ft);
+    ticks.LowPart = ft.dwLowDateTime;
+    ticks.HighPart = ft.dwHighDateTime;
+
+    // FILETIME counts 100 ns intervals since 1601-01-01
+    return (int64_t)((ticks.QuadPart - 116444736000000000ull) / 10000);
+}
+
 void ty_delay(unsigned int ms)
 {
     Sleep(ms);
@@ -100,6 +131,61 @@ bool ty_compare_paths(const char *path1, const char *path2)
     return strcasecmp(path1, path2) == 0;
 }
 
+int ty_list_directory(const char *path, int (*f)(const char *name, void *udata), void *udata)
+{
+    assert(path);
+    assert(f);
+
+    char *pattern = NULL;
+    HANDLE h = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATA find_data;
+    int r;
+
+    r = asprintf(&pattern, "%s\\*", path);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    h = FindFirstFile(pattern, &find_data);
+    if (h == INVALID_HANDLE_VALUE) {
+        switch (GetLastError()) {
+            case ERROR_ACCESS_DENIED: {
+                r = ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", path);
+            } break;
+            case ERROR_FILE_NOT_FOUND:
+            case ERROR_PATH_NOT_FOUND: {
+                r = ty_error(TY_ERROR_NOT_FOUND, "Directory '%s' does not exist", path);
+            } break;
+            case ERROR_DIRECTORY: {
+                r = ty_error(TY_ERROR_MODE, "Path '%s' is not a directory", path);
+            } break;
+
+            default: {
+                r = ty_error(TY_ERROR_SYSTEM, "FindFirstFile('%s') failed: %s", path,
+                             ty_win32_strerror(0));
+            } break;
+        }
+        goto cleanup;
+    }
+
+    r = 0;
+    do {
+        if (!strcmp(find_data.cFileName, ".") || !strcmp(find_data.cFileName, ".."))
+            continue;
+
+        r = (*f)(find_data.cFileName, udata);
+        if (r)
+            break;
+    } while (FindNextFile(h, &find_data));
+
+cleanup:
+    if (h != INVALID_HANDLE_VALUE)
+        FindClose(h);
+    free(pattern);
+    return r;
+}
+
 unsigned int ty_descriptor_get_modes(ty_descriptor desc)
 {
     DWORD tmp;
@@ -10,9 +10,30 @@
 
 #include "common_priv.h"
 #include "../libhs/array.h"
+#include "../libhs/htable.h"
 #include "system.h"
 #include "task.h"
 
+#define SERIAL_QUEUES_TABLE_SIZE 64
+#define DEQUE_MIN_SIZE 16
+
+// Ring buffer, tasks are pushed at the back and popped from the front
+struct task_deque {
+    ty_task **values;
+    size_t allocated;
+    size_t start;
+    size_t count;
+};
+
+struct serial_queue {
+    _hs_htable_head hnode;
+    const void *key;
+
+    // One task of the queue is ready or running, the next ones wait in tasks
+    bool busy;
+    struct task_deque tasks;
+};
+
 struct ty_pool {
     int unused_timeout;
     unsigned int max_threads;
@@ -22,7 +43,13 @@ struct ty_pool {
     _HS_ARRAY(ty_thread) worker_threads;
     size_t busy_workers;
 
-    _HS_ARRAY(ty_task *) pending_tasks;
+    struct task_deque ready_tasks[TY_TASK_PRIORITY_COUNT];
+    size_t ready_count;
+    /* Pending tasks of each priority, ready or waiting in a serial queue. The ready deques
+       are kept big enough for all of them, so that scheduling the next task of a serial
+       queue cannot fail. */
+    size_t pending_counts[TY_TASK_PRIORITY_COUNT];
+    _hs_htable serial_queues;
     ty_cond pending_cond;
 
     bool init;
@@ -31,6 +58,108 @@ struct ty_pool {
 static ty_pool *default_pool;
 static TY_THREAD_LOCAL ty_task *current_task;
 
+static int reserve_deque(struct task_deque *deque, size_t need)
+{
+    ty_task **values;
+    size_t allocated;
+
+    if (need <= deque->allocated)
+        return 0;
+
+    allocated = deque->allocated ? deque->allocated : DEQUE_MIN_SIZE;
+    while (allocated < need)
+        allocated *= 2;
+    values = malloc(allocated * sizeof(*values));
+    if (!values)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    for (size_t i = 0; i < deque->count; i++)
+        values[i] = deque->values[(deque->start + i) % deque->allocated];
+    free(deque->values);
+
+    deque->values = values;
+    deque->allocated = allocated;
+    deque->start = 0;
+
+    return 0;
+}
+
+// Call reserve_deque() first
+static void push_deque(struct task_deque *deque, ty_task *task)
+{
+    assert(deque->count < deque->allocated);
+    deque->values[(deque->start + deque->count++) % deque->allocated] = task;
+}
+
+static ty_task *pop_deque(struct task_deque *deque)
+{
+    ty_task *task;
+
+    if (!deque->count)
+        return NULL;
+
+    task = deque->values[deque->start];
+    deque->start = (deque->start + 1) % deque->allocated;
+    deque->count--;
+
+    return task;
+}
+
+// This is O(n) but only happens when a thread takes over a pending task
+static bool remove_deque(struct task_deque *deque, ty_task *task)
+{
+    for (size_t i = 0; i < deque->count; i++) {
+        if (deque->values[(deque->start + i) % deque->allocated] == task) {
+            for (size_t j = i; j + 1 < deque->count; j++)
+                deque->values[(deque->start + j) % deque->allocated] =
+                    deque->values[(deque->start + j + 1) % deque->allocated];
+            deque->count--;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static struct serial_queue *find_serial_queue(ty_pool *pool, const void *key)
+{
+    _hs_htable_foreach_hash(cur, &pool->serial_queues, _hs_htable_hash_ptr(key)) {
+        struct serial_queue *queue = ty_container_of(cur, struct serial_queue, hnode);
+
+        if (queue->key == key)
+            return queue;
+    }
+
+    return NULL;
+}
+
+// Call with pool->mutex locked
+static int get_serial_queue(ty_pool *pool, const void *key, struct serial_queue **rqueue)
+{
+    struct serial_queue *queue;
+
+    queue = find_serial_queue(pool, key);
+    if (!queue) {
+        queue = calloc(1, sizeof(*queue));
+        if (!queue)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        queue->key = key;
+
+        _hs_htable_add(&pool->serial_queues, _hs_htable_hash_ptr(key), &queue->hnode);
+    }
+
+    *rqueue = queue;
+    return 0;
+}
+
+static void drop_serial_queue(struct serial_queue *queue)
+{
+    _hs_htable_remove(&queue->hnode);
+    free(queue->tasks.values);
+    free(queue);
+}
+
 int ty_pool_new(ty_pool **rpool)
 {
     assert(rpool);
@@ -47,6 +176,12 @@ int ty_pool_new(ty_pool **rpool)
     pool->max_threads = 16;
     pool->unused_timeout = 10000;
 
+    r = _hs_htable_init(&pool->serial_queues, SERIAL_QUEUES_TABLE_SIZE);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto error;
+    }
+
     r = ty_mutex_init(&pool->mutex);
     if (r < 0)
         goto error;
@@ -70,11 +205,22 @@ void ty_pool_free(ty_pool *pool)
         if (pool->init) {
             ty_mutex_lock(&pool->mutex);
 
-            for (size_t i = 0; i < pool->pending_tasks.count; i++) {
-                ty_task *task = pool->pending_tasks.values[i];
-                ty_task_unref(task);
+            for (unsigned int i = 0; i < TY_TASK_PRIORITY_COUNT; i++) {
+                ty_task *task;
+
+                while ((task = pop_deque(&pool->ready_tasks[i])))
+                    ty_task_unref(task);
+                pool->pending_counts[i] = 0;
+            }
+            pool->ready_count = 0;
+            // Running tasks still need their queue, we free them after the join
+            _hs_htable_foreach(cur, &pool->serial_queues) {
+                struct serial_queue *queue = ty_container_of(cur, struct serial_queue, hnode);
+                ty_task *task;
+
+                while ((task = pop_deque(&queue->tasks)))
+                    ty_task_unref(task);
             }
-            _hs_array_release(&pool->pending_tasks);
             pool->max_threads = 0;
             ty_cond_broadcast(&pool->pending_cond);
 
@@ -91,6 +237,14 @@ void ty_pool_free(ty_pool *pool)
             _hs_array_release(&pool->worker_threads);
         }
 
+        for (unsigned int i = 0; i < TY_TASK_PRIORITY_COUNT; i++)
+            free(pool->ready_tasks[i].values);
+        _hs_htable_foreach(cur, &pool->serial_queues) {
+            struct serial_queue *queue = ty_container_of(cur, struct serial_queue, hnode);
+            drop_serial_queue(queue);
+        }
+        _hs_htable_release(&pool->serial_queues);
+
         ty_cond_release(&pool->pending_cond);
         ty_mutex_release(&pool->mutex);
     }
@@ -108,7 +262,7 @@ int ty_pool_set_max_threads(ty_pool *pool, unsigned int max)
     ty_mutex_lock(&pool->mutex);
 
     if (max > pool->max_threads) {
-        size_t need_threads = pool->pending_tasks.count;
+        size_t need_threads = pool->ready_count;
         if (need_threads > (size_t)pool->max_threads - pool->worker_threads.count)
             need_threads = (size_t)pool->max_threads - pool->worker_threads.count;
         for (size_t i = 0; i < need_threads; i++) {
@@ -188,6 +342,7 @@ int ty_task_new(const char *name, int (*run)(ty_task *task), ty_task **rtask)
         goto error;
     }
     task->refcount = 1;
+    task->priority = TY_TASK_PRIORITY_NORMAL;
 
     task->task_run = run;
     task->name = strdup(name);
@@ -241,13 +396,24 @@ void ty_task_unref(ty_task *task)
     free(task);
 }
 
+// The status is read from other threads, always access it with task->mutex locked
+static ty_task_status get_task_status(ty_task *task)
+{
+    ty_task_status status;
+
+    ty_mutex_lock(&task->mutex);
+    status = task->status;
+    ty_mutex_unlock(&task->mutex);
+
+    return status;
+}
+
 static void change_task_status(ty_task *task, ty_task_status status)
 {
     ty_message_data msg = {0};
 
-    task->status = status;
-
     ty_mutex_lock(&task->mutex);
+    task->status = status;
     ty_cond_broadcast(&task->cond);
     ty_mutex_unlock(&task->mutex);
 
@@ -278,6 +444,58 @@ static void run_task(ty_task *task)
     current_task = previous_task;
 }
 
+// Call with pool->mutex locked
+static ty_task *pop_ready_task(ty_pool *pool)
+{
+    for (unsigned int i = TY_TASK_PRIORITY_COUNT; i-- > 0;) {
+        ty_task *task = pop_deque(&pool->ready_tasks[i]);
+
+        if (task) {
+            pool->ready_count--;
+            pool->pending_counts[i]--;
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+// Call with pool->mutex locked, after reserve_deque()
+static void push_ready_task(ty_pool *pool, ty_task *task)
+{
+    push_deque(&pool->ready_tasks[task->priority], task);
+    pool->ready_count++;
+    ty_cond_signal(&pool->pending_cond);
+}
+
+static bool need_worker_thread(ty_pool *pool, size_t ready_count)
+{
+    return ready_count > pool->worker_threads.count - pool->busy_workers &&
+           pool->worker_threads.count < pool->max_threads;
+}
+
+/* Call with pool->mutex locked, once the task has run. The next task with the same key
+   becomes ready, workers that finish a task pick up new ones by themselves. */
+static void release_serial_key(ty_pool *pool, ty_task *task, bool worker)
+{
+    struct serial_queue *queue;
+    ty_task *next;
+
+    queue = find_serial_queue(pool, task->serial_key);
+    assert(queue && queue->busy);
+
+    next = pop_deque(&queue->tasks);
+    if (!next) {
+        drop_serial_queue(queue);
+        return;
+    }
+
+    push_ready_task(pool, next);
+    // We can't report this, but the next ty_task_start() will try again
+    if (!worker && need_worker_thread(pool, pool->ready_count))
+        start_worker_thread(pool);
+}
+
 static int worker_thread_main(void *udata)
 {
     ty_pool *pool = udata;
@@ -295,11 +513,9 @@ static int worker_thread_main(void *udata)
         while (true) {
             if (pool->worker_threads.count > pool->max_threads)
                 goto timeout;
-            if (pool->pending_tasks.count) {
-                task = pool->pending_tasks.values[0];
-                _hs_array_remove(&pool->pending_tasks, 0, 1);
+            task = pop_ready_task(pool);
+            if (task)
                 break;
-            }
             if (!run)
                 goto timeout;
 
@@ -311,6 +527,11 @@ static int worker_thread_main(void *udata)
         ty_mutex_unlock(&pool->mutex);
 
         run_task(task);
+        if (task->serial_key) {
+            ty_mutex_lock(&pool->mutex);
+            release_serial_key(pool, task, true);
+            ty_mutex_unlock(&pool->mutex);
+        }
         ty_task_unref(task);
     }
 
@@ -358,8 +579,10 @@ int ty_task_start(ty_task *task)
 {
     assert(task);
     assert(task->status == TY_TASK_STATUS_READY);
+    assert(task->priority < TY_TASK_PRIORITY_COUNT);
 
     ty_pool *pool;
+    struct serial_queue *queue = NULL;
     int r;
 
     if (!task->pool) {
@@ -371,24 +594,95 @@ int ty_task_start(ty_task *task)
 
     ty_mutex_lock(&pool->mutex);
 
-    if (pool->busy_workers == pool->worker_threads.count &&
-            pool->worker_threads.count < pool->max_threads) {
-        r = start_worker_thread(pool);
+    r = reserve_deque(&pool->ready_tasks[task->priority],
+                      pool->pending_counts[task->priority] + 1);
+    if (r < 0)
+        goto cleanup;
+
+    if (task->serial_key) {
+        r = get_serial_queue(pool, task->serial_key, &queue);
         if (r < 0)
             goto cleanup;
     }
 
-    r = _hs_array_push(&pool->pending_tasks, task);
-    if (r < 0) {
-        r = ty_libhs_translate_error(r);
-        goto cleanup;
+    if (queue && queue->busy) {
+        r = reserve_deque(&queue->tasks, queue->tasks.count + 1);
+        if (r < 0)
+            goto cleanup;
+        push_deque(&queue->tasks, task);
+    } else {
+        if (need_worker_thread(pool, pool->ready_count + 1)) {
+            r = start_worker_thread(pool);
+            if (r < 0)
+                goto cleanup;
+        }
+
+        if (queue)
+            queue->busy = true;
+        push_ready_task(pool, task);
     }
+    pool->pending_counts[task->priority]++;
     ty_task_ref(task);
-    ty_cond_signal(&pool->pending_cond);
 
     change_task_status(task, TY_TASK_STATUS_PENDING);
 
     r = 0;
+cleanup:
+    if (r < 0 && queue && !queue->busy)
+        drop_serial_queue(queue);
+    ty_mutex_unlock(&pool->mutex);
+    return r;
+}
+
+/* Returns 1 if the calling thread can run the task right away: either it has not been
+   started or it is pending and nothing runs before it. The task stays pending otherwise. */
+static int take_over_task(ty_task *task)
+{
+    ty_pool *pool;
+    ty_task_status status;
+    int r;
+
+    status = get_task_status(task);
+    if (status == TY_TASK_STATUS_READY && !task->serial_key)
+        return 1;
+    if (status > TY_TASK_STATUS_PENDING)
+        return 0;
+
+    if (!task->pool) {
+        r = ty_pool_get_default(&task->pool);
+        if (r < 0)
+            return r;
+    }
+    pool = task->pool;
+
+    ty_mutex_lock(&pool->mutex);
+
+    status = get_task_status(task);
+    if (status == TY_TASK_STATUS_PENDING) {
+        // The serial queue (if any) stays busy, this thread now runs the task
+        r = remove_deque(&pool->ready_tasks[task->priority], task);
+        if (r) {
+            pool->ready_count--;
+            pool->pending_counts[task->priority]--;
+            ty_task_unref(task);
+
+            ty_mutex_lock(&task->mutex);
+            task->status = TY_TASK_STATUS_READY;
+            ty_mutex_unlock(&task->mutex);
+        }
+    } else if (status == TY_TASK_STATUS_READY) {
+        struct serial_queue *queue;
+
+        r = get_serial_queue(pool, task->serial_key, &queue);
+        if (r < 0)
+            goto cleanup;
+
+        r = !queue->busy;
+        queue->busy = true;
+    } else {
+        r = 0;
+    }
+
 cleanup:
     ty_mutex_unlock(&pool->mutex);
     return r;
@@ -405,29 +699,21 @@ int ty_task_wait(ty_task *task, ty_task_status status, int timeout)
     /* If the caller wants to wait until the task has finished without timing out, try
        to execute the task in this thread if it's not running already. */
     if (status == TY_TASK_STATUS_FINISHED && timeout < 0) {
-        if (task->status == TY_TASK_STATUS_PENDING) {
-            ty_pool *pool = task->pool;
-
-            ty_mutex_lock(&pool->mutex);
-            if (task->status == TY_TASK_STATUS_PENDING) {
-                for (size_t i = 0; i < pool->pending_tasks.count; i++) {
-                    if (pool->pending_tasks.values[i] == task) {
-                        _hs_array_remove(&pool->pending_tasks, i, 1);
-                        break;
-                    }
-                }
-                ty_task_unref(task);
-
-                task->status = TY_TASK_STATUS_READY;
-            }
-            ty_mutex_unlock(&pool->mutex);
-        }
+        r = take_over_task(task);
+        if (r < 0)
+            return r;
 
-        if (task->status == TY_TASK_STATUS_READY) {
+        if (r) {
             run_task(task);
+            if (task->serial_key) {
+                ty_mutex_lock(&task->pool->mutex);
+                release_serial_key(task->pool, task, false);
+                ty_mutex_unlock(&task->pool->mutex);
+            }
             return 1;
         }
-    } else if (task->status == TY_TASK_STATUS_READY) {
+    }
+    if (get_task_status(task) == TY_TASK_STATUS_READY) {
         r = ty_task_start(task);
         if (r < 0)
             return r;
@@ -21,12 +21,25 @@ struct ty_firmware;
 
 typedef struct ty_pool ty_pool;
 
+// Pending tasks with a higher priority are started first
+typedef enum ty_task_priority {
+    TY_TASK_PRIORITY_LOW,
+    TY_TASK_PRIORITY_NORMAL,
+    TY_TASK_PRIORITY_HIGH
+} ty_task_priority;
+#define TY_TASK_PRIORITY_COUNT 3
+
 typedef struct ty_task {
     unsigned int refcount;
 
     char *name;
     ty_task_status status;
     ty_pool *pool;
+    ty_task_priority priority;
+    /* Tasks with the same key (e.g. the board) run one at a time in each pool, in the
+       order they were started, and never occupy more than one worker thread. The queue of
+       a key is strictly FIFO: priority only matters between tasks with different keys. */
+    const void *serial_key;
 
     ty_message_func *user_callback;
     void *user_callback_udata;
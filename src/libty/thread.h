@@ -76,6 +76,19 @@ typedef struct ty_cond {
     bool init;
 } ty_cond;
 
+typedef struct ty_once {
+#ifdef _WIN32
+    volatile long state; // LONG
+#else
+    pthread_once_t once;
+#endif
+} ty_once;
+#ifdef _WIN32
+    #define TY_ONCE_INIT {0}
+#else
+    #define TY_ONCE_INIT {PTHREAD_ONCE_INIT}
+#endif
+
 typedef int ty_thread_func(void *udata);
 
 int ty_thread_create(ty_thread *thread, ty_thread_func *f, void *udata);
@@ -84,6 +97,8 @@ void ty_thread_detach(ty_thread *thread);
 
 ty_thread_id ty_thread_get_self_id(void);
 
+void ty_once_run(ty_once *once, void (*f)(void));
+
 int ty_mutex_init(ty_mutex *mutex);
 void ty_mutex_release(ty_mutex *mutex);
 
@@ -12,6 +12,7 @@
 #include <time.h>
 #include "system.h"
 #include "thread.h"
+#include "trace.h"
 
 static pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t thread_cond = PTHREAD_COND_INITIALIZER;
@@ -32,7 +33,10 @@ static void *thread_proc(void *udata)
     pthread_cond_broadcast(&thread_cond);
     pthread_mutex_unlock(&thread_mutex);
 
-    return (void *)(intptr_t)(*ctx.f)(ctx.udata);
+    int r = (*ctx.f)(ctx.udata);
+    _ty_trace_release_thread();
+
+    return (void *)(intptr_t)r;
 }
 
 int ty_thread_create(ty_thread *thread, ty_thread_func *f, void *udata)
@@ -86,6 +90,11 @@ ty_thread_id ty_thread_get_self_id(void)
     return pthread_self();
 }
 
+void ty_once_run(ty_once *once, void (*f)(void))
+{
+    pthread_once(&once->once, f);
+}
+
 int ty_mutex_init(ty_mutex *mutex)
 {
     int r;
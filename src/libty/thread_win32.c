@@ -14,6 +14,7 @@
 #include <process.h>
 #include "system.h"
 #include "thread.h"
+#include "trace.h"
 
 typedef void WINAPI InitializeConditionVariable_func(CONDITION_VARIABLE *cv);
 typedef BOOL WINAPI SleepConditionVariableCS_func(CONDITION_VARIABLE *cv, CRITICAL_SECTION *cs, DWORD timeout);
@@ -41,6 +42,8 @@ static unsigned int __stdcall thread_proc(void *udata)
     SetEvent(ctx.ev);
 
     code.i = (*ctx.f)(ctx.udata);
+    _ty_trace_release_thread();
+
     return code.dw;
 }
 
@@ -106,6 +109,22 @@ ty_thread_id ty_thread_get_self_id()
     return GetCurrentThreadId();
 }
 
+void ty_once_run(ty_once *once, void (*f)(void))
+{
+    // InitOnceExecuteOnce() does not exist on XP, other threads spin until f is done
+    switch (InterlockedCompareExchange(&once->state, 1, 0)) {
+        case 0: {
+            (*f)();
+            InterlockedExchange(&once->state, 2);
+        } break;
+
+        case 1: {
+            while (InterlockedCompareExchange(&once->state, 2, 2) != 2)
+                Sleep(0);
+        } break;
+    }
+}
+
 int ty_mutex_init(ty_mutex *mutex)
 {
     InitializeCriticalSection((CRITICAL_SECTION *)&mutex->mutex);
@@ -0,0 +1,369 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#ifdef _WIN32
+    // Need that for InterlockedX functions
+    #include <windows.h>
+#endif
+#include "system.h"
+#include "task.h"
+#include "thread.h"
+#include "trace.h"
+
+#define TRACE_CHUNK_EVENTS 1024
+
+struct trace_event {
+    uint64_t time;
+    const char *name;
+    char phase;
+    // Copy of the task name (begin events only), the task may be gone when we dump
+    char task[63];
+};
+
+struct trace_chunk {
+    struct trace_chunk *next;
+    unsigned int count;
+
+    struct trace_event events[TRACE_CHUNK_EVENTS];
+};
+
+struct trace_thread {
+    struct trace_thread *next;
+    unsigned int id;
+    bool main;
+    // Set (under threads_mutex) once the thread is gone, the buffer can be reused
+    bool exited;
+
+    struct trace_chunk *first;
+    struct trace_chunk *last;
+    unsigned int total;
+    // Written by the thread, read by ty_trace_write()
+    unsigned int dropped;
+};
+
+int _ty_trace_enabled;
+
+static ty_mutex threads_mutex;
+static struct trace_thread *threads;
+static unsigned int threads_count;
+static uint64_t start_time;
+
+static TY_THREAD_LOCAL struct trace_thread *current_thread;
+
+/* Buffers are only written by their thread, and the dumping thread reads them concurrently.
+   Publish the events with a release store once they are complete. */
+static unsigned int load_acquire_uint(unsigned int *ptr)
+{
+#ifdef _MSC_VER
+    return *(volatile unsigned int *)ptr;
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void store_release_uint(unsigned int *ptr, unsigned int value)
+{
+#ifdef _MSC_VER
+    *(volatile unsigned int *)ptr = value;
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static struct trace_chunk *load_acquire_chunk(struct trace_chunk **ptr)
+{
+#ifdef _MSC_VER
+    return *(struct trace_chunk *volatile *)ptr;
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void store_release_chunk(struct trace_chunk **ptr, struct trace_chunk *chunk)
+{
+#ifdef _MSC_VER
+    *(struct trace_chunk *volatile *)ptr = chunk;
+#else
+    __atomic_store_n(ptr, chunk, __ATOMIC_RELEASE);
+#endif
+}
+
+static void set_enabled(int enabled)
+{
+#ifdef _MSC_VER
+    InterlockedExchange((volatile LONG *)&_ty_trace_enabled, (LONG)enabled);
+#else
+    __atomic_store_n(&_ty_trace_enabled, enabled, __ATOMIC_RELAXED);
+#endif
+}
+
+static struct trace_thread *register_thread(bool main)
+{
+    struct trace_thread *thread;
+
+    // Take over the buffer of a thread that has exited, if any
+    ty_mutex_lock(&threads_mutex);
+    for (thread = threads; thread; thread = thread->next) {
+        if (thread->exited) {
+            thread->exited = false;
+            thread->main = main;
+            ty_mutex_unlock(&threads_mutex);
+
+            return thread;
+        }
+    }
+    ty_mutex_unlock(&threads_mutex);
+
+    thread = calloc(1, sizeof(*thread));
+    if (!thread)
+        return NULL;
+    thread->first = calloc(1, sizeof(*thread->first));
+    if (!thread->first) {
+        free(thread);
+        return NULL;
+    }
+    thread->last = thread->first;
+    thread->main = main;
+
+    ty_mutex_lock(&threads_mutex);
+    thread->id = ++threads_count;
+    thread->next = threads;
+    threads = thread;
+    ty_mutex_unlock(&threads_mutex);
+
+    return thread;
+}
+
+void _ty_trace_release_thread(void)
+{
+    struct trace_thread *thread = current_thread;
+
+    if (!thread)
+        return;
+    current_thread = NULL;
+
+    ty_mutex_lock(&threads_mutex);
+    thread->exited = true;
+    ty_mutex_unlock(&threads_mutex);
+}
+
+void _ty_trace_record(const char *name, char phase)
+{
+    struct trace_thread *thread = current_thread;
+    struct trace_chunk *chunk;
+    struct trace_event *ev;
+    unsigned int count;
+
+    if (!thread) {
+        thread = register_thread(false);
+        if (!thread)
+            return;
+        current_thread = thread;
+    }
+
+    if (thread->total >= TY_TRACE_MAX_EVENTS) {
+        store_release_uint(&thread->dropped, thread->dropped + 1);
+        return;
+    }
+
+    chunk = thread->last;
+    count = chunk->count;
+    if (count == TRACE_CHUNK_EVENTS) {
+        struct trace_chunk *next = calloc(1, sizeof(*next));
+        if (!next) {
+            store_release_uint(&thread->dropped, thread->dropped + 1);
+            return;
+        }
+        store_release_chunk(&chunk->next, next);
+        thread->last = next;
+
+        chunk = next;
+        count = 0;
+    }
+
+    ev = &chunk->events[count];
+    ev->time = ty_micros();
+    ev->name = name;
+    ev->phase = phase;
+    if (phase == 'B') {
+        ty_task *task = ty_task_get_current();
+
+        if (task) {
+            strncpy(ev->task, task->name, sizeof(ev->task) - 1);
+            ev->task[sizeof(ev->task) - 1] = 0;
+        } else {
+            ev->task[0] = 0;
+        }
+    }
+
+    store_release_uint(&chunk->count, count + 1);
+    thread->total++;
+}
+
+int ty_trace_start(void)
+{
+    int r;
+
+    if (ty_trace_is_enabled())
+        return 0;
+
+    if (!threads_mutex.init) {
+        r = ty_mutex_init(&threads_mutex);
+        if (r < 0)
+            return r;
+
+        start_time = ty_micros();
+    }
+
+    // The thread that starts tracing is named "Main" in the output
+    if (!current_thread) {
+        current_thread = register_thread(true);
+        if (!current_thread)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+
+    set_enabled(1);
+    return 0;
+}
+
+void ty_trace_stop(void)
+{
+    set_enabled(0);
+}
+
+static void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const char *ptr = str; *ptr; ptr++) {
+        unsigned char c = (unsigned char)*ptr;
+
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_thread_events(FILE *fp, struct trace_thread *thread, bool *first)
+{
+    struct trace_chunk *chunk = thread->first;
+    char thread_name[32];
+    unsigned int depth = 0;
+    unsigned int dropped;
+
+    if (thread->main) {
+        strcpy(thread_name, "Main");
+    } else {
+        sprintf(thread_name, "Thread %u", thread->id);
+    }
+    fprintf(fp, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                "\"args\": {\"name\": \"%s\"}}",
+            *first ? "" : ",", thread->id, thread_name);
+    *first = false;
+
+    while (chunk) {
+        unsigned int count = load_acquire_uint(&chunk->count);
+
+        for (unsigned int i = 0; i < count; i++) {
+            const struct trace_event *ev = &chunk->events[i];
+            uint64_t ts = ev->time > start_time ? ev->time - start_time : 0;
+
+            if (ev->phase == 'B') {
+                fprintf(fp, ",\n{\"name\": ");
+                write_json_string(fp, ev->name);
+                fprintf(fp, ", \"cat\": \"tytools\", \"ph\": \"B\", \"ts\": %"PRIu64", "
+                            "\"pid\": 1, \"tid\": %u", ts, thread->id);
+                if (ev->task[0]) {
+                    fprintf(fp, ", \"args\": {\"task\": ");
+                    write_json_string(fp, ev->task);
+                    fputc('}', fp);
+                }
+                fputc('}', fp);
+
+                depth++;
+            } else if (depth) {
+                // Skip end events of spans that started before tracing was enabled
+                fprintf(fp, ",\n{\"ph\": \"E\", \"ts\": %"PRIu64", \"pid\": 1, \"tid\": %u}",
+                        ts, thread->id);
+
+                depth--;
+            }
+        }
+
+        chunk = load_acquire_chunk(&chunk->next);
+    }
+
+    dropped = load_acquire_uint(&thread->dropped);
+    if (dropped)
+        ty_log(TY_LOG_WARNING, "Trace buffer of thread %u is full, dropped %u events",
+               thread->id, dropped);
+}
+
+int ty_trace_write(FILE *fp)
+{
+    assert(fp);
+
+    bool first = true;
+
+    fprintf(fp, "{\"traceEvents\": [");
+    if (threads_mutex.init) {
+        ty_mutex_lock(&threads_mutex);
+        for (struct trace_thread *thread = threads; thread; thread = thread->next)
+            write_thread_events(fp, thread, &first);
+        ty_mutex_unlock(&threads_mutex);
+    }
+    fprintf(fp, "\n], \"displayTimeUnit\": \"ms\"}\n");
+
+    fflush(fp);
+    if (ferror(fp))
+        return ty_error(TY_ERROR_IO, "Failed to write trace: %s", strerror(errno));
+
+    return 0;
+}
+
+int ty_trace_dump(const char *filename)
+{
+    assert(filename);
+
+    FILE *fp;
+    int r;
+
+#ifdef _WIN32
+    fp = fopen(filename, "w");
+#else
+    fp = fopen(filename, "we");
+#endif
+    if (!fp) {
+        switch (errno) {
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case EIO: {
+                return ty_error(TY_ERROR_IO, "I/O error while opening '%s' for writing", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_NOT_FOUND, "Directory of '%s' does not exist", filename);
+            } break;
+        }
+        return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename, strerror(errno));
+    }
+
+    r = ty_trace_write(fp);
+
+    if (fclose(fp) && !r)
+        r = ty_error(TY_ERROR_IO, "Failed to write trace to '%s': %s", filename, strerror(errno));
+    return r;
+}
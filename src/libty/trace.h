@@ -0,0 +1,63 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_TRACE_H
+#define TY_TRACE_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+/* Traces are made of timestamped spans (begin/end pairs) recorded in thread-local buffers,
+   tagged with the name of the current task if there is one. Nothing is recorded (and the
+   cost is a single test) until ty_trace_start() is called. Span names are not copied, use
+   string literals. Threads record at most TY_TRACE_MAX_EVENTS events each, the rest is
+   dropped. The buffer of a thread made by ty_thread_create() is reused by the next thread
+   that needs one once it exits, so worker threads that come and go don't add up. */
+
+#define TY_TRACE_MAX_EVENTS 262144
+
+// Written by ty_trace_start() and ty_trace_stop(), read by any thread
+extern int _ty_trace_enabled;
+
+void _ty_trace_record(const char *name, char phase);
+// Called by ty_thread_create() threads when they exit
+void _ty_trace_release_thread(void);
+
+static inline bool ty_trace_is_enabled(void)
+{
+#ifdef _MSC_VER
+    return *(volatile int *)&_ty_trace_enabled;
+#else
+    return __atomic_load_n(&_ty_trace_enabled, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void ty_trace_begin(const char *name)
+{
+    if (ty_trace_is_enabled())
+        _ty_trace_record(name, 'B');
+}
+static inline void ty_trace_end(void)
+{
+    if (ty_trace_is_enabled())
+        _ty_trace_record(NULL, 'E');
+}
+
+int ty_trace_start(void);
+void ty_trace_stop(void);
+
+// Write everything recorded so far in the Chrome trace event format (JSON)
+int ty_trace_write(FILE *fp);
+int ty_trace_dump(const char *filename);
+
+TY_C_END
+
+#endif
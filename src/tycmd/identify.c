@@ -14,6 +14,7 @@
 
 static const char *identify_firmware_format = NULL;
 static bool identify_output_json = false;
+static bool identify_sections = false;
 
 static void print_identify_usage(FILE *f)
 {
@@ -24,7 +25,63 @@ static void print_identify_usage(FILE *f)
 
     fprintf(f, "Identify options:\n"
                "   -f, --format <format>    Firmware file format (autodetected by default)\n"
-               "   -j, --json               Output data in JSON format\n");
+               "   -j, --json               Output data in JSON format\n"
+               "   -s, --sections           Show flash and RAM usage of each section (ELF)\n");
+}
+
+static void print_json_string(const char *str)
+{
+    putchar('"');
+    for (const char *ptr = str; *ptr; ptr++) {
+        unsigned char c = (unsigned char)*ptr;
+
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20 || c == 0x7F) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_sections(const ty_firmware *fw)
+{
+    size_t flash_usage = 0, ram_usage = 0;
+
+    for (unsigned int i = 0; i < fw->sections_count; i++) {
+        const ty_firmware_section *section = &fw->sections[i];
+
+        if (section->flash)
+            flash_usage += section->size;
+        if (section->ram)
+            ram_usage += section->size;
+    }
+
+    if (identify_output_json) {
+        printf(", \"sections\": [");
+        for (unsigned int i = 0; i < fw->sections_count; i++) {
+            const ty_firmware_section *section = &fw->sections[i];
+
+            // Section names come straight from the ELF file
+            printf("%s{\"name\": ", i ? ", " : "");
+            print_json_string(section->name);
+            printf(", \"address\": %"PRIu32", \"size\": %"PRIu32", \"flash\": %s, \"ram\": %s}",
+                   section->address, section->size, section->flash ? "true" : "false",
+                   section->ram ? "true" : "false");
+        }
+        printf("], \"flash\": %zu, \"ram\": %zu", flash_usage, ram_usage);
+    } else {
+        for (unsigned int i = 0; i < fw->sections_count; i++) {
+            const ty_firmware_section *section = &fw->sections[i];
+
+            printf("  %-24s 0x%08"PRIx32"  %8"PRIu32"  %s\n", section->name, section->address,
+                   section->size, section->flash ? (section->ram ? "flash+RAM" : "flash") : "RAM");
+        }
+        if (fw->sections_count)
+            printf("  Flash: %zu bytes, RAM: %zu bytes\n", flash_usage, ram_usage);
+    }
 }
 
 int identify(int argc, char *argv[])
@@ -46,6 +103,8 @@ int identify(int argc, char *argv[])
             }
         } else if (strcmp(opt, "--json") == 0 || strcmp(opt, "-j") == 0) {
             identify_output_json = true;
+        } else if (strcmp(opt, "--sections") == 0 || strcmp(opt, "-s") == 0) {
+            identify_sections = true;
         } else if (!parse_common_option(&optl, opt)) {
             print_identify_usage(stderr);
             return EXIT_FAILURE;
@@ -68,18 +127,23 @@ int identify(int argc, char *argv[])
                                   identify_firmware_format, &fw);
         if (!r)
             fw_models_count = ty_firmware_identify(fw, fw_models, TY_COUNTOF(fw_models));
-        ty_firmware_unref(fw);
 
         if (identify_output_json) {
-            printf("{\"file\": \"%s\", \"models\": [", opt);
+            printf("{\"file\": ");
+            print_json_string(opt);
+            printf(", \"models\": [");
             if (fw_models_count) {
                 printf("\"%s\"", ty_models[fw_models[0]].name);
                 for (unsigned int i = 1; i < fw_models_count; i++)
                     printf(", \"%s\"", ty_models[fw_models[i]].name);
             }
             printf("]");
-            if (r < 0)
-                printf(", \"error\": \"%s\"", ty_error_last_message());
+            if (fw && identify_sections)
+                print_sections(fw);
+            if (r < 0) {
+                printf(", \"error\": ");
+                print_json_string(ty_error_last_message());
+            }
             printf("}\n");
         } else {
             printf("%s: ", opt);
@@ -92,7 +156,11 @@ int identify(int argc, char *argv[])
                 printf("Unknown");
             }
             printf("\n");
+            if (fw && identify_sections)
+                print_sections(fw);
         }
+
+        ty_firmware_unref(fw);
     } while ((opt = ty_optline_consume_non_option(&optl)));
 
     return EXIT_SUCCESS;
@@ -0,0 +1,540 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <time.h>
+#include "../libhs/array.h"
+#include "../libty/serial_log.h"
+#include "../libty/system.h"
+#include "main.h"
+
+enum log_mode {
+    LOG_MODE_INFO,
+    LOG_MODE_TIME,
+    LOG_MODE_LINE,
+    LOG_MODE_GREP
+};
+
+struct line_reader {
+    ty_serial_log *log;
+    uint64_t offset;
+    uint64_t end;
+
+    // Number of the line returned by the last read_line() call
+    uint64_t line;
+    uint64_t next_line;
+
+    char buf[65536];
+    size_t len;
+    size_t pos;
+};
+
+typedef _HS_ARRAY(char *) filename_array;
+
+static enum log_mode log_mode = LOG_MODE_INFO;
+static int64_t log_time;
+static uint64_t log_line;
+static const char *log_pattern;
+static unsigned int log_count = 20;
+static int64_t log_since = INT64_MIN;
+static int64_t log_until = INT64_MAX;
+
+static void print_log_usage(FILE *f)
+{
+    fprintf(f, "usage: %s log [options] <logs or directories>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Log options:\n"
+               "   -t, --time <time>        Show lines received around <time>\n"
+               "   -l, --line <line>        Show lines starting at line number <line>\n"
+               "   -n, --count <count>      Number of lines to show, default is %u\n\n"
+               "   -g, --grep <text>        Show lines that contain <text>\n"
+               "       --since <time>       Ignore lines received before <time> (grep only)\n"
+               "       --until <time>       Ignore lines received after <time> (grep only)\n\n"
+               "Times use the local time zone, with one of these formats: HH:MM[:SS] (today),\n"
+               "YYYY-MM-DD HH:MM[:SS] or @<seconds since the Unix epoch>. Directories are\n"
+               "searched for serial logs that have an index. Without any of the options above,\n"
+               "the command shows the range of lines and times covered by each log.\n\n"
+               "The index only records the time of one line per second of data, --since and\n"
+               "--until estimate the time of the other lines. Logs without an index are not\n"
+               "filtered by time.\n", log_count);
+}
+
+// strtoull() accepts leading spaces and signs, and wraps negative values around
+static bool parse_number(const char *str, uint64_t max, uint64_t *rvalue)
+{
+    unsigned long long value;
+    char *end;
+
+    if (str[0] < '0' || str[0] > '9')
+        return false;
+
+    errno = 0;
+    value = strtoull(str, &end, 10);
+    if (errno || *end || value > max)
+        return false;
+
+    *rvalue = (uint64_t)value;
+    return true;
+}
+
+static bool parse_time(const char *str, int64_t *rtime)
+{
+    struct tm tm;
+    int year, month, day, hour, min, sec = 0;
+    char c;
+
+    if (str[0] == '@') {
+        long long seconds;
+
+        if (sscanf(str + 1, "%lld%c", &seconds, &c) != 1)
+            return false;
+
+        *rtime = (int64_t)seconds * 1000;
+        return true;
+    }
+
+    if (sscanf(str, "%d-%d-%d%*[ T]%d:%d:%d%c", &year, &month, &day, &hour, &min, &sec, &c) == 6 ||
+            sscanf(str, "%d-%d-%d%*[ T]%d:%d%c", &year, &month, &day, &hour, &min, &c) == 5) {
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+    } else if (sscanf(str, "%d:%d:%d%c", &hour, &min, &sec, &c) == 3 ||
+               sscanf(str, "%d:%d%c", &hour, &min, &c) == 2) {
+        time_t now = time(NULL);
+        tm = *localtime(&now);
+    } else {
+        return false;
+    }
+    tm.tm_hour = hour;
+    tm.tm_min = min;
+    tm.tm_sec = sec;
+    tm.tm_isdst = -1;
+
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1)
+        return false;
+
+    *rtime = (int64_t)t * 1000;
+    return true;
+}
+
+static void format_time(int64_t time, char *buf, size_t size)
+{
+    time_t t = (time_t)(time / 1000);
+    struct tm *tm = localtime(&t);
+
+    if (time < 0 || !tm || !strftime(buf, size, "%Y-%m-%d %H:%M:%S", tm)) {
+        snprintf(buf, size, "?");
+        return;
+    }
+}
+
+static void init_line_reader(struct line_reader *rd, ty_serial_log *log,
+                             const ty_serial_log_position *pos, uint64_t end)
+{
+    rd->log = log;
+    rd->offset = pos->offset;
+    rd->end = end;
+    rd->line = pos->line;
+    rd->next_line = pos->line;
+    rd->len = 0;
+    rd->pos = 0;
+}
+
+// Lines too long for the buffer come in several pieces with the same number
+static int read_line(struct line_reader *rd, const char **rline, size_t *rlen)
+{
+    for (;;) {
+        char *start = rd->buf + rd->pos;
+        char *end = memchr(start, '\n', rd->len - rd->pos);
+
+        if (end) {
+            *rline = start;
+            *rlen = (size_t)(end - start);
+            rd->pos = (size_t)(end + 1 - rd->buf);
+            rd->line = rd->next_line++;
+            return 1;
+        }
+        if (rd->offset >= rd->end || (!rd->pos && rd->len == sizeof(rd->buf))) {
+            if (rd->pos == rd->len)
+                return 0;
+
+            *rline = start;
+            *rlen = rd->len - rd->pos;
+            rd->pos = rd->len;
+            rd->line = rd->next_line;
+            return 1;
+        }
+
+        memmove(rd->buf, start, rd->len - rd->pos);
+        rd->len -= rd->pos;
+        rd->pos = 0;
+
+        ssize_t r = ty_serial_log_read(rd->log, rd->offset, rd->buf + rd->len,
+                                       (size_t)TY_MIN(sizeof(rd->buf) - rd->len,
+                                                      rd->end - rd->offset));
+        if (r < 0)
+            return (int)r;
+        if (!r)
+            rd->end = rd->offset;
+        rd->offset += (uint64_t)r;
+        rd->len += (size_t)r;
+    }
+}
+
+static int add_log_filename(filename_array *filenames, const char *filename)
+{
+    char *copy;
+    int r;
+
+    copy = strdup(filename);
+    if (!copy)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    r = _hs_array_push(filenames, copy);
+    if (r < 0) {
+        free(copy);
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+
+    return 0;
+}
+
+struct list_context {
+    const char *dir;
+    filename_array *filenames;
+};
+
+static int list_callback(const char *name, void *udata)
+{
+    struct list_context *ctx = udata;
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(TY_SERIAL_LOG_INDEX_SUFFIX);
+    char filename[TY_PATH_MAX_SIZE];
+
+    // Only indexed logs are interesting, find them through the index
+    if (name_len <= suffix_len || strcmp(name + name_len - suffix_len, TY_SERIAL_LOG_INDEX_SUFFIX))
+        return 0;
+
+    if (snprintf(filename, sizeof(filename), "%s/%.*s", ctx->dir,
+                 (int)(name_len - suffix_len), name) >= (int)sizeof(filename))
+        return ty_error(TY_ERROR_RANGE, "Path '%s/%s' is too long", ctx->dir, name);
+
+    return add_log_filename(ctx->filenames, filename);
+}
+
+static int compare_filenames(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int add_log_path(filename_array *filenames, const char *path)
+{
+    struct list_context ctx;
+    size_t start = filenames->count;
+    int r;
+
+    ctx.dir = path;
+    ctx.filenames = filenames;
+
+    ty_error_mask(TY_ERROR_MODE);
+    ty_error_mask(TY_ERROR_NOT_FOUND);
+    r = ty_list_directory(path, list_callback, &ctx);
+    ty_error_unmask();
+    ty_error_unmask();
+
+    // Let ty_serial_log_open() complain if the file does not exist either
+    if (r == TY_ERROR_MODE || r == TY_ERROR_NOT_FOUND)
+        return add_log_filename(filenames, path);
+    if (r < 0)
+        return r;
+
+    qsort(filenames->values + start, filenames->count - start, sizeof(*filenames->values),
+          compare_filenames);
+    return 0;
+}
+
+static int show_info(ty_serial_log *log)
+{
+    const ty_serial_log_position *positions;
+    unsigned int positions_count;
+    char first_time[64], last_time[64];
+
+    positions_count = ty_serial_log_get_positions(log, &positions);
+
+    printf("%s:", ty_serial_log_get_filename(log));
+    printf(" %"PRIu64" bytes, from line %"PRIu64, ty_serial_log_get_size(log), positions[0].line);
+    if (positions_count > 1 || positions[0].time >= 0) {
+        // The first position is only indexed if the data starts with an index entry
+        const ty_serial_log_position *first = &positions[positions[0].time < 0];
+
+        format_time(first->time, first_time, sizeof(first_time));
+        format_time(positions[positions_count - 1].time, last_time, sizeof(last_time));
+        printf(", %s to %s", first_time, last_time);
+    } else if (!ty_serial_log_is_indexed(log)) {
+        printf(", not indexed");
+    }
+    printf("\n");
+
+    return 0;
+}
+
+static int show_lines(ty_serial_log *log, const ty_serial_log_position *pos, uint64_t first_line)
+{
+    struct line_reader *rd;
+    const char *line;
+    size_t len;
+    unsigned int count = 0;
+    int r = 0;
+
+    rd = malloc(sizeof(*rd));
+    if (!rd)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    init_line_reader(rd, log, pos, ty_serial_log_get_size(log));
+
+    while (count < log_count && (r = read_line(rd, &line, &len)) > 0) {
+        if (rd->line < first_line)
+            continue;
+
+        printf("%8"PRIu64"  %.*s\n", rd->line, (int)len, line);
+        count++;
+    }
+
+    free(rd);
+    return r < 0 ? r : 0;
+}
+
+/* TyCommander indexes the first line received after each second of data (at least), so the
+   lines that follow an indexed position arrive within that second. Spread them evenly. */
+#define INDEX_TIME_INTERVAL 1000
+
+static int64_t estimate_line_time(const ty_serial_log_position *positions, unsigned int count,
+                                  unsigned int *ridx, uint64_t line)
+{
+    const ty_serial_log_position *prev, *next;
+    unsigned int idx = *ridx;
+
+    while (idx + 1 < count && positions[idx + 1].line <= line)
+        idx++;
+    *ridx = idx;
+
+    prev = &positions[idx];
+    next = idx + 1 < count ? &positions[idx + 1] : NULL;
+
+    // The data can start before the first indexed position
+    if (prev->time < 0)
+        return next ? next->time : -1;
+    if (!next || next->line <= prev->line || next->time <= prev->time)
+        return prev->time;
+
+    int64_t span = TY_MIN(next->time - prev->time, INDEX_TIME_INTERVAL);
+    return prev->time + (int64_t)((double)span * (double)(line - prev->line) /
+                                  (double)(next->line - prev->line));
+}
+
+static int grep_lines(ty_serial_log *log)
+{
+    const ty_serial_log_position *positions;
+    unsigned int positions_count;
+    ty_serial_log_position pos;
+    unsigned int time_idx = 0;
+    uint64_t end;
+    struct line_reader *rd;
+    const char *line;
+    size_t len, pattern_len;
+    int r;
+
+    rd = malloc(sizeof(*rd));
+    if (!rd)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    // Use the index to restrict the search to the requested time range
+    positions_count = ty_serial_log_get_positions(log, &positions);
+    ty_serial_log_seek_time(log, log_since, &pos);
+    end = ty_serial_log_get_size(log);
+    for (unsigned int i = 1; i < positions_count; i++) {
+        if (positions[i].time > log_until) {
+            end = positions[i].offset;
+            break;
+        }
+    }
+    init_line_reader(rd, log, &pos, end);
+
+    pattern_len = strlen(log_pattern);
+    while ((r = read_line(rd, &line, &len)) > 0) {
+        // Index entries are sparse, the range above can still include a few lines outside
+        if (log_since != INT64_MIN || log_until != INT64_MAX) {
+            int64_t time = estimate_line_time(positions, positions_count, &time_idx, rd->line);
+            if (time >= 0 && (time < log_since || time > log_until))
+                continue;
+        }
+
+        for (const char *ptr = line; (size_t)(line + len - ptr) >= pattern_len; ptr++) {
+            ptr = memchr(ptr, log_pattern[0], (size_t)(line + len - ptr) - pattern_len + 1);
+            if (!ptr)
+                break;
+
+            if (!memcmp(ptr, log_pattern, pattern_len)) {
+                printf("%s:%"PRIu64":%.*s\n", ty_serial_log_get_filename(log), rd->line,
+                       (int)len, line);
+                break;
+            }
+        }
+    }
+
+    free(rd);
+    return r < 0 ? r : 0;
+}
+
+static int process_log(const char *filename, bool show_header)
+{
+    ty_serial_log *log = NULL;
+    ty_serial_log_position pos;
+    int r;
+
+    r = ty_serial_log_open(filename, &log);
+    if (r < 0)
+        goto cleanup;
+
+    switch (log_mode) {
+        case LOG_MODE_INFO: {
+            r = show_info(log);
+        } break;
+
+        case LOG_MODE_TIME: {
+            if (show_header)
+                printf("==> %s <==\n", filename);
+            ty_serial_log_seek_time(log, log_time, &pos);
+            r = show_lines(log, &pos, 0);
+        } break;
+
+        case LOG_MODE_LINE: {
+            if (show_header)
+                printf("==> %s <==\n", filename);
+            ty_serial_log_seek_line(log, log_line, &pos);
+            r = show_lines(log, &pos, log_line);
+        } break;
+
+        case LOG_MODE_GREP: {
+            r = grep_lines(log);
+        } break;
+    }
+
+cleanup:
+    ty_serial_log_close(log);
+    return r;
+}
+
+int log_command(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    filename_array filenames = {0};
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_log_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--time") == 0 || strcmp(opt, "-t") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value || !parse_time(value, &log_time)) {
+                ty_log(TY_LOG_ERROR, "--time requires a valid time");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            log_mode = LOG_MODE_TIME;
+        } else if (strcmp(opt, "--line") == 0 || strcmp(opt, "-l") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--line' takes an argument");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (!parse_number(value, UINT64_MAX, &log_line)) {
+                ty_log(TY_LOG_ERROR, "--line requires a non-negative number, not '%s'", value);
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            log_mode = LOG_MODE_LINE;
+        } else if (strcmp(opt, "--count") == 0 || strcmp(opt, "-n") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            uint64_t count;
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--count' takes an argument");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (!parse_number(value, UINT_MAX, &count)) {
+                ty_log(TY_LOG_ERROR, "--count requires a non-negative number, not '%s'", value);
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            log_count = (unsigned int)count;
+        } else if (strcmp(opt, "--grep") == 0 || strcmp(opt, "-g") == 0) {
+            log_pattern = ty_optline_get_value(&optl);
+            if (!log_pattern || !log_pattern[0]) {
+                ty_log(TY_LOG_ERROR, "Option '--grep' takes a non-empty argument");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            log_mode = LOG_MODE_GREP;
+        } else if (strcmp(opt, "--since") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value || !parse_time(value, &log_since)) {
+                ty_log(TY_LOG_ERROR, "--since requires a valid time");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--until") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value || !parse_time(value, &log_until)) {
+                ty_log(TY_LOG_ERROR, "--until requires a valid time");
+                print_log_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_log_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    opt = ty_optline_consume_non_option(&optl);
+    if (!opt) {
+        ty_log(TY_LOG_ERROR, "Missing log filename or directory");
+        print_log_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    do {
+        r = add_log_path(&filenames, opt);
+        if (r < 0)
+            goto cleanup;
+    } while ((opt = ty_optline_consume_non_option(&optl)));
+
+    // Keep going when a log cannot be read, but report the failure
+    r = 0;
+    for (size_t i = 0; i < filenames.count; i++) {
+        int r2 = process_log(filenames.values[i], filenames.count > 1);
+        if (r2 < 0)
+            r = r2;
+    }
+
+cleanup:
+    for (size_t i = 0; i < filenames.count; i++)
+        free(filenames.values[i]);
+    _hs_array_release(&filenames);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -13,7 +13,9 @@
     #include <sys/wait.h>
 #endif
 #include "../libhs/common.h"
+#include "../libty/firmware.h"
 #include "../libty/system.h"
+#include "../libty/trace.h"
 #include "main.h"
 
 struct command {
@@ -24,26 +26,31 @@ struct command {
 
 int identify(int argc, char *argv[]);
 int list(int argc, char *argv[]);
+int log_command(int argc, char *argv[]);
 int monitor(int argc, char *argv[]);
 int reset(int argc, char *argv[]);
 int upload(int argc, char *argv[]);
 
 static const struct command commands[] = {
-    {"identify", identify, "Identify models compatible with firmware"},
-    {"list",     list,     "List available boards"},
-    {"monitor",  monitor,  "Open serial (or emulated) connection with board"},
-    {"reset",    reset,    "Reset board"},
-    {"upload",   upload,   "Upload new firmware"},
+    {"identify", identify,    "Identify models compatible with firmware"},
+    {"list",     list,        "List available boards"},
+    {"log",      log_command, "Seek or search in serial logs written by TyCommander"},
+    {"monitor",  monitor,     "Open serial (or emulated) connection with board"},
+    {"reset",    reset,       "Reset board"},
+    {"upload",   upload,      "Upload new firmware"},
     {0}
 };
 
 const char *tycmd_executable_name;
 
-static const char *main_board_tag = NULL;
+static const char *main_board_tags[64];
+static unsigned int main_board_tags_count;
 
 static ty_monitor *main_board_monitor;
 static ty_board *main_board;
 
+static const char *main_trace_filename;
+
 static void print_version(FILE *f)
 {
     fprintf(f, "%s %s\n", tycmd_executable_name, ty_version_string());
@@ -74,7 +81,9 @@ void print_common_options(FILE *f)
                "       --help               Show help message\n"
                "       --version            Display version information\n\n"
                "   -B, --board <tag>        Work with board <tag> instead of first detected\n"
-               "   -q, --quiet              Disable output, use -qqq to silence errors\n");
+               "                            Repeat to select several boards (upload, monitor)\n"
+               "   -q, --quiet              Disable output, use -qqq to silence errors\n"
+               "       --trace <file>       Record task phases to <file> (Chrome trace format)\n");
 }
 
 static inline unsigned int get_board_priority(ty_board *board)
@@ -82,6 +91,19 @@ static inline unsigned int get_board_priority(ty_board *board)
     return ty_models[ty_board_get_model(board)].priority;
 }
 
+bool matches_board_tags(ty_board *board)
+{
+    if (!main_board_tags_count)
+        return true;
+
+    for (unsigned int i = 0; i < main_board_tags_count; i++) {
+        if (ty_board_matches_tag(board, main_board_tags[i]))
+            return true;
+    }
+
+    return false;
+}
+
 static int board_callback(ty_board *board, ty_monitor_event event, void *udata)
 {
     TY_UNUSED(udata);
@@ -89,7 +111,7 @@ static int board_callback(ty_board *board, ty_monitor_event event, void *udata)
     switch (event) {
         case TY_MONITOR_EVENT_ADDED: {
             if ((!main_board || get_board_priority(board) > get_board_priority(main_board))
-                    && ty_board_matches_tag(board, main_board_tag)) {
+                    && matches_board_tags(board)) {
                 ty_board_unref(main_board);
                 main_board = ty_board_ref(board);
             }
@@ -155,8 +177,8 @@ int get_board(ty_board **rboard)
         return r;
 
     if (!main_board) {
-        if (main_board_tag) {
-            return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", main_board_tag);
+        if (main_board_tags_count) {
+            return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", main_board_tags[0]);
         } else {
             return ty_error(TY_ERROR_NOT_FOUND, "No board available");
         }
@@ -166,18 +188,133 @@ int get_board(ty_board **rboard)
     return 0;
 }
 
+struct list_boards_context {
+    const char *tag;
+    bool all;
+
+    ty_board **boards;
+    unsigned int count;
+    unsigned int max;
+
+    ty_board *best_board;
+};
+
+static bool has_board(const struct list_boards_context *ctx, const ty_board *board)
+{
+    for (unsigned int i = 0; i < ctx->count; i++) {
+        if (ctx->boards[i] == board)
+            return true;
+    }
+
+    return false;
+}
+
+static int list_boards_callback(ty_board *board, ty_monitor_event event, void *udata)
+{
+    TY_UNUSED(event);
+
+    struct list_boards_context *ctx = udata;
+
+    if (ctx->all ? !matches_board_tags(board) : !ty_board_matches_tag(board, ctx->tag))
+        return 0;
+
+    if (ctx->all) {
+        if (has_board(ctx, board))
+            return 0;
+        if (ctx->count >= ctx->max)
+            return 1;
+        ctx->boards[ctx->count++] = ty_board_ref(board);
+    } else if (!ctx->best_board ||
+               get_board_priority(board) > get_board_priority(ctx->best_board)) {
+        ctx->best_board = board;
+    }
+
+    return 0;
+}
+
+int get_boards(bool all, ty_board **rboards, unsigned int max_boards)
+{
+    assert(rboards);
+    assert(max_boards);
+
+    struct list_boards_context ctx = {0};
+    int r;
+
+    r = init_monitor();
+    if (r < 0)
+        return r;
+
+    ctx.boards = rboards;
+    ctx.max = max_boards;
+
+    if (all) {
+        /* Select every board matching any of the tags (or every board if no tag was given),
+           ty_monitor_list() stops early if we run out of space. */
+        ctx.all = true;
+        r = ty_monitor_list(main_board_monitor, list_boards_callback, &ctx);
+        if (r > 0)
+            ty_log(TY_LOG_WARNING, "Too many boards, considering only %u boards", max_boards);
+    } else {
+        // Select the best board for each tag, the same way get_board() does
+        for (unsigned int i = 0; i < TY_MAX(main_board_tags_count, 1u); i++) {
+            ctx.tag = main_board_tags_count ? main_board_tags[i] : NULL;
+            ctx.best_board = NULL;
+
+            ty_monitor_list(main_board_monitor, list_boards_callback, &ctx);
+            if (!ctx.best_board) {
+                r = ctx.tag ? ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", ctx.tag)
+                            : ty_error(TY_ERROR_NOT_FOUND, "No board available");
+                goto error;
+            }
+
+            // Several tags can designate the same board, use it only once
+            if (has_board(&ctx, ctx.best_board))
+                continue;
+            if (ctx.count >= max_boards) {
+                ty_log(TY_LOG_WARNING, "Too many boards, considering only %u boards", max_boards);
+                break;
+            }
+            ctx.boards[ctx.count++] = ty_board_ref(ctx.best_board);
+        }
+    }
+
+    if (!ctx.count) {
+        r = ty_error(TY_ERROR_NOT_FOUND, "No board available");
+        goto error;
+    }
+
+    return (int)ctx.count;
+
+error:
+    for (unsigned int i = 0; i < ctx.count; i++)
+        ty_board_unref(ctx.boards[i]);
+    return r;
+}
+
 bool parse_common_option(ty_optline_context *optl, char *arg)
 {
     if (strcmp(arg, "--board") == 0 || strcmp(arg, "-B") == 0) {
-        main_board_tag = ty_optline_get_value(optl);
-        if (!main_board_tag) {
+        const char *tag = ty_optline_get_value(optl);
+        if (!tag) {
             ty_log(TY_LOG_ERROR, "Option '--board' takes an argument");
             return false;
         }
+        if (main_board_tags_count >= TY_COUNTOF(main_board_tags)) {
+            ty_log(TY_LOG_ERROR, "Too many '--board' options (max %zu)", TY_COUNTOF(main_board_tags));
+            return false;
+        }
+        main_board_tags[main_board_tags_count++] = tag;
         return true;
     } else if (strcmp(arg, "--quiet") == 0 || strcmp(arg, "-q") == 0) {
         ty_config_verbosity--;
         return true;
+    } else if (strcmp(arg, "--trace") == 0) {
+        main_trace_filename = ty_optline_get_value(optl);
+        if (!main_trace_filename) {
+            ty_log(TY_LOG_ERROR, "Option '--trace' takes an argument");
+            return false;
+        }
+        return !ty_trace_start();
     } else {
         ty_log(TY_LOG_ERROR, "Unknown option '%s'", arg);
         return false;
@@ -238,6 +375,13 @@ int main(int argc, char *argv[])
 
     ty_board_unref(main_board);
     ty_monitor_free(main_board_monitor);
+    ty_firmware_cache_clear();
+
+    if (main_trace_filename) {
+        ty_trace_stop();
+        if (ty_trace_dump(main_trace_filename) < 0 && r == EXIT_SUCCESS)
+            r = EXIT_FAILURE;
+    }
 
     return r;
 }
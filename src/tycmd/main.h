@@ -26,6 +26,9 @@ bool parse_common_option(ty_optline_context *optl, char *arg);
 
 int get_monitor(ty_monitor **rmonitor);
 int get_board(ty_board **rboard);
+int get_boards(bool all, ty_board **rboards, unsigned int max_boards);
+// Always true if no tag was given with --board
+bool matches_board_tags(ty_board *board);
 
 TY_C_END
 
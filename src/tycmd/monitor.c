@@ -8,13 +8,20 @@
 
    See the LICENSE file for more details. */
 
+#include <time.h>
 #include <unistd.h>
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
 #endif
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <sys/stat.h>
+#endif
+#include "../libhs/array.h"
 #include "../libhs/device.h"
 #include "../libhs/serial.h"
+#include "../libty/reactor.h"
 #include "../libty/system.h"
 #include "main.h"
 
@@ -23,7 +30,18 @@ enum {
     DIRECTION_OUTPUT = 2
 };
 
+enum {
+    FORMAT_AUTO,
+    FORMAT_RAW,
+    FORMAT_TAGGED,
+    FORMAT_JSON
+};
+
 #define BUFFER_SIZE 8192
+#define SPLICE_SIZE 65536
+#define LINE_SIZE 4096
+// Longer board tags get truncated in JSON output
+#define TAG_MAX_LENGTH 256
 #define ERROR_IO_TIMEOUT 5000
 
 static int monitor_term_flags = 0;
@@ -33,6 +51,8 @@ static hs_serial_config monitor_serial_config = {
 static int monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
 static bool monitor_reconnect = false;
 static int monitor_timeout_eof = 200;
+static bool monitor_all = false;
+static int monitor_format = FORMAT_AUTO;
 
 #ifdef _WIN32
 static bool monitor_fake_echo;
@@ -47,6 +67,14 @@ static char monitor_input_line[BUFFER_SIZE];
 static ssize_t monitor_input_ret;
 #endif
 
+#ifdef __linux__
+// Intermediate pipe for splice(), unused when stdout is already a pipe
+static int monitor_splice_pipe[2] = {-1, -1};
+static bool monitor_splice_disabled = false;
+#endif
+
+static int write_all(int fd, const char *buf, size_t len);
+
 static void print_monitor_usage(FILE *f)
 {
     fprintf(f, "usage: %s monitor [options]\n\n", tycmd_executable_name);
@@ -61,7 +89,14 @@ static void print_monitor_usage(FILE *f)
                "   -D, --direction <dir>    Open serial connection in given direction\n"
                "                            Supports input, output, both (default)\n"
                "       --timeout-eof <ms>   Time before closing after EOF on standard input\n"
-               "                            Defaults to %d ms, use -1 to disable\n\n", monitor_timeout_eof);
+               "                            Defaults to %d ms, use -1 to disable\n\n"
+               "   -a, --all                Monitor all boards matching the --board tags\n"
+               "                            (including boards plugged in later)\n"
+               "   -F, --format <format>    Output format: raw, tagged or json\n"
+               "                            Defaults to raw for one board, tagged otherwise\n\n"
+               "Boards selected with multiple --board options or --all are monitored together,\n"
+               "without local input. Each board reconnects on its own, and monitoring stops\n"
+               "once every board is gone (never with --all).\n\n", monitor_timeout_eof);
 
     fprintf(f, "Serial settings:\n"
                "   -b, --baudrate <rate>    Use baudrate for serial port\n"
@@ -211,12 +246,13 @@ static int open_serial_interface(ty_board *board, ty_board_interface **riface)
     return 0;
 }
 
-static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
+static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board, int *rsplice_fd)
 {
     ty_board_interface *iface = NULL;
     int r;
 
     ty_descriptor_set_clear(set);
+    *rsplice_fd = -1;
 
     // Board events / state changes
     ty_monitor_get_descriptors(ty_board_get_monitor(board), set, 1);
@@ -227,6 +263,17 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
 
     if (monitor_directions & DIRECTION_INPUT)
         ty_board_interface_get_descriptors(iface, set, 2);
+#ifdef __linux__
+    // Seremu goes through HID reports, and simulated ports are not real files
+    if (ty_board_interface_get_device(iface)->type == HS_DEVICE_TYPE_SERIAL &&
+            !monitor_splice_disabled) {
+        int fd = hs_port_get_poll_handle(ty_board_interface_get_handle(iface));
+        struct stat sb;
+
+        if (!fstat(fd, &sb) && S_ISCHR(sb.st_mode))
+            *rsplice_fd = fd;
+    }
+#endif
 #ifdef _WIN32
     if (monitor_directions & DIRECTION_OUTPUT) {
         if (monitor_input_available) {
@@ -248,15 +295,97 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
     return 0;
 }
 
-static int loop(ty_board *board, int outfd)
+#ifdef __linux__
+
+/* Move serial data to outfd without going through a user buffer: straight to outfd if it is a
+   pipe, or through our own pipe otherwise. Returns TY_ERROR_UNSUPPORTED if the kernel refuses
+   (old kernels cannot splice from ttys, O_APPEND files, etc.), in which case the caller must
+   use the copy loop from now on. Nothing is lost when that happens. */
+static ssize_t splice_serial(ty_board *board, int fd, int outfd)
+{
+    static int outfd_is_pipe = -1;
+    ssize_t len, r;
+
+    if (outfd_is_pipe < 0) {
+        struct stat sb;
+        outfd_is_pipe = !fstat(outfd, &sb) && S_ISFIFO(sb.st_mode);
+    }
+
+    if (outfd_is_pipe) {
+        // Blocks (like write) if the reader of stdout falls behind
+        len = splice(fd, NULL, outfd, NULL, SPLICE_SIZE, 0);
+    } else {
+        if (monitor_splice_pipe[0] < 0) {
+            if (pipe2(monitor_splice_pipe, O_CLOEXEC) < 0)
+                return ty_error(TY_ERROR_UNSUPPORTED, "pipe2() failed: %s", strerror(errno));
+        }
+
+        len = splice(fd, NULL, monitor_splice_pipe[1], NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK);
+    }
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 0;
+        if (errno == EINVAL || errno == ENOSYS)
+            return ty_error(TY_ERROR_UNSUPPORTED, "Cannot splice from '%s'",
+                            ty_board_get_tag(board));
+        if (errno == EPIPE)
+            return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                            strerror(errno));
+        return ty_error(TY_ERROR_IO, "I/O error while reading from '%s': %s",
+                        ty_board_get_tag(board), strerror(errno));
+    }
+    if (outfd_is_pipe)
+        return len;
+
+    for (ssize_t left = len; left;) {
+        r = splice(monitor_splice_pipe[0], NULL, outfd, NULL, (size_t)left, SPLICE_F_MOVE);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EINVAL && errno != ENOSYS)
+                return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                                strerror(errno));
+
+            // The data is already in the pipe, copy it out before we give up on splice
+            char buf[BUFFER_SIZE];
+            while (left) {
+                ssize_t read_len = read(monitor_splice_pipe[0], buf,
+                                        TY_MIN(sizeof(buf), (size_t)left));
+                if (read_len < 0 && errno == EINTR)
+                    continue;
+                if (read_len <= 0)
+                    return ty_error(TY_ERROR_SYSTEM, "Failed to drain splice pipe");
+
+                r = write_all(outfd, buf, (size_t)read_len);
+                if (r < 0)
+                    return r;
+                left -= read_len;
+            }
+            return ty_error(TY_ERROR_UNSUPPORTED, "Cannot splice to standard output");
+        }
+
+        left -= r;
+    }
+
+    return len;
+}
+
+#endif
+
+static int loop(ty_board *board, ty_reactor *reactor, int outfd)
 {
     ty_descriptor_set set = {0};
+    int splice_fd;
     int timeout;
     char buf[BUFFER_SIZE];
     ssize_t r;
 
 restart:
-    r = fill_descriptor_set(&set, board);
+    r = fill_descriptor_set(&set, board, &splice_fd);
+    if (r < 0)
+        return (int)r;
+    ty_reactor_clear(reactor);
+    r = ty_reactor_add_set(reactor, &set);
     if (r < 0)
         return (int)r;
     timeout = -1;
@@ -264,10 +393,10 @@ restart:
     ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(board));
 
     while (true) {
-        if (!set.count)
+        if (!ty_reactor_get_count(reactor))
             return 0;
 
-        r = ty_poll(&set, timeout);
+        r = ty_reactor_wait(reactor, timeout);
         if (r < 0)
             return (int)r;
 
@@ -295,12 +424,39 @@ restart:
             } break;
 
             case 2: {
+#ifdef __linux__
+                if (splice_fd >= 0) {
+                    ty_error_mask(TY_ERROR_UNSUPPORTED);
+                    r = splice_serial(board, splice_fd, outfd);
+                    ty_error_unmask();
+
+                    if (r == TY_ERROR_UNSUPPORTED) {
+                        ty_log(TY_LOG_DEBUG, "Falling back to read/write for serial data");
+                        monitor_splice_disabled = true;
+                        splice_fd = -1;
+                        break;
+                    }
+                    if (r < 0) {
+                        if (r == TY_ERROR_IO && monitor_reconnect) {
+                            timeout = ERROR_IO_TIMEOUT;
+                            ty_reactor_remove(reactor, 2);
+                            ty_reactor_remove(reactor, 3);
+                            break;
+                        }
+                        return (int)r;
+                    }
+                    break;
+                }
+#else
+                TY_UNUSED(splice_fd);
+#endif
+
                 r = ty_board_serial_read(board, buf, sizeof(buf), 0);
                 if (r < 0) {
                     if (r == TY_ERROR_IO && monitor_reconnect) {
                         timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
+                        ty_reactor_remove(reactor, 2);
+                        ty_reactor_remove(reactor, 3);
                         break;
                     }
                     return (int)r;
@@ -347,8 +503,8 @@ restart:
                         /* EOF reached, don't listen to stdin anymore, and start timeout to give some
                            time for the device to send any data before closing down. */
                         timeout = monitor_timeout_eof;
-                        ty_descriptor_set_remove(&set, 1);
-                        ty_descriptor_set_remove(&set, 3);
+                        ty_reactor_remove(reactor, 1);
+                        ty_reactor_remove(reactor, 3);
                     }
                     break;
                 }
@@ -365,8 +521,8 @@ restart:
                 if (r < 0) {
                     if (r == TY_ERROR_IO && monitor_reconnect) {
                         timeout = ERROR_IO_TIMEOUT;
-                        ty_descriptor_set_remove(&set, 2);
-                        ty_descriptor_set_remove(&set, 3);
+                        ty_reactor_remove(reactor, 2);
+                        ty_reactor_remove(reactor, 3);
                         break;
                     }
                     return (int)r;
@@ -376,11 +532,458 @@ restart:
     }
 }
 
+struct monitor_board {
+    ty_board *board;
+    // Open serial interface, NULL while we wait for the board to come back
+    ty_board_interface *iface;
+    uint64_t retry_time;
+
+    char line[LINE_SIZE];
+    size_t line_len;
+    int64_t line_time;
+};
+
+struct multi_context {
+    ty_reactor *reactor;
+    int outfd;
+
+    _HS_ARRAY(struct monitor_board *) boards;
+    unsigned int active_count;
+};
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+#ifdef _WIN32
+        ssize_t r = write(fd, buf, (unsigned int)len);
+#else
+        ssize_t r = write(fd, buf, len);
+#endif
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EIO)
+                return ty_error(TY_ERROR_IO, "I/O error on standard output");
+            return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                            strerror(errno));
+        }
+
+        buf += r;
+        len -= (size_t)r;
+    }
+
+    return 0;
+}
+
+// Returns 0 if the bytes at ptr do not start a valid UTF-8 sequence
+static size_t utf8_sequence_length(const char *ptr, size_t len)
+{
+    const unsigned char *bytes = (const unsigned char *)ptr;
+    size_t seq_len;
+
+    if (bytes[0] < 0x80) {
+        return 1;
+    } else if ((bytes[0] & 0xE0) == 0xC0 && bytes[0] >= 0xC2) {
+        seq_len = 2;
+    } else if ((bytes[0] & 0xF0) == 0xE0) {
+        seq_len = 3;
+    } else if ((bytes[0] & 0xF8) == 0xF0 && bytes[0] <= 0xF4) {
+        seq_len = 4;
+    } else {
+        return 0;
+    }
+    if (seq_len > len)
+        return 0;
+
+    for (size_t i = 1; i < seq_len; i++) {
+        if ((bytes[i] & 0xC0) != 0x80)
+            return 0;
+    }
+
+    return seq_len;
+}
+
+// Needs up to 6 bytes of output per input byte
+static size_t escape_json(char *buf, const char *str, size_t str_len)
+{
+    size_t len = 0;
+
+    for (size_t i = 0; i < str_len; i++) {
+        unsigned char c = (unsigned char)str[i];
+
+        if (c == '"' || c == '\\') {
+            buf[len++] = '\\';
+            buf[len++] = (char)c;
+        } else if (c < 0x20 || c == 0x7F) {
+            len += (size_t)sprintf(buf + len, "\\u%04x", c);
+        } else {
+            size_t seq_len = utf8_sequence_length(str + i, str_len - i);
+
+            // Boards may send anything, don't let invalid UTF-8 break the JSON stream
+            if (seq_len) {
+                memcpy(buf + len, str + i, seq_len);
+                len += seq_len;
+                i += seq_len - 1;
+            } else {
+                len += (size_t)sprintf(buf + len, "\\u%04x", c);
+            }
+        }
+    }
+
+    return len;
+}
+
+static int write_line(struct multi_context *ctx, struct monitor_board *mb)
+{
+    // Worst case is JSON where every byte of the line and tag becomes \u00XX
+    char buf[(LINE_SIZE + TAG_MAX_LENGTH) * 6 + 1024];
+    size_t len = 0;
+    const char *tag = ty_board_get_tag(mb->board);
+    size_t line_len = mb->line_len;
+
+    if (line_len && mb->line[line_len - 1] == '\r')
+        line_len--;
+
+    if (monitor_format == FORMAT_JSON) {
+        len += (size_t)snprintf(buf, sizeof(buf), "{\"time\": %" PRId64 ", \"board\": \"",
+                                mb->line_time);
+        len += escape_json(buf + len, tag, TY_MIN(strlen(tag), TAG_MAX_LENGTH));
+        len += (size_t)snprintf(buf + len, sizeof(buf) - len, "\", \"line\": \"");
+        len += escape_json(buf + len, mb->line, line_len);
+        memcpy(buf + len, "\"}\n", 3);
+        len += 3;
+    } else {
+        time_t t = (time_t)(mb->line_time / 1000);
+        struct tm *tm = localtime(&t);
+
+        if (!tm || !(len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm)))
+            len = (size_t)sprintf(buf, "0000-00-00 00:00:00");
+        len += (size_t)snprintf(buf + len, sizeof(buf) - len, ".%03d %s: ",
+                                (int)(mb->line_time % 1000), tag);
+        len = TY_MIN(len, sizeof(buf) - LINE_SIZE - 1);
+
+        memcpy(buf + len, mb->line, line_len);
+        len += line_len;
+        buf[len++] = '\n';
+    }
+
+    mb->line_len = 0;
+    return write_all(ctx->outfd, buf, len);
+}
+
+static int process_data(struct multi_context *ctx, struct monitor_board *mb,
+                        const char *buf, size_t len)
+{
+    int r;
+
+    if (monitor_format == FORMAT_RAW)
+        return write_all(ctx->outfd, buf, len);
+
+    for (size_t i = 0; i < len; i++) {
+        if (!mb->line_len)
+            mb->line_time = ty_unix_millis();
+
+        if (buf[i] == '\n') {
+            r = write_line(ctx, mb);
+            if (r < 0)
+                return r;
+        } else {
+            mb->line[mb->line_len++] = buf[i];
+
+            // Split lines that are too long, better than losing data
+            if (mb->line_len == sizeof(mb->line)) {
+                r = write_line(ctx, mb);
+                if (r < 0)
+                    return r;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int board_id(struct multi_context *ctx, struct monitor_board *mb)
+{
+    for (size_t i = 0; i < ctx->boards.count; i++) {
+        if (ctx->boards.values[i] == mb)
+            return (int)i + 2;
+    }
+
+    // Boards are closed before they leave ctx->boards, -1 matches no reactor source
+    assert(false);
+    return -1;
+}
+
+static void close_board(struct multi_context *ctx, struct monitor_board *mb)
+{
+    if (!mb->iface)
+        return;
+
+    if (mb->line_len)
+        write_line(ctx, mb);
+
+    ty_reactor_remove(ctx->reactor, board_id(ctx, mb));
+    ty_board_interface_close(mb->iface);
+    mb->iface = NULL;
+    mb->retry_time = ty_millis() + ERROR_IO_TIMEOUT;
+}
+
+static int open_board(struct multi_context *ctx, struct monitor_board *mb)
+{
+    ty_descriptor_set set = {0};
+    int r;
+
+    if (mb->iface)
+        return 0;
+    if (!ty_board_has_capability(mb->board, TY_BOARD_CAPABILITY_SERIAL))
+        return 0;
+
+    r = open_serial_interface(mb->board, &mb->iface);
+    if (r < 0) {
+        mb->retry_time = ty_millis() + ERROR_IO_TIMEOUT;
+        return r;
+    }
+
+    ty_board_interface_get_descriptors(mb->iface, &set, board_id(ctx, mb));
+    r = ty_reactor_add_set(ctx->reactor, &set);
+    if (r < 0) {
+        ty_board_interface_close(mb->iface);
+        mb->iface = NULL;
+        return r;
+    }
+
+    ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(mb->board));
+    return 1;
+}
+
+static void remove_board(struct multi_context *ctx, struct monitor_board *mb)
+{
+    close_board(ctx, mb);
+
+    ty_log(TY_LOG_INFO, "Stopped monitoring '%s'", ty_board_get_tag(mb->board));
+
+    // Keep the slot so that the ids of other boards do not change
+    for (size_t i = 0; i < ctx->boards.count; i++) {
+        if (ctx->boards.values[i] == mb) {
+            ctx->boards.values[i] = NULL;
+            break;
+        }
+    }
+    ctx->active_count--;
+
+    ty_board_unref(mb->board);
+    free(mb);
+}
+
+static struct monitor_board *find_board(struct multi_context *ctx, ty_board *board)
+{
+    for (size_t i = 0; i < ctx->boards.count; i++) {
+        struct monitor_board *mb = ctx->boards.values[i];
+
+        if (mb && mb->board == board)
+            return mb;
+    }
+
+    return NULL;
+}
+
+static int add_board(struct multi_context *ctx, ty_board *board)
+{
+    struct monitor_board *mb;
+    size_t slot;
+    int r;
+
+    if (find_board(ctx, board))
+        return 0;
+
+    for (slot = 0; slot < ctx->boards.count; slot++) {
+        if (!ctx->boards.values[slot])
+            break;
+    }
+    if (slot == ctx->boards.count) {
+        r = _hs_array_grow(&ctx->boards, 1);
+        if (r < 0)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        ctx->boards.values[ctx->boards.count++] = NULL;
+    }
+
+    mb = calloc(1, sizeof(*mb));
+    if (!mb)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    mb->board = ty_board_ref(board);
+
+    ctx->boards.values[slot] = mb;
+    ctx->active_count++;
+
+    r = open_board(ctx, mb);
+    if (!r)
+        ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
+
+    return 0;
+}
+
+// Boards handle their own failures, one broken board must not stop the others
+static void handle_board_failure(struct multi_context *ctx, struct monitor_board *mb)
+{
+    close_board(ctx, mb);
+
+    if (monitor_reconnect || monitor_all) {
+        ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(mb->board));
+    } else {
+        remove_board(ctx, mb);
+    }
+}
+
+static int multi_board_callback(ty_board *board, ty_monitor_event event, void *udata)
+{
+    struct multi_context *ctx = udata;
+    struct monitor_board *mb = find_board(ctx, board);
+    int r;
+
+    switch (event) {
+        case TY_MONITOR_EVENT_ADDED: {
+            if (!mb && monitor_all && matches_board_tags(board)) {
+                r = add_board(ctx, board);
+                if (r < 0)
+                    return r;
+            }
+        } break;
+
+        case TY_MONITOR_EVENT_CHANGED:
+        case TY_MONITOR_EVENT_DISAPPEARED: {
+            if (!mb)
+                break;
+
+            if (ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
+                open_board(ctx, mb);
+            } else if (mb->iface) {
+                handle_board_failure(ctx, mb);
+            }
+        } break;
+
+        case TY_MONITOR_EVENT_DROPPED: {
+            if (mb)
+                remove_board(ctx, mb);
+        } break;
+    }
+
+    return 0;
+}
+
+static int loop_multi(ty_board **boards, unsigned int boards_count, ty_reactor *reactor,
+                      int outfd)
+{
+    struct multi_context ctx = {0};
+    ty_monitor *monitor;
+    ty_descriptor_set set = {0};
+    int callback_id = -1;
+    char buf[BUFFER_SIZE];
+    int r;
+
+    ctx.reactor = reactor;
+    ctx.outfd = outfd;
+
+    r = get_monitor(&monitor);
+    if (r < 0)
+        return r;
+
+    ty_monitor_get_descriptors(monitor, &set, 1);
+    r = ty_reactor_add_set(reactor, &set);
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_monitor_register_callback(monitor, multi_board_callback, &ctx);
+    if (r < 0)
+        goto cleanup;
+    callback_id = r;
+
+    if (monitor_all) {
+        r = ty_monitor_list(monitor, multi_board_callback, &ctx);
+        if (r < 0)
+            goto cleanup;
+        if (!ctx.active_count)
+            ty_log(TY_LOG_INFO, "Waiting for boards...");
+    } else {
+        for (unsigned int i = 0; i < boards_count; i++) {
+            r = add_board(&ctx, boards[i]);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+    // With --all we keep going until interrupted, boards can come and go
+    while (monitor_all || ctx.active_count) {
+        int timeout = -1;
+        uint64_t now = ty_millis();
+
+        // Serial errors do not always come with a device event, retry once in a while
+        for (size_t i = 0; i < ctx.boards.count; i++) {
+            struct monitor_board *mb = ctx.boards.values[i];
+
+            if (mb && !mb->iface) {
+                if (mb->retry_time <= now) {
+                    open_board(&ctx, mb);
+                    now = ty_millis();
+                }
+                if (!mb->iface && ty_board_has_capability(mb->board, TY_BOARD_CAPABILITY_SERIAL)) {
+                    int delay = (int)(TY_MAX(mb->retry_time, now) - now);
+                    timeout = timeout < 0 ? delay : TY_MIN(timeout, delay);
+                }
+            }
+        }
+
+        r = ty_reactor_wait(reactor, timeout);
+        if (r < 0)
+            goto cleanup;
+
+        if (r == 1) {
+            r = ty_monitor_refresh(monitor);
+            if (r < 0)
+                goto cleanup;
+        } else if (r >= 2) {
+            struct monitor_board *mb = ctx.boards.values[r - 2];
+            ssize_t len;
+
+            if (!mb)
+                continue;
+
+            len = ty_board_serial_read(mb->board, buf, sizeof(buf), 0);
+            if (len < 0) {
+                handle_board_failure(&ctx, mb);
+                continue;
+            }
+
+            r = process_data(&ctx, mb, buf, (size_t)len);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+    r = 0;
+cleanup:
+    if (callback_id >= 0)
+        ty_monitor_deregister_callback(monitor, callback_id);
+    for (size_t i = 0; i < ctx.boards.count; i++) {
+        struct monitor_board *mb = ctx.boards.values[i];
+
+        if (mb) {
+            close_board(&ctx, mb);
+            ty_board_unref(mb->board);
+            free(mb);
+        }
+    }
+    _hs_array_release(&ctx.boards);
+    return r;
+}
+
 int monitor(int argc, char *argv[])
 {
     ty_optline_context optl;
     char *opt;
-    ty_board *board = NULL;
+    ty_board *boards[256];
+    int boards_count = 0;
+    bool multi;
+    ty_reactor *reactor = NULL;
     int outfd = -1;
     int r;
 
@@ -496,6 +1099,27 @@ int monitor(int argc, char *argv[])
                 print_monitor_usage(stderr);
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(opt, "--all") == 0 || strcmp(opt, "-a") == 0) {
+            monitor_all = true;
+        } else if (strcmp(opt, "--format") == 0 || strcmp(opt, "-F") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--format' takes an argument");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(value, "raw") == 0) {
+                monitor_format = FORMAT_RAW;
+            } else if (strcmp(value, "tagged") == 0) {
+                monitor_format = FORMAT_TAGGED;
+            } else if (strcmp(value, "json") == 0) {
+                monitor_format = FORMAT_JSON;
+            } else {
+                ty_log(TY_LOG_ERROR, "--format must be one of: raw, tagged or json");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
         } else if (strcmp(opt, "--raw") == 0 || strcmp(opt, "-r") == 0) {
             monitor_term_flags |= TY_TERMINAL_RAW;
         } else if (strcmp(opt, "--reconnect") == 0 || strcmp(opt, "-R") == 0) {
@@ -530,7 +1154,25 @@ int monitor(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (ty_standard_get_modes(TY_STREAM_INPUT) & TY_DESCRIPTOR_MODE_TERMINAL) {
+    // With --all, boards are picked up as they appear
+    if (!monitor_all) {
+        r = get_boards(false, boards, TY_COUNTOF(boards));
+        if (r < 0)
+            goto cleanup;
+        boards_count = r;
+    }
+
+    multi = monitor_all || boards_count > 1 || (monitor_format != FORMAT_AUTO &&
+                                                monitor_format != FORMAT_RAW);
+    if (multi) {
+        if (monitor_format == FORMAT_AUTO)
+            monitor_format = FORMAT_TAGGED;
+        monitor_directions = DIRECTION_INPUT;
+    } else {
+        monitor_format = FORMAT_RAW;
+    }
+
+    if (!multi && ty_standard_get_modes(TY_STREAM_INPUT) & TY_DESCRIPTOR_MODE_TERMINAL) {
 #ifdef _WIN32
         if (monitor_term_flags & TY_TERMINAL_RAW && !(monitor_term_flags & TY_TERMINAL_SILENT)) {
             monitor_term_flags |= TY_TERMINAL_SILENT;
@@ -565,16 +1207,22 @@ int monitor(int argc, char *argv[])
     if (r < 0)
         goto cleanup;
 
-    r = get_board(&board);
+    r = ty_reactor_new(&reactor);
     if (r < 0)
         goto cleanup;
 
-    r = loop(board, outfd);
+    if (multi) {
+        r = loop_multi(boards, (unsigned int)boards_count, reactor, outfd);
+    } else {
+        r = loop(boards[0], reactor, outfd);
+    }
 
 cleanup:
 #ifdef _WIN32
     stop_stdin_thread();
 #endif
-    ty_board_unref(board);
+    ty_reactor_free(reactor);
+    for (int i = 0; i < boards_count; i++)
+        ty_board_unref(boards[i]);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -9,11 +9,32 @@
    See the LICENSE file for more details. */
 
 #include "../libty/firmware.h"
+#include "../libty/system.h"
 #include "../libty/task.h"
 #include "main.h"
 
+struct upload_board {
+    ty_board *board;
+    ty_task *task;
+
+    uint64_t start;
+    uint64_t end;
+    unsigned int progress_step;
+    char error[256];
+};
+
+struct upload_context {
+    ty_mutex mutex;
+
+    struct upload_board *boards;
+    unsigned int boards_count;
+};
+
+#define MAX_UPLOAD_BOARDS 256
+
 static int upload_flags = 0;
 static const char *upload_firmware_format = NULL;
+static bool upload_all = false;
 
 static void print_upload_usage(FILE *f)
 {
@@ -23,11 +44,15 @@ static void print_upload_usage(FILE *f)
     fprintf(f, "\n");
 
     fprintf(f, "Upload options:\n"
+               "   -a, --all                Upload to all boards matching the --board tags\n"
+               "                            (or to all boards if there is no --board option)\n"
                "   -w, --wait               Wait for the bootloader instead of rebooting\n"
                "       --nocheck            Force upload even if the board is not compatible\n"
                "       --noreset            Do not reset the device once the upload is finished\n"
+               "       --sparse             Skip blocks that only contain erased bytes (0xFF)\n"
                "   -f, --format <format>    Firmware file format (autodetected by default)\n\n"
-               "You can pass multiple firmwares, and the first compatible one will be used.\n\n"
+               "You can pass multiple firmwares, and the first compatible one will be used.\n"
+               "Boards selected with multiple --board options or --all are flashed in parallel.\n\n"
                "Use '-' to read firmware from stdin, in which case you need to specificy the\n"
                "format with -f <format>.\n\n");
 
@@ -37,11 +62,206 @@ static void print_upload_usage(FILE *f)
     fprintf(f, ".\n");
 }
 
+static struct upload_board *find_upload_board(struct upload_context *ctx, const ty_task *task)
+{
+    for (unsigned int i = 0; i < ctx->boards_count; i++) {
+        if (ctx->boards[i].task == task)
+            return &ctx->boards[i];
+    }
+
+    return NULL;
+}
+
+static void upload_message_handler(const ty_message_data *msg, void *udata)
+{
+    struct upload_context *ctx = udata;
+    struct upload_board *ub;
+
+    ty_mutex_lock(&ctx->mutex);
+
+    ub = msg->task ? find_upload_board(ctx, msg->task) : NULL;
+    if (!ub) {
+        ty_message_default_handler(msg, NULL);
+        goto cleanup;
+    }
+
+    switch (msg->type) {
+        case TY_MESSAGE_LOG: {
+            if (msg->u.log.level == TY_LOG_ERROR) {
+                strncpy(ub->error, msg->u.log.msg, sizeof(ub->error));
+                ub->error[sizeof(ub->error) - 1] = 0;
+            }
+            ty_message_default_handler(msg, NULL);
+        } break;
+
+        case TY_MESSAGE_PROGRESS: {
+            /* Carriage return based progress does not work with several boards writing
+               to the same terminal, print a line for every 10% step instead. */
+            unsigned int step = (unsigned int)(10 * msg->u.progress.value / msg->u.progress.max);
+            if (step > ub->progress_step || !msg->u.progress.value) {
+                if (ty_config_verbosity >= TY_LOG_INFO) {
+                    printf("%28s  %s... %u%%\n", msg->ctx, msg->u.progress.action, step * 10);
+                    fflush(stdout);
+                }
+                ub->progress_step = step;
+            }
+        } break;
+
+        case TY_MESSAGE_STATUS: {
+            if (msg->u.task.status == TY_TASK_STATUS_RUNNING) {
+                ub->start = ty_millis();
+            } else if (msg->u.task.status == TY_TASK_STATUS_FINISHED) {
+                ub->end = ty_millis();
+            }
+        } break;
+    }
+
+cleanup:
+    ty_mutex_unlock(&ctx->mutex);
+}
+
+static int check_upload_tasks(ty_monitor *monitor, void *udata)
+{
+    TY_UNUSED(monitor);
+
+    struct upload_context *ctx = udata;
+
+    for (unsigned int i = 0; i < ctx->boards_count; i++) {
+        ty_task *task = ctx->boards[i].task;
+        bool finished;
+
+        if (!task)
+            continue;
+
+        // The status changes in worker threads, read it under the task lock
+        ty_mutex_lock(&task->mutex);
+        finished = task->status == TY_TASK_STATUS_FINISHED;
+        ty_mutex_unlock(&task->mutex);
+
+        if (!finished)
+            return 0;
+    }
+
+    return 1;
+}
+
+static void print_upload_summary(struct upload_context *ctx)
+{
+    printf("\n%-28s %-12s %-8s %s\n", "Board", "Model", "Time", "Result");
+    for (unsigned int i = 0; i < ctx->boards_count; i++) {
+        struct upload_board *ub = &ctx->boards[i];
+        char time_buf[32] = "-";
+
+        if (ub->end > ub->start)
+            snprintf(time_buf, sizeof(time_buf), "%.1f s", (double)(ub->end - ub->start) / 1000.0);
+
+        printf("%-28s %-12s %-8s %s\n", ty_board_get_tag(ub->board),
+               ty_models[ty_board_get_model(ub->board)].name, time_buf,
+               ub->task && !ub->task->ret ? "OK" : (ub->error[0] ? ub->error : "Failed"));
+    }
+    fflush(stdout);
+}
+
+/* Upload tasks run in the pool, but ty_board_wait_for() from worker threads relies on
+   the main thread to refresh the monitor. Do that until every task has finished. */
+static int upload_parallel(ty_board **boards, unsigned int boards_count,
+                           ty_firmware **fws, unsigned int fws_count)
+{
+    struct upload_context ctx = {0};
+    ty_monitor *monitor;
+    ty_pool *pool;
+    unsigned int failures = 0;
+    int r;
+
+    r = ty_mutex_init(&ctx.mutex);
+    if (r < 0)
+        return r;
+
+    ctx.boards = calloc(boards_count, sizeof(*ctx.boards));
+    if (!ctx.boards) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < boards_count; i++)
+        ctx.boards[i].board = boards[i];
+    ctx.boards_count = boards_count;
+
+    r = get_monitor(&monitor);
+    if (r < 0)
+        goto cleanup;
+    r = ty_pool_get_default(&pool);
+    if (r < 0)
+        goto cleanup;
+    if (ty_pool_get_max_threads(pool) < boards_count) {
+        r = ty_pool_set_max_threads(pool, boards_count);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    // Create all the tasks before any of them can run and emit messages
+    for (unsigned int i = 0; i < boards_count; i++) {
+        struct upload_board *ub = &ctx.boards[i];
+
+        r = ty_upload(ub->board, fws, fws_count, upload_flags, &ub->task);
+        if (r < 0) {
+            strncpy(ub->error, ty_error_last_message(), sizeof(ub->error));
+            ub->error[sizeof(ub->error) - 1] = 0;
+        }
+    }
+
+    ty_message_redirect(upload_message_handler, &ctx);
+
+    for (unsigned int i = 0; i < boards_count; i++) {
+        struct upload_board *ub = &ctx.boards[i];
+
+        if (!ub->task)
+            continue;
+
+        r = ty_task_start(ub->task);
+        if (r < 0) {
+            ty_mutex_lock(&ctx.mutex);
+            strncpy(ub->error, ty_error_last_message(), sizeof(ub->error));
+            ub->error[sizeof(ub->error) - 1] = 0;
+            ty_task_unref(ub->task);
+            ub->task = NULL;
+            ty_mutex_unlock(&ctx.mutex);
+        }
+    }
+
+    do {
+        r = ty_monitor_wait(monitor, check_upload_tasks, &ctx, 200);
+    } while (!r);
+    if (r < 0)
+        goto restore;
+
+    for (unsigned int i = 0; i < boards_count; i++) {
+        if (!ctx.boards[i].task || ctx.boards[i].task->ret < 0)
+            failures++;
+    }
+    if (ty_config_verbosity >= TY_LOG_INFO)
+        print_upload_summary(&ctx);
+
+    r = failures ? ty_error(TY_ERROR_OTHER, "Failed to upload to %u of %u boards",
+                            failures, boards_count) : 0;
+
+restore:
+    ty_message_redirect(ty_message_default_handler, NULL);
+cleanup:
+    if (ctx.boards) {
+        for (unsigned int i = 0; i < ctx.boards_count; i++)
+            ty_task_unref(ctx.boards[i].task);
+    }
+    free(ctx.boards);
+    ty_mutex_release(&ctx.mutex);
+    return r;
+}
+
 int upload(int argc, char *argv[])
 {
     ty_optline_context optl;
     char *opt;
-    ty_board *board = NULL;
+    ty_board *boards[MAX_UPLOAD_BOARDS];
+    int boards_count = 0;
     ty_firmware *fws[TY_UPLOAD_MAX_FIRMWARES];
     unsigned int fws_count;
     ty_task *task = NULL;
@@ -52,12 +272,16 @@ int upload(int argc, char *argv[])
         if (strcmp(opt, "--help") == 0) {
             print_upload_usage(stdout);
             return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--all") == 0 || strcmp(opt, "-a") == 0) {
+            upload_all = true;
         } else if (strcmp(opt, "--wait") == 0 || strcmp(opt, "-w") == 0) {
             upload_flags |= TY_UPLOAD_WAIT;
         } else if (strcmp(opt, "--nocheck") == 0) {
             upload_flags |= TY_UPLOAD_NOCHECK;
         } else if (strcmp(opt, "--noreset") == 0) {
             upload_flags |= TY_UPLOAD_NORESET;
+        } else if (strcmp(opt, "--sparse") == 0) {
+            upload_flags |= TY_UPLOAD_SPARSE;
         } else if (strcmp(opt, "--format") == 0 || strcmp(opt, "-f") == 0) {
             upload_firmware_format = ty_optline_get_value(&optl);
             if (!upload_firmware_format) {
@@ -89,20 +313,27 @@ int upload(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    r = get_board(&board);
+    r = get_boards(upload_all, boards, TY_COUNTOF(boards));
     if (r < 0)
         goto cleanup;
+    boards_count = r;
 
-    r = ty_upload(board, fws, fws_count, upload_flags, &task);
-    for (unsigned int i = 0; i < fws_count; i++)
-        ty_firmware_unref(fws[i]);
+    if (boards_count > 1) {
+        r = upload_parallel(boards, (unsigned int)boards_count, fws, fws_count);
+        goto cleanup;
+    }
+
+    r = ty_upload(boards[0], fws, fws_count, upload_flags, &task);
     if (r < 0)
         goto cleanup;
 
     r = ty_task_join(task);
 
 cleanup:
+    for (unsigned int i = 0; i < fws_count; i++)
+        ty_firmware_unref(fws[i]);
     ty_task_unref(task);
-    ty_board_unref(board);
+    for (int i = 0; i < boards_count; i++)
+        ty_board_unref(boards[i]);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -12,10 +12,6 @@
 #include <QDateTime>
 #include <QDir>
 #include <QFileInfo>
-#include <QMutexLocker>
-#include <QPlainTextDocumentLayout>
-#include <QTextBlock>
-#include <QTextCursor>
 
 #include "board.hpp"
 #include "../libhs/device.h"
@@ -27,26 +23,12 @@
 using namespace std;
 
 #define MAX_RECENT_FIRMWARES 4
-#define SERIAL_LOG_DELIMITER "\n@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
+#define DEFAULT_SERIAL_BUFFER_SIZE 1048576
 
 Board::Board(ty_board *board, QObject *parent)
-    : QObject(parent), board_(ty_board_ref(board))
+    : QObject(parent), board_(ty_board_ref(board)), serial_ring_(DEFAULT_SERIAL_BUFFER_SIZE),
+      serial_log_(make_shared<SerialLog>())
 {
-    serial_document_.setDocumentLayout(new QPlainTextDocumentLayout(&serial_document_));
-    serial_document_.setUndoRedoEnabled(false);
-
-    /* Doing font changes in Board is ugly, but the whole shared serial document thing
-       we do is ugly and will need to change eventually. */
-    {
-        QFont font("monospace", 9);
-        if (!QFontInfo(font).fixedPitch()) {
-            font.setStyleHint(QFont::Monospace);
-            if (!QFontInfo(font).fixedPitch())
-                font.setStyleHint(QFont::TypeWriter);
-        }
-        serial_document_.setDefaultFont(font);
-    }
-
     // The monitor will move the serial notifier to a dedicated thread
     connect(&serial_notifier_, &DescriptorNotifier::activated, this, &Board::serialReceived,
             Qt::DirectConnection);
@@ -54,10 +36,16 @@ Board::Board(ty_board *board, QObject *parent)
     error_timer_.setInterval(TY_SHOW_ERROR_TIMEOUT);
     error_timer_.setSingleShot(true);
     connect(&error_timer_, &QTimer::timeout, this, &Board::updateStatus);
+
+    connect(serial_log_.get(), &SerialLog::error, this, [=](const QString &msg) {
+        notifyLog(TY_LOG_ERROR, msg);
+        emit settingsChanged();
+    });
 }
 
 Board::~Board()
 {
+    stopSerialReader();
     ty_board_interface_close(serial_iface_);
     ty_board_unref(board_);
 }
@@ -88,7 +76,7 @@ void Board::loadSettings(Monitor *monitor)
     }
     serial_decoder_.reset(serial_codec_->makeDecoder());
     clear_on_reset_ = db_.get("clearOnReset", false).toBool();
-    serial_document_.setMaximumBlockCount(db_.get("scrollBackLimit", 200000).toInt());
+    serial_store_.setMaximumLines(db_.get("scrollBackLimit", 200000).toULongLong());
     {
         bool default_serial;
         if (model() != TY_MODEL_GENERIC && monitor) {
@@ -101,6 +89,22 @@ void Board::loadSettings(Monitor *monitor)
     serial_log_size_ = db_.get(
         "serialLogSize",
         static_cast<quint64>(monitor ? monitor->serialLogSize() : 0)).toULongLong();
+    {
+        auto buffer_size = static_cast<size_t>(
+            db_.get("serialBufferSize", DEFAULT_SERIAL_BUFFER_SIZE).toULongLong());
+        if (buffer_size != serial_ring_.size()) {
+            /* This also runs when the board interfaces change, the reader may be writing to
+               the ring at this point. Stop it while we replace the buffer. */
+            if (serial_iface_)
+                stopSerialReader();
+            serial_ring_.reset(buffer_size);
+            if (serial_iface_) {
+                ty_descriptor_set set = {};
+                ty_board_interface_get_descriptors(serial_iface_, &set, 1);
+                startSerialReader(&set);
+            }
+        }
+    }
 
     /* Even if the user decides to enable persistence for ambiguous identifiers,
        we still don't want to cache the board model. */
@@ -231,6 +235,10 @@ void Board::updateStatus()
         icon_name = ":/board_other";
         break;
     }
+    if (serial_overrun_shown_)
+        status_text_ += tr(" [%1 serial bytes lost]").arg(serial_overrun_shown_);
+    if (serial_log_dropped_shown_)
+        status_text_ += tr(" [%1 bytes missing from log]").arg(serial_log_dropped_shown_);
 
     if (errorOccured()) {
         icon_name = ":/board_error";
@@ -309,10 +317,25 @@ TaskInterface Board::upload(const vector<shared_ptr<Firmware>> &fws, bool reset_
 
     auto task2 = make_task<TyTask>(task);
     watchTask(task2);
+    connect(&task_watcher_, &TaskWatcher::started, this, [=]() {
+        upload_timer_.start();
+        // Nothing to wait for if the board is already in bootloader mode
+        if (hasCapability(TY_BOARD_CAPABILITY_UPLOAD)) {
+            bootloader_timer_.invalidate();
+        } else {
+            bootloader_timer_.start();
+        }
+    });
     connect(&task_watcher_, &TaskWatcher::finished, this,
             [=](bool success, shared_ptr<void> result) {
-        if (success)
+        if (success) {
             addUploadedFirmware(static_cast<ty_firmware *>(result.get()));
+            if (upload_timer_.isValid())
+                BoardMetrics::observe(metrics_.upload_duration,
+                                      static_cast<double>(upload_timer_.nsecsElapsed()) / 1e9);
+        }
+        upload_timer_.invalidate();
+        bootloader_timer_.invalidate();
     });
 
     return task2;
@@ -354,7 +377,14 @@ TaskInterface Board::sendSerial(const QByteArray &buf)
         return watchTask(make_task<FailedTask>(ty_error_last_message()));
     task->pool = pool_;
 
-    return watchTask(make_task<TyTask>(task));
+    auto task2 = watchTask(make_task<TyTask>(task));
+    auto size = static_cast<uint64_t>(buf.size());
+    connect(&task_watcher_, &TaskWatcher::finished, this, [=](bool success, shared_ptr<void>) {
+        if (success)
+            BoardMetrics::add(metrics_.serial_sent, size);
+    });
+
+    return task2;
 }
 
 TaskInterface Board::sendSerial(const QString &s)
@@ -372,21 +402,25 @@ TaskInterface Board::sendFile(const QString &filename)
         return watchTask(make_task<FailedTask>(ty_error_last_message()));
     task->pool = pool_;
 
-    return watchTask(make_task<TyTask>(task));
+    auto task2 = watchTask(make_task<TyTask>(task));
+    connect(&task_watcher_, &TaskWatcher::finished, this, [=](bool success, shared_ptr<void>) {
+        if (success) {
+            auto size = QFileInfo(filename).size();
+            BoardMetrics::add(metrics_.serial_sent, static_cast<uint64_t>(size));
+        }
+    });
+
+    return task2;
 }
 
 void Board::appendFakeSerialRead(const QString &s)
 {
-    if (serial_log_file_.isOpen()) {
+    if (serial_log_->isOpen()) {
         auto buf = serial_codec_->fromUnicode(s);
-        QMutexLocker locker(&serial_lock_);
-        writeToSerialLog(buf.constData(), buf.size());
-        locker.unlock();
+        writeToSerialLog(buf.constData(), static_cast<size_t>(buf.size()));
     }
 
-    QTextCursor cursor(&serial_document_);
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertText(s);
+    serial_store_.appendText(s);
 }
 
 void Board::setTag(const QString &tag)
@@ -467,10 +501,10 @@ void Board::setClearOnReset(bool clear_on_reset)
 
 void Board::setScrollBackLimit(unsigned int limit)
 {
-    if (static_cast<int>(limit) == serial_document_.maximumBlockCount())
+    if (limit == serial_store_.maximumLines())
         return;
 
-    serial_document_.setMaximumBlockCount(static_cast<int>(limit));
+    serial_store_.setMaximumLines(limit);
 
     db_.put("scrollBackLimit", limit);
     emit settingsChanged();
@@ -567,101 +601,143 @@ void Board::notifyLog(ty_log_level level, const QString &msg)
     }
 }
 
+// Called from the notifier thread
 void Board::serialReceived(ty_descriptor desc)
 {
     Q_UNUSED(desc);
 
-    QMutexLocker locker(&serial_lock_);
+    if (!readSerial())
+        serial_notifier_.clear();
+}
 
+// Called from the reader thread, returns false when the interface cannot be read anymore
+bool Board::readSerial()
+{
     ty_error_mask(TY_ERROR_MODE);
     ty_error_mask(TY_ERROR_IO);
 
-    size_t previous_len = serial_buf_len_;
+    bool received = false;
+    bool success = true;
     /* On OSX El Capitan (at least), serial device reads are often partial (512 and 1020 bytes
        reads happen pretty often), so try hard to empty the OS buffer. The Qt event loop may not
        give us back control before some time, and we want to avoid buffer overruns. */
     for (unsigned int i = 0; i < 4; i++) {
-        if (serial_buf_len_ == sizeof(serial_buf_))
-            break;
+        char *ptr;
+        size_t len = serial_ring_.writeSpan(&ptr);
+
+        /* When the GUI thread falls behind, keep reading (and logging) but drop the data
+           instead of leaving it to overflow the OS buffer. The board status shows how much
+           was lost. */
+        bool overrun = !len;
+        if (overrun) {
+            ptr = serial_overrun_buf_;
+            len = sizeof(serial_overrun_buf_);
+        }
 
-        int r = ty_board_serial_read(board_, serial_buf_ + serial_buf_len_,
-                                     sizeof(serial_buf_) - serial_buf_len_, 0);
+        int r = ty_board_serial_read(board_, ptr, len, 0);
         if (r < 0) {
-            serial_notifier_.clear();
+            success = false;
             break;
         }
         if (!r)
             break;
-        serial_buf_len_ += static_cast<size_t>(r);
+
+        if (serial_log_->isOpen())
+            writeToSerialLog(ptr, static_cast<size_t>(r));
+        BoardMetrics::add(metrics_.serial_received, static_cast<uint64_t>(r));
+        {
+            lock_guard<mutex> locker(serial_subscribers_mutex_);
+            for (auto &ring: serial_subscribers_)
+                ring->write(ptr, static_cast<size_t>(r));
+        }
+
+        if (overrun) {
+            serial_ring_.addOverrun(static_cast<size_t>(r));
+        } else {
+            serial_ring_.commit(static_cast<size_t>(r));
+        }
+        received = true;
     }
 
     ty_error_unmask();
     ty_error_unmask();
 
-    if (serial_log_file_.isOpen())
-        writeToSerialLog(serial_buf_ + previous_len, serial_buf_len_ - previous_len);
-
-    locker.unlock();
-
-    if (!previous_len && serial_buf_len_)
+    if (received && !serial_pending_.exchange(true))
         QMetaObject::invokeMethod(this, "appendBufferToSerialDocument", Qt::QueuedConnection);
+
+    return success;
 }
 
-// You need to lock serial_lock_ before you call this
-void Board::writeToSerialLog(const char *buf, size_t len)
+shared_ptr<RingBuffer> Board::subscribeSerial(size_t size)
 {
-    serial_log_file_.unsetError();
+    auto ring = make_shared<RingBuffer>(size);
 
-    qint64 pos = serial_log_file_.pos();
-    if (pos + len > serial_log_size_) {
-        auto part_len = serial_log_size_ - pos;
-        serial_log_file_.write(buf, part_len);
-        serial_log_file_.seek(0);
-        serial_log_file_.write(buf + part_len, len - part_len);
-    } else {
-        serial_log_file_.write(buf, len);
-    }
+    lock_guard<mutex> locker(serial_subscribers_mutex_);
+    serial_subscribers_.push_back(ring);
 
-    if (!serial_log_file_.atEnd()) {
-        pos = serial_log_file_.pos();
-        if (pos + sizeof(SERIAL_LOG_DELIMITER) >= serial_log_size_) {
-            serial_log_file_.resize(pos);
-            serial_log_file_.seek(0);
-        } else {
-            serial_log_file_.write(SERIAL_LOG_DELIMITER);
-            serial_log_file_.seek(pos);
-        }
-    }
+    return ring;
+}
 
-    if (serial_log_file_.error() != QFileDevice::NoError) {
-        auto error_msg = QString("Closed serial log file after error: %1")
-                         .arg(serial_log_file_.errorString());
-        ty_log(TY_LOG_ERROR, "%s", error_msg.toUtf8().constData());
-        QMetaObject::invokeMethod(this, "notifyLog", Qt::QueuedConnection,
-                                  Q_ARG(ty_log_level, TY_LOG_ERROR), Q_ARG(QString, error_msg));
+void Board::unsubscribeSerial(const shared_ptr<RingBuffer> &ring)
+{
+    lock_guard<mutex> locker(serial_subscribers_mutex_);
+    serial_subscribers_.erase(remove(serial_subscribers_.begin(), serial_subscribers_.end(), ring),
+                              serial_subscribers_.end());
+}
 
-        serial_log_file_.close();
-        emit settingsChanged();
+// Called from the reader thread, this must not wait for the disk
+void Board::writeToSerialLog(const char *buf, size_t len)
+{
+    if (serial_log_writer_ && serial_log_writer_->isRunning()) {
+        serial_log_writer_->append(serial_log_, buf, len);
+    } else {
+        serial_log_->write(buf, len, QDateTime::currentMSecsSinceEpoch());
     }
 }
 
 void Board::appendBufferToSerialDocument()
 {
-    QMutexLocker locker(&serial_lock_);
-    auto str = serial_decoder_->toUnicode(serial_buf_, static_cast<int>(serial_buf_len_));
-    serial_buf_len_ = 0;
-    locker.unlock();
+    // Anything committed after this will queue another call
+    serial_pending_ = false;
 
-    QTextCursor cursor(&serial_document_);
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertText(str);
+    QString str;
+    // Two spans at most, when the readable data wraps around the end of the ring
+    for (unsigned int i = 0; i < 2; i++) {
+        const char *ptr;
+        size_t len = serial_ring_.readSpan(&ptr);
+        if (!len)
+            break;
+
+        str += serial_decoder_->toUnicode(ptr, static_cast<int>(len));
+        serial_ring_.consume(len);
+    }
+
+    if (!str.isEmpty())
+        serial_store_.appendText(str);
+    // Only the GUI thread modifies the list, no need for the lock to read it here
+    if (!serial_subscribers_.empty())
+        emit serialAvailable();
+
+    uint64_t overrun = serial_ring_.overrun();
+    uint64_t log_dropped = serial_log_->dropped();
+    if (overrun != serial_overrun_shown_ || log_dropped != serial_log_dropped_shown_) {
+        // Both counters only ever grow
+        BoardMetrics::add(metrics_.serial_dropped, (overrun - serial_overrun_shown_) +
+                                                   (log_dropped - serial_log_dropped_shown_));
+
+        serial_overrun_shown_ = overrun;
+        serial_log_dropped_shown_ = log_dropped;
+        updateStatus();
+    }
 }
 
 void Board::notifyFinished(bool success, std::shared_ptr<void> result)
 {
-    Q_UNUSED(success);
     Q_UNUSED(result);
 
+    if (!success)
+        BoardMetrics::add(metrics_.task_failures, 1);
+
     task_ = TaskInterface();
     task_watcher_.setTask(nullptr);
 
@@ -670,6 +746,12 @@ void Board::notifyFinished(bool success, std::shared_ptr<void> result)
 
 void Board::refreshBoard()
 {
+    if (bootloader_timer_.isValid() && hasCapability(TY_BOARD_CAPABILITY_UPLOAD)) {
+        BoardMetrics::observe(metrics_.bootloader_wait,
+                              static_cast<double>(bootloader_timer_.nsecsElapsed()) / 1e9);
+        bootloader_timer_.invalidate();
+    }
+
     updateSerialInterface();
 
     if (ty_board_get_status(board_) == TY_BOARD_STATUS_DROPPED) {
@@ -680,7 +762,7 @@ void Board::refreshBoard()
     if (clear_on_reset_) {
         if (hasCapability(TY_BOARD_CAPABILITY_SERIAL)) {
             if (serial_clear_when_available_) {
-                serial_document_.clear();
+                serial_store_.clear();
                 updateSerialLogState(true);
             }
             serial_clear_when_available_ = false;
@@ -714,8 +796,11 @@ bool Board::openSerialInterface()
     }
     if (!r)
         return false;
+    if (serial_opened_)
+        BoardMetrics::add(metrics_.serial_reconnects, 1);
+    serial_opened_ = true;
     ty_board_interface_get_descriptors(serial_iface_, &set, 1);
-    serial_notifier_.setDescriptorSet(&set);
+    startSerialReader(&set);
 
     // TODO: Make serial settings (mainly speed) configurable in the GUI
     hs_device *dev = ty_board_interface_get_device(serial_iface_);
@@ -734,37 +819,63 @@ void Board::closeSerialInterface()
     if (!serial_iface_)
         return;
 
-    serial_notifier_.clear();
+    stopSerialReader();
     ty_board_interface_close(serial_iface_);
     serial_iface_ = nullptr;
 }
 
+void Board::startSerialReader(ty_descriptor_set *set)
+{
+    if (serial_reactor_ && serial_reactor_->isRunning() && set->count) {
+        auto desc = set->desc[0];
+        serial_reactor_id_ = serial_reactor_->add(desc, [=]() { return readSerial(); });
+        if (serial_reactor_id_)
+            return;
+    }
+
+    serial_notifier_.setDescriptorSet(set);
+}
+
+/* GUI thread only. Once this returns, the reader is not running anymore, even if it had
+   stopped itself after a read error. */
+void Board::stopSerialReader()
+{
+    if (serial_reactor_id_) {
+        serial_reactor_->remove(serial_reactor_id_);
+        serial_reactor_id_ = 0;
+    }
+    serial_notifier_.clear();
+}
+
+// GUI thread only, picks the event loop if the reactor is not running anymore
+void Board::restartSerialReader()
+{
+    ty_descriptor_set set = {};
+
+    if (!serial_reactor_id_)
+        return;
+
+    stopSerialReader();
+    ty_board_interface_get_descriptors(serial_iface_, &set, 1);
+    startSerialReader(&set);
+}
+
 void Board::updateSerialLogState(bool new_file)
 {
     if (!hasCapability(TY_BOARD_CAPABILITY_UNIQUE)) {
         return;
     }
 
-    QMutexLocker locker(&serial_lock_);
-
-    if (serial_log_file_.fileName().isEmpty() || new_file) {
-        serial_log_file_.close();
-        serial_log_file_.setFileName(findLogFilename(id(), 4));
+    QString filename;
+    if (serial_log_filename_.isEmpty() || new_file) {
+        filename = findLogFilename(id(), 4);
+        serial_log_filename_ = filename;
     }
-
-    if (serial_log_size_) {
-        if (!serial_log_file_.isOpen()) {
-            if (!serial_log_file_.open(QIODevice::WriteOnly)) {
-                ty_log(TY_LOG_ERROR, "Cannot open board log '%s' for writing",
-                       serial_log_file_.fileName().toUtf8().constData());
-            }
-        }
-        if (serial_log_file_.isOpen() &&
-                static_cast<size_t>(serial_log_file_.size()) > serial_log_size_)
-            serial_log_file_.resize(serial_log_size_);
+    // Pending data belongs to the previous file, the writer keeps things in order
+    if (serial_log_writer_) {
+        serial_log_writer_->update(serial_log_, filename, serial_log_size_);
     } else {
-        serial_log_file_.close();
-        serial_log_file_.remove();
+        serial_log_->update(filename, serial_log_size_);
     }
 }
 
@@ -11,24 +11,30 @@
 #ifndef BOARD_HH
 #define BOARD_HH
 
+#include <QElapsedTimer>
 #include <QFile>
 #include <QIcon>
-#include <QMutex>
 #include <QStringList>
 #include <QTextCodec>
 #include <QTextDecoder>
-#include <QTextDocument>
 #include <QThread>
 #include <QTimer>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "../libty/board.h"
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
 #include "firmware.hpp"
+#include "line_store.hpp"
+#include "metrics_server.hpp"
 #include "../libty/monitor.h"
+#include "ring_buffer.hpp"
+#include "serial_log.hpp"
+#include "serial_reactor.hpp"
 #include "task.hpp"
 
 class Monitor;
@@ -51,15 +57,34 @@ class Board : public QObject, public std::enable_shared_from_this<Board> {
     ty_board *board_;
 
     ty_board_interface *serial_iface_ = nullptr;
+    // Serial reads go through the reactor when the monitor has one, or the notifier
+    SerialReactor *serial_reactor_ = nullptr;
+    // Only the GUI thread adds and removes the reactor handler
+    uint64_t serial_reactor_id_ = 0;
     DescriptorNotifier serial_notifier_;
     QTextCodec *serial_codec_;
     std::unique_ptr<QTextDecoder> serial_decoder_;
-    QMutex serial_lock_;
-    char serial_buf_[262144];
-    size_t serial_buf_len_ = 0;
-    QTextDocument serial_document_;
-    QFile serial_log_file_;
+    // The reader thread fills serial_ring_, the GUI thread drains it
+    RingBuffer serial_ring_;
+    std::atomic_bool serial_pending_ {false};
+    char serial_overrun_buf_[16384];
+    uint64_t serial_overrun_shown_ = 0;
+    LineStore serial_store_;
+    // Written by the log writer thread when there is one, or synchronously
+    std::shared_ptr<SerialLog> serial_log_;
+    SerialLogWriter *serial_log_writer_ = nullptr;
+    // The log itself switches files asynchronously, in the writer thread
+    QString serial_log_filename_;
+    uint64_t serial_log_dropped_shown_ = 0;
     bool serial_clear_when_available_ = false;
+    // Extra copies of the serial stream (for remote clients), see subscribeSerial()
+    std::mutex serial_subscribers_mutex_;
+    std::vector<std::shared_ptr<RingBuffer>> serial_subscribers_;
+    bool serial_opened_ = false;
+
+    BoardMetrics metrics_;
+    QElapsedTimer upload_timer_;
+    QElapsedTimer bootloader_timer_;
 
     QTimer error_timer_;
 
@@ -120,13 +145,16 @@ public:
     QString serialCodecName() const { return serial_codec_name_; }
     QTextCodec *serialCodec() const { return serial_codec_; }
     bool clearOnReset() const { return clear_on_reset_; }
-    unsigned int scrollBackLimit() const { return serial_document_.maximumBlockCount(); }
+    unsigned int scrollBackLimit() const { return static_cast<unsigned int>(serial_store_.maximumLines()); }
     bool enableSerial() const { return enable_serial_; }
     size_t serialLogSize() const { return serial_log_size_; }
-    QString serialLogFilename() const { return serial_log_file_.fileName(); }
+    size_t serialBufferSize() const { return serial_ring_.size(); }
+    uint64_t serialOverrun() const { return serial_ring_.overrun(); }
+    uint64_t serialLogDropped() const { return serial_log_->dropped(); }
+    QString serialLogFilename() const { return serial_log_filename_; }
 
     bool serialOpen() const { return serial_iface_; }
-    QTextDocument &serialDocument() { return serial_document_; }
+    LineStore &serialStore() { return serial_store_; }
 
     static QStringList makeCapabilityList(uint16_t capabilities);
     static QString makeCapabilityString(uint16_t capabilities, QString empty_str = QString());
@@ -142,6 +170,12 @@ public:
 
     void appendFakeSerialRead(const QString &s);
 
+    /* Each subscriber gets its own copy of the raw serial data, drain it when serialAvailable()
+       is emitted. Reads that do not fit in the ring are dropped for this subscriber only, and
+       counted in RingBuffer::overrun(). */
+    std::shared_ptr<RingBuffer> subscribeSerial(size_t size);
+    void unsubscribeSerial(const std::shared_ptr<RingBuffer> &ring);
+
     TaskInterface task() const { return task_; }
     ty_task_status taskStatus() const { return task_.status(); }
 
@@ -174,6 +208,7 @@ signals:
     void interfacesChanged();
     void statusChanged();
     void progressChanged();
+    void serialAvailable();
 
     void dropped();
 
@@ -191,13 +226,20 @@ private:
     QString findLogFilename(const QString &id, unsigned int max);
 
     void setThreadPool(ty_pool *pool) { pool_ = pool; }
+    void setSerialReactor(SerialReactor *reactor) { serial_reactor_ = reactor; }
+    void setSerialLogWriter(SerialLogWriter *writer) { serial_log_writer_ = writer; }
+    void setMetrics(const BoardMetrics &metrics) { metrics_ = metrics; }
 
+    bool readSerial();
     void writeToSerialLog(const char *buf, size_t len);
 
     void refreshBoard();
     bool updateSerialInterface();
     bool openSerialInterface();
     void closeSerialInterface();
+    void startSerialReader(ty_descriptor_set *set);
+    void stopSerialReader();
+    void restartSerialReader();
     void updateSerialLogState(bool new_file);
 
     void addUploadedFirmware(ty_firmware *fw);
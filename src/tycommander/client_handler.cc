@@ -26,6 +26,12 @@
 
 using namespace std;
 
+// Per-client copy of the serial stream, what does not fit is dropped for this client only
+#define STREAM_QUEUE_SIZE 262144
+// Stop feeding the socket above this, so that a stuck client fills its queue instead of our memory
+#define STREAM_SOCKET_LIMIT 262144
+#define STREAM_FRAME_SIZE 65536
+
 const QHash<QString, void (ClientHandler::*)(const QStringList &)> ClientHandler::commands_ = {
     {"workdir", &ClientHandler::setWorkingDirectory},
     {"multi",   &ClientHandler::setMultiSelection},
@@ -36,7 +42,8 @@ const QHash<QString, void (ClientHandler::*)(const QStringList &)> ClientHandler
     {"reboot",  &ClientHandler::reboot},
     {"upload",  &ClientHandler::upload},
     {"attach",  &ClientHandler::attach},
-    {"detach",  &ClientHandler::detach}
+    {"detach",  &ClientHandler::detach},
+    {"stream",  &ClientHandler::stream}
 };
 
 ClientHandler::ClientHandler(unique_ptr<SessionPeer> peer, QObject *parent)
@@ -50,6 +57,14 @@ ClientHandler::ClientHandler(unique_ptr<SessionPeer> peer, QObject *parent)
 #endif
 }
 
+ClientHandler::~ClientHandler()
+{
+    for (auto &stream: streams_) {
+        if (auto board = stream.board.lock())
+            board->unsubscribeSerial(stream.ring);
+    }
+}
+
 void ClientHandler::execute(const QStringList &arguments)
 {
     if (arguments.isEmpty()) {
@@ -256,6 +271,33 @@ void ClientHandler::detach(const QStringList &)
     notifyFinished(true);
 }
 
+/* Raw serial data goes to the client in binary frames, until it disconnects or all the
+   boards are gone. The boards keep a single reader, the GUI and every client share it. */
+void ClientHandler::stream(const QStringList &)
+{
+    auto boards = selectedBoards();
+    if (boards.empty())
+        return;
+
+    for (auto &board: boards) {
+        // Boards in bootloader mode are fine, data will flow once the serial interface is back
+        board->setEnableSerial(true, persist_);
+
+        SerialStream stream;
+        stream.board = board;
+        stream.tag = board->tag();
+        stream.ring = board->subscribeSerial(STREAM_QUEUE_SIZE);
+        streams_.push_back(stream);
+
+        connect(board.get(), &Board::serialAvailable, this, &ClientHandler::flushStreams);
+        auto ptr = board.get();
+        connect(board.get(), &Board::dropped, this, [=]() { closeStream(ptr); });
+    }
+
+    connect(peer_.get(), &SessionPeer::written, this, &ClientHandler::flushStreams,
+            Qt::UniqueConnection);
+}
+
 /* This function is static because it can be called after the client is gone (and the
    handler destroyed), such as if the user does not wait for the board selection dialog.
    This means we cannot use notify*() methods in there, hence the use of pseudo-tasks
@@ -407,3 +449,48 @@ void ClientHandler::executeTasks()
     for (auto &task: tasks_)
         task.start();
 }
+
+void ClientHandler::flushStreams()
+{
+    for (auto &stream: streams_) {
+        bool empty = false;
+        while (peer_->bytesToWrite() < STREAM_SOCKET_LIMIT) {
+            const char *ptr;
+            size_t len = stream.ring->readSpan(&ptr);
+            if (!len) {
+                empty = true;
+                break;
+            }
+
+            len = min(len, static_cast<size_t>(STREAM_FRAME_SIZE));
+            peer_->sendBinary(QByteArray(ptr, static_cast<int>(len)));
+            stream.ring->consume(len);
+        }
+
+        // Report the gap once the client has caught up, not once per read while it is stuck
+        uint64_t dropped = stream.ring->overrun();
+        if (empty && dropped != stream.dropped_shown) {
+            peer_->send({"log", stream.tag, QString::number(TY_LOG_WARNING),
+                         tr("Dropped %1 bytes of serial data, client is too slow")
+                         .arg(dropped - stream.dropped_shown)});
+            stream.dropped_shown = dropped;
+        }
+    }
+}
+
+void ClientHandler::closeStream(Board *board)
+{
+    flushStreams();
+
+    auto it = find_if(streams_.begin(), streams_.end(), [&](const SerialStream &stream) {
+        return stream.board.lock().get() == board;
+    });
+    if (it == streams_.end())
+        return;
+
+    board->unsubscribeSerial(it->ring);
+    streams_.erase(it);
+
+    if (streams_.empty())
+        notifyFinished(true);
+}
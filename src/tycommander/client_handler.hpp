@@ -16,6 +16,7 @@
 #include <memory>
 #include <vector>
 
+#include "ring_buffer.hpp"
 #include "session_channel.hpp"
 #include "task.hpp"
 
@@ -35,11 +36,20 @@ class ClientHandler : public QObject {
 
     std::vector<TaskInterface> tasks_;
 
+    struct SerialStream {
+        std::weak_ptr<Board> board;
+        QString tag;
+        std::shared_ptr<RingBuffer> ring;
+        uint64_t dropped_shown = 0;
+    };
+    std::vector<SerialStream> streams_;
+
     unsigned int finished_tasks_ = 0;
     unsigned int error_count_ = 0;
 
 public:
     ClientHandler(std::unique_ptr<SessionPeer> peer, QObject *parent = nullptr);
+    virtual ~ClientHandler();
 
     void execute(const QStringList &parameters);
 
@@ -57,6 +67,7 @@ private:
     void upload(const QStringList &parameters);
     void attach(const QStringList &parameters);
     void detach(const QStringList &parameters);
+    void stream(const QStringList &parameters);
 
     static std::vector<TaskInterface> makeUploadTasks(
         const std::vector<std::shared_ptr<Board>> &boards, const QStringList &filenames);
@@ -70,6 +81,9 @@ private:
 
     void addTask(TaskInterface task);
     void executeTasks();
+
+    void flushStreams();
+    void closeStream(Board *board);
 };
 
 #endif
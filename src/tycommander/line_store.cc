@@ -0,0 +1,276 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+
+#include "line_store.hpp"
+
+using namespace std;
+
+#define CHUNK_SIZE 65536
+#define MAX_MEMORY_CHUNKS 16
+#define MAX_MAPPED_CHUNKS 8
+#define MAX_LINE_LENGTH 4096
+#define TAB_WIDTH 8
+/* Chunks are closed once they reach CHUNK_SIZE (line data and ends), and the last line can
+   take up to TAB_WIDTH bytes per character (tab expansion) plus its end and the padding. */
+#define SPILL_SLOT_SIZE (CHUNK_SIZE + MAX_LINE_LENGTH * TAB_WIDTH + 8)
+
+LineStore::~LineStore()
+{
+    for (auto &chunk: chunks_) {
+        if (chunk.map)
+            spill_file_.unmap(chunk.map);
+    }
+}
+
+const char *LineStore::lineData(const Chunk &chunk, size_t idx, size_t *rlen) const
+{
+    const char *base;
+    const uint32_t *line_ends;
+    if (chunk.spilled) {
+        if (!mapChunk(chunk))
+            return nullptr;
+        base = reinterpret_cast<const char *>(chunk.map);
+        line_ends = reinterpret_cast<const uint32_t *>(chunk.map + chunk.ends_offset);
+    } else {
+        base = chunk.data.constData();
+        line_ends = chunk.ends.data();
+    }
+    uint32_t start = idx ? line_ends[idx - 1] : 0;
+
+    *rlen = line_ends[idx] - start;
+    return base + start;
+}
+
+// The view only asks for visible lines, keep the mappings of the last chunks it used
+bool LineStore::mapChunk(const Chunk &chunk) const
+{
+    if (!chunk.map) {
+        if (mapped_chunks_ >= MAX_MAPPED_CHUNKS) {
+            const Chunk *lru = nullptr;
+            for (auto &chunk2: chunks_) {
+                if (chunk2.map && (!lru || chunk2.map_use < lru->map_use))
+                    lru = &chunk2;
+            }
+            spill_file_.unmap(lru->map);
+            lru->map = nullptr;
+            mapped_chunks_--;
+        }
+
+        chunk.map = spill_file_.map(chunk.spill_offset, chunk.spill_len);
+        if (!chunk.map) {
+            qWarning("Cannot map scrollback file");
+            return false;
+        }
+        mapped_chunks_++;
+    }
+    chunk.map_use = ++map_clock_;
+
+    return true;
+}
+
+void LineStore::setMaximumLines(uint64_t max_lines)
+{
+    max_lines_ = max_lines;
+
+    if (max_lines_ && lineCount() > max_lines_) {
+        dropOldLines();
+        emit appended();
+    }
+}
+
+QString LineStore::line(uint64_t idx) const
+{
+    if (idx == end_line_)
+        return partial_;
+    if (idx < first_line_ || idx > end_line_)
+        return QString();
+
+    auto it = upper_bound(chunks_.begin(), chunks_.end(), idx,
+                          [](uint64_t idx, const Chunk &chunk) { return idx < chunk.first_line; });
+    const Chunk &chunk = *--it;
+
+    size_t len;
+    const char *data = lineData(chunk, static_cast<size_t>(idx - chunk.first_line), &len);
+    if (!data)
+        return QString();
+    return QString::fromUtf8(data, static_cast<int>(len));
+}
+
+void LineStore::appendText(const QString &str)
+{
+    int start = 0;
+    while (start < str.length()) {
+        int end = str.indexOf('\n', start);
+        int len = (end >= 0 ? end : str.length()) - start;
+
+        // Wrap long lines, neither partial_ nor the chunks may grow without limit
+        int room = MAX_LINE_LENGTH - partial_.length();
+        if (len > room) {
+            if (room > 1 && str[start + room - 1].isHighSurrogate())
+                room--;
+            partial_ += str.midRef(start, room);
+            commitLine(partial_);
+            partial_.clear();
+
+            start += room;
+            continue;
+        }
+
+        partial_ += str.midRef(start, len);
+        if (end < 0)
+            break;
+        commitLine(partial_);
+        partial_.clear();
+
+        start = end + 1;
+    }
+    max_length_ = max(max_length_, partial_.length());
+
+    dropOldLines();
+    emit appended();
+}
+
+void LineStore::clear()
+{
+    for (auto &chunk: chunks_) {
+        if (chunk.map)
+            spill_file_.unmap(chunk.map);
+    }
+    chunks_.clear();
+    memory_chunks_ = 0;
+    mapped_chunks_ = 0;
+    spill_slots_ = 0;
+    free_slots_.clear();
+    if (spill_file_.isOpen())
+        spill_file_.resize(0);
+
+    first_line_ = 0;
+    end_line_ = 0;
+    partial_.clear();
+    max_length_ = 0;
+
+    emit cleared();
+}
+
+void LineStore::commitLine(const QString &line)
+{
+    // Expand tabs and drop carriage returns, so that characters map to columns
+    QString clean;
+    clean.reserve(line.length());
+    for (auto c: line) {
+        if (c == '\t') {
+            clean.append(QString(TAB_WIDTH - clean.length() % TAB_WIDTH, ' '));
+        } else if (c != '\r') {
+            clean.append(c);
+        }
+    }
+    max_length_ = max(max_length_, clean.length());
+
+    if (chunks_.empty() || chunks_.back().spilled ||
+            static_cast<size_t>(chunks_.back().data.size()) +
+            chunks_.back().ends.size() * sizeof(uint32_t) >= CHUNK_SIZE) {
+        Chunk chunk;
+        chunk.first_line = end_line_;
+        chunk.count = 0;
+        chunks_.push_back(chunk);
+        memory_chunks_++;
+
+        if (spill_ && memory_chunks_ > MAX_MEMORY_CHUNKS)
+            spillChunk(chunks_[chunks_.size() - memory_chunks_]);
+    }
+
+    Chunk &chunk = chunks_.back();
+    chunk.data.append(clean.toUtf8());
+    chunk.ends.push_back(static_cast<uint32_t>(chunk.data.size()));
+    chunk.count++;
+
+    end_line_++;
+}
+
+void LineStore::spillChunk(Chunk &chunk)
+{
+    if (!spill_file_.isOpen() && !spill_file_.open()) {
+        qWarning("Cannot create scrollback file, keeping everything in memory");
+        spill_ = false;
+        return;
+    }
+
+    // Keep the line offsets aligned in the mapping
+    QByteArray padding((4 - chunk.data.size() % 4) % 4, 0);
+    qint64 ends_offset = chunk.data.size() + padding.size();
+    qint64 len = ends_offset + static_cast<qint64>(chunk.ends.size() * sizeof(uint32_t));
+    Q_ASSERT(len <= SPILL_SLOT_SIZE);
+
+    // Reuse the slots of dropped chunks before growing the file
+    qint64 offset;
+    if (!free_slots_.empty()) {
+        offset = free_slots_.back();
+        free_slots_.pop_back();
+    } else {
+        offset = spill_slots_++ * SPILL_SLOT_SIZE;
+    }
+
+    spill_file_.seek(offset);
+    spill_file_.write(chunk.data);
+    spill_file_.write(padding);
+    spill_file_.write(reinterpret_cast<const char *>(chunk.ends.data()),
+                      static_cast<qint64>(chunk.ends.size() * sizeof(uint32_t)));
+    if (!spill_file_.flush() || spill_file_.error() != QFileDevice::NoError) {
+        qWarning("Cannot write to scrollback file, keeping everything in memory");
+        spill_file_.unsetError();
+        free_slots_.push_back(offset);
+        spill_ = false;
+        return;
+    }
+
+    chunk.spilled = true;
+    chunk.spill_offset = offset;
+    chunk.spill_len = len;
+    chunk.ends_offset = ends_offset;
+
+    chunk.data = QByteArray();
+    vector<uint32_t>().swap(chunk.ends);
+    memory_chunks_--;
+}
+
+void LineStore::releaseChunk(Chunk &chunk)
+{
+    if (chunk.map) {
+        spill_file_.unmap(chunk.map);
+        chunk.map = nullptr;
+        mapped_chunks_--;
+    }
+    if (chunk.spilled) {
+        free_slots_.push_back(chunk.spill_offset);
+    } else {
+        memory_chunks_--;
+    }
+}
+
+void LineStore::dropOldLines()
+{
+    if (!max_lines_ || lineCount() <= max_lines_)
+        return;
+
+    first_line_ = endLine() - max_lines_;
+    while (!chunks_.empty() && chunks_.front().first_line + chunks_.front().count <= first_line_) {
+        releaseChunk(chunks_.front());
+        chunks_.pop_front();
+    }
+
+    // Dropped slots are reused by spillChunk(), shrink the file once nothing refers to it
+    if (spill_file_.isOpen() && memory_chunks_ == chunks_.size() && spill_slots_) {
+        spill_file_.resize(0);
+        spill_slots_ = 0;
+        free_slots_.clear();
+    }
+}
@@ -0,0 +1,106 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef LINE_STORE_HH
+#define LINE_STORE_HH
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QTemporaryFile>
+
+#include <deque>
+#include <vector>
+
+#include <stdint.h>
+
+/* Append-only store of text lines, used as the serial console scrollback. Lines are packed
+   as UTF-8 into chunks of about 64 kB. Only the most recent chunks stay in memory, older
+   ones are written to fixed-size slots of a temporary file (reused once their lines are
+   dropped) and mapped back on demand, a few at a time. The RAM cost stays the same whatever
+   the scrollback size. Lines longer than 4096 characters are wrapped. Line numbers returned
+   by firstLine() and lineCount() are absolute: they keep increasing when old lines are
+   dropped. */
+class LineStore : public QObject {
+    Q_OBJECT
+
+    struct Chunk {
+        uint64_t first_line;
+        size_t count;
+
+        // Packed lines, and the end offset of each of them
+        QByteArray data;
+        std::vector<uint32_t> ends;
+
+        // Set once the chunk has been spilled to disk, the slot is mapped when needed
+        bool spilled = false;
+        qint64 spill_offset;
+        qint64 spill_len;
+        qint64 ends_offset;
+        mutable uchar *map = nullptr;
+        mutable uint64_t map_use;
+    };
+
+    std::deque<Chunk> chunks_;
+    uint64_t first_line_ = 0;
+    uint64_t end_line_ = 0;
+    QString partial_;
+    int max_length_ = 0;
+
+    uint64_t max_lines_ = 0;
+
+    bool spill_ = true;
+    mutable QTemporaryFile spill_file_;
+    size_t memory_chunks_ = 0;
+    qint64 spill_slots_ = 0;
+    std::vector<qint64> free_slots_;
+    mutable size_t mapped_chunks_ = 0;
+    mutable uint64_t map_clock_ = 0;
+
+public:
+    LineStore(QObject *parent = nullptr)
+        : QObject(parent) {}
+    virtual ~LineStore();
+
+    // Zero means no limit
+    void setMaximumLines(uint64_t max_lines);
+    uint64_t maximumLines() const { return max_lines_; }
+
+    void setSpillEnabled(bool enable) { spill_ = enable; }
+    bool spillEnabled() const { return spill_; }
+
+    // The last (incomplete) line is always there, even when it is empty
+    uint64_t firstLine() const { return first_line_; }
+    uint64_t endLine() const { return end_line_ + 1; }
+    uint64_t lineCount() const { return endLine() - first_line_; }
+    QString line(uint64_t idx) const;
+
+    // Length of the longest line ever appended, in characters
+    int maximumLength() const { return max_length_; }
+
+public slots:
+    void appendText(const QString &str);
+    void clear();
+
+signals:
+    void appended();
+    void cleared();
+
+private:
+    void commitLine(const QString &line);
+    void spillChunk(Chunk &chunk);
+    void releaseChunk(Chunk &chunk);
+    void dropOldLines();
+
+    const char *lineData(const Chunk &chunk, size_t idx, size_t *rlen) const;
+    bool mapChunk(const Chunk &chunk) const;
+};
+
+#endif
@@ -216,8 +216,7 @@ MainWindow::MainWindow(QWidget *parent)
         if (!tabWidget->hasFocus())
             autoFocusBoardWidgets();
     });
-    serialText->setWordWrapMode(QTextOption::NoWrap);
-    connect(serialText, &QPlainTextEdit::customContextMenuRequested, this,
+    connect(serialText, &SerialConsole::customContextMenuRequested, this,
             &MainWindow::openSerialContextMenu);
     connect(serialEdit, &EnhancedLineInput::textCommitted, this, &MainWindow::sendToSelectedBoards);
     connect(sendButton, &QToolButton::clicked, serialEdit, &EnhancedLineInput::commit);
@@ -663,12 +662,8 @@ void MainWindow::enableBoardWidgets()
     optionsTab->setEnabled(true);
     actionEnableSerial->setEnabled(true);
 
-    QTextDocument *document = &current_board_->serialDocument();
-    serialText->setDocument(document);
-    serialText->moveCursor(QTextCursor::End);
-    serialText->verticalScrollBar()->setValue(serialText->verticalScrollBar()->maximum());
-    serialText->setFont(document->defaultFont());
-    serialEdit->setFont(document->defaultFont());
+    serialText->setStore(&current_board_->serialStore());
+    serialEdit->setFont(serialText->font());
 
     actionRenameBoard->setEnabled(true);
 }
@@ -833,7 +828,7 @@ void MainWindow::selectionChanged(const QItemSelection &newsel, const QItemSelec
 
     for (auto &board: selected_boards_)
         board->disconnect(this);
-    serialText->setDocument(nullptr);
+    serialText->setStore(nullptr);
     selected_boards_.clear();
     current_board_ = nullptr;
 
@@ -0,0 +1,254 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QTimer>
+
+#include "metrics_server.hpp"
+
+using namespace std;
+
+#define MAX_REQUEST_SIZE 8192
+#define CLIENT_TIMEOUT 10000
+
+static const double upload_buckets[] = {0.5, 1.0, 2.0, 5.0, 10.0, 20.0, 30.0, 60.0};
+static const double bootloader_buckets[] = {0.1, 0.25, 0.5, 1.0, 2.0, 5.0, 10.0};
+
+MetricsServer::MetricsServer(QObject *parent)
+    : QObject(parent)
+{
+    ty_metric *boards;
+    ty_metric *serial_log_queue;
+    ty_metric *serial_log_dropped;
+    int r;
+
+    r = ty_metrics_new(&metrics_);
+    if (r < 0)
+        throw bad_alloc();
+
+    // Rates (such as serial throughput) are left to the scraper, use rate() on the counters
+    r = 0;
+    r |= ty_metrics_add(metrics_, "tycommander_serial_received_bytes_total",
+                        "Bytes read from the serial interface", TY_METRIC_COUNTER, "board",
+                        nullptr, 0, &serial_received_);
+    r |= ty_metrics_add(metrics_, "tycommander_serial_sent_bytes_total",
+                        "Bytes sent to the serial interface", TY_METRIC_COUNTER, "board",
+                        nullptr, 0, &serial_sent_);
+    r |= ty_metrics_add(metrics_, "tycommander_serial_dropped_bytes_total",
+                        "Serial bytes lost by the monitor or missing from the log",
+                        TY_METRIC_COUNTER, "board", nullptr, 0, &serial_dropped_);
+    r |= ty_metrics_add(metrics_, "tycommander_serial_reconnects_total",
+                        "Serial interface reopened after being closed", TY_METRIC_COUNTER,
+                        "board", nullptr, 0, &serial_reconnects_);
+    r |= ty_metrics_add(metrics_, "tycommander_upload_duration_seconds",
+                        "Duration of successful uploads", TY_METRIC_HISTOGRAM, "board",
+                        upload_buckets, TY_COUNTOF(upload_buckets), &upload_duration_);
+    r |= ty_metrics_add(metrics_, "tycommander_bootloader_wait_seconds",
+                        "Time from upload start to bootloader availability",
+                        TY_METRIC_HISTOGRAM, "board", bootloader_buckets,
+                        TY_COUNTOF(bootloader_buckets), &bootloader_wait_);
+    r |= ty_metrics_add(metrics_, "tycommander_task_failures_total",
+                        "Board tasks (uploads, resets, etc.) that failed", TY_METRIC_COUNTER,
+                        "board", nullptr, 0, &task_failures_);
+    r |= ty_metrics_add(metrics_, "tycommander_boards", "Boards currently listed",
+                        TY_METRIC_GAUGE, nullptr, nullptr, 0, &boards);
+    r |= ty_metrics_add(metrics_, "tycommander_serial_log_queue_bytes",
+                        "Serial data waiting to be written to the logs", TY_METRIC_GAUGE,
+                        nullptr, nullptr, 0, &serial_log_queue);
+    r |= ty_metrics_add(metrics_, "tycommander_serial_log_dropped_bytes_total",
+                        "Serial bytes not logged because the log queue was full",
+                        TY_METRIC_COUNTER, nullptr, nullptr, 0, &serial_log_dropped);
+    if (!r)
+        r = ty_metric_get_series(boards, nullptr, &boards_);
+    if (!r)
+        r = ty_metric_get_series(serial_log_queue, nullptr, &serial_log_queue_);
+    if (!r)
+        r = ty_metric_get_series(serial_log_dropped, nullptr, &serial_log_dropped_);
+    if (r < 0) {
+        ty_metrics_free(metrics_);
+        throw bad_alloc();
+    }
+}
+
+MetricsServer::~MetricsServer()
+{
+    close();
+    ty_metrics_free(metrics_);
+}
+
+bool MetricsServer::listen(const QString &address)
+{
+    close();
+
+    bool port_ok;
+    unsigned int port = address.toUInt(&port_ok);
+
+    if (port_ok) {
+        if (port > 65535) {
+            error_string_ = tr("Invalid port number %1").arg(port);
+            return false;
+        }
+
+        unique_ptr<QTcpServer> server(new QTcpServer());
+        connect(server.get(), &QTcpServer::newConnection, this, &MetricsServer::acceptConnection);
+        // Stay away from the network, scrape through a local proxy if needed
+        if (!server->listen(QHostAddress::LocalHost, static_cast<quint16>(port))) {
+            error_string_ = server->errorString();
+            return false;
+        }
+        tcp_server_ = move(server);
+    } else {
+        unique_ptr<QLocalServer> server(new QLocalServer());
+        connect(server.get(), &QLocalServer::newConnection, this, &MetricsServer::acceptConnection);
+        server->setSocketOptions(QLocalServer::UserAccessOption);
+        QLocalServer::removeServer(address);
+        if (!server->listen(address)) {
+            error_string_ = server->errorString();
+            return false;
+        }
+        local_server_ = move(server);
+    }
+
+    return true;
+}
+
+void MetricsServer::close()
+{
+    tcp_server_.reset();
+    local_server_.reset();
+}
+
+BoardMetrics MetricsServer::boardMetrics(const QString &id)
+{
+    auto id2 = id.toUtf8();
+    BoardMetrics metrics;
+    int r = 0;
+
+    r |= ty_metric_get_series(serial_received_, id2.constData(), &metrics.serial_received);
+    r |= ty_metric_get_series(serial_sent_, id2.constData(), &metrics.serial_sent);
+    r |= ty_metric_get_series(serial_dropped_, id2.constData(), &metrics.serial_dropped);
+    r |= ty_metric_get_series(serial_reconnects_, id2.constData(), &metrics.serial_reconnects);
+    r |= ty_metric_get_series(upload_duration_, id2.constData(), &metrics.upload_duration);
+    r |= ty_metric_get_series(bootloader_wait_, id2.constData(), &metrics.bootloader_wait);
+    r |= ty_metric_get_series(task_failures_, id2.constData(), &metrics.task_failures);
+    if (r < 0)
+        throw bad_alloc();
+
+    return metrics;
+}
+
+void MetricsServer::setBoardCount(unsigned int count)
+{
+    ty_metric_series_set(boards_, count);
+}
+
+void MetricsServer::setSerialLogStats(size_t queue_depth, uint64_t dropped)
+{
+    ty_metric_series_set(serial_log_queue_, static_cast<int64_t>(queue_depth));
+    // The writer keeps the total, and it only ever grows
+    ty_metric_series_set(serial_log_dropped_, static_cast<int64_t>(dropped));
+}
+
+QByteArray MetricsServer::format()
+{
+    char *buf;
+    size_t len;
+    int r;
+
+    emit aboutToFormat();
+
+    r = ty_metrics_format(metrics_, &buf, &len);
+    if (r < 0)
+        throw bad_alloc();
+
+    QByteArray text(buf, static_cast<int>(len));
+    free(buf);
+
+    return text;
+}
+
+void MetricsServer::acceptConnection()
+{
+    if (tcp_server_) {
+        while (auto socket = tcp_server_->nextPendingConnection())
+            serveClient(socket);
+    }
+    if (local_server_) {
+        while (auto socket = local_server_->nextPendingConnection())
+            serveClient(socket);
+    }
+}
+
+/* Just enough HTTP for Prometheus and curl: one response per connection, and we don't care
+   about the request beyond the method. */
+void MetricsServer::serveClient(QIODevice *socket)
+{
+    struct ClientState {
+        QByteArray request;
+        bool answered = false;
+    };
+    auto state = make_shared<ClientState>();
+
+    auto finish = [=](const QByteArray &response) {
+        state->answered = true;
+        state->request.clear();
+
+        socket->write(response);
+
+        if (auto tcp_socket = qobject_cast<QTcpSocket *>(socket)) {
+            tcp_socket->disconnectFromHost();
+        } else if (auto local_socket = qobject_cast<QLocalSocket *>(socket)) {
+            local_socket->disconnectFromServer();
+        }
+    };
+
+    if (auto tcp_socket = qobject_cast<QTcpSocket *>(socket)) {
+        connect(tcp_socket, &QTcpSocket::disconnected, tcp_socket, &QObject::deleteLater);
+    } else if (auto local_socket = qobject_cast<QLocalSocket *>(socket)) {
+        connect(local_socket, &QLocalSocket::disconnected, local_socket, &QObject::deleteLater);
+    }
+    connect(socket, &QIODevice::readyRead, this, [=]() {
+        auto buf = socket->readAll();
+        // Ignore anything sent after the request headers
+        if (state->answered)
+            return;
+
+        auto &request = state->request;
+        request.append(buf);
+        if (request.size() > MAX_REQUEST_SIZE) {
+            finish("HTTP/1.0 413 Request Entity Too Large\r\nConnection: close\r\n\r\n");
+            return;
+        }
+        if (!request.contains("\r\n\r\n") && !request.contains("\n\n"))
+            return;
+
+        bool get = request.startsWith("GET ");
+        bool head = request.startsWith("HEAD ");
+
+        if (!get && !head) {
+            finish("HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD\r\n"
+                   "Connection: close\r\n\r\n");
+            return;
+        }
+
+        auto body = format();
+        QByteArray response = "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                              "Connection: close\r\n\r\n";
+        if (get)
+            response += body;
+        finish(response);
+    });
+
+    // Don't let idle clients linger
+    QTimer::singleShot(CLIENT_TIMEOUT, socket, &QObject::deleteLater);
+}
@@ -0,0 +1,93 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef METRICS_SERVER_HH
+#define METRICS_SERVER_HH
+
+#include <QByteArray>
+#include <QLocalServer>
+#include <QTcpServer>
+
+#include <memory>
+
+#include "../libty/metrics.h"
+
+// Series are owned by the registry, boards can update them from any thread
+struct BoardMetrics {
+    ty_metric_series *serial_received = nullptr;
+    ty_metric_series *serial_sent = nullptr;
+    ty_metric_series *serial_dropped = nullptr;
+    ty_metric_series *serial_reconnects = nullptr;
+    ty_metric_series *upload_duration = nullptr;
+    ty_metric_series *bootloader_wait = nullptr;
+    ty_metric_series *task_failures = nullptr;
+
+    // Boards without metrics server get null series, do nothing in this case
+    static void add(ty_metric_series *series, uint64_t value)
+    {
+        if (series)
+            ty_metric_series_add(series, value);
+    }
+    static void observe(ty_metric_series *series, double value)
+    {
+        if (series)
+            ty_metric_series_observe(series, value);
+    }
+};
+
+class MetricsServer : public QObject {
+    Q_OBJECT
+
+    ty_metrics *metrics_;
+
+    ty_metric *serial_received_;
+    ty_metric *serial_sent_;
+    ty_metric *serial_dropped_;
+    ty_metric *serial_reconnects_;
+    ty_metric *upload_duration_;
+    ty_metric *bootloader_wait_;
+    ty_metric *task_failures_;
+    ty_metric_series *boards_;
+    ty_metric_series *serial_log_queue_;
+    ty_metric_series *serial_log_dropped_;
+
+    std::unique_ptr<QTcpServer> tcp_server_;
+    std::unique_ptr<QLocalServer> local_server_;
+    QString error_string_;
+
+public:
+    MetricsServer(QObject *parent = nullptr);
+    virtual ~MetricsServer();
+
+    // Port number (bound to localhost only), or local socket name or path
+    bool listen(const QString &address);
+    void close();
+
+    bool isListening() const { return tcp_server_ || local_server_; }
+    QString errorString() const { return error_string_; }
+
+    BoardMetrics boardMetrics(const QString &id);
+    void setBoardCount(unsigned int count);
+    void setSerialLogStats(size_t queue_depth, uint64_t dropped);
+
+    QByteArray format();
+
+signals:
+    // Emitted before each scrape, to refresh values that are only sampled
+    void aboutToFormat();
+
+private slots:
+    void acceptConnection();
+
+private:
+    void serveClient(QIODevice *socket);
+};
+
+#endif
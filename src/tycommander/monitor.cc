@@ -14,6 +14,7 @@
 #include "board.hpp"
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
+#include "metrics_server.hpp"
 #include "monitor.hpp"
 #include "../libhs/platform.h"
 #include "../libty/task.h"
@@ -27,6 +28,10 @@ Monitor::Monitor(QObject *parent)
     if (r < 0)
         throw bad_alloc();
 
+    serial_reactor_.setFailureHandler([this]() {
+        QMetaObject::invokeMethod(this, "restartSerialReaders", Qt::QueuedConnection);
+    });
+
     loadSettings();
 }
 
@@ -57,8 +62,15 @@ void Monitor::loadSettings()
     ty_pool_set_max_threads(pool_, max_tasks);
     ignore_generic_ = db_.get("ignoreGeneric", false).toBool();
     default_serial_ = db_.get("serialByDefault", true).toBool();
+    // The reactor reads serial data from one I/O thread, without the Qt event loop
+    serial_reactor_enabled_ = db_.get("serialReactor", true).toBool() &&
+                              SerialReactor::isSupported();
     serial_log_size_ = db_.get("serialLogSize", 20000000ull).toULongLong();
     serial_log_dir_ = db_.get("serialLogDir", "").toString();
+    // Logs are written in batches by a background thread, see SerialLogWriter
+    serial_log_writer_.setFlushInterval(db_.get("serialLogFlushInterval", 250).toUInt());
+    serial_log_writer_.setMaximumQueueSize(
+        static_cast<size_t>(db_.get("serialLogQueueSize", 4194304ull).toULongLong()));
 
     emit settingsChanged();
 
@@ -96,6 +108,7 @@ void Monitor::setIgnoreGeneric(bool ignore_generic)
                 i--;
             }
         }
+        updateBoardCount();
     } else {
         ty_monitor_list(monitor_, handleEvent, this);
     }
@@ -167,6 +180,22 @@ void Monitor::setSerialLogDir(const QString &dir)
     emit settingsChanged();
 }
 
+void Monitor::setMetricsServer(MetricsServer *server)
+{
+    if (metrics_server_)
+        metrics_server_->disconnect(this);
+    metrics_server_ = server;
+    if (server) {
+        connect(server, &MetricsServer::aboutToFormat, this, [=]() {
+            server->setSerialLogStats(serialLogQueueDepth(), serialLogDropped());
+        });
+    }
+
+    for (auto &board: boards_)
+        board->setMetrics(server ? server->boardMetrics(board->id()) : BoardMetrics());
+    updateBoardCount();
+}
+
 bool Monitor::start()
 {
     if (started_)
@@ -195,6 +224,10 @@ bool Monitor::start()
     }
 
     serial_thread_.start();
+    serial_log_writer_.start();
+    if (serial_reactor_enabled_ && !serial_reactor_.start())
+        ty_log(TY_LOG_WARNING, "Falling back to event loop for serial reads: %s",
+               ty_error_last_message());
 
     r = ty_monitor_start(monitor_);
     if (r < 0)
@@ -217,7 +250,10 @@ void Monitor::stop()
         beginRemoveRows(QModelIndex(), 0, static_cast<int>(boards_.size()));
         boards_.clear();
         endRemoveRows();
+        updateBoardCount();
     }
+    serial_reactor_.stop();
+    serial_log_writer_.stop();
 
     monitor_notifier_.setEnabled(false);
     ty_monitor_stop(monitor_);
@@ -369,6 +405,13 @@ void Monitor::refresh(ty_descriptor desc)
     ty_monitor_refresh(monitor_);
 }
 
+// The serial reactor has stopped, move the boards that were using it to the event loop
+void Monitor::restartSerialReaders()
+{
+    for (auto &board: boards_)
+        board->restartSerialReader();
+}
+
 int Monitor::handleEvent(ty_board *board, ty_monitor_event event, void *udata)
 {
     auto self = static_cast<Monitor *>(udata);
@@ -412,6 +455,11 @@ void Monitor::handleAddedEvent(ty_board *board)
     if (board_wrapper->hasCapability(TY_BOARD_CAPABILITY_UNIQUE))
         configureBoardDatabase(*board_wrapper);
     board_wrapper->serial_log_dir_ = serial_log_dir_;
+    // Set it before loadSettings(), which may open the serial interface
+    board_wrapper->setSerialReactor(&serial_reactor_);
+    board_wrapper->setSerialLogWriter(&serial_log_writer_);
+    if (metrics_server_)
+        board_wrapper->setMetrics(metrics_server_->boardMetrics(board_wrapper->id()));
     board_wrapper->loadSettings(this);
 
     board_wrapper->setThreadPool(pool_);
@@ -443,6 +491,7 @@ void Monitor::handleAddedEvent(ty_board *board)
                     static_cast<int>(boards_.size()));
     boards_.push_back(board_wrapper_ptr);
     endInsertRows();
+    updateBoardCount();
 
     emit boardAdded(board_wrapper);
 }
@@ -468,6 +517,13 @@ void Monitor::removeBoardItem(iterator it)
     beginRemoveRows(QModelIndex(), it - boards_.begin(), it - boards_.begin());
     boards_.erase(it);
     endRemoveRows();
+    updateBoardCount();
+}
+
+void Monitor::updateBoardCount()
+{
+    if (metrics_server_)
+        metrics_server_->setBoardCount(static_cast<unsigned int>(boards_.size()));
 }
 
 void Monitor::configureBoardDatabase(Board &board)
@@ -19,9 +19,12 @@
 
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
+#include "serial_log.hpp"
+#include "serial_reactor.hpp"
 #include "../libty/monitor.h"
 
 class Board;
+class MetricsServer;
 struct ty_board;
 struct ty_pool;
 
@@ -37,9 +40,13 @@ class Monitor : public QAbstractListModel {
 
     ty_pool *pool_;
     QThread serial_thread_;
+    SerialReactor serial_reactor_;
+    SerialLogWriter serial_log_writer_;
+    MetricsServer *metrics_server_ = nullptr;
 
     bool ignore_generic_;
     bool default_serial_;
+    bool serial_reactor_enabled_;
     size_t serial_log_size_;
     QString serial_log_dir_;
 
@@ -80,6 +87,12 @@ public:
     bool serialByDefault() const { return default_serial_; }
     size_t serialLogSize() const { return serial_log_size_; }
     QString serialLogDir() const { return serial_log_dir_; }
+    size_t serialLogQueueDepth() const { return serial_log_writer_.queueDepth(); }
+    uint64_t serialLogDropped() const { return serial_log_writer_.droppedBytes(); }
+
+    // The server must outlive the monitor, boards update their metrics from other threads
+    void setMetricsServer(MetricsServer *server);
+    MetricsServer *metricsServer() const { return metrics_server_; }
 
     bool start();
     void stop();
@@ -126,6 +139,7 @@ signals:
 
 private slots:
     void refresh(ty_descriptor desc);
+    void restartSerialReaders();
 
 private:
     iterator findBoardIterator(ty_board *board);
@@ -136,6 +150,7 @@ private:
 
     void refreshBoardItem(iterator it);
     void removeBoardItem(iterator it);
+    void updateBoardCount();
 
     void configureBoardDatabase(Board &board);
 };
@@ -0,0 +1,25 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "ring_buffer.hpp"
+
+void RingBuffer::reset(size_t size)
+{
+    size_t real_size = 4096;
+    while (real_size < size)
+        real_size *= 2;
+
+    buf_.reset(new char[real_size]);
+    size_ = real_size;
+
+    write_pos_ = 0;
+    read_pos_ = 0;
+    overrun_ = 0;
+}
@@ -0,0 +1,96 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lock-free ring buffer for exactly one producer thread and one consumer thread. Positions
+   grow forever and are masked on access, the size is rounded up to a power of two.
+   reset() is not thread-safe, call it when neither side is running. */
+class RingBuffer {
+    std::unique_ptr<char[]> buf_;
+    size_t size_ = 0;
+
+    std::atomic<size_t> write_pos_ {0};
+    std::atomic<size_t> read_pos_ {0};
+    std::atomic<uint64_t> overrun_ {0};
+
+public:
+    RingBuffer() {}
+    RingBuffer(size_t size) { reset(size); }
+
+    void reset(size_t size);
+
+    size_t size() const { return size_; }
+
+    // Producer side
+    size_t writeSpan(char **rptr) const
+    {
+        size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+        size_t read_pos = read_pos_.load(std::memory_order_acquire);
+        size_t offset = write_pos & (size_ - 1);
+
+        *rptr = buf_.get() + offset;
+        return std::min(size_ - (write_pos - read_pos), size_ - offset);
+    }
+    void commit(size_t len)
+    {
+        write_pos_.store(write_pos_.load(std::memory_order_relaxed) + len,
+                         std::memory_order_release);
+    }
+    void addOverrun(size_t len) { overrun_.fetch_add(len, std::memory_order_relaxed); }
+    // Copy the whole buffer, or drop it (and count it as overrun) if it does not fit
+    bool write(const char *buf, size_t len)
+    {
+        size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+        size_t read_pos = read_pos_.load(std::memory_order_acquire);
+
+        if (len > size_ - (write_pos - read_pos)) {
+            addOverrun(len);
+            return false;
+        }
+
+        size_t offset = write_pos & (size_ - 1);
+        size_t len1 = std::min(len, size_ - offset);
+        std::copy(buf, buf + len1, buf_.get() + offset);
+        std::copy(buf + len1, buf + len, buf_.get());
+        commit(len);
+
+        return true;
+    }
+
+    // Consumer side
+    size_t readSpan(const char **rptr) const
+    {
+        size_t read_pos = read_pos_.load(std::memory_order_relaxed);
+        size_t write_pos = write_pos_.load(std::memory_order_acquire);
+        size_t offset = read_pos & (size_ - 1);
+
+        *rptr = buf_.get() + offset;
+        return std::min(write_pos - read_pos, size_ - offset);
+    }
+    void consume(size_t len)
+    {
+        read_pos_.store(read_pos_.load(std::memory_order_relaxed) + len,
+                        std::memory_order_release);
+    }
+
+    // Bytes dropped by the producer because the buffer was full
+    uint64_t overrun() const { return overrun_.load(std::memory_order_relaxed); }
+};
+
+#endif
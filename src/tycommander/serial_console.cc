@@ -0,0 +1,363 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QApplication>
+#include <QClipboard>
+#include <QKeyEvent>
+#include <QMenu>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QScrollBar>
+
+#include <algorithm>
+#include <limits>
+
+#include "serial_console.hpp"
+
+using namespace std;
+
+#define TEXT_MARGIN 4
+
+SerialConsole::SerialConsole(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    {
+        QFont font("monospace", 9);
+        if (!QFontInfo(font).fixedPitch()) {
+            font.setStyleHint(QFont::Monospace);
+            if (!QFontInfo(font).fixedPitch())
+                font.setStyleHint(QFont::TypeWriter);
+        }
+        setFont(font);
+    }
+
+    setFocusPolicy(Qt::StrongFocus);
+    viewport()->setCursor(Qt::IBeamCursor);
+    viewport()->setBackgroundRole(QPalette::Base);
+
+    copy_action_ = new QAction(tr("&Copy"), this);
+    copy_action_->setShortcut(QKeySequence::Copy);
+    connect(copy_action_, &QAction::triggered, this, &SerialConsole::copy);
+    select_all_action_ = new QAction(tr("Select &All"), this);
+    select_all_action_->setShortcut(QKeySequence::SelectAll);
+    connect(select_all_action_, &QAction::triggered, this, &SerialConsole::selectAll);
+    updateActions();
+
+    updateScrollBars();
+}
+
+void SerialConsole::setStore(LineStore *store)
+{
+    if (store == store_)
+        return;
+
+    if (store_)
+        store_->disconnect(this);
+    store_ = store;
+    if (store_) {
+        connect(store_, &LineStore::appended, this, &SerialConsole::updateLines);
+        connect(store_, &LineStore::cleared, this, &SerialConsole::resetView);
+    }
+
+    resetView();
+}
+
+QString SerialConsole::selectedText() const
+{
+    if (!store_ || !hasSelection())
+        return QString();
+
+    auto start = min(anchor_, cursor_);
+    auto end = max(anchor_, cursor_);
+    if (start.line < store_->firstLine())
+        start = {store_->firstLine(), 0};
+
+    QString text;
+    for (uint64_t idx = start.line; idx <= end.line && idx < store_->endLine(); idx++) {
+        auto line = store_->line(idx);
+
+        int from = (idx == start.line) ? start.column : 0;
+        if (idx == end.line) {
+            text += line.midRef(from, end.column - from);
+        } else {
+            text += line.midRef(from);
+            text += '\n';
+        }
+    }
+
+    return text;
+}
+
+QMenu *SerialConsole::createStandardContextMenu()
+{
+    auto menu = new QMenu(this);
+
+    updateActions();
+    menu->addAction(copy_action_);
+    menu->addSeparator();
+    menu->addAction(select_all_action_);
+
+    return menu;
+}
+
+void SerialConsole::copy()
+{
+    if (hasSelection())
+        QApplication::clipboard()->setText(selectedText());
+}
+
+void SerialConsole::selectAll()
+{
+    if (!store_)
+        return;
+
+    anchor_ = {store_->firstLine(), 0};
+    cursor_ = {store_->endLine() - 1, store_->line(store_->endLine() - 1).length()};
+    updateActions();
+    viewport()->update();
+}
+
+void SerialConsole::clear()
+{
+    if (store_)
+        store_->clear();
+}
+
+void SerialConsole::paintEvent(QPaintEvent *e)
+{
+    Q_UNUSED(e);
+
+    QPainter painter(viewport());
+    if (!store_)
+        return;
+
+    auto metrics = fontMetrics();
+    int line_height = metrics.lineSpacing();
+    int char_width = metrics.averageCharWidth();
+    int x = TEXT_MARGIN - horizontalScrollBar()->value();
+
+    auto start = min(anchor_, cursor_);
+    auto end = max(anchor_, cursor_);
+    auto text_color = palette().color(QPalette::Text);
+    auto highlight_color = palette().color(QPalette::Highlight);
+    auto highlight_text_color = palette().color(QPalette::HighlightedText);
+
+    uint64_t first = store_->firstLine() + static_cast<uint64_t>(verticalScrollBar()->value());
+    int visible = visibleLines() + 1;
+    for (int i = 0; i < visible && first + static_cast<uint64_t>(i) < store_->endLine(); i++) {
+        uint64_t idx = first + static_cast<uint64_t>(i);
+        auto line = store_->line(idx);
+        int y = i * line_height;
+        int baseline = y + metrics.ascent();
+
+        if (hasSelection() && idx >= start.line && idx <= end.line) {
+            int from = (idx == start.line) ? min(start.column, line.length()) : 0;
+            // Show the selected line break as an extra character
+            int to = (idx == end.line) ? min(end.column, line.length()) : line.length() + 1;
+
+            painter.fillRect(x + from * char_width, y, (to - from) * char_width, line_height,
+                             highlight_color);
+
+            painter.setPen(text_color);
+            painter.drawText(x, baseline, line.left(from));
+            painter.drawText(x + to * char_width, baseline, line.mid(to));
+            painter.setPen(highlight_text_color);
+            painter.drawText(x + from * char_width, baseline, line.mid(from, to - from));
+        } else {
+            painter.setPen(text_color);
+            painter.drawText(x, baseline, line);
+        }
+    }
+}
+
+void SerialConsole::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+    updateLines();
+}
+
+void SerialConsole::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dx);
+    Q_UNUSED(dy);
+
+    auto vbar = verticalScrollBar();
+    autoscroll_ = vbar->value() >= vbar->maximum();
+    if (store_)
+        top_line_ = store_->firstLine() + static_cast<uint64_t>(vbar->value());
+
+    viewport()->update();
+}
+
+void SerialConsole::keyPressEvent(QKeyEvent *e)
+{
+    auto vbar = verticalScrollBar();
+
+    if (e == QKeySequence::Copy) {
+        copy();
+    } else if (e == QKeySequence::SelectAll) {
+        selectAll();
+    } else if (e == QKeySequence::MoveToPreviousPage) {
+        vbar->triggerAction(QAbstractSlider::SliderPageStepSub);
+    } else if (e == QKeySequence::MoveToNextPage) {
+        vbar->triggerAction(QAbstractSlider::SliderPageStepAdd);
+    } else if (e == QKeySequence::MoveToPreviousLine) {
+        vbar->triggerAction(QAbstractSlider::SliderSingleStepSub);
+    } else if (e == QKeySequence::MoveToNextLine) {
+        vbar->triggerAction(QAbstractSlider::SliderSingleStepAdd);
+    } else if (e == QKeySequence::MoveToStartOfDocument) {
+        vbar->triggerAction(QAbstractSlider::SliderToMinimum);
+    } else if (e == QKeySequence::MoveToEndOfDocument) {
+        vbar->triggerAction(QAbstractSlider::SliderToMaximum);
+    } else {
+        QAbstractScrollArea::keyPressEvent(e);
+    }
+}
+
+void SerialConsole::mousePressEvent(QMouseEvent *e)
+{
+    if (e->button() != Qt::LeftButton) {
+        QAbstractScrollArea::mousePressEvent(e);
+        return;
+    }
+
+    cursor_ = positionAt(e->pos());
+    if (!(e->modifiers() & Qt::ShiftModifier))
+        anchor_ = cursor_;
+    selecting_ = true;
+
+    updateActions();
+    viewport()->update();
+}
+
+void SerialConsole::mouseMoveEvent(QMouseEvent *e)
+{
+    if (!selecting_)
+        return;
+
+    // Scroll when the user drags the selection out of the view
+    if (e->pos().y() < 0) {
+        verticalScrollBar()->triggerAction(QAbstractSlider::SliderSingleStepSub);
+    } else if (e->pos().y() > viewport()->height()) {
+        verticalScrollBar()->triggerAction(QAbstractSlider::SliderSingleStepAdd);
+    }
+
+    cursor_ = positionAt(e->pos());
+
+    updateActions();
+    viewport()->update();
+}
+
+void SerialConsole::mouseReleaseEvent(QMouseEvent *e)
+{
+    if (e->button() != Qt::LeftButton || !selecting_) {
+        QAbstractScrollArea::mouseReleaseEvent(e);
+        return;
+    }
+
+    selecting_ = false;
+    if (hasSelection() && QApplication::clipboard()->supportsSelection())
+        QApplication::clipboard()->setText(selectedText(), QClipboard::Selection);
+}
+
+void SerialConsole::mouseDoubleClickEvent(QMouseEvent *e)
+{
+    if (e->button() != Qt::LeftButton || !store_) {
+        QAbstractScrollArea::mouseDoubleClickEvent(e);
+        return;
+    }
+
+    auto pos = positionAt(e->pos());
+    anchor_ = {pos.line, 0};
+    cursor_ = {pos.line, store_->line(pos.line).length()};
+
+    updateActions();
+    viewport()->update();
+}
+
+void SerialConsole::updateLines()
+{
+    updateScrollBars();
+
+    auto vbar = verticalScrollBar();
+    if (autoscroll_ || !store_) {
+        vbar->setValue(vbar->maximum());
+    } else {
+        top_line_ = max(top_line_, store_->firstLine());
+        uint64_t value = min(top_line_ - store_->firstLine(),
+                             static_cast<uint64_t>(vbar->maximum()));
+        vbar->setValue(static_cast<int>(value));
+    }
+
+    viewport()->update();
+}
+
+void SerialConsole::resetView()
+{
+    anchor_ = {};
+    cursor_ = {};
+    selecting_ = false;
+    autoscroll_ = true;
+    top_line_ = 0;
+
+    horizontalScrollBar()->setValue(0);
+    updateActions();
+    updateLines();
+}
+
+int SerialConsole::visibleLines() const
+{
+    return max(1, viewport()->height() / fontMetrics().lineSpacing());
+}
+
+SerialConsole::Position SerialConsole::positionAt(const QPoint &pos) const
+{
+    if (!store_)
+        return {};
+
+    auto metrics = fontMetrics();
+    int row = max(0, min(pos.y() / metrics.lineSpacing(), visibleLines()));
+
+    Position ret;
+    ret.line = min(store_->firstLine() + static_cast<uint64_t>(verticalScrollBar()->value()) +
+                   static_cast<uint64_t>(row), store_->endLine() - 1);
+    int x = pos.x() - TEXT_MARGIN + horizontalScrollBar()->value();
+    ret.column = max(0, min((x + metrics.averageCharWidth() / 2) / metrics.averageCharWidth(),
+                            store_->line(ret.line).length()));
+
+    return ret;
+}
+
+void SerialConsole::updateScrollBars()
+{
+    auto vbar = verticalScrollBar();
+    auto hbar = horizontalScrollBar();
+    int visible = visibleLines();
+    int char_width = fontMetrics().averageCharWidth();
+
+    uint64_t count = store_ ? store_->lineCount() : 0;
+    uint64_t max_value = count > static_cast<uint64_t>(visible) ? count - static_cast<uint64_t>(visible) : 0;
+    // QScrollBar uses int, this is a lot of lines anyway
+    max_value = min(max_value, static_cast<uint64_t>(numeric_limits<int>::max()));
+    vbar->setRange(0, static_cast<int>(max_value));
+    vbar->setPageStep(visible);
+    vbar->setSingleStep(1);
+
+    int width = store_ ? store_->maximumLength() * char_width + 2 * TEXT_MARGIN : 0;
+    hbar->setRange(0, max(0, width - viewport()->width()));
+    hbar->setPageStep(viewport()->width());
+    hbar->setSingleStep(char_width);
+}
+
+void SerialConsole::updateActions()
+{
+    copy_action_->setEnabled(hasSelection());
+    select_all_action_->setEnabled(!store_.isNull());
+}
@@ -0,0 +1,86 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_CONSOLE_HH
+#define SERIAL_CONSOLE_HH
+
+#include <QAbstractScrollArea>
+#include <QPointer>
+
+#include "line_store.hpp"
+
+class QMenu;
+
+/* Read-only console view over a LineStore. Only the visible lines are fetched and painted,
+   so the cost of an update does not depend on the scrollback size. */
+class SerialConsole : public QAbstractScrollArea {
+    Q_OBJECT
+
+    struct Position {
+        uint64_t line;
+        int column;
+
+        bool operator<(const Position &other) const
+            { return line < other.line || (line == other.line && column < other.column); }
+        bool operator==(const Position &other) const
+            { return line == other.line && column == other.column; }
+    };
+
+    QPointer<LineStore> store_;
+
+    bool autoscroll_ = true;
+    // Absolute number of the first visible line, so the view stays put when old lines go
+    uint64_t top_line_ = 0;
+
+    Position anchor_ = {};
+    Position cursor_ = {};
+    bool selecting_ = false;
+
+    QAction *copy_action_;
+    QAction *select_all_action_;
+
+public:
+    SerialConsole(QWidget *parent = nullptr);
+
+    void setStore(LineStore *store);
+    LineStore *store() const { return store_; }
+
+    bool hasSelection() const { return !(anchor_ == cursor_); }
+    QString selectedText() const;
+
+    QMenu *createStandardContextMenu();
+
+public slots:
+    void copy();
+    void selectAll();
+    void clear();
+
+protected:
+    void paintEvent(QPaintEvent *e) override;
+    void resizeEvent(QResizeEvent *e) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void keyPressEvent(QKeyEvent *e) override;
+    void mousePressEvent(QMouseEvent *e) override;
+    void mouseMoveEvent(QMouseEvent *e) override;
+    void mouseReleaseEvent(QMouseEvent *e) override;
+    void mouseDoubleClickEvent(QMouseEvent *e) override;
+
+private slots:
+    void updateLines();
+    void resetView();
+
+private:
+    int visibleLines() const;
+    Position positionAt(const QPoint &pos) const;
+    void updateScrollBars();
+    void updateActions();
+};
+
+#endif
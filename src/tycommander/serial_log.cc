@@ -0,0 +1,391 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QDateTime>
+
+#include <algorithm>
+#include <chrono>
+
+#include <string.h>
+
+#include "../libty/common.h"
+#include "serial_log.hpp"
+
+using namespace std;
+
+// Add an index entry every INDEX_INTERVAL bytes or INDEX_TIME_INTERVAL milliseconds
+#define INDEX_INTERVAL 16384
+#define INDEX_TIME_INTERVAL 1000
+#define INDEX_MIN_CAPACITY 1024
+
+void SerialLog::update(const QString &filename, size_t size)
+{
+    lock_guard<mutex> locker(mutex_);
+
+    if (!filename.isEmpty()) {
+        file_.close();
+        file_.setFileName(filename);
+        index_file_.close();
+        index_file_.setFileName(filename + TY_SERIAL_LOG_INDEX_SUFFIX);
+    }
+    size_ = size;
+
+    if (size_) {
+        if (!file_.isOpen()) {
+            if (file_.open(QIODevice::WriteOnly)) {
+                resetIndex();
+            } else {
+                ty_log(TY_LOG_ERROR, "Cannot open board log '%s' for writing",
+                       file_.fileName().toUtf8().constData());
+            }
+        }
+        if (file_.isOpen() && static_cast<size_t>(file_.size()) > size_) {
+            file_.resize(static_cast<qint64>(size_));
+            // The next write will wrap around
+            if (static_cast<size_t>(file_.pos()) > size_)
+                file_.seek(static_cast<qint64>(size_));
+
+            index_header_.write_offset = min(index_header_.write_offset, static_cast<uint64_t>(size_));
+            index_header_.old_end = min(index_header_.old_end, static_cast<uint64_t>(size_));
+            index_header_.old_offset = min(index_header_.old_offset, index_header_.old_end);
+            writeIndex(nullptr);
+        }
+    } else {
+        file_.close();
+        file_.remove();
+        index_file_.close();
+        index_file_.remove();
+    }
+
+    open_ = file_.isOpen();
+}
+
+QString SerialLog::fileName() const
+{
+    lock_guard<mutex> locker(mutex_);
+    return file_.fileName();
+}
+
+void SerialLog::write(const char *buf, size_t len, int64_t time)
+{
+    unique_lock<mutex> locker(mutex_);
+
+    if (!file_.isOpen())
+        return;
+    file_.unsetError();
+
+    // Big batches may not fit, only the most recent data would survive anyway
+    if (len > size_) {
+        countLines(buf, len - size_);
+        buf += len - size_;
+        len = size_;
+    }
+
+    // Index the first line that starts in this write, once in a while
+    size_t entry_start = SIZE_MAX;
+    uint64_t entry_line = 0;
+    if (written_ - index_written_ >= INDEX_INTERVAL || time - index_time_ >= INDEX_TIME_INTERVAL) {
+        if (line_start_) {
+            entry_start = 0;
+            entry_line = lines_;
+        } else {
+            auto ptr = static_cast<const char *>(memchr(buf, '\n', len));
+            if (ptr && ptr + 1 < buf + len) {
+                entry_start = static_cast<size_t>(ptr + 1 - buf);
+                entry_line = lines_ + 1;
+            }
+        }
+    }
+    countLines(buf, len);
+
+    ty_serial_log_index_entry entry = {};
+    entry.generation = index_header_.generation;
+    entry.line = entry_line;
+    entry.time = time;
+
+    qint64 pos = file_.pos();
+    entry.offset = static_cast<uint64_t>(pos) + entry_start;
+    if (static_cast<size_t>(pos) + len > size_) {
+        auto part_len = static_cast<qint64>(size_) - pos;
+        file_.write(buf, part_len);
+        file_.seek(0);
+        file_.write(buf + part_len, static_cast<qint64>(len) - part_len);
+
+        index_header_.generation++;
+        if (entry_start >= static_cast<size_t>(part_len)) {
+            entry.generation++;
+            entry.offset = entry_start - static_cast<size_t>(part_len);
+        }
+    } else {
+        file_.write(buf, static_cast<qint64>(len));
+    }
+
+    if (!file_.atEnd()) {
+        pos = file_.pos();
+        if (static_cast<size_t>(pos) + sizeof(TY_SERIAL_LOG_DELIMITER) >= size_) {
+            file_.resize(pos);
+            file_.seek(0);
+
+            // Everything left in the file belongs to the previous generation now
+            index_header_.generation++;
+            index_header_.write_offset = 0;
+            index_header_.old_offset = 0;
+            index_header_.old_end = static_cast<uint64_t>(pos);
+        } else {
+            file_.write(TY_SERIAL_LOG_DELIMITER);
+            file_.seek(pos);
+
+            index_header_.write_offset = static_cast<uint64_t>(pos);
+            index_header_.old_offset = static_cast<uint64_t>(pos) + strlen(TY_SERIAL_LOG_DELIMITER);
+            index_header_.old_end = static_cast<uint64_t>(file_.size());
+        }
+    } else {
+        pos = file_.pos();
+        index_header_.write_offset = static_cast<uint64_t>(pos);
+        index_header_.old_offset = static_cast<uint64_t>(pos);
+        index_header_.old_end = static_cast<uint64_t>(pos);
+    }
+    index_header_.lines = lines_;
+
+    // Readers must not see index entries before the data they point to
+    file_.flush();
+    if (file_.error() != QFileDevice::NoError) {
+        auto error_msg = QString("Closed serial log file after error: %1")
+                         .arg(file_.errorString());
+        ty_log(TY_LOG_ERROR, "%s", error_msg.toUtf8().constData());
+
+        file_.close();
+        index_file_.close();
+        open_ = false;
+
+        locker.unlock();
+        emit error(error_msg);
+        return;
+    }
+
+    if (entry_start != SIZE_MAX) {
+        writeIndex(&entry);
+        index_written_ = written_;
+        index_time_ = time;
+    } else {
+        writeIndex(nullptr);
+    }
+}
+
+void SerialLog::resetIndex()
+{
+    lines_ = 0;
+    line_start_ = true;
+    written_ = 0;
+    index_written_ = 0;
+    index_time_ = 0;
+
+    index_header_ = {};
+    memcpy(index_header_.magic, TY_SERIAL_LOG_INDEX_MAGIC, sizeof(index_header_.magic));
+    index_header_.version = TY_SERIAL_LOG_INDEX_VERSION;
+    index_header_.capacity = static_cast<uint32_t>(
+        min(max(static_cast<size_t>(INDEX_MIN_CAPACITY), size_ / INDEX_INTERVAL * 2),
+            static_cast<size_t>(UINT32_MAX)));
+    index_header_.generation = 1;
+
+    // The log is still useful without its index
+    index_file_.close();
+    if (!index_file_.open(QIODevice::WriteOnly)) {
+        ty_log(TY_LOG_WARNING, "Cannot open serial log index '%s' for writing",
+               index_file_.fileName().toUtf8().constData());
+        return;
+    }
+    // Unused slots must be zero-filled, resize() does that for us
+    index_file_.resize(static_cast<qint64>(sizeof(index_header_) +
+                                           index_header_.capacity * sizeof(ty_serial_log_index_entry)));
+    writeIndex(nullptr);
+}
+
+void SerialLog::writeIndex(const ty_serial_log_index_entry *entry)
+{
+    if (!index_file_.isOpen())
+        return;
+    index_file_.unsetError();
+
+    if (entry) {
+        auto slot = index_header_.next_slot++ % index_header_.capacity;
+        index_file_.seek(static_cast<qint64>(sizeof(index_header_) + slot * sizeof(*entry)));
+        index_file_.write(reinterpret_cast<const char *>(entry), sizeof(*entry));
+    }
+    index_file_.seek(0);
+    index_file_.write(reinterpret_cast<const char *>(&index_header_), sizeof(index_header_));
+    index_file_.flush();
+
+    if (index_file_.error() != QFileDevice::NoError) {
+        ty_log(TY_LOG_WARNING, "Closed serial log index after error: %s",
+               index_file_.errorString().toUtf8().constData());
+        index_file_.close();
+    }
+}
+
+void SerialLog::countLines(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+    for (auto ptr = buf; (ptr = static_cast<const char *>(memchr(ptr, '\n', static_cast<size_t>(end - ptr)))); ptr++)
+        lines_++;
+
+    if (len)
+        line_start_ = (end[-1] == '\n');
+    written_ += len;
+}
+
+SerialLogWriter::~SerialLogWriter()
+{
+    stop();
+}
+
+void SerialLogWriter::setFlushInterval(unsigned int interval)
+{
+    lock_guard<mutex> locker(mutex_);
+    flush_interval_ = interval;
+    wake_cond_.notify_one();
+}
+
+void SerialLogWriter::setMaximumQueueSize(size_t size)
+{
+    lock_guard<mutex> locker(mutex_);
+    max_queue_size_ = size;
+}
+
+bool SerialLogWriter::start()
+{
+    if (isRunning())
+        return true;
+
+    stop_ = false;
+    thread_ = thread(&SerialLogWriter::run, this);
+    running_ = true;
+
+    return true;
+}
+
+// Everything still queued gets written before the thread exits
+void SerialLogWriter::stop()
+{
+    if (!isRunning())
+        return;
+
+    {
+        lock_guard<mutex> locker(mutex_);
+        stop_ = true;
+        wake_cond_.notify_one();
+    }
+    thread_.join();
+    running_ = false;
+}
+
+bool SerialLogWriter::append(const shared_ptr<SerialLog> &log, const char *buf, size_t len)
+{
+    lock_guard<mutex> locker(mutex_);
+
+    if (queued_ + len > max_queue_size_) {
+        log->addDropped(len);
+        dropped_ += len;
+        return false;
+    }
+
+    // Consecutive reads from the same board end up in the same chunk
+    if (queue_chunks_.empty() || queue_chunks_.back().log != log || queue_chunks_.back().update)
+        queue_chunks_.push_back({log, queue_data_.size(), 0, QDateTime::currentMSecsSinceEpoch(),
+                                 false, QString(), 0});
+    queue_data_.insert(queue_data_.end(), buf, buf + len);
+    queue_chunks_.back().len += len;
+    queued_ += len;
+
+    if (queued_ >= max_queue_size_ / 2)
+        wake_cond_.notify_one();
+
+    return true;
+}
+
+void SerialLogWriter::update(const shared_ptr<SerialLog> &log, const QString &filename,
+                             size_t size)
+{
+    if (!isRunning()) {
+        log->update(filename, size);
+        return;
+    }
+
+    lock_guard<mutex> locker(mutex_);
+
+    queue_chunks_.push_back({log, queue_data_.size(), 0, 0, true, filename, size});
+    // Don't keep the user waiting for the next flush interval
+    update_pending_ = true;
+    wake_cond_.notify_one();
+}
+
+void SerialLogWriter::run()
+{
+    unique_lock<mutex> locker(mutex_);
+
+    for (;;) {
+        wake_cond_.wait_for(locker, chrono::milliseconds(flush_interval_), [&]() {
+            return stop_ || update_pending_ || queued_ >= max_queue_size_ / 2;
+        });
+
+        bool stop = stop_;
+        update_pending_ = false;
+
+        swap(queue_data_, batch_data_);
+        swap(queue_chunks_, batch_chunks_);
+        queued_ = 0;
+
+        locker.unlock();
+        writeBatch();
+        locker.lock();
+
+        if (stop && queue_chunks_.empty())
+            break;
+    }
+}
+
+void SerialLogWriter::writeBatch()
+{
+    // Group the chunks of each log to issue a single sequential write per log
+    stable_sort(batch_chunks_.begin(), batch_chunks_.end(),
+                [](const Chunk &chunk1, const Chunk &chunk2) {
+        return chunk1.log.get() < chunk2.log.get();
+    });
+
+    for (auto it = batch_chunks_.begin(); it != batch_chunks_.end();) {
+        if (it->update) {
+            it->log->update(it->filename, it->size);
+            it++;
+            continue;
+        }
+
+        // Data queued after an update must not be coalesced with data queued before
+        auto end = find_if(it, batch_chunks_.end(), [&](const Chunk &chunk) {
+            return chunk.log != it->log || chunk.update;
+        });
+
+        if (end - it == 1) {
+            it->log->write(batch_data_.data() + it->offset, it->len, it->time);
+        } else {
+            scratch_.clear();
+            for (auto chunk = it; chunk != end; chunk++)
+                scratch_.insert(scratch_.end(), batch_data_.begin() + chunk->offset,
+                                batch_data_.begin() + chunk->offset + chunk->len);
+            // The index only gets the time of the first chunk, this is precise enough
+            it->log->write(scratch_.data(), scratch_.size(), it->time);
+        }
+
+        it = end;
+    }
+
+    batch_data_.clear();
+    // Release the logs of boards that are gone
+    batch_chunks_.clear();
+}
@@ -0,0 +1,145 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_LOG_HH
+#define SERIAL_LOG_HH
+
+#include <QFile>
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+#include "../libty/serial_log.h"
+
+/* Circular log file of the serial data received from a board. Once the file reaches its
+   maximum size, writing wraps around to the beginning and a delimiter line marks the end
+   of the most recent data. A sparse index of line numbers and times is maintained next
+   to it, see libty/serial_log.h for the format. All methods are thread-safe. */
+class SerialLog : public QObject {
+    Q_OBJECT
+
+    mutable std::mutex mutex_;
+    QFile file_;
+    size_t size_ = 0;
+
+    QFile index_file_;
+    ty_serial_log_index_header index_header_;
+    uint64_t lines_;
+    bool line_start_;
+    uint64_t written_;
+    uint64_t index_written_;
+    int64_t index_time_;
+
+    // Lets the capture path skip closed logs without taking the lock
+    std::atomic_bool open_ {false};
+    std::atomic<uint64_t> dropped_ {0};
+
+public:
+    SerialLog(QObject *parent = nullptr)
+        : QObject(parent) {}
+
+    // Switches to filename unless it is empty, and removes the file if size is 0
+    void update(const QString &filename, size_t size);
+
+    QString fileName() const;
+    bool isOpen() const { return open_; }
+
+    // Time is in milliseconds since the Unix epoch, and goes into the index
+    void write(const char *buf, size_t len, int64_t time);
+
+    void addDropped(size_t len) { dropped_ += len; }
+    uint64_t dropped() const { return dropped_; }
+
+signals:
+    // Emitted from the thread that writes, the log is closed when this happens
+    void error(const QString &msg);
+
+private:
+    void resetIndex();
+    void writeIndex(const ty_serial_log_index_entry *entry);
+    void countLines(const char *buf, size_t len);
+};
+
+/* Background thread that writes the serial logs of all boards. Capture threads only copy
+   data into a queue, the writer coalesces it into one sequential write per log every flush
+   interval (or sooner, when the queue is half full). Data is dropped when the queue is
+   full, so that a slow disk never stalls serial capture. Log updates (such as a switch to
+   a new file) go through the same queue, so data received before them still ends up in
+   the previous file and the GUI thread never waits for the disk. */
+class SerialLogWriter {
+    struct Chunk {
+        std::shared_ptr<SerialLog> log;
+        size_t offset;
+        size_t len;
+        // Reception time of the first byte
+        int64_t time;
+
+        // Set for SerialLog::update() requests, which carry no data
+        bool update;
+        QString filename;
+        size_t size;
+    };
+
+    std::thread thread_;
+    std::atomic_bool running_ {false};
+
+    std::mutex mutex_;
+    std::condition_variable wake_cond_;
+    bool stop_ = false;
+    bool update_pending_ = false;
+
+    unsigned int flush_interval_ = 250;
+    size_t max_queue_size_ = 4194304;
+
+    // Filled by capture threads, under the lock
+    std::vector<char> queue_data_;
+    std::vector<Chunk> queue_chunks_;
+    std::atomic<size_t> queued_ {0};
+    std::atomic<uint64_t> dropped_ {0};
+
+    // Swapped with the queue by the writer thread, so the capacity is reused
+    std::vector<char> batch_data_;
+    std::vector<Chunk> batch_chunks_;
+    std::vector<char> scratch_;
+
+public:
+    SerialLogWriter() {}
+    ~SerialLogWriter();
+
+    void setFlushInterval(unsigned int interval);
+    unsigned int flushInterval() const { return flush_interval_; }
+    void setMaximumQueueSize(size_t size);
+    size_t maximumQueueSize() const { return max_queue_size_; }
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running_; }
+
+    bool append(const std::shared_ptr<SerialLog> &log, const char *buf, size_t len);
+    // Calls log->update() in the writer thread, once everything queued before is written
+    void update(const std::shared_ptr<SerialLog> &log, const QString &filename, size_t size);
+
+    size_t queueDepth() const { return queued_; }
+    uint64_t droppedBytes() const { return dropped_; }
+
+private:
+    void run();
+    void writeBatch();
+};
+
+#endif
@@ -0,0 +1,201 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifdef __linux__
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <unistd.h>
+#endif
+
+#include <QtGlobal>
+
+#include "serial_reactor.hpp"
+
+using namespace std;
+
+#define MAX_EVENTS 64
+
+SerialReactor::~SerialReactor()
+{
+    stop();
+
+#ifdef __linux__
+    if (wake_fd_ >= 0)
+        close(wake_fd_);
+    if (epoll_fd_ >= 0)
+        close(epoll_fd_);
+#endif
+}
+
+bool SerialReactor::isSupported()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool SerialReactor::start()
+{
+#ifdef __linux__
+    if (isRunning())
+        return true;
+    // Join the thread if it has stopped on an error
+    stop();
+
+    if (epoll_fd_ < 0) {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0) {
+            ty_error(TY_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+            return false;
+        }
+    }
+    if (wake_fd_ < 0) {
+        struct epoll_event ev = {};
+
+        wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake_fd_ < 0) {
+            ty_error(TY_ERROR_SYSTEM, "eventfd() failed: %s", strerror(errno));
+            return false;
+        }
+
+        // Handler ids start at 1, 0 is the stop request
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev) < 0) {
+            ty_error(TY_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    running_ = true;
+    thread_ = thread(&SerialReactor::run, this);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void SerialReactor::stop()
+{
+#ifdef __linux__
+    if (!thread_.joinable())
+        return;
+
+    uint64_t value = 1;
+    if (write(wake_fd_, &value, sizeof(value)) < 0) {
+        // The counter cannot overflow with a single write, this should not happen
+    }
+    thread_.join();
+    thread_id_ = thread::id();
+    running_ = false;
+
+    // Drain the eventfd so that the next start() does not stop immediately
+    if (read(wake_fd_, &value, sizeof(value)) < 0) {
+        // Already empty
+    }
+#endif
+}
+
+uint64_t SerialReactor::add(ty_descriptor desc, function<bool()> f)
+{
+#ifdef __linux__
+    lock_guard<mutex> locker(mutex_);
+
+    struct epoll_event ev = {};
+    uint64_t id = next_id_++;
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, desc, &ev) < 0) {
+        ty_error(TY_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+        return 0;
+    }
+    handlers_[id] = {desc, f};
+
+    return id;
+#else
+    Q_UNUSED(desc);
+    Q_UNUSED(f);
+    return 0;
+#endif
+}
+
+void SerialReactor::remove(uint64_t id)
+{
+#ifdef __linux__
+    if (!id)
+        return;
+
+    /* Taking the lock guarantees that the handler is not running anymore once we return,
+       even if it has already asked to stop. Handlers calling remove() run with the lock
+       held by the reactor thread. */
+    unique_lock<mutex> locker(mutex_, defer_lock);
+    if (this_thread::get_id() != thread_id_.load())
+        locker.lock();
+
+    auto it = handlers_.find(id);
+    if (it == handlers_.end())
+        return;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.desc, nullptr);
+    handlers_.erase(it);
+#else
+    Q_UNUSED(id);
+#endif
+}
+
+void SerialReactor::run()
+{
+#ifdef __linux__
+    struct epoll_event events[MAX_EVENTS];
+
+    thread_id_ = this_thread::get_id();
+
+    for (;;) {
+        int ready = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+
+            ty_log(TY_LOG_ERROR, "Falling back to event loop for serial reads: "
+                                 "epoll_wait() failed: %s", strerror(errno));
+            running_ = false;
+            if (failure_handler_)
+                failure_handler_();
+            return;
+        }
+
+        lock_guard<mutex> locker(mutex_);
+        for (int i = 0; i < ready; i++) {
+            if (!events[i].data.u64)
+                return;
+
+            // The handler may have been removed by a previous handler in this batch
+            auto it = handlers_.find(events[i].data.u64);
+            if (it == handlers_.end())
+                continue;
+
+            // Copy it, the handler may remove itself
+            auto f = it->second.f;
+            if (!f()) {
+                it = handlers_.find(events[i].data.u64);
+                if (it != handlers_.end()) {
+                    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.desc, nullptr);
+                    handlers_.erase(it);
+                }
+            }
+        }
+    }
+#endif
+}
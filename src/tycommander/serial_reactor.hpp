@@ -0,0 +1,68 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_REACTOR_HH
+#define SERIAL_REACTOR_HH
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "../libty/system.h"
+
+/* Single I/O thread that waits on all serial descriptors at once and calls their read
+   handler as soon as data is available, independently of any Qt event loop. Handlers run
+   in the reactor thread and must not block, they return false to stop being called (e.g.
+   after an I/O error). The caller still owns the id and must remove() it. Only Linux
+   (epoll) is supported for now, other platforms keep using DescriptorNotifier. */
+class SerialReactor {
+    struct Handler {
+        ty_descriptor desc;
+        std::function<bool()> f;
+    };
+
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+
+    std::thread thread_;
+    // Set by the reactor thread itself, remove() may run before thread_ is assigned
+    std::atomic<std::thread::id> thread_id_ {std::thread::id()};
+    // Cleared by the reactor thread if it stops on an error, thread_ must still be joined
+    std::atomic<bool> running_ {false};
+    std::function<void()> failure_handler_;
+
+    // Held by the reactor thread while it dispatches events
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, Handler> handlers_;
+    uint64_t next_id_ = 1;
+
+public:
+    SerialReactor() {}
+    ~SerialReactor();
+
+    static bool isSupported();
+
+    // Called from the reactor thread when it stops on an error, handlers are not called anymore
+    void setFailureHandler(std::function<void()> f) { failure_handler_ = f; }
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running_; }
+
+    uint64_t add(ty_descriptor desc, std::function<bool()> f);
+    void remove(uint64_t id);
+
+private:
+    void run();
+};
+
+#endif
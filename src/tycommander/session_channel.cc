@@ -199,6 +199,7 @@ SessionPeer::SessionPeer(QLocalSocket *socket)
     socket_->setParent(nullptr);
 
     QObject::connect(socket, &QLocalSocket::readyRead, this, &SessionPeer::dataReceived);
+    QObject::connect(socket, &QLocalSocket::bytesWritten, this, &SessionPeer::written);
     QObject::connect(socket, &QLocalSocket::disconnected, this, [=]() {
         close(RemoteClose);
     });
@@ -232,6 +233,16 @@ void SessionPeer::send(const QStringList &arguments)
     socket_->write(buf);
 }
 
+void SessionPeer::sendBinary(const QByteArray &buf)
+{
+    if (socket_->state() != QLocalSocket::ConnectedState)
+        return;
+
+    uint32_t length = static_cast<uint32_t>(buf.size()) | BinaryFrameFlag;
+    socket_->write(reinterpret_cast<char *>(&length), sizeof(length));
+    socket_->write(buf);
+}
+
 void SessionPeer::dataReceived()
 {
     if (socket_->state() != QLocalSocket::ConnectedState)
@@ -249,13 +260,20 @@ void SessionPeer::dataReceived()
                 break;
             }
         }
+        uint32_t length = expected_length_ & ~BinaryFrameFlag;
         // Easier to let Qt/OS handle the buffer, I won't use very big messages anyway
-        if (socket_->bytesAvailable() < expected_length_)
+        if (socket_->bytesAvailable() < length)
             break;
 
-        auto buf = socket_->read(static_cast<qint64>(expected_length_));
+        auto buf = socket_->read(static_cast<qint64>(length));
+        bool binary = expected_length_ & BinaryFrameFlag;
         expected_length_ = 0;
 
+        if (binary) {
+            emit binaryReceived(buf);
+            continue;
+        }
+
         QDataStream stream(buf);
         QStringList arguments;
         stream >> arguments;
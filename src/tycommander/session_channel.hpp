@@ -23,6 +23,9 @@ class SessionPeer : public QObject {
     std::unique_ptr<QLocalSocket> socket_;
     uint32_t expected_length_ = 0;
 
+    // Set in the length prefix of raw byte frames, other frames contain a QStringList
+    static const uint32_t BinaryFrameFlag = 0x80000000u;
+
 public:
     enum CloseReason {
         LocalClose,
@@ -41,9 +44,15 @@ public:
     void send(const QStringList &arguments);
     void send(const QString &argument) { send(QStringList(argument)); }
     void send(const char *argument) { send(QStringList(argument)); }
+    void sendBinary(const QByteArray &buf);
+
+    // Bytes queued in the socket, use it to avoid buffering without limit for slow peers
+    qint64 bytesToWrite() const { return socket_->bytesToWrite(); }
 
 signals:
     void received(const QStringList &arguments);
+    void binaryReceived(const QByteArray &buf);
+    void written();
     void closed(SessionPeer::CloseReason reason);
 
 private:
@@ -20,14 +20,18 @@
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
+    #include <fcntl.h>
+    #include <io.h>
 #endif
 
 #include "arduino_install.hpp"
 #include "client_handler.hpp"
 #include "../libty/common.h"
+#include "../libty/firmware.h"
 #include "log_dialog.hpp"
 #include "main_window.hpp"
 #include "../libty/optline.h"
+#include "../libty/trace.h"
 #include "task.hpp"
 #include "tycommander.hpp"
 
@@ -48,6 +52,7 @@ static const ClientCommand commands[] = {
     {"upload",    &TyCommander::executeRemoteCommand, QT_TR_NOOP("[<firmwares>]"), QT_TR_NOOP("Upload current or new firmware")},
     {"attach",    &TyCommander::executeRemoteCommand, NULL,                        QT_TR_NOOP("Attach serial monitor")},
     {"detach",    &TyCommander::executeRemoteCommand, NULL,                        QT_TR_NOOP("Detach serial monitor")},
+    {"stream",    &TyCommander::executeRemoteCommand, NULL,                        QT_TR_NOOP("Copy serial output to stdout")},
     {"integrate", &TyCommander::integrateArduino,     NULL,                        NULL},
     {"restore",   &TyCommander::integrateArduino,     NULL,                        NULL},
     // Hidden command for Arduino 1.0.6 integration
@@ -104,6 +109,7 @@ TyCommander::TyCommander(int &argc, char *argv[])
 TyCommander::~TyCommander()
 {
     ty_message_redirect(ty_message_default_handler, nullptr);
+    ty_firmware_cache_clear();
 }
 
 QString TyCommander::clientFilePath()
@@ -237,6 +243,9 @@ int TyCommander::runMainInstance(int argc, char *argv[])
 {
     ty_optline_context optl;
     char *opt;
+    QString trace_filename;
+    QString metrics_address;
+    int ret;
 
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
@@ -246,12 +255,30 @@ int TyCommander::runMainInstance(int argc, char *argv[])
             return EXIT_SUCCESS;
         } else if (opt2 == "--quiet" || opt2 == "-q") {
             ty_config_verbosity--;
+        } else if (opt2 == "--trace") {
+            trace_filename = ty_optline_get_value(&optl);
+            if (trace_filename.isEmpty()) {
+                showClientError(tr("Option '--trace' takes an argument\n%1").arg(helpText()));
+                return EXIT_FAILURE;
+            }
+        } else if (opt2 == "--metrics") {
+            metrics_address = ty_optline_get_value(&optl);
+            if (metrics_address.isEmpty()) {
+                showClientError(tr("Option '--metrics' takes an argument\n%1").arg(helpText()));
+                return EXIT_FAILURE;
+            }
         } else {
             showClientError(tr("Unknown option '%1'\n%2").arg(opt2, helpText()));
             return EXIT_FAILURE;
         }
     }
 
+    // Task phases are recorded until the application exits, then written out all at once
+    if (!trace_filename.isEmpty() && ty_trace_start() < 0) {
+        showClientError(ty_error_last_message());
+        return EXIT_FAILURE;
+    }
+
     if (!channel_.lock()) {
         showClientError(tr("Cannot start main instance, lock file in place"));
         return EXIT_FAILURE;
@@ -265,6 +292,15 @@ int TyCommander::runMainInstance(int argc, char *argv[])
     monitor_.setCache(&monitor_cache_);
     monitor_.loadSettings();
 
+    if (!metrics_address.isEmpty()) {
+        if (!metrics_server_.listen(metrics_address)) {
+            showClientError(tr("Failed to start metrics server on '%1': %2")
+                            .arg(metrics_address, metrics_server_.errorString()));
+            return EXIT_FAILURE;
+        }
+        monitor_.setMetricsServer(&metrics_server_);
+    }
+
     log_dialog_ = unique_ptr<LogDialog>(new LogDialog());
     log_dialog_->setAttribute(Qt::WA_QuitOnClose, false);
     log_dialog_->setWindowIcon(QIcon(":/tycommander"));
@@ -292,7 +328,15 @@ int TyCommander::runMainInstance(int argc, char *argv[])
     if (!channel_.listen())
         reportError(tr("Failed to start session channel, single-instance mode won't work"));
 
-    return QApplication::exec();
+    ret = QApplication::exec();
+
+    if (!trace_filename.isEmpty()) {
+        ty_trace_stop();
+        if (ty_trace_dump(trace_filename.toLocal8Bit().constData()) < 0)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
 }
 
 int TyCommander::executeRemoteCommand(int argc, char *argv[])
@@ -369,6 +413,15 @@ int TyCommander::executeRemoteCommand(int argc, char *argv[])
     }
 
     connect(client.get(), &SessionPeer::received, this, &TyCommander::processServerAnswer);
+    // Raw serial data for the stream command, messages and errors go to stderr
+    connect(client.get(), &SessionPeer::binaryReceived, this, [](const QByteArray &buf) {
+        fwrite(buf.constData(), 1, static_cast<size_t>(buf.size()), stdout);
+        fflush(stdout);
+    });
+#ifdef _WIN32
+    if (command_ == "stream")
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
 
     // Hack for Arduino integration, see option loop above
     if (!usbtype.isEmpty() && !usbtype.contains("_SERIAL"))
@@ -535,7 +588,11 @@ QString TyCommander::helpText()
                       "General options:\n"
                       "       --help               Show help message\n"
                       "       --version            Display version information\n"
-                      "   -q, --quiet              Disable output, use -qqq to silence errors\n\n"
+                      "   -q, --quiet              Disable output, use -qqq to silence errors\n"
+                      "       --trace <file>       Record task phases of the main instance to <file>\n"
+                      "                            (Chrome trace format), written on exit\n"
+                      "       --metrics <addr>     Serve board metrics (Prometheus text format) on\n"
+                      "                            localhost:<addr> (port) or local socket <addr>\n\n"
                       "Client options:\n"
                       "       --autostart          Start main instance if it is not available\n"
                       "   -w, --wait               Wait until full completion\n\n"
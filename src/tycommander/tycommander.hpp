@@ -19,6 +19,7 @@
 #include <memory>
 
 #include "database.hpp"
+#include "metrics_server.hpp"
 #include "monitor.hpp"
 #include "session_channel.hpp"
 
@@ -38,6 +39,8 @@ class TyCommander : public QApplication {
 
     SessionChannel channel_;
 
+    // Declared before monitor_ because boards keep pointers to its series
+    MetricsServer metrics_server_;
     Monitor monitor_;
 
     SettingsDatabase tycommander_db_;
@@ -0,0 +1,87 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libty/board_priv.h"
+#include "../../src/libty/class_priv.h"
+#include "bench_devices.h"
+
+hs_device **create_devices(unsigned int count)
+{
+    hs_device **devs = calloc(count, sizeof(*devs));
+    if (!devs)
+        abort();
+
+    for (unsigned int i = 0; i < count; i++) {
+        hs_device *dev = calloc(1, sizeof(*dev));
+        char buf[64];
+
+        if (!dev)
+            abort();
+        dev->refcount = 1;
+        dev->type = HS_DEVICE_TYPE_SERIAL;
+        dev->status = HS_DEVICE_STATUS_ONLINE;
+
+        sprintf(buf, "usb-%u-%u-%u", i / 256 + 1, i / 16 % 16 + 1, i % 16 + 1);
+        dev->location = strdup(buf);
+        sprintf(buf, "/dev/ttyBENCH%u", i);
+        dev->path = strdup(buf);
+        dev->key = strdup(buf);
+        sprintf(buf, "%u", 10000 + i);
+        dev->serial_number_string = strdup(buf);
+        dev->manufacturer_string = strdup("Bench");
+        dev->product_string = strdup("Synthetic");
+        dev->vid = 0x1234;
+        dev->pid = 0x5678;
+        dev->match_udata = (void *)_ty_classes[0].vtable;
+
+        devs[i] = dev;
+    }
+
+    return devs;
+}
+
+void free_devices(hs_device **devs, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+        hs_device_unref(devs[i]);
+    free(devs);
+}
+
+int inject_devices(ty_monitor *monitor, hs_device **devs, unsigned int count,
+                   hs_device_status status)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        int r;
+
+        devs[i]->status = status;
+        r = _ty_monitor_inject_device(monitor, devs[i]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static int count_callback(ty_board *board, ty_monitor_event event, void *udata)
+{
+    TY_UNUSED(board);
+    TY_UNUSED(event);
+
+    (*(unsigned int *)udata)++;
+    return 0;
+}
+
+unsigned int count_boards(ty_monitor *monitor)
+{
+    unsigned int count = 0;
+    ty_monitor_list(monitor, count_callback, &count);
+    return count;
+}
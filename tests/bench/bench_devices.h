@@ -0,0 +1,31 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef BENCH_DEVICES_H
+#define BENCH_DEVICES_H
+
+#include "../../src/libty/common.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libty/monitor.h"
+
+TY_C_BEGIN
+
+// Synthetic serial devices handled by the generic class, one per hub port
+hs_device **create_devices(unsigned int count);
+void free_devices(hs_device **devs, unsigned int count);
+
+// Sets the status of every device and feeds them to the monitor
+int inject_devices(ty_monitor *monitor, hs_device **devs, unsigned int count,
+                   hs_device_status status);
+unsigned int count_boards(ty_monitor *monitor);
+
+TY_C_END
+
+#endif
@@ -0,0 +1,334 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Compares how soon devices are reported by the udev and kernel monitor backends.
+
+   Traces are recorded with "udevadm monitor --kernel --udev", for example while a board
+   reboots to its bootloader and gets flashed:
+
+       KERNEL[4123.019481] remove   /devices/pci0000:00/.../ttyACM0 (tty)
+       UDEV  [4123.031122] remove   /devices/pci0000:00/.../ttyACM0 (tty)
+       KERNEL[4123.602315] add      /devices/pci0000:00/.../hidraw/hidraw3 (hidraw)
+       UDEV  [4123.671804] add      /devices/pci0000:00/.../hidraw/hidraw3 (hidraw)
+
+   Properties printed with --property are skipped, tests/libty/uevent_reboot.txt is a short
+   example.
+
+   With --live, both backends run side by side for a while and the time each of them
+   reports the devices is recorded instead. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/monitor.h"
+#include "../../src/libhs/platform.h"
+
+// A HID device appearing this soon after a serial device went away is a reboot
+#define REBOOT_WINDOW 10.0
+
+struct event {
+    char action[16];
+    char devpath[512];
+    char subsystem[32];
+
+    // In seconds, negative until this backend reports the event
+    double kernel_time;
+    double udev_time;
+};
+
+struct event_list {
+    struct event *events;
+    size_t count;
+    size_t allocated;
+};
+
+struct live_context {
+    struct event_list *list;
+    bool kernel;
+    uint64_t start;
+};
+
+static struct event *find_event(struct event_list *list, const char *action,
+                                const char *devpath, bool kernel)
+{
+    // The same devpath comes back on each reboot, the latest unmatched event is the right one
+    for (size_t i = list->count; i-- > 0;) {
+        struct event *event = &list->events[i];
+
+        if (!strcmp(event->action, action) && !strcmp(event->devpath, devpath) &&
+                (kernel ? event->kernel_time : event->udev_time) < 0.0)
+            return event;
+    }
+
+    return NULL;
+}
+
+static struct event *add_event(struct event_list *list, const char *action,
+                               const char *devpath, const char *subsystem)
+{
+    struct event *event;
+
+    if (list->count == list->allocated) {
+        size_t allocated = list->allocated ? list->allocated * 2 : 256;
+        struct event *events = realloc(list->events, allocated * sizeof(*events));
+        if (!events)
+            abort();
+
+        list->events = events;
+        list->allocated = allocated;
+    }
+
+    event = &list->events[list->count++];
+    snprintf(event->action, sizeof(event->action), "%s", action);
+    snprintf(event->devpath, sizeof(event->devpath), "%s", devpath);
+    snprintf(event->subsystem, sizeof(event->subsystem), "%s", subsystem);
+    event->kernel_time = -1.0;
+    event->udev_time = -1.0;
+
+    return event;
+}
+
+static void record_event(struct event_list *list, bool kernel, const char *action,
+                         const char *devpath, const char *subsystem, double time)
+{
+    struct event *event;
+
+    event = find_event(list, action, devpath, kernel);
+    if (!event)
+        event = add_event(list, action, devpath, subsystem);
+
+    if (kernel) {
+        event->kernel_time = time;
+    } else {
+        event->udev_time = time;
+    }
+}
+
+static int load_trace(const char *filename, struct event_list *list)
+{
+    FILE *fp;
+    char line[1024];
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char source[8], action[16], devpath[512], subsystem[32];
+        double time;
+
+        if (sscanf(line, "%7[A-Z ][%lf] %15s %511s (%31[^)])", source, &time, action, devpath,
+                   subsystem) != 5)
+            continue;
+        // Only the subsystems libhs cares about
+        if (strcmp(subsystem, "tty") && strcmp(subsystem, "hidraw"))
+            continue;
+
+        record_event(list, !strncmp(source, "KERNEL", 6), action, devpath, subsystem, time);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static int live_callback(hs_device *dev, void *udata)
+{
+    struct live_context *ctx = udata;
+    const char *action = dev->status == HS_DEVICE_STATUS_ONLINE ? "add" : "remove";
+    const char *subsystem = dev->type == HS_DEVICE_TYPE_HID ? "hidraw" : "tty";
+
+    record_event(ctx->list, ctx->kernel, action, dev->path, subsystem,
+                 (double)(hs_millis() - ctx->start) / 1000.0);
+    return 0;
+}
+
+static int record_live(unsigned int duration, struct event_list *list)
+{
+    hs_monitor *monitors[2] = {0};
+    struct live_context ctxs[2];
+    hs_poll_source sources[2];
+    uint64_t start;
+    int r;
+
+    start = hs_millis();
+    for (unsigned int i = 0; i < 2; i++) {
+        r = hs_monitor_new(NULL, 0, &monitors[i]);
+        if (r < 0)
+            goto cleanup;
+        if (i) {
+            r = hs_monitor_set_backend(monitors[i], HS_MONITOR_BACKEND_KERNEL);
+            if (r < 0)
+                goto cleanup;
+        }
+        r = hs_monitor_start(monitors[i]);
+        if (r < 0)
+            goto cleanup;
+
+        ctxs[i].list = list;
+        ctxs[i].kernel = i;
+        ctxs[i].start = start;
+        sources[i].desc = hs_monitor_get_poll_handle(monitors[i]);
+    }
+
+    printf("Recording for %u seconds, plug or reboot some devices...\n", duration);
+    while (hs_millis() - start < duration * 1000) {
+        r = hs_poll(sources, 2, hs_adjust_timeout((int)(duration * 1000), start));
+        if (r < 0)
+            goto cleanup;
+
+        for (unsigned int i = 0; i < 2; i++) {
+            r = hs_monitor_refresh(monitors[i], live_callback, &ctxs[i]);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+    r = 0;
+cleanup:
+    hs_monitor_free(monitors[1]);
+    hs_monitor_free(monitors[0]);
+    return r;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double d1 = *(const double *)a;
+    double d2 = *(const double *)b;
+
+    return (d1 > d2) - (d1 < d2);
+}
+
+static void print_stats(const char *name, double *values, size_t count)
+{
+    if (!count) {
+        printf("%-22s %7u\n", name, 0);
+        return;
+    }
+
+    qsort(values, count, sizeof(*values), compare_doubles);
+    printf("%-22s %7zu %9.1f ms %9.1f ms %9.1f ms\n", name, count, values[count / 2],
+           values[count * 9 / 10], values[count - 1]);
+}
+
+static void print_report(const struct event_list *list)
+{
+    static const char *const kinds[][2] = {
+        {"hidraw", "add"},
+        {"hidraw", "remove"},
+        {"tty", "add"},
+        {"tty", "remove"}
+    };
+    double *kernel_values, *udev_values;
+    size_t count, unmatched = 0;
+
+    kernel_values = calloc(list->count + 1, sizeof(*kernel_values));
+    udev_values = calloc(list->count + 1, sizeof(*udev_values));
+    if (!kernel_values || !udev_values)
+        abort();
+
+    printf("Lag of udev over the kernel backend\n");
+    printf("%-22s %7s %12s %12s %12s\n", "Events", "Count", "Median", "P90", "Max");
+    for (unsigned int i = 0; i < TY_COUNTOF(kinds); i++) {
+        char name[32];
+
+        count = 0;
+        for (size_t j = 0; j < list->count; j++) {
+            const struct event *event = &list->events[j];
+
+            if (strcmp(event->subsystem, kinds[i][0]) || strcmp(event->action, kinds[i][1]))
+                continue;
+            if (event->kernel_time < 0.0 || event->udev_time < 0.0) {
+                unmatched++;
+                continue;
+            }
+
+            udev_values[count++] = (event->udev_time - event->kernel_time) * 1000.0;
+        }
+
+        snprintf(name, sizeof(name), "%s %s", kinds[i][0], kinds[i][1]);
+        print_stats(name, udev_values, count);
+    }
+    if (unmatched)
+        printf("(%zu events were only seen by one backend)\n", unmatched);
+
+    // Time between the serial device going away and the bootloader showing up
+    count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const struct event *add = &list->events[i];
+        const struct event *remove = NULL;
+
+        if (strcmp(add->subsystem, "hidraw") || strcmp(add->action, "add") ||
+                add->kernel_time < 0.0 || add->udev_time < 0.0)
+            continue;
+
+        for (size_t j = i; j-- > 0;) {
+            const struct event *event = &list->events[j];
+
+            if (!strcmp(event->subsystem, "tty") && !strcmp(event->action, "remove") &&
+                    event->kernel_time >= 0.0) {
+                remove = event;
+                break;
+            }
+        }
+        if (!remove || add->kernel_time - remove->kernel_time > REBOOT_WINDOW)
+            continue;
+
+        kernel_values[count] = (add->kernel_time - remove->kernel_time) * 1000.0;
+        udev_values[count] = (add->udev_time - remove->kernel_time) * 1000.0;
+        count++;
+    }
+
+    printf("\nReboots (serial removed, HID added)\n");
+    printf("%-22s %7s %12s %12s %12s\n", "Backend", "Count", "Median", "P90", "Max");
+    print_stats("kernel", kernel_values, count);
+    print_stats("udev", udev_values, count);
+
+    free(udev_values);
+    free(kernel_values);
+}
+
+static void print_usage(void)
+{
+    fprintf(stderr, "usage: bench_hotplug <trace> ...\n"
+                    "       bench_hotplug --live [seconds]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct event_list list = {0};
+    int r;
+
+    if (argc < 2) {
+        print_usage();
+        return 1;
+    }
+
+    if (!strcmp(argv[1], "--live")) {
+        unsigned int duration = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 30;
+
+        r = record_live(duration ? duration : 30, &list);
+        if (r < 0)
+            goto cleanup;
+    } else {
+        for (int i = 1; i < argc; i++) {
+            r = load_trace(argv[i], &list);
+            if (r < 0)
+                goto cleanup;
+        }
+    }
+
+    print_report(&list);
+
+    r = 0;
+cleanup:
+    free(list.events);
+    return r < 0;
+}
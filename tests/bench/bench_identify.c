@@ -0,0 +1,132 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libty/class.h"
+#include "../../src/libty/firmware.h"
+#include "../../src/libty/system.h"
+
+#define IMAGE_SIZE 130048
+#define MIN_DURATION 500
+
+static uint64_t read_uint64_le(const uint8_t *ptr)
+{
+    return (uint64_t)ptr[0] | ((uint64_t)ptr[1] << 8) | ((uint64_t)ptr[2] << 16) |
+           ((uint64_t)ptr[3] << 24) | ((uint64_t)ptr[4] << 32) | ((uint64_t)ptr[5] << 40) |
+           ((uint64_t)ptr[6] << 48) | ((uint64_t)ptr[7] << 56);
+}
+
+// Byte-by-byte scan used by teensy_identify_models() before the memchr() prefilter
+static ty_model reference_scan(const uint8_t *image, size_t size)
+{
+    for (size_t i = 0; i < size - sizeof(uint64_t); i++) {
+        switch (read_uint64_le(image + i)) {
+            case 0x94F8CFFF7E00940C: { return TY_MODEL_TEENSY_PP_10; } break;
+            case 0x94F8CFFF3F00940C: { return TY_MODEL_TEENSY_20; } break;
+            case 0x94F8CFFFFE00940C: { return TY_MODEL_TEENSY_PP_20; } break;
+        }
+    }
+
+    return 0;
+}
+
+/* Pseudo-random AVR-like code, with a sprinkling of 0xF8 and 0x94 bytes to exercise the
+   prefilter. The magic value of the model is written near the end, like the real
+   _reboot_Teensyduino_() in big sketches. */
+static void fill_image(uint8_t *image, size_t size, uint64_t magic)
+{
+    uint32_t state = 0x12345678;
+
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        image[i] = (uint8_t)(state >> 16);
+        if (!(i % 61))
+            image[i] = 0xF8;
+    }
+    for (unsigned int i = 0; i < 8; i++)
+        image[size - 512 + i] = (uint8_t)(magic >> (i * 8));
+}
+
+static double time_run(ty_model (*f)(const ty_firmware *fw), const ty_firmware *fw,
+                       unsigned int *riterations)
+{
+    uint64_t start = ty_millis(), elapsed;
+    unsigned int iterations = 0;
+
+    do {
+        for (unsigned int i = 0; i < 16; i++)
+            f(fw);
+        iterations += 16;
+        elapsed = ty_millis() - start;
+    } while (elapsed < MIN_DURATION);
+
+    *riterations = iterations;
+    return (double)elapsed * 1000.0 / iterations;
+}
+
+static ty_model run_reference(const ty_firmware *fw)
+{
+    return reference_scan(fw->image, fw->size);
+}
+
+static ty_model run_identify(const ty_firmware *fw)
+{
+    ty_model models[16];
+    unsigned int count = ty_firmware_identify(fw, models, TY_COUNTOF(models));
+
+    return count ? models[0] : 0;
+}
+
+int main(void)
+{
+    static const struct {
+        uint64_t magic;
+        ty_model model;
+    } cases[] = {
+        {0x94F8CFFF7E00940C, TY_MODEL_TEENSY_PP_10},
+        {0x94F8CFFF3F00940C, TY_MODEL_TEENSY_20},
+        {0x94F8CFFFFE00940C, TY_MODEL_TEENSY_PP_20},
+        {0, 0}
+    };
+    int ret = 0;
+
+    printf("%-14s %12s %12s %8s\n", "Model", "Reference", "Identify", "Speedup");
+
+    for (unsigned int i = 0; i < TY_COUNTOF(cases); i++) {
+        ty_firmware *fw;
+        double reference_time, identify_time;
+        unsigned int reference_iterations, identify_iterations;
+        int r;
+
+        r = ty_firmware_new("bench.hex", &fw);
+        if (r < 0)
+            return 1;
+        r = ty_firmware_expand_image(fw, IMAGE_SIZE);
+        if (r < 0)
+            return 1;
+        fill_image(fw->image, fw->size, cases[i].magic);
+
+        if (run_reference(fw) != cases[i].model || run_identify(fw) != cases[i].model) {
+            fprintf(stderr, "Model mismatch for magic value 0x%016"PRIx64"\n", cases[i].magic);
+            ret = 1;
+        }
+
+        reference_time = time_run(run_reference, fw, &reference_iterations);
+        identify_time = time_run(run_identify, fw, &identify_iterations);
+
+        printf("%-14s %9.1f us %9.1f us %7.1fx\n",
+               cases[i].model ? ty_models[cases[i].model].name : "(none)",
+               reference_time, identify_time, reference_time / identify_time);
+
+        ty_firmware_unref(fw);
+    }
+
+    return ret;
+}
@@ -0,0 +1,130 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/system.h"
+#include "bench_devices.h"
+
+#define MIN_DURATION 500
+
+enum {
+    PHASE_PLUG,
+    PHASE_UNPLUG,
+    PHASE_REPLUG,
+    PHASE_DROP,
+
+    PHASES_COUNT
+};
+
+static const char *phase_names[] = {
+    "Plug",
+    "Unplug",
+    "Replug",
+    "Drop"
+};
+
+static uint64_t time_injection(ty_monitor *monitor, hs_device **devs, unsigned int count,
+                               hs_device_status status)
+{
+    uint64_t start = ty_millis();
+
+    if (inject_devices(monitor, devs, count, status) < 0)
+        abort();
+
+    return ty_millis() - start;
+}
+
+static int run_cycle(ty_monitor *monitor, unsigned int count, uint64_t *times)
+{
+    hs_device **devs;
+    uint64_t start;
+
+    devs = create_devices(count);
+    times[PHASE_PLUG] += time_injection(monitor, devs, count, HS_DEVICE_STATUS_ONLINE);
+    if (count_boards(monitor) != count) {
+        fprintf(stderr, "Expected %u online boards after plug\n", count);
+        return -1;
+    }
+    times[PHASE_UNPLUG] += time_injection(monitor, devs, count, HS_DEVICE_STATUS_DISCONNECTED);
+    free_devices(devs, count);
+
+    // Same locations and serial numbers, the boards come back from the missing state
+    devs = create_devices(count);
+    times[PHASE_REPLUG] += time_injection(monitor, devs, count, HS_DEVICE_STATUS_ONLINE);
+    if (count_boards(monitor) != count) {
+        fprintf(stderr, "Expected %u online boards after replug\n", count);
+        return -1;
+    }
+    time_injection(monitor, devs, count, HS_DEVICE_STATUS_DISCONNECTED);
+    free_devices(devs, count);
+
+    // Wait for the drop delay, then drop everything in one refresh
+    ty_delay(2);
+    start = ty_millis();
+    if (ty_monitor_refresh(monitor) < 0)
+        return -1;
+    times[PHASE_DROP] += ty_millis() - start;
+
+    return 0;
+}
+
+int main(void)
+{
+    static const unsigned int counts[] = {10, 100, 300, 1000, 3000};
+    ty_monitor *monitor;
+    int r;
+
+    // Boards missing for more than 1 ms get dropped by the next refresh
+#ifdef _WIN32
+    _putenv("TYTOOLS_DROP_BOARD_DELAY=1");
+#else
+    setenv("TYTOOLS_DROP_BOARD_DELAY", "1", 1);
+#endif
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        return 1;
+
+    printf("%-8s", "Boards");
+    for (unsigned int i = 0; i < PHASES_COUNT; i++)
+        printf(" %14s", phase_names[i]);
+    printf("\n");
+
+    for (unsigned int i = 0; i < TY_COUNTOF(counts); i++) {
+        uint64_t times[PHASES_COUNT] = {0};
+        uint64_t start = ty_millis();
+        unsigned int cycles = 0;
+
+        do {
+            r = run_cycle(monitor, counts[i], times);
+            if (r < 0)
+                goto cleanup;
+            cycles++;
+        } while (ty_millis() - start < MIN_DURATION);
+
+        if (count_boards(monitor)) {
+            fprintf(stderr, "Boards were not dropped\n");
+            r = -1;
+            goto cleanup;
+        }
+
+        // Time per board, for each phase
+        printf("%-8u", counts[i]);
+        for (unsigned int j = 0; j < PHASES_COUNT; j++)
+            printf(" %11.2f us", (double)times[j] * 1000.0 / (cycles * counts[i]));
+        printf("\n");
+    }
+
+    r = 0;
+cleanup:
+    ty_monitor_free(monitor);
+    return r < 0;
+}
@@ -0,0 +1,327 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/platform.h"
+#include "../../src/libhs/simulator.h"
+#include "../../src/libty/board.h"
+#include "../../src/libty/firmware.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+
+#define MAX_BOARDS 16
+#define SERIAL_DURATION 1000
+
+/* Block timings are in the ballpark of real boards, reboot and boot delays are much shorter
+   to keep the runs short. */
+static const struct {
+    const char *name;
+    hs_simulator_config config;
+} models[] = {
+    {"Teensy++ 2.0", {.halfkay_version = 2, .halfkay_usage = 0x1C, .code_size = 130048,
+                      .block_size = 256, .transfer_time = 250, .program_time = 3000,
+                      .erase_time = 30000, .reboot_time = 50000, .boot_time = 50000,
+                      .serial = HS_SIMULATOR_SERIAL_CDC}},
+    {"Teensy LC", {.halfkay_version = 3, .halfkay_usage = 0x20, .code_size = 63488,
+                   .block_size = 512, .transfer_time = 500, .program_time = 1500,
+                   .erase_time = 30000, .reboot_time = 50000, .boot_time = 50000,
+                   .serial = HS_SIMULATOR_SERIAL_CDC}},
+    {"Teensy 3.1", {.halfkay_version = 3, .halfkay_usage = 0x1E, .code_size = 262144,
+                    .block_size = 1024, .transfer_time = 1000, .program_time = 1000,
+                    .erase_time = 50000, .reboot_time = 50000, .boot_time = 50000,
+                    .serial = HS_SIMULATOR_SERIAL_CDC}},
+    {"Teensy 3.6", {.halfkay_version = 3, .halfkay_usage = 0x22, .code_size = 1048576,
+                    .block_size = 1024, .transfer_time = 1000, .program_time = 500,
+                    .erase_time = 100000, .reboot_time = 50000, .boot_time = 50000,
+                    .serial = HS_SIMULATOR_SERIAL_CDC}}
+};
+
+struct bench_context {
+    ty_board *boards[MAX_BOARDS];
+    ty_task *tasks[MAX_BOARDS];
+    unsigned int count;
+};
+
+static void quiet_handler(const ty_message_data *msg, void *udata)
+{
+    TY_UNUSED(udata);
+
+    if (msg->type == TY_MESSAGE_LOG && msg->u.log.level == TY_LOG_ERROR)
+        ty_message_default_handler(msg, NULL);
+}
+
+static int add_board_callback(ty_board *board, ty_monitor_event event, void *udata)
+{
+    struct bench_context *ctx = udata;
+
+    TY_UNUSED(event);
+
+    if (ctx->count < MAX_BOARDS)
+        ctx->boards[ctx->count++] = ty_board_ref(board);
+    return 0;
+}
+
+static int check_tasks(ty_monitor *monitor, void *udata)
+{
+    struct bench_context *ctx = udata;
+
+    TY_UNUSED(monitor);
+
+    for (unsigned int i = 0; i < ctx->count; i++) {
+        if (ctx->tasks[i] && ctx->tasks[i]->status != TY_TASK_STATUS_FINISHED)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int plug_boards(const hs_simulator_config *config, unsigned int count,
+                       hs_simulator_board **sims, ty_monitor **rmonitor,
+                       struct bench_context *ctx)
+{
+    ty_monitor *monitor = NULL;
+    int r;
+
+    for (unsigned int i = 0; i < count; i++) {
+        hs_simulator_config board_config = *config;
+
+        board_config.serial_number = 1000 + i;
+        r = hs_simulator_add_board(&board_config, &sims[i]);
+        if (r < 0)
+            return r;
+    }
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        return r;
+    r = ty_monitor_start(monitor);
+    if (r < 0) {
+        ty_monitor_free(monitor);
+        return r;
+    }
+    ty_monitor_list(monitor, add_board_callback, ctx);
+    if (ctx->count != count) {
+        ty_monitor_free(monitor);
+        return ty_error(TY_ERROR_OTHER, "Found %u of %u simulated boards", ctx->count, count);
+    }
+
+    *rmonitor = monitor;
+    return 0;
+}
+
+static void unplug_boards(hs_simulator_board **sims, unsigned int count, ty_monitor *monitor,
+                          struct bench_context *ctx)
+{
+    for (unsigned int i = 0; i < ctx->count; i++) {
+        ty_task_unref(ctx->tasks[i]);
+        ty_board_unref(ctx->boards[i]);
+    }
+    ty_monitor_free(monitor);
+    for (unsigned int i = 0; i < count; i++)
+        hs_simulator_remove_board(sims[i]);
+}
+
+// Pseudo-random code over the first half of the flash, the rest stays blank
+static int create_firmware(size_t size, ty_firmware **rfw)
+{
+    ty_firmware *fw;
+    uint32_t state = 0x12345678;
+    int r;
+
+    r = ty_firmware_new("bench.bin", &fw);
+    if (r < 0)
+        return r;
+    r = ty_firmware_expand_image(fw, size);
+    if (r < 0) {
+        ty_firmware_unref(fw);
+        return r;
+    }
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        fw->image[i] = (uint8_t)(state >> 16);
+    }
+
+    *rfw = fw;
+    return 0;
+}
+
+static int bench_upload(const hs_simulator_config *config, const char *name, unsigned int count)
+{
+    hs_simulator_board *sims[MAX_BOARDS] = {NULL};
+    struct bench_context ctx = {0};
+    ty_monitor *monitor = NULL;
+    ty_firmware *fw = NULL;
+    size_t size = config->code_size / 2;
+    unsigned int stalls = 0;
+    uint64_t start, elapsed;
+    int r;
+
+    r = plug_boards(config, count, sims, &monitor, &ctx);
+    if (r < 0)
+        goto cleanup;
+    r = create_firmware(size, &fw);
+    if (r < 0)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < count; i++) {
+        r = ty_upload(ctx.boards[i], &fw, 1, TY_UPLOAD_NOCHECK, &ctx.tasks[i]);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    start = ty_millis();
+    for (unsigned int i = 0; i < count; i++) {
+        r = ty_task_start(ctx.tasks[i]);
+        if (r < 0)
+            goto cleanup;
+    }
+    do {
+        r = ty_monitor_wait(monitor, check_tasks, &ctx, 200);
+    } while (!r);
+    if (r < 0)
+        goto cleanup;
+    elapsed = ty_millis() - start;
+
+    for (unsigned int i = 0; i < count; i++) {
+        hs_simulator_stats stats;
+
+        if (ctx.tasks[i]->ret < 0) {
+            r = ctx.tasks[i]->ret;
+            goto cleanup;
+        }
+        hs_simulator_get_stats(sims[i], &stats);
+        stalls += stats.stalls;
+    }
+
+    printf("%-14s %6u %8u KiB %9.2f s %9.1f KiB/s %8u\n", name, count,
+           (unsigned int)(size / 1024), (double)elapsed / 1000.0,
+           (double)(size * count) / 1024.0 / ((double)elapsed / 1000.0), stalls);
+
+    r = 0;
+cleanup:
+    ty_firmware_unref(fw);
+    unplug_boards(sims, count, monitor, &ctx);
+    return r;
+}
+
+static int bench_serial(hs_simulator_serial serial, unsigned int rate, unsigned int count)
+{
+    hs_simulator_board *sims[MAX_BOARDS] = {NULL};
+    struct bench_context ctx = {0};
+    ty_monitor *monitor = NULL;
+    hs_simulator_config config = {0};
+    ty_board_interface *ifaces[MAX_BOARDS] = {NULL};
+    hs_poll_source sources[MAX_BOARDS];
+    uint64_t start, elapsed, received = 0, dropped = 0;
+    int r;
+
+    config.serial = serial;
+    config.serial_rate = rate;
+
+    r = plug_boards(&config, count, sims, &monitor, &ctx);
+    if (r < 0)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < count; i++) {
+        r = ty_board_open_interface(ctx.boards[i], TY_BOARD_CAPABILITY_SERIAL, &ifaces[i]);
+        if (r <= 0) {
+            if (!r)
+                r = ty_error(TY_ERROR_MODE, "Simulated board has no serial interface");
+            goto cleanup;
+        }
+        sources[i].desc = hs_port_get_poll_handle(ty_board_interface_get_handle(ifaces[i]));
+    }
+
+    start = ty_millis();
+    while ((elapsed = ty_millis() - start) < SERIAL_DURATION) {
+        r = hs_poll(sources, count, ty_adjust_timeout(SERIAL_DURATION, start));
+        if (r < 0)
+            goto cleanup;
+
+        for (unsigned int i = 0; i < count; i++) {
+            char buf[8192];
+            ssize_t len;
+
+            if (!sources[i].ready)
+                continue;
+            len = ty_board_serial_read(ctx.boards[i], buf, sizeof(buf), 0);
+            if (len < 0) {
+                r = (int)len;
+                goto cleanup;
+            }
+            received += (uint64_t)len;
+        }
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        hs_simulator_stats stats;
+
+        hs_simulator_get_stats(sims[i], &stats);
+        dropped += stats.serial_dropped;
+    }
+
+    printf("%-8s %10u %6u %12.1f KiB/s %11.2f%%\n",
+           serial == HS_SIMULATOR_SERIAL_SEREMU ? "Seremu" : "CDC", rate, count,
+           (double)received / 1024.0 / ((double)elapsed / 1000.0),
+           received + dropped ? 100.0 * (double)dropped / (double)(received + dropped) : 0.0);
+
+    r = 0;
+cleanup:
+    for (unsigned int i = 0; i < count; i++) {
+        if (ifaces[i])
+            ty_board_interface_close(ifaces[i]);
+    }
+    unplug_boards(sims, count, monitor, &ctx);
+    return r;
+}
+
+int main(void)
+{
+    static const unsigned int counts[] = {1, 4, 16};
+    static const unsigned int rates[] = {64000, 1000000, 8000000};
+    ty_pool *pool;
+    int r;
+
+    setenv("TYTOOLS_MONITOR_BACKEND", "simulator", 1);
+    ty_message_redirect(quiet_handler, NULL);
+
+    r = ty_pool_get_default(&pool);
+    if (r < 0)
+        return 1;
+    r = ty_pool_set_max_threads(pool, MAX_BOARDS);
+    if (r < 0)
+        return 1;
+
+    printf("%-14s %6s %12s %11s %15s %8s\n", "Model", "Boards", "Image", "Time", "Throughput",
+           "Stalls");
+    for (unsigned int i = 0; i < TY_COUNTOF(models); i++) {
+        for (unsigned int j = 0; j < TY_COUNTOF(counts); j++) {
+            r = bench_upload(&models[i].config, models[i].name, counts[j]);
+            if (r < 0)
+                return 1;
+        }
+    }
+
+    printf("\n%-8s %10s %6s %18s %12s\n", "Serial", "Rate", "Boards", "Received", "Dropped");
+    for (unsigned int i = 0; i < TY_COUNTOF(rates); i++) {
+        for (unsigned int j = 0; j < TY_COUNTOF(counts); j++) {
+            r = bench_serial(HS_SIMULATOR_SERIAL_CDC, rates[i], counts[j]);
+            if (r < 0)
+                return 1;
+            r = bench_serial(HS_SIMULATOR_SERIAL_SEREMU, rates[i], counts[j]);
+            if (r < 0)
+                return 1;
+        }
+    }
+
+    return 0;
+}
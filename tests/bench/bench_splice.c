@@ -0,0 +1,307 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Compares the ways tycmd monitor can move serial data to stdout, on a pty pair standing in
+   for a CDC-ACM board. A thread floods the master side, the reader polls the slave side and
+   forwards everything to /dev/null, a temporary file or a pipe drained by another thread.
+   The CPU time of the reader thread matters as much as the throughput, the pty itself is
+   the bottleneck. */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "../../src/libty/common.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/thread.h"
+
+#define DEFAULT_SIZE (64 * 1024 * 1024)
+#define SPLICE_SIZE 65536
+
+enum method {
+    METHOD_COPY_8K,
+    METHOD_COPY_64K,
+    METHOD_SPLICE
+};
+
+static const char *const method_names[] = {
+    "copy (8 kB)",
+    "copy (64 kB)",
+    "splice"
+};
+
+enum output {
+    OUTPUT_NULL,
+    OUTPUT_FILE,
+    OUTPUT_PIPE
+};
+
+static const char *const output_names[] = {
+    "/dev/null",
+    "file",
+    "pipe"
+};
+
+struct flood_context {
+    int fd;
+    size_t size;
+};
+
+static int flood_master(void *udata)
+{
+    struct flood_context *ctx = udata;
+    char buf[16384];
+    size_t left = ctx->size;
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (char)('a' + i % 26);
+
+    while (left) {
+        ssize_t r = write(ctx->fd, buf, TY_MIN(sizeof(buf), left));
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        left -= (size_t)r;
+    }
+
+    return 0;
+}
+
+static int drain_pipe(void *udata)
+{
+    int fd = *(int *)udata;
+    char buf[65536];
+    ssize_t r;
+
+    do {
+        r = read(fd, buf, sizeof(buf));
+    } while (r > 0 || (r < 0 && errno == EINTR));
+
+    return 0;
+}
+
+static int open_pty(int *rmaster, int *rslave)
+{
+    struct termios tio;
+    int master, slave;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master < 0)
+        return ty_error(TY_ERROR_SYSTEM, "posix_openpt() failed: %s", strerror(errno));
+    if (grantpt(master) < 0 || unlockpt(master) < 0) {
+        close(master);
+        return ty_error(TY_ERROR_SYSTEM, "Failed to unlock pty: %s", strerror(errno));
+    }
+
+    // Non-blocking like the serial ports opened by libhs
+    slave = open(ptsname(master), O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (slave < 0) {
+        close(master);
+        return ty_error(TY_ERROR_SYSTEM, "Failed to open pty slave: %s", strerror(errno));
+    }
+
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    *rmaster = master;
+    *rslave = slave;
+    return 0;
+}
+
+static int forward(enum method method, int fd, int outfd, int tmp_pipe[2], size_t size)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    char buf[SPLICE_SIZE];
+    size_t buf_size = (method == METHOD_COPY_8K) ? 8192 : sizeof(buf);
+    bool direct;
+
+    {
+        struct stat sb;
+        direct = !fstat(outfd, &sb) && S_ISFIFO(sb.st_mode);
+    }
+
+    while (size) {
+        ssize_t len;
+
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return ty_error(TY_ERROR_SYSTEM, "poll() failed: %s", strerror(errno));
+
+        // Same paths as loop() in tycmd monitor
+        if (method == METHOD_SPLICE) {
+            if (direct) {
+                len = splice(fd, NULL, outfd, NULL, SPLICE_SIZE, 0);
+            } else {
+                len = splice(fd, NULL, tmp_pipe[1], NULL, SPLICE_SIZE, SPLICE_F_NONBLOCK);
+                for (ssize_t left = len; left > 0;) {
+                    ssize_t r = splice(tmp_pipe[0], NULL, outfd, NULL, (size_t)left,
+                                       SPLICE_F_MOVE);
+                    if (r < 0)
+                        return ty_error(TY_ERROR_UNSUPPORTED, "Cannot splice to output: %s",
+                                        strerror(errno));
+                    left -= r;
+                }
+            }
+            if (len < 0 && errno != EAGAIN && errno != EINTR)
+                return ty_error(TY_ERROR_UNSUPPORTED, "Cannot splice from pty: %s",
+                                strerror(errno));
+        } else {
+            len = read(fd, buf, buf_size);
+            if (len < 0 && errno != EAGAIN && errno != EINTR)
+                return ty_error(TY_ERROR_SYSTEM, "read() failed: %s", strerror(errno));
+            for (ssize_t off = 0; off < len;) {
+                ssize_t r = write(outfd, buf + off, (size_t)(len - off));
+                if (r < 0)
+                    return ty_error(TY_ERROR_SYSTEM, "write() failed: %s", strerror(errno));
+                off += r;
+            }
+        }
+
+        if (len > 0)
+            size -= (size_t)len;
+    }
+
+    return 0;
+}
+
+static double thread_cpu_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run(enum method method, enum output output, size_t size, double *rrate, double *rcpu)
+{
+    int master = -1, slave = -1;
+    int outfd = -1, sink[2] = {-1, -1}, tmp_pipe[2] = {-1, -1};
+    ty_thread flood_thread, drain_thread;
+    bool flood_started = false, drain_started = false;
+    struct flood_context flood;
+    uint64_t start;
+    double cpu;
+    int r;
+
+    r = open_pty(&master, &slave);
+    if (r < 0)
+        return r;
+
+    if (output == OUTPUT_PIPE) {
+        if (pipe2(sink, O_CLOEXEC) < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "pipe2() failed: %s", strerror(errno));
+            goto cleanup;
+        }
+        outfd = sink[1];
+
+        r = ty_thread_create(&drain_thread, drain_pipe, &sink[0]);
+        if (r < 0)
+            goto cleanup;
+        drain_started = true;
+    } else if (output == OUTPUT_FILE) {
+        char filename[] = "/tmp/bench_splice.XXXXXX";
+
+        outfd = mkstemp(filename);
+        if (outfd < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "Cannot create temporary file: %s", strerror(errno));
+            goto cleanup;
+        }
+        unlink(filename);
+    } else {
+        outfd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (outfd < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "Cannot open /dev/null: %s", strerror(errno));
+            goto cleanup;
+        }
+    }
+    if (pipe2(tmp_pipe, O_CLOEXEC) < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "pipe2() failed: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    flood.fd = master;
+    flood.size = size;
+    r = ty_thread_create(&flood_thread, flood_master, &flood);
+    if (r < 0)
+        goto cleanup;
+    flood_started = true;
+
+    start = ty_millis();
+    cpu = thread_cpu_time();
+    r = forward(method, slave, outfd, tmp_pipe, size);
+    if (r < 0)
+        goto cleanup;
+    cpu = thread_cpu_time() - cpu;
+
+    *rrate = (double)size / 1048576.0 / ((double)TY_MAX(ty_millis() - start, 1) / 1000.0);
+    *rcpu = cpu * 1e9 / (double)size * 1024.0;
+
+    r = 0;
+cleanup:
+    // The slave side must go first, or the flood thread could block forever on errors
+    if (slave >= 0)
+        close(slave);
+    if (flood_started)
+        ty_thread_join(&flood_thread);
+    if (master >= 0)
+        close(master);
+    if (output == OUTPUT_PIPE) {
+        if (sink[1] >= 0)
+            close(sink[1]);
+        if (drain_started)
+            ty_thread_join(&drain_thread);
+        if (sink[0] >= 0)
+            close(sink[0]);
+    } else if (outfd >= 0) {
+        close(outfd);
+    }
+    if (tmp_pipe[0] >= 0) {
+        close(tmp_pipe[0]);
+        close(tmp_pipe[1]);
+    }
+    return r;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = DEFAULT_SIZE;
+    int r;
+
+    if (argc > 1) {
+        char *end;
+        unsigned long mb = strtoul(argv[1], &end, 10);
+        if (end == argv[1] || *end || !mb) {
+            fprintf(stderr, "usage: %s [<MB>]\n", argv[0]);
+            return 1;
+        }
+        size = (size_t)mb * 1024 * 1024;
+    }
+
+    printf("%-14s %-10s %12s %16s\n", "Method", "Output", "Throughput", "Reader CPU");
+    for (unsigned int i = 0; i < TY_COUNTOF(output_names); i++) {
+        for (unsigned int j = 0; j < TY_COUNTOF(method_names); j++) {
+            double rate, cpu;
+
+            r = run((enum method)j, (enum output)i, size, &rate, &cpu);
+            if (r < 0) {
+                printf("%-14s %-10s %12s\n", method_names[j], output_names[i], "failed");
+                continue;
+            }
+
+            printf("%-14s %-10s %7.1f MB/s %10.0f ns/kB\n", method_names[j], output_names[i],
+                   rate, cpu);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,990 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../../src/libty/common.h"
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+#include "../../src/libhs/htable.h"
+#include "../../src/libty/firmware.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/optline.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+#include "../../src/libty/thread.h"
+#include "bench_devices.h"
+
+#define DEFAULT_MIN_DURATION 500
+#define MAX_RESULTS 128
+#define MAX_SAMPLES 100000
+#define TASK_TIMEOUT 10000
+
+struct bench_result {
+    char name[64];
+    uint64_t iterations;
+    double ns_per_op;
+    // Only for latency benchmarks
+    bool latency;
+    double p50_ns;
+    double p99_ns;
+    // Only for benchmarks that process data, 0 otherwise
+    double mb_per_s;
+};
+
+static unsigned int min_duration = DEFAULT_MIN_DURATION;
+
+static struct bench_result results[MAX_RESULTS];
+static unsigned int results_count;
+
+static struct bench_result *add_result(const char *name, uint64_t iterations, double ns_per_op)
+{
+    struct bench_result *result;
+
+    if (results_count == MAX_RESULTS) {
+        fprintf(stderr, "Too many results, increase MAX_RESULTS\n");
+        abort();
+    }
+
+    result = &results[results_count++];
+    memset(result, 0, sizeof(*result));
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->iterations = iterations;
+    result->ns_per_op = ns_per_op;
+
+    return result;
+}
+
+/* Call f() in growing batches until min_duration has elapsed, after one warm-up call. Use
+   size to get the throughput of each call. */
+static int measure(const char *name, int (*f)(void *udata), void *udata, size_t size)
+{
+    uint64_t start, elapsed;
+    uint64_t iterations = 0;
+    unsigned int batch = 1;
+    struct bench_result *result;
+    int r;
+
+    r = (*f)(udata);
+    if (r < 0)
+        return r;
+
+    start = ty_micros();
+    do {
+        for (unsigned int i = 0; i < batch; i++) {
+            r = (*f)(udata);
+            if (r < 0)
+                return r;
+        }
+        iterations += batch;
+        elapsed = ty_micros() - start;
+
+        if (batch < 4096 && elapsed < (uint64_t)min_duration * 100)
+            batch *= 2;
+    } while (elapsed < (uint64_t)min_duration * 1000);
+
+    result = add_result(name, iterations, (double)elapsed * 1000.0 / (double)iterations);
+    if (size)
+        result->mb_per_s = (double)size * (double)iterations / (double)elapsed;
+
+    return 0;
+}
+
+static int compare_uint64(const void *a, const void *b)
+{
+    uint64_t u1 = *(const uint64_t *)a;
+    uint64_t u2 = *(const uint64_t *)b;
+
+    return (u1 > u2) - (u1 < u2);
+}
+
+// Samples are in microseconds, they get sorted
+static void add_latency_result(const char *name, uint64_t *samples, unsigned int count)
+{
+    struct bench_result *result;
+    uint64_t total = 0;
+
+    if (!count)
+        return;
+
+    qsort(samples, count, sizeof(*samples), compare_uint64);
+    for (unsigned int i = 0; i < count; i++)
+        total += samples[i];
+
+    result = add_result(name, count, (double)total * 1000.0 / count);
+    result->latency = true;
+    result->p50_ns = (double)samples[count / 2] * 1000.0;
+    result->p99_ns = (double)samples[(uint64_t)count * 99 / 100] * 1000.0;
+}
+
+// Deterministic so that results can be compared across runs and commits
+static void fill_random(uint8_t *buf, size_t size, uint32_t seed)
+{
+    uint32_t state = seed;
+
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        buf[i] = (uint8_t)(state >> 16);
+    }
+}
+
+static void write_uint32_le(uint8_t *ptr, uint32_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+    ptr[2] = (uint8_t)(value >> 16);
+    ptr[3] = (uint8_t)(value >> 24);
+}
+
+static void write_uint16_le(uint8_t *ptr, uint16_t value)
+{
+    ptr[0] = (uint8_t)value;
+    ptr[1] = (uint8_t)(value >> 8);
+}
+
+struct firmware_input {
+    const char *filename;
+    int (*load)(ty_firmware *fw, const uint8_t *mem, size_t len);
+
+    uint8_t *mem;
+    size_t len;
+};
+
+static int run_firmware_load(void *udata)
+{
+    struct firmware_input *input = udata;
+    ty_firmware *fw;
+    int r;
+
+    r = ty_firmware_new(input->filename, &fw);
+    if (r < 0)
+        return r;
+    r = (*input->load)(fw, input->mem, input->len);
+    ty_firmware_unref(fw);
+
+    return r;
+}
+
+static char *append_ihex_record(char *ptr, uint8_t type, uint16_t address,
+                                const uint8_t *data, uint8_t len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    uint8_t header[4] = {len, (uint8_t)(address >> 8), (uint8_t)address, type};
+    uint8_t checksum = 0;
+
+    *ptr++ = ':';
+    for (unsigned int i = 0; i < 4 + (unsigned int)len; i++) {
+        uint8_t value = i < 4 ? header[i] : data[i - 4];
+
+        *ptr++ = hex[value >> 4];
+        *ptr++ = hex[value & 0xF];
+        checksum = (uint8_t)(checksum + value);
+    }
+    checksum = (uint8_t)-checksum;
+    *ptr++ = hex[checksum >> 4];
+    *ptr++ = hex[checksum & 0xF];
+    *ptr++ = '\r';
+    *ptr++ = '\n';
+
+    return ptr;
+}
+
+// 32 bytes per record, with an extended linear address record every 64 kiB
+static void build_ihex(const uint8_t *image, size_t size, struct firmware_input *input)
+{
+    char *ptr;
+
+    input->mem = malloc((size / 32 + size / 65536 + 2) * 80);
+    if (!input->mem)
+        abort();
+
+    ptr = (char *)input->mem;
+    for (size_t offset = 0; offset < size; offset += 32) {
+        uint8_t len = (uint8_t)TY_MIN(size - offset, 32);
+
+        if (!(offset % 65536)) {
+            uint8_t segment[2] = {(uint8_t)(offset >> 24), (uint8_t)(offset >> 16)};
+            ptr = append_ihex_record(ptr, 4, 0, segment, 2);
+        }
+        ptr = append_ihex_record(ptr, 0, (uint16_t)offset, image + offset, len);
+    }
+    ptr = append_ihex_record(ptr, 1, 0, NULL, 0);
+
+    input->len = (size_t)(ptr - (char *)input->mem);
+}
+
+#define ELF_SEGMENTS 4
+#define ELF_EHDR_SIZE 52
+#define ELF_PHDR_SIZE 32
+#define ELF_SHDR_SIZE 40
+#define ELF_SYM_SIZE 16
+
+/* Little-endian ARM executable with ELF_SEGMENTS loadable segments, and a symbol table
+   with symbols_count symbols so that the section and symbol indexing shows up too. */
+static void build_elf(const uint8_t *image, size_t size, unsigned int symbols_count,
+                      struct firmware_input *input)
+{
+    static const char shstrtab[] = "\0.text\0.symtab\0.strtab\0.shstrtab";
+    size_t strtab_size = 1 + (size_t)symbols_count * 16;
+    size_t phoff = ELF_EHDR_SIZE;
+    size_t data_offset = phoff + ELF_SEGMENTS * ELF_PHDR_SIZE;
+    size_t symtab_offset = data_offset + size;
+    size_t strtab_offset = symtab_offset + (size_t)(symbols_count + 1) * ELF_SYM_SIZE;
+    size_t shstrtab_offset = strtab_offset + strtab_size;
+    size_t shoff = (shstrtab_offset + sizeof(shstrtab) + 3) / 4 * 4;
+    uint8_t *mem;
+    char *strtab;
+
+    input->len = shoff + 5 * ELF_SHDR_SIZE;
+    input->mem = calloc(1, input->len);
+    if (!input->mem)
+        abort();
+    mem = input->mem;
+
+    memcpy(mem, "\177ELF", 4);
+    mem[4] = 1; // ELFCLASS32
+    mem[5] = 1; // ELFDATA2LSB
+    mem[6] = 1; // EV_CURRENT
+    write_uint16_le(mem + 16, 2); // ET_EXEC
+    write_uint16_le(mem + 18, 40); // EM_ARM
+    write_uint32_le(mem + 20, 1);
+    write_uint32_le(mem + 28, (uint32_t)phoff);
+    write_uint32_le(mem + 32, (uint32_t)shoff);
+    write_uint16_le(mem + 40, ELF_EHDR_SIZE);
+    write_uint16_le(mem + 42, ELF_PHDR_SIZE);
+    write_uint16_le(mem + 44, ELF_SEGMENTS);
+    write_uint16_le(mem + 46, ELF_SHDR_SIZE);
+    write_uint16_le(mem + 48, 5);
+    write_uint16_le(mem + 50, 4);
+
+    for (unsigned int i = 0; i < ELF_SEGMENTS; i++) {
+        uint8_t *phdr = mem + phoff + i * ELF_PHDR_SIZE;
+        size_t segment_size = size / ELF_SEGMENTS;
+        size_t segment_offset = i * segment_size;
+
+        write_uint32_le(phdr, 1); // PT_LOAD
+        write_uint32_le(phdr + 4, (uint32_t)(data_offset + segment_offset));
+        write_uint32_le(phdr + 8, (uint32_t)segment_offset);
+        write_uint32_le(phdr + 12, (uint32_t)segment_offset);
+        write_uint32_le(phdr + 16, (uint32_t)segment_size);
+        write_uint32_le(phdr + 20, (uint32_t)segment_size);
+        write_uint32_le(phdr + 24, 5); // PF_R | PF_X
+        write_uint32_le(phdr + 28, 4);
+    }
+    memcpy(mem + data_offset, image, size);
+
+    // Symbol 0 is the null symbol, names are "sym_%08x" with reverse order addresses
+    strtab = (char *)mem + strtab_offset;
+    for (unsigned int i = 0; i < symbols_count; i++) {
+        uint8_t *sym = mem + symtab_offset + (i + 1) * ELF_SYM_SIZE;
+        uint32_t name_offset = 1 + i * 16;
+
+        sprintf(strtab + name_offset, "sym_%08x", symbols_count - i);
+        write_uint32_le(sym, name_offset);
+        write_uint32_le(sym + 4, (uint32_t)((symbols_count - i) * 4 % size));
+        write_uint32_le(sym + 8, 4);
+        sym[12] = 2; // STT_FUNC
+        write_uint16_le(sym + 14, 1);
+    }
+    memcpy(mem + shstrtab_offset, shstrtab, sizeof(shstrtab));
+
+    // Null, .text, .symtab, .strtab and .shstrtab sections
+    {
+        uint8_t *shdr = mem + shoff + ELF_SHDR_SIZE;
+
+        write_uint32_le(shdr, 1);
+        write_uint32_le(shdr + 4, 1); // SHT_PROGBITS
+        write_uint32_le(shdr + 8, 0x6); // SHF_ALLOC | SHF_EXECINSTR
+        write_uint32_le(shdr + 16, (uint32_t)data_offset);
+        write_uint32_le(shdr + 20, (uint32_t)size);
+        shdr += ELF_SHDR_SIZE;
+
+        write_uint32_le(shdr, 7);
+        write_uint32_le(shdr + 4, 2); // SHT_SYMTAB
+        write_uint32_le(shdr + 16, (uint32_t)symtab_offset);
+        write_uint32_le(shdr + 20, (symbols_count + 1) * ELF_SYM_SIZE);
+        write_uint32_le(shdr + 24, 3);
+        write_uint32_le(shdr + 36, ELF_SYM_SIZE);
+        shdr += ELF_SHDR_SIZE;
+
+        write_uint32_le(shdr, 15);
+        write_uint32_le(shdr + 4, 3); // SHT_STRTAB
+        write_uint32_le(shdr + 16, (uint32_t)strtab_offset);
+        write_uint32_le(shdr + 20, (uint32_t)strtab_size);
+        shdr += ELF_SHDR_SIZE;
+
+        write_uint32_le(shdr, 23);
+        write_uint32_le(shdr + 4, 3);
+        write_uint32_le(shdr + 16, (uint32_t)shstrtab_offset);
+        write_uint32_le(shdr + 20, sizeof(shstrtab));
+    }
+}
+
+static int bench_firmware_load(void)
+{
+    static const size_t sizes[] = {65536, 262144, TY_FIRMWARE_MAX_SIZE};
+    uint8_t *image;
+    int r = 0;
+
+    image = malloc(TY_FIRMWARE_MAX_SIZE);
+    if (!image)
+        abort();
+    fill_random(image, TY_FIRMWARE_MAX_SIZE, 0x12345678);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(sizes); i++) {
+        struct firmware_input ihex = {"bench.hex", ty_firmware_load_ihex};
+        struct firmware_input elf = {"bench.elf", ty_firmware_load_elf};
+        char name[64];
+
+        build_ihex(image, sizes[i], &ihex);
+        build_elf(image, sizes[i], 4096, &elf);
+
+        // Throughput is relative to the image size, not the size of the input file
+        sprintf(name, "firmware_load_ihex/%zuk", sizes[i] / 1024);
+        r = measure(name, run_firmware_load, &ihex, sizes[i]);
+        if (!r) {
+            sprintf(name, "firmware_load_elf/%zuk", sizes[i] / 1024);
+            r = measure(name, run_firmware_load, &elf, sizes[i]);
+        }
+
+        free(elf.mem);
+        free(ihex.mem);
+        if (r < 0)
+            break;
+    }
+
+    free(image);
+    return r;
+}
+
+static int run_identify(void *udata)
+{
+    const ty_firmware *fw = udata;
+    ty_model models[8];
+
+    ty_firmware_identify(fw, models, TY_COUNTOF(models));
+    return 0;
+}
+
+static int bench_firmware_identify(void)
+{
+    // Vector table signatures for ARM models, magic values of _reboot_Teensyduino_() for AVR
+    static const struct {
+        ty_model model;
+        uint32_t stack_addr;
+        uint32_t vectors_size;
+        uint64_t avr_magic;
+    } cases[] = {
+        {TY_MODEL_TEENSY_PP_10, 0, 0, 0x94F8CFFF7E00940C},
+        {TY_MODEL_TEENSY_20,    0, 0, 0x94F8CFFF3F00940C},
+        {TY_MODEL_TEENSY_PP_20, 0, 0, 0x94F8CFFFFE00940C},
+        {TY_MODEL_TEENSY_30,    0x20002000, 0xF8, 0},
+        {TY_MODEL_TEENSY_31,    0x20008000, 0x1BC, 0},
+        {TY_MODEL_TEENSY_LC,    0x20001800, 0xC0, 0},
+        {TY_MODEL_TEENSY_35,    0x20020000, 0x198, 0},
+        {TY_MODEL_TEENSY_36,    0x20030000, 0x1D0, 0},
+        // Worst case, nothing matches and we scan the whole AVR-sized image
+        {0, 0, 0, 0}
+    };
+
+    for (unsigned int i = 0; i < TY_COUNTOF(cases); i++) {
+        ty_firmware *fw;
+        ty_model models[8];
+        char name[64];
+        int r;
+
+        r = ty_firmware_new("bench.hex", &fw);
+        if (r < 0)
+            return r;
+        r = ty_firmware_expand_image(fw, cases[i].stack_addr ? 262144 : 130048);
+        if (r < 0) {
+            ty_firmware_unref(fw);
+            return r;
+        }
+        fill_random(fw->image, fw->size, 0x12345678);
+
+        if (cases[i].stack_addr) {
+            write_uint32_le(fw->image, cases[i].stack_addr);
+            write_uint32_le(fw->image + 4, cases[i].vectors_size | 1);
+        } else {
+            // The AVR code is not supposed to look like an ARM vector table
+            write_uint32_le(fw->image, 0x940C0000);
+            write_uint32_le(fw->image + 4, 0x940C0000);
+            for (unsigned int j = 0; j < 8; j++)
+                fw->image[fw->size - 512 + j] = (uint8_t)(cases[i].avr_magic >> (j * 8));
+        }
+
+        if (!ty_firmware_identify(fw, models, TY_COUNTOF(models)) != !cases[i].model ||
+                (cases[i].model && models[0] != cases[i].model)) {
+            fprintf(stderr, "Failed to identify synthetic %s image\n",
+                    cases[i].model ? ty_models[cases[i].model].name : "unknown");
+            ty_firmware_unref(fw);
+            return -1;
+        }
+
+        sprintf(name, "firmware_identify/%s",
+                cases[i].model ? ty_models[cases[i].model].name : "none");
+        // Throughput only makes sense for the AVR scan, ARM models are found right away
+        r = measure(name, run_identify, fw, cases[i].stack_addr ? 0 : fw->size);
+        ty_firmware_unref(fw);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+struct htable_entry {
+    _hs_htable_head hnode;
+    char key[32];
+};
+
+struct htable_input {
+    _hs_htable table;
+    struct htable_entry *entries;
+    unsigned int count;
+    unsigned int next;
+};
+
+static int run_htable_lookup(void *udata)
+{
+    struct htable_input *input = udata;
+    const char *key = input->entries[input->next].key;
+    uint32_t hash = _hs_htable_hash_str(key);
+    struct htable_entry *found = NULL;
+
+    // Walk the keys in a scattered order to defeat the cache a little
+    input->next = (input->next + 7919) % input->count;
+
+    _hs_htable_foreach_hash(cur, &input->table, hash) {
+        struct htable_entry *entry = ty_container_of(cur, struct htable_entry, hnode);
+
+        if (!strcmp(entry->key, key)) {
+            found = entry;
+            break;
+        }
+    }
+
+    return found ? 0 : -1;
+}
+
+static int bench_htable(void)
+{
+    // The monitor uses 64 buckets, try a few load factors
+    static const unsigned int counts[] = {64, 1024, 65536};
+
+    for (unsigned int i = 0; i < TY_COUNTOF(counts); i++) {
+        struct htable_input input = {0};
+        char name[64];
+        int r;
+
+        input.count = counts[i];
+        input.entries = calloc(input.count, sizeof(*input.entries));
+        if (!input.entries)
+            abort();
+        if (_hs_htable_init(&input.table, 64) < 0)
+            abort();
+
+        // Same shape as device keys
+        for (unsigned int j = 0; j < input.count; j++) {
+            struct htable_entry *entry = &input.entries[j];
+
+            sprintf(entry->key, "/dev/ttyBENCH%u", j);
+            _hs_htable_add(&input.table, _hs_htable_hash_str(entry->key), &entry->hnode);
+        }
+
+        sprintf(name, "htable_lookup/%u", counts[i]);
+        r = measure(name, run_htable_lookup, &input, 0);
+
+        _hs_htable_release(&input.table);
+        free(input.entries);
+        if (r < 0) {
+            fprintf(stderr, "Failed to find key in hash table\n");
+            return r;
+        }
+    }
+
+    return 0;
+}
+
+// Only one task runs at a time, ty_task_join() makes the value visible to the main thread
+static uint64_t dispatch_time;
+
+static int run_dispatch(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    dispatch_time = ty_micros();
+    return 0;
+}
+
+static int run_nothing(ty_task *task)
+{
+    TY_UNUSED(task);
+    return 0;
+}
+
+static int bench_pool_dispatch(void)
+{
+    ty_pool *pool;
+    uint64_t *samples = NULL;
+    unsigned int samples_count = 0;
+    ty_task *tasks[256];
+    uint64_t start;
+    int r;
+
+    r = ty_pool_new(&pool);
+    if (r < 0)
+        return r;
+    ty_pool_set_max_threads(pool, 4);
+
+    samples = malloc(MAX_SAMPLES * sizeof(*samples));
+    if (!samples)
+        abort();
+
+    // Latency from ty_task_start() to the start of the task, one task at a time
+    start = ty_millis();
+    do {
+        ty_task *task;
+        uint64_t start_time;
+
+        r = ty_task_new("dispatch", run_dispatch, &task);
+        if (r < 0)
+            goto cleanup;
+        task->pool = pool;
+
+        /* Waiting with a timeout keeps ty_task_wait() from running the task in this thread,
+           we want a worker thread to pick it up. */
+        start_time = ty_micros();
+        r = ty_task_start(task);
+        if (r >= 0) {
+            r = ty_task_wait(task, TY_TASK_STATUS_FINISHED, TASK_TIMEOUT);
+            if (!r)
+                r = ty_error(TY_ERROR_OTHER, "Timed out while waiting for dispatched task");
+        }
+        ty_task_unref(task);
+        if (r < 0)
+            goto cleanup;
+
+        samples[samples_count++] = dispatch_time - start_time;
+    } while (samples_count < MAX_SAMPLES && ty_millis() - start < min_duration);
+    add_latency_result("pool_dispatch_latency", samples, samples_count);
+
+    // Throughput with many tasks in flight
+    {
+        uint64_t iterations = 0;
+        uint64_t elapsed;
+
+        start = ty_micros();
+        do {
+            for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+                r = ty_task_new("batch", run_nothing, &tasks[i]);
+                if (r < 0)
+                    goto cleanup;
+                tasks[i]->pool = pool;
+                r = ty_task_start(tasks[i]);
+                if (r < 0) {
+                    ty_task_unref(tasks[i]);
+                    goto cleanup;
+                }
+            }
+            for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+                if (r >= 0) {
+                    r = ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, TASK_TIMEOUT);
+                    if (!r)
+                        r = ty_error(TY_ERROR_OTHER, "Timed out while waiting for batch task");
+                }
+                ty_task_unref(tasks[i]);
+            }
+            if (r < 0)
+                goto cleanup;
+            iterations += TY_COUNTOF(tasks);
+
+            elapsed = ty_micros() - start;
+        } while (elapsed < (uint64_t)min_duration * 1000);
+
+        add_result("pool_dispatch_batch", iterations,
+                   (double)elapsed * 1000.0 / (double)iterations);
+    }
+
+    r = 0;
+cleanup:
+    free(samples);
+    ty_pool_free(pool);
+    return r;
+}
+
+/* Plug, unplug, replug (the boards come back from the missing state) and drop everything.
+   The wait for the drop delay is left out of the elapsed time. */
+static int churn_boards(ty_monitor *monitor, unsigned int count, uint64_t *relapsed)
+{
+    hs_device **devs;
+    uint64_t start, elapsed;
+    int r;
+
+    start = ty_micros();
+    devs = create_devices(count);
+    r = inject_devices(monitor, devs, count, HS_DEVICE_STATUS_ONLINE);
+    if (r >= 0)
+        r = inject_devices(monitor, devs, count, HS_DEVICE_STATUS_DISCONNECTED);
+    free_devices(devs, count);
+    if (r < 0)
+        return r;
+
+    devs = create_devices(count);
+    r = inject_devices(monitor, devs, count, HS_DEVICE_STATUS_ONLINE);
+    if (r >= 0)
+        r = inject_devices(monitor, devs, count, HS_DEVICE_STATUS_DISCONNECTED);
+    free_devices(devs, count);
+    if (r < 0)
+        return r;
+    elapsed = ty_micros() - start;
+
+    // Wait for the drop delay, then drop everything in one refresh
+    ty_delay(2);
+    start = ty_micros();
+    r = ty_monitor_refresh(monitor);
+    if (r < 0)
+        return r;
+    elapsed += ty_micros() - start;
+
+    if (count_boards(monitor)) {
+        fprintf(stderr, "Boards were not dropped\n");
+        return -1;
+    }
+
+    *relapsed += elapsed;
+    return 0;
+}
+
+static int bench_monitor_churn(void)
+{
+    static const unsigned int counts[] = {10, 100, 1000};
+    ty_monitor *monitor;
+    int r;
+
+    // Boards missing for more than 1 ms get dropped by the next refresh
+#ifdef _WIN32
+    _putenv("TYTOOLS_DROP_BOARD_DELAY=1");
+#else
+    setenv("TYTOOLS_DROP_BOARD_DELAY", "1", 1);
+#endif
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(counts); i++) {
+        uint64_t start, elapsed = 0;
+        uint64_t iterations = 0;
+        char name[64];
+
+        // Warm-up
+        r = churn_boards(monitor, counts[i], &elapsed);
+        if (r < 0)
+            goto cleanup;
+        elapsed = 0;
+
+        // Each iteration churns all the boards, results are per iteration
+        start = ty_millis();
+        do {
+            r = churn_boards(monitor, counts[i], &elapsed);
+            if (r < 0)
+                goto cleanup;
+            iterations++;
+        } while (ty_millis() - start < min_duration);
+
+        sprintf(name, "monitor_churn/%u", counts[i]);
+        add_result(name, iterations, (double)elapsed * 1000.0 / (double)iterations);
+    }
+
+    r = 0;
+cleanup:
+    ty_monitor_free(monitor);
+    return r;
+}
+
+struct wakeup_context {
+    ty_mutex mutex;
+    ty_cond cond;
+    bool armed;
+    bool stop;
+    uint64_t signal_time;
+
+#ifdef _WIN32
+    HANDLE event;
+#else
+    int pipe[2];
+#endif
+};
+
+static int run_wakeup_thread(void *udata)
+{
+    struct wakeup_context *ctx = udata;
+
+    while (true) {
+        ty_mutex_lock(&ctx->mutex);
+        while (!ctx->armed && !ctx->stop)
+            ty_cond_wait(&ctx->cond, &ctx->mutex, -1);
+        ctx->armed = false;
+        if (ctx->stop) {
+            ty_mutex_unlock(&ctx->mutex);
+            break;
+        }
+        ty_mutex_unlock(&ctx->mutex);
+
+        // Give the main thread the time to block in ty_poll()
+        ty_delay(1);
+
+        ty_mutex_lock(&ctx->mutex);
+        ctx->signal_time = ty_micros();
+        ty_mutex_unlock(&ctx->mutex);
+#ifdef _WIN32
+        SetEvent(ctx->event);
+#else
+        if (write(ctx->pipe[1], "", 1) < 0)
+            abort();
+#endif
+    }
+
+    return 0;
+}
+
+static int bench_poll_wakeup(void)
+{
+    struct wakeup_context ctx = {0};
+    ty_descriptor_set set = {0};
+    ty_thread thread;
+    uint64_t *samples;
+    unsigned int samples_count = 0;
+    uint64_t start;
+    int r;
+
+#ifdef _WIN32
+    ctx.event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!ctx.event)
+        return ty_error(TY_ERROR_SYSTEM, "CreateEvent() failed: %s", ty_win32_strerror(0));
+    ty_descriptor_set_add(&set, ctx.event, 1);
+#else
+    if (pipe(ctx.pipe) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+    ty_descriptor_set_add(&set, ctx.pipe[0], 1);
+#endif
+    ty_mutex_init(&ctx.mutex);
+    ty_cond_init(&ctx.cond);
+
+    samples = malloc(MAX_SAMPLES * sizeof(*samples));
+    if (!samples)
+        abort();
+
+    r = ty_thread_create(&thread, run_wakeup_thread, &ctx);
+    if (r < 0)
+        goto cleanup;
+
+    // Each sample costs at least 1 ms, don't wait forever with big durations
+    start = ty_millis();
+    do {
+        uint64_t wake_time;
+
+        ty_mutex_lock(&ctx.mutex);
+        ctx.armed = true;
+        ty_cond_signal(&ctx.cond);
+        ty_mutex_unlock(&ctx.mutex);
+
+        r = ty_poll(&set, 1000);
+        wake_time = ty_micros();
+        if (r <= 0) {
+            if (!r)
+                r = ty_error(TY_ERROR_TIMEOUT, "Timed out while waiting for wakeup");
+            break;
+        }
+#ifndef _WIN32
+        {
+            char buf[1];
+            if (read(ctx.pipe[0], buf, sizeof(buf)) < 0)
+                abort();
+        }
+#endif
+
+        ty_mutex_lock(&ctx.mutex);
+        samples[samples_count++] = wake_time - ctx.signal_time;
+        ty_mutex_unlock(&ctx.mutex);
+    } while (samples_count < 2000 && ty_millis() - start < min_duration);
+
+    ty_mutex_lock(&ctx.mutex);
+    ctx.stop = true;
+    ty_cond_signal(&ctx.cond);
+    ty_mutex_unlock(&ctx.mutex);
+    ty_thread_join(&thread);
+
+    if (r >= 0) {
+        add_latency_result("poll_wakeup_latency", samples, samples_count);
+        r = 0;
+    }
+
+cleanup:
+    free(samples);
+    ty_cond_release(&ctx.cond);
+    ty_mutex_release(&ctx.mutex);
+#ifdef _WIN32
+    CloseHandle(ctx.event);
+#else
+    close(ctx.pipe[0]);
+    close(ctx.pipe[1]);
+#endif
+    return r;
+}
+
+static const struct benchmark {
+    const char *name;
+    int (*run)(void);
+} benchmarks[] = {
+    {"firmware_load",     bench_firmware_load},
+    {"firmware_identify", bench_firmware_identify},
+    {"htable_lookup",     bench_htable},
+    {"pool_dispatch",     bench_pool_dispatch},
+    {"monitor_churn",     bench_monitor_churn},
+    {"poll_wakeup",       bench_poll_wakeup}
+};
+
+static void print_result(FILE *fp, const struct bench_result *result)
+{
+    fprintf(fp, "%-32s %10"PRIu64" %14.1f ns", result->name, result->iterations,
+            result->ns_per_op);
+    if (result->latency)
+        fprintf(fp, "   p50 %9.1f us   p99 %9.1f us", result->p50_ns / 1000.0,
+                result->p99_ns / 1000.0);
+    if (result->mb_per_s)
+        fprintf(fp, "   %9.1f MB/s", result->mb_per_s);
+    fputc('\n', fp);
+}
+
+static int write_json(const char *filename)
+{
+    FILE *fp;
+
+    if (strcmp(filename, "-")) {
+        fp = fopen(filename, "w");
+        if (!fp)
+            return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename, strerror(errno));
+    } else {
+        fp = stdout;
+    }
+
+    // Result names (including model names) have no quotes or backslashes to escape
+    fprintf(fp, "{\n  \"version\": \"%s\",\n  \"timestamp\": %"PRId64",\n"
+                "  \"min_duration_ms\": %u,\n  \"results\": [",
+            ty_version_string(), ty_unix_millis() / 1000, min_duration);
+    for (unsigned int i = 0; i < results_count; i++) {
+        const struct bench_result *result = &results[i];
+
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"iterations\": %"PRIu64", \"ns_per_op\": %.1f",
+                i ? "," : "", result->name, result->iterations, result->ns_per_op);
+        if (result->latency)
+            fprintf(fp, ", \"p50_ns\": %.1f, \"p99_ns\": %.1f", result->p50_ns, result->p99_ns);
+        if (result->mb_per_s)
+            fprintf(fp, ", \"mb_per_s\": %.2f", result->mb_per_s);
+        fputc('}', fp);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (fp != stdout) {
+        if (fclose(fp))
+            return ty_error(TY_ERROR_IO, "Failed to write '%s': %s", filename, strerror(errno));
+    } else {
+        fflush(fp);
+    }
+
+    return 0;
+}
+
+static void print_usage(FILE *fp)
+{
+    fprintf(fp, "usage: bench_tytools [options] [<filter> ...]\n\n"
+                "Options:\n"
+                "       --help               Show help message\n"
+                "   -o, --json <file>        Write results to <file> in JSON format ('-' for stdout)\n"
+                "   -d, --duration <ms>      Minimum duration of each benchmark (default: %u)\n\n"
+                "Filters select benchmarks with names containing one of them:\n",
+            DEFAULT_MIN_DURATION);
+    for (unsigned int i = 0; i < TY_COUNTOF(benchmarks); i++)
+        fprintf(fp, "   %s\n", benchmarks[i].name);
+}
+
+int main(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *json_filename = NULL;
+    char *filters[32];
+    unsigned int filters_count = 0;
+    FILE *table_fp;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_usage(stdout);
+            return 0;
+        } else if (strcmp(opt, "--json") == 0 || strcmp(opt, "-o") == 0) {
+            json_filename = ty_optline_get_value(&optl);
+            if (!json_filename) {
+                fprintf(stderr, "Option '%s' takes an argument\n", opt);
+                return 1;
+            }
+        } else if (strcmp(opt, "--duration") == 0 || strcmp(opt, "-d") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value || !atoi(value)) {
+                fprintf(stderr, "Option '%s' takes a positive number\n", opt);
+                return 1;
+            }
+            min_duration = (unsigned int)atoi(value);
+        } else {
+            fprintf(stderr, "Unknown option '%s'\n", opt);
+            print_usage(stderr);
+            return 1;
+        }
+    }
+    while ((opt = ty_optline_consume_non_option(&optl))) {
+        if (filters_count == TY_COUNTOF(filters)) {
+            fprintf(stderr, "Too many filters\n");
+            return 1;
+        }
+        filters[filters_count++] = opt;
+    }
+
+    // Keep stdout clean for the JSON output
+    table_fp = (json_filename && !strcmp(json_filename, "-")) ? stderr : stdout;
+    fprintf(table_fp, "%-32s %10s %17s\n", "Benchmark", "Iterations", "Time/op");
+
+    for (unsigned int i = 0; i < TY_COUNTOF(benchmarks); i++) {
+        const struct benchmark *bench = &benchmarks[i];
+        unsigned int first_result = results_count;
+        bool selected = !filters_count;
+
+        for (unsigned int j = 0; j < filters_count && !selected; j++)
+            selected = strstr(bench->name, filters[j]);
+        if (!selected)
+            continue;
+
+        if ((*bench->run)() < 0) {
+            fprintf(stderr, "Benchmark '%s' failed\n", bench->name);
+            return 1;
+        }
+
+        for (unsigned int j = first_result; j < results_count; j++)
+            print_result(table_fp, &results[j]);
+    }
+
+    if (json_filename && write_json(json_filename) < 0)
+        return 1;
+
+    return 0;
+}
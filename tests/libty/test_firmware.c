@@ -0,0 +1,285 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/firmware.h"
+
+static int load_ihex(const char *str, ty_firmware **rfw)
+{
+    int r;
+
+    ty_error_mask(TY_ERROR_PARSE);
+    r = ty_firmware_load_mem("test.hex", (const uint8_t *)str, strlen(str), NULL, rfw);
+    ty_error_unmask();
+
+    return r;
+}
+
+static void test_firmware_ihex_data(void)
+{
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":0400000001020304F2\n"
+                          ":00000001FF\n", &fw);
+
+        ASSERT(!r);
+        ASSERT(fw && fw->size == 4);
+        ASSERT(fw && !memcmp(fw->image, "\x01\x02\x03\x04", 4));
+        ty_firmware_unref(fw);
+    }
+
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":02000400010FB\r\n"
+                          ":02000000ABCD86\r\n"
+                          ":00000001FF\r\n", &fw);
+
+        // Truncated extended address record
+        ASSERT(r == TY_ERROR_PARSE);
+        ty_firmware_unref(fw);
+    }
+
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":020000040001F9\r\n"
+                          ":02000800abcd7E\r\n"
+                          ":00000001FF\r\n", &fw);
+
+        ASSERT(!r);
+        ASSERT(fw && fw->size == 0x1000A);
+        ASSERT(fw && fw->image[0x10008] == 0xAB && fw->image[0x10009] == 0xCD);
+        ty_firmware_unref(fw);
+    }
+}
+
+static void test_firmware_ihex_order(void)
+{
+    ty_firmware *fw = NULL;
+    int r = load_ihex(":020008001122C3\n"
+                      ":02000000334487\n"
+                      ":00000001FF\n", &fw);
+
+    // Lower records must not shrink the image, and gaps are filled like erased flash
+    ASSERT(!r);
+    ASSERT(fw && fw->size == 10);
+    ASSERT(fw && !memcmp(fw->image, "\x33\x44\xFF\xFF\xFF\xFF\xFF\xFF\x11\x22", 10));
+    ty_firmware_unref(fw);
+}
+
+static void test_firmware_ihex_errors(void)
+{
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":0400000001020304F2\n"
+                          "\n"
+                          ":0400040001020304F3\n"
+                          ":00000001FF\n", &fw);
+
+        ASSERT(r == TY_ERROR_PARSE);
+        ASSERT_STR_EQUAL(ty_error_last_message(), "IHEX parse error on line 3 in 'test.hex'");
+        ty_firmware_unref(fw);
+    }
+
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":0400000001020304F2\r\n"
+                          "\r\n"
+                          ":04000400010G0304EE\r\n"
+                          ":00000001FF\r\n", &fw);
+
+        ASSERT(r == TY_ERROR_PARSE);
+        ASSERT_STR_EQUAL(ty_error_last_message(), "IHEX parse error on line 3 in 'test.hex'");
+        ty_firmware_unref(fw);
+    }
+
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":0400000001020304F2\n"
+                          ":0400040001020304\n", &fw);
+
+        ASSERT(r == TY_ERROR_PARSE);
+        ASSERT_STR_EQUAL(ty_error_last_message(), "IHEX parse error on line 2 in 'test.hex'");
+        ty_firmware_unref(fw);
+    }
+
+    {
+        ty_firmware *fw = NULL;
+        int r = load_ihex(":0400000001020304F2\n", &fw);
+
+        ASSERT(r == TY_ERROR_PARSE);
+        ASSERT_STR_EQUAL(ty_error_last_message(), "Missing EOF record in 'test.hex' (IHEX)");
+        ty_firmware_unref(fw);
+    }
+}
+
+static void put_uint16(uint8_t *ptr, uint16_t u)
+{
+    ptr[0] = (uint8_t)(u & 0xFF);
+    ptr[1] = (uint8_t)(u >> 8);
+}
+
+static void put_uint32(uint8_t *ptr, uint32_t u)
+{
+    put_uint16(ptr, (uint16_t)(u & 0xFFFF));
+    put_uint16(ptr + 2, (uint16_t)(u >> 16));
+}
+
+static void put_section(uint8_t *elf, unsigned int i, uint32_t name, uint32_t type,
+                        uint32_t flags, uint32_t addr, uint32_t offset, uint32_t size,
+                        uint32_t link)
+{
+    uint8_t *shdr = elf + 0x200 + i * 40;
+
+    put_uint32(shdr, name);
+    put_uint32(shdr + 4, type);
+    put_uint32(shdr + 8, flags);
+    put_uint32(shdr + 12, addr);
+    put_uint32(shdr + 16, offset);
+    put_uint32(shdr + 20, size);
+    put_uint32(shdr + 24, link);
+}
+
+static void put_symbol(uint8_t *elf, unsigned int i, uint32_t name, uint32_t value,
+                       uint32_t size, uint8_t info)
+{
+    uint8_t *sym = elf + 0x180 + i * 16;
+
+    put_uint32(sym, name);
+    put_uint32(sym + 4, value);
+    put_uint32(sym + 8, size);
+    sym[12] = info;
+    put_uint16(sym + 14, 1);
+}
+
+/* Little-endian ELF with one 8-byte PT_LOAD segment and 6 sections: NULL, .text, .bss,
+   .symtab, .strtab and .shstrtab. The section table starts at 0x200. */
+#define TEST_ELF_SIZE (0x200 + 6 * 40)
+static void build_elf(uint8_t *elf)
+{
+    static const char shstrtab[] = "\0.text\0.bss\0.symtab\0.strtab\0.shstrtab";
+    static const char strtab[] = "\0_VectorsFlash\0setup";
+
+    memset(elf, 0, TEST_ELF_SIZE);
+
+    memcpy(elf, "\177ELF\1\1\1", 7);
+    put_uint16(elf + 16, 2); // e_type
+    put_uint16(elf + 18, 40); // e_machine
+    put_uint32(elf + 20, 1); // e_version
+    put_uint32(elf + 28, 52); // e_phoff
+    put_uint32(elf + 32, 0x200); // e_shoff
+    put_uint16(elf + 40, 52); // e_ehsize
+    put_uint16(elf + 42, 32); // e_phentsize
+    put_uint16(elf + 44, 1); // e_phnum
+    put_uint16(elf + 46, 40); // e_shentsize
+    put_uint16(elf + 48, 6); // e_shnum
+    put_uint16(elf + 50, 5); // e_shstrndx
+
+    put_uint32(elf + 52, 1); // PT_LOAD
+    put_uint32(elf + 56, 0x100);
+    put_uint32(elf + 68, 8);
+    put_uint32(elf + 72, 8);
+    memcpy(elf + 0x100, "\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+
+    memcpy(elf + 0x120, shstrtab, sizeof(shstrtab));
+    memcpy(elf + 0x160, strtab, sizeof(strtab));
+    put_symbol(elf, 1, 1, 0, 8, 1);
+    put_symbol(elf, 2, 15, 4, 4, 2);
+
+    put_section(elf, 1, 1, 1, 0x2, 0, 0x100, 8, 0);
+    put_section(elf, 2, 7, 8, 0x3, 0x20000000, 0, 64, 0);
+    put_section(elf, 3, 12, 2, 0, 0, 0x180, 3 * 16, 4);
+    put_section(elf, 4, 20, 3, 0, 0, 0x160, sizeof(strtab), 0);
+    put_section(elf, 5, 28, 3, 0, 0, 0x120, sizeof(shstrtab), 0);
+}
+
+static int load_elf(const uint8_t *elf, size_t len, ty_firmware **rfw)
+{
+    int verbosity = ty_config_verbosity;
+    int r;
+
+    // Broken section tables only emit a warning, keep the test output clean
+    ty_config_verbosity = TY_LOG_ERROR;
+    ty_error_mask(TY_ERROR_PARSE);
+    r = ty_firmware_load_mem("test.elf", elf, len, NULL, rfw);
+    ty_error_unmask();
+    ty_config_verbosity = verbosity;
+
+    return r;
+}
+
+static void test_firmware_elf_sections(void)
+{
+    uint8_t elf[TEST_ELF_SIZE];
+    ty_firmware *fw = NULL;
+    const ty_firmware_symbol *sym;
+    int r;
+
+    build_elf(elf);
+    r = load_elf(elf, sizeof(elf), &fw);
+
+    ASSERT(!r);
+    ASSERT(fw && fw->size == 8);
+    ASSERT(fw && fw->sections_count == 2);
+    if (fw && fw->sections_count == 2) {
+        ASSERT_STR_EQUAL(fw->sections[0].name, ".text");
+        ASSERT(fw->sections[0].flash && !fw->sections[0].ram && fw->sections[0].size == 8);
+        ASSERT_STR_EQUAL(fw->sections[1].name, ".bss");
+        ASSERT(!fw->sections[1].flash && fw->sections[1].ram);
+        ASSERT(fw->sections[1].address == 0x20000000 && fw->sections[1].size == 64);
+    }
+
+    ASSERT(fw && fw->symbols_count == 2);
+    sym = fw ? ty_firmware_find_symbol(fw, "setup") : NULL;
+    ASSERT(sym && sym->address == 4 && sym->size == 4);
+    sym = fw ? ty_firmware_find_symbol(fw, "_VectorsFlash") : NULL;
+    ASSERT(sym && sym->address == 0 && sym->size == 8);
+    ASSERT(fw && !ty_firmware_find_symbol(fw, "loop"));
+
+    ty_firmware_unref(fw);
+}
+
+static void test_firmware_elf_broken_sections(void)
+{
+    uint8_t elf[TEST_ELF_SIZE];
+
+    // The image must load from the program headers whatever the state of the section table
+    for (unsigned int i = 0; i < 5; i++) {
+        size_t len = sizeof(elf);
+        ty_firmware *fw = NULL;
+        int r;
+
+        build_elf(elf);
+        switch (i) {
+            case 0: { put_uint16(elf + 46, 8); } break; // e_shentsize too small
+            case 1: { put_uint32(elf + 32, 0x10000); } break; // e_shoff out of range
+            case 2: { put_section(elf, 3, 12, 2, 0, 0, 0x180, 3 * 16, 99); } break; // sh_link
+            case 3: { put_section(elf, 4, 20, 3, 0, 0, 0x160, 0x7FFFFFFF, 0); } break;
+            case 4: { len = 0x200 + 3 * 40; } break; // Truncated section table
+        }
+
+        r = load_elf(elf, len, &fw);
+
+        ASSERT(!r);
+        ASSERT(fw && fw->size == 8 && !memcmp(fw->image, "\x01\x02\x03\x04", 4));
+        ASSERT(fw && !fw->sections_count && !fw->symbols_count);
+        ASSERT(fw && !ty_firmware_find_symbol(fw, "setup"));
+
+        ty_firmware_unref(fw);
+    }
+}
+
+void test_firmware(void)
+{
+    test_firmware_ihex_data();
+    test_firmware_ihex_order();
+    test_firmware_ihex_errors();
+    test_firmware_elf_sections();
+    test_firmware_elf_broken_sections();
+}
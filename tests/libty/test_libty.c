@@ -9,9 +9,31 @@
    See the LICENSE file for more details. */
 
 #include <stdarg.h>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
 #include "test_libty.h"
 
+void test_firmware(void);
+void test_metrics(void);
 void test_optline(void);
+void test_reactor(void);
+void test_serial_log(void);
+void test_task(void);
+void test_trace(void);
+#ifdef TEST_SERIAL_LOG_WRITER
+void test_serial_log_writer(void);
+#endif
+#ifdef _HS_SIMULATOR
+void test_simulator(void);
+#endif
+#ifdef TEST_UEVENT
+void test_uevent(void);
+#endif
+
+static char test_dir[1024];
 
 static char current_file[1024];
 static char current_fn[256];
@@ -66,9 +88,63 @@ void report_test(bool pred, const char *file, unsigned int line, const char *fn,
     current_total++;
 }
 
+const char *get_test_directory(void)
+{
+    if (test_dir[0])
+        return test_dir;
+
+#ifdef _WIN32
+    char tmp[MAX_PATH + 1];
+    DWORD len = GetTempPathA(sizeof(tmp), tmp);
+
+    if (!len || len >= sizeof(tmp))
+        strcpy(tmp, ".\\");
+    snprintf(test_dir, sizeof(test_dir), "%stest_libty.%lu", tmp, GetCurrentProcessId());
+    if (!CreateDirectoryA(test_dir, NULL)) {
+        fprintf(stderr, "Cannot create test directory '%s'\n", test_dir);
+        exit(1);
+    }
+#else
+    const char *tmp = getenv("TMPDIR");
+
+    if (!tmp || !tmp[0])
+        tmp = "/tmp";
+    snprintf(test_dir, sizeof(test_dir), "%s/test_libty.XXXXXX", tmp);
+    if (!mkdtemp(test_dir)) {
+        fprintf(stderr, "Cannot create test directory in '%s': %s\n", tmp, strerror(errno));
+        exit(1);
+    }
+#endif
+
+    return test_dir;
+}
+
 int main(void)
 {
+    test_firmware();
+    test_metrics();
     test_optline();
+    test_reactor();
+    test_serial_log();
+    test_task();
+    test_trace();
+#ifdef TEST_SERIAL_LOG_WRITER
+    test_serial_log_writer();
+#endif
+#ifdef _HS_SIMULATOR
+    test_simulator();
+#endif
+#ifdef TEST_UEVENT
+    test_uevent();
+#endif
+
+    if (test_dir[0]) {
+#ifdef _WIN32
+        RemoveDirectoryA(test_dir);
+#else
+        rmdir(test_dir);
+#endif
+    }
 
     conclude_current_test();
     if (cases_failures) {
@@ -30,6 +30,9 @@ TY_C_BEGIN
 void report_test(bool pred, const char *file, unsigned int line, const char *fn,
                  const char *pred_fmt, ...) TY_PRINTF_FORMAT(5, 6);
 
+// Created on first use, tests must remove their files so that main() can remove it
+const char *get_test_directory(void);
+
 TY_C_END
 
 #endif
@@ -0,0 +1,194 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <locale.h>
+#include "test_libty.h"
+#include "../../src/libty/metrics.h"
+#include "../../src/libty/thread.h"
+
+#define THREADS_COUNT 4
+#define INCREMENTS_PER_THREAD 100000
+
+static int run_increments(void *udata)
+{
+    ty_metric_series *series = udata;
+
+    for (unsigned int i = 0; i < INCREMENTS_PER_THREAD; i++)
+        ty_metric_series_add(series, 1);
+
+    return 0;
+}
+
+static void test_metrics_concurrent(void)
+{
+    ty_metrics *metrics = NULL;
+    ty_metric *metric;
+    ty_metric_series *series = NULL;
+    ty_thread threads[THREADS_COUNT];
+    unsigned int threads_count = 0;
+    int r;
+
+    r = ty_metrics_new(&metrics);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    r = ty_metrics_add(metrics, "test_total", "Test", TY_METRIC_COUNTER, "board", NULL, 0, &metric);
+    ASSERT(!r);
+    if (!r)
+        r = ty_metric_get_series(metric, "foo", &series);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < THREADS_COUNT; i++) {
+        r = ty_thread_create(&threads[i], run_increments, series);
+        ASSERT(!r);
+        if (r < 0)
+            break;
+        threads_count++;
+    }
+    for (unsigned int i = 0; i < threads_count; i++)
+        ty_thread_join(&threads[i]);
+
+    ASSERT(ty_metric_series_get_count(series) ==
+           (uint64_t)threads_count * INCREMENTS_PER_THREAD);
+
+cleanup:
+    ty_metrics_free(metrics);
+}
+
+static void test_metrics_format(void)
+{
+    static const double buckets[] = {0.5, 1.0, 5.0};
+
+    ty_metrics *metrics = NULL;
+    ty_metric *counter, *gauge, *histogram;
+    ty_metric_series *series;
+    char *text = NULL;
+    size_t size = 0;
+    int r;
+
+    r = ty_metrics_new(&metrics);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    r = ty_metrics_add(metrics, "test_bytes_total", "Bytes seen", TY_METRIC_COUNTER, "board",
+                       NULL, 0, &counter);
+    ASSERT(!r);
+    if (!r)
+        r = ty_metrics_add(metrics, "test_boards", "Boards", TY_METRIC_GAUGE, NULL, NULL, 0, &gauge);
+    ASSERT(!r);
+    if (!r)
+        r = ty_metrics_add(metrics, "test_seconds", "Durations", TY_METRIC_HISTOGRAM, "board",
+                           buckets, TY_COUNTOF(buckets), &histogram);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    // Same label value, same series
+    ASSERT(!ty_metric_get_series(counter, "a\"b\\c\nd", &series));
+    ty_metric_series_add(series, 40);
+    ASSERT(!ty_metric_get_series(counter, "a\"b\\c\nd", &series));
+    ty_metric_series_add(series, 2);
+    ASSERT(ty_metric_series_get_count(series) == 42);
+
+    ASSERT(!ty_metric_get_series(gauge, NULL, &series));
+    ty_metric_series_set(series, 3);
+    ty_metric_series_set(series, -1);
+
+    ASSERT(!ty_metric_get_series(histogram, "x", &series));
+    ty_metric_series_observe(series, 0.25);
+    ty_metric_series_observe(series, 0.5);
+    ty_metric_series_observe(series, 2.0);
+    ty_metric_series_observe(series, 10.0);
+    ASSERT(ty_metric_series_get_count(series) == 4);
+
+    r = ty_metrics_format(metrics, &text, &size);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    ASSERT(strlen(text) == size);
+
+    ASSERT(strstr(text, "# HELP test_bytes_total Bytes seen\n# TYPE test_bytes_total counter\n"));
+    ASSERT(strstr(text, "\ntest_bytes_total{board=\"a\\\"b\\\\c\\nd\"} 42\n"));
+    ASSERT(strstr(text, "# TYPE test_boards gauge\ntest_boards -1\n"));
+    ASSERT(strstr(text, "# TYPE test_seconds histogram\n"
+                        "test_seconds_bucket{board=\"x\",le=\"0.5\"} 2\n"
+                        "test_seconds_bucket{board=\"x\",le=\"1\"} 2\n"
+                        "test_seconds_bucket{board=\"x\",le=\"5\"} 3\n"
+                        "test_seconds_bucket{board=\"x\",le=\"+Inf\"} 4\n"
+                        "test_seconds_sum{board=\"x\"} 12.75\n"
+                        "test_seconds_count{board=\"x\"} 4\n"));
+
+cleanup:
+    free(text);
+    ty_metrics_free(metrics);
+}
+
+// Prometheus wants a dot, whatever the decimal point of the locale is
+static void test_metrics_locale(void)
+{
+    static const char *const locales[] = {
+        "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR", "German"
+    };
+    static const double buckets[] = {0.25, 2.5};
+
+    ty_metrics *metrics = NULL;
+    ty_metric *histogram;
+    ty_metric_series *series;
+    char *text = NULL;
+    size_t size = 0;
+    bool changed = false;
+    int r;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(locales) && !changed; i++)
+        changed = setlocale(LC_NUMERIC, locales[i]);
+    // Nothing to test if the system has none of these locales
+    if (!changed)
+        return;
+
+    r = ty_metrics_new(&metrics);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    r = ty_metrics_add(metrics, "test_seconds", "Durations", TY_METRIC_HISTOGRAM, NULL,
+                       buckets, TY_COUNTOF(buckets), &histogram);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    ASSERT(!ty_metric_get_series(histogram, NULL, &series));
+    ty_metric_series_observe(series, 0.125);
+    ty_metric_series_observe(series, 12.5);
+
+    r = ty_metrics_format(metrics, &text, &size);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    ASSERT(strstr(text, "test_seconds_bucket{le=\"0.25\"} 1\n"
+                        "test_seconds_bucket{le=\"2.5\"} 1\n"
+                        "test_seconds_bucket{le=\"+Inf\"} 2\n"
+                        "test_seconds_sum 12.625\n"));
+
+cleanup:
+    free(text);
+    ty_metrics_free(metrics);
+    setlocale(LC_NUMERIC, "C");
+}
+
+void test_metrics(void)
+{
+    test_metrics_concurrent();
+    test_metrics_format();
+    test_metrics_locale();
+}
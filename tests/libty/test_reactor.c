@@ -0,0 +1,134 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
+#include "../../src/libty/reactor.h"
+
+#ifndef _WIN32
+
+// More than ty_descriptor_set and ty_poll() can handle
+#define PIPES_COUNT 100
+
+static void test_reactor_pipes(void)
+{
+    ty_reactor *reactor = NULL;
+    int pipes[PIPES_COUNT][2];
+    unsigned int pipes_count = 0;
+    char buf[16];
+    int r;
+
+    r = ty_reactor_new(&reactor);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    for (pipes_count = 0; pipes_count < PIPES_COUNT; pipes_count++) {
+        r = pipe(pipes[pipes_count]);
+        ASSERT(!r);
+        if (r < 0)
+            goto cleanup;
+
+        r = ty_reactor_add(reactor, pipes[pipes_count][0], (int)pipes_count + 1);
+        ASSERT(!r);
+    }
+    ASSERT(ty_reactor_get_count(reactor) == PIPES_COUNT);
+
+    ASSERT(ty_reactor_wait(reactor, 0) == 0);
+
+    r = (int)write(pipes[PIPES_COUNT - 1][1], "a", 1);
+    ASSERT(r == 1);
+    ASSERT(ty_reactor_wait(reactor, 100) == PIPES_COUNT);
+
+    // Both ready descriptors must come up, whatever the order
+    r = (int)write(pipes[10][1], "b", 1);
+    ASSERT(r == 1);
+    r = ty_reactor_wait(reactor, 0);
+    ASSERT(r == 11 || r == PIPES_COUNT);
+    r = (int)read(pipes[r - 1][0], buf, sizeof(buf));
+    ASSERT(r == 1);
+    r = ty_reactor_wait(reactor, 0);
+    ASSERT(r == 11 || r == PIPES_COUNT);
+    r = (int)read(pipes[r - 1][0], buf, sizeof(buf));
+    ASSERT(r == 1);
+    ASSERT(ty_reactor_wait(reactor, 0) == 0);
+
+    r = (int)write(pipes[20][1], "c", 1);
+    ASSERT(r == 1);
+    ty_reactor_remove(reactor, 21);
+    ASSERT(ty_reactor_get_count(reactor) == PIPES_COUNT - 1);
+    ASSERT(ty_reactor_wait(reactor, 0) == 0);
+
+    ty_reactor_clear(reactor);
+    ASSERT(!ty_reactor_get_count(reactor));
+    r = ty_reactor_add(reactor, pipes[20][0], 42);
+    ASSERT(!r);
+    ASSERT(ty_reactor_wait(reactor, 0) == 42);
+
+cleanup:
+    ty_reactor_free(reactor);
+    for (unsigned int i = 0; i < pipes_count; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+}
+
+static void test_reactor_file(void)
+{
+    ty_reactor *reactor = NULL;
+    int pfd[2] = {-1, -1};
+    FILE *fp;
+    int r;
+
+    fp = tmpfile();
+    ASSERT(fp);
+    if (!fp)
+        return;
+    r = pipe(pfd);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    r = ty_reactor_new(&reactor);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    // Regular files are always ready (like with poll), but should not hide other descriptors
+    r = ty_reactor_add(reactor, fileno(fp), 1);
+    ASSERT(!r);
+    r = ty_reactor_add(reactor, pfd[0], 2);
+    ASSERT(!r);
+    ASSERT(ty_reactor_wait(reactor, -1) == 1);
+
+    r = (int)write(pfd[1], "a", 1);
+    ASSERT(r == 1);
+    ASSERT(ty_reactor_wait(reactor, -1) == 2);
+
+cleanup:
+    ty_reactor_free(reactor);
+    if (pfd[0] >= 0) {
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+    fclose(fp);
+}
+
+#endif
+
+void test_reactor(void)
+{
+#ifndef _WIN32
+    test_reactor_pipes();
+    test_reactor_file();
+#endif
+}
@@ -0,0 +1,159 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/serial_log.h"
+
+static char log_filename[1024];
+static char index_filename[sizeof(log_filename) + 8];
+
+// The previous generation starts in the middle of line 1, line 4 starts the current one
+#define NEW_DATA "line4\nline5\n"
+#define OLD_DATA "e1\nline2\nline3\n"
+
+static void write_file(const char *filename, const void *data, size_t len)
+{
+    FILE *fp = fopen(filename, "wb");
+    ASSERT(fp);
+    if (fp) {
+        fwrite(data, 1, len, fp);
+        fclose(fp);
+    }
+}
+
+static void write_wrapped_log(void)
+{
+    ty_serial_log_index_header header = {0};
+    ty_serial_log_index_entry entries[6] = {{0}};
+    const size_t new_len = strlen(NEW_DATA);
+    const size_t delimiter_len = strlen(TY_SERIAL_LOG_DELIMITER);
+    char data[256];
+    size_t len;
+    FILE *fp;
+
+    len = (size_t)sprintf(data, "%s%s%s", NEW_DATA, TY_SERIAL_LOG_DELIMITER, OLD_DATA);
+    write_file(log_filename, data, len);
+
+    memcpy(header.magic, TY_SERIAL_LOG_INDEX_MAGIC, sizeof(header.magic));
+    header.version = TY_SERIAL_LOG_INDEX_VERSION;
+    header.capacity = TY_COUNTOF(entries);
+    header.generation = 2;
+    header.next_slot = 4;
+    header.write_offset = new_len;
+    header.old_offset = new_len + delimiter_len;
+    header.old_end = len;
+    header.lines = 6;
+
+    // Overwritten by the current generation
+    entries[0] = (ty_serial_log_index_entry){1, 0, 0, 0, 500};
+    entries[1] = (ty_serial_log_index_entry){1, 0, new_len + delimiter_len + 3, 2, 1000};
+    entries[2] = (ty_serial_log_index_entry){2, 0, 0, 4, 3000};
+    entries[3] = (ty_serial_log_index_entry){2, 0, 6, 5, 4000};
+    // Generation that does not exist (yet)
+    entries[4] = (ty_serial_log_index_entry){0x7FFFFFFF, 0, 0, 0, 0};
+
+    fp = fopen(index_filename, "wb");
+    ASSERT(fp);
+    if (fp) {
+        fwrite(&header, sizeof(header), 1, fp);
+        fwrite(entries, sizeof(entries), 1, fp);
+        fclose(fp);
+    }
+}
+
+static void test_serial_log_index(void)
+{
+    ty_serial_log *log = NULL;
+    const ty_serial_log_position *positions;
+    unsigned int positions_count;
+    ty_serial_log_position pos;
+    char buf[256];
+    ssize_t len;
+    int r;
+
+    write_wrapped_log();
+
+    r = ty_serial_log_open(log_filename, &log);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    ASSERT(ty_serial_log_is_indexed(log));
+    ASSERT(ty_serial_log_get_size(log) == strlen(OLD_DATA NEW_DATA));
+    len = ty_serial_log_read(log, 0, buf, sizeof(buf) - 1);
+    ASSERT(len == (ssize_t)strlen(OLD_DATA NEW_DATA));
+    buf[len > 0 ? len : 0] = 0;
+    ASSERT_STR_EQUAL(buf, OLD_DATA NEW_DATA);
+
+    len = ty_serial_log_read(log, 9, buf, 9);
+    ASSERT(len == 9);
+    buf[len > 0 ? len : 0] = 0;
+    ASSERT_STR_EQUAL(buf, "line3\nlin");
+
+    positions_count = ty_serial_log_get_positions(log, &positions);
+    ASSERT(positions_count == 4);
+    ASSERT(positions[0].offset == 0 && positions[0].line == 1 && positions[0].time == -1);
+    ASSERT(positions[1].offset == 3 && positions[1].line == 2);
+    ASSERT(positions[2].offset == strlen(OLD_DATA) && positions[2].line == 4);
+
+    ty_serial_log_seek_line(log, 3, &pos);
+    ASSERT(pos.line == 2 && pos.offset == 3);
+    ty_serial_log_seek_line(log, 100, &pos);
+    ASSERT(pos.line == 5);
+    ty_serial_log_seek_line(log, 0, &pos);
+    ASSERT(pos.offset == 0);
+
+    ty_serial_log_seek_time(log, 3500, &pos);
+    ASSERT(pos.line == 4 && pos.time == 3000);
+    ty_serial_log_seek_time(log, 0, &pos);
+    ASSERT(pos.offset == 0);
+
+cleanup:
+    ty_serial_log_close(log);
+    remove(index_filename);
+    remove(log_filename);
+}
+
+static void test_serial_log_legacy(void)
+{
+    ty_serial_log *log = NULL;
+    char data[256];
+    char buf[256];
+    ssize_t len;
+    int r;
+
+    len = sprintf(data, "%s%s%s", NEW_DATA, TY_SERIAL_LOG_DELIMITER, OLD_DATA);
+    write_file(log_filename, data, (size_t)len);
+
+    r = ty_serial_log_open(log_filename, &log);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    // Without an index, the delimiter still tells us how to order the data
+    ASSERT(!ty_serial_log_is_indexed(log));
+    len = ty_serial_log_read(log, 0, buf, sizeof(buf) - 1);
+    buf[len > 0 ? len : 0] = 0;
+    ASSERT_STR_EQUAL(buf, OLD_DATA NEW_DATA);
+
+cleanup:
+    ty_serial_log_close(log);
+    remove(log_filename);
+}
+
+void test_serial_log(void)
+{
+    snprintf(log_filename, sizeof(log_filename), "%s/serial_log.txt", get_test_directory());
+    snprintf(index_filename, sizeof(index_filename), "%s%s", log_filename,
+             TY_SERIAL_LOG_INDEX_SUFFIX);
+
+    test_serial_log_index();
+    test_serial_log_legacy();
+}
@@ -0,0 +1,103 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <string>
+
+#include "test_libty.h"
+#include "../../src/libty/serial_log.h"
+#include "../../src/tycommander/serial_log.hpp"
+
+using namespace std;
+
+// Small enough to wrap around several times, big enough for the delimiter to fit most of the time
+#define LOG_SIZE 256
+#define LINE_COUNT 100
+#define START_TIME 1000000
+
+static string format_line(unsigned int line)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "line%03u\n", line);
+    return buf;
+}
+
+/* Write lines the way TyCommander does, one second apart so that each one gets an index
+   entry, and check that the reader finds the most recent ones with the right numbers
+   and times. */
+static void test_serial_log_writer_round_trip()
+{
+    char filename[1024];
+    SerialLog writer;
+    string written;
+    ty_serial_log *log = nullptr;
+    const ty_serial_log_position *positions;
+    unsigned int positions_count;
+    ty_serial_log_position pos;
+    char buf[LOG_SIZE + 1];
+    ssize_t len;
+    int r;
+
+    snprintf(filename, sizeof(filename), "%s/serial_log_writer.txt", get_test_directory());
+
+    writer.update(QString::fromUtf8(filename), LOG_SIZE);
+    ASSERT(writer.isOpen());
+    for (unsigned int i = 0; i < LINE_COUNT; i++) {
+        string line = format_line(i);
+        writer.write(line.c_str(), line.size(), START_TIME + i * 1000);
+        written += line;
+    }
+
+    r = ty_serial_log_open(filename, &log);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    ASSERT(ty_serial_log_is_indexed(log));
+
+    // Only the most recent data survives, in order and without the delimiter
+    len = ty_serial_log_read(log, 0, buf, sizeof(buf) - 1);
+    ASSERT(len > 0 && len < LOG_SIZE);
+    ASSERT(len == static_cast<ssize_t>(ty_serial_log_get_size(log)));
+    buf[len > 0 ? len : 0] = 0;
+    ASSERT(len > 0 && written.compare(written.size() - static_cast<size_t>(len), string::npos, buf) == 0);
+
+    positions_count = ty_serial_log_get_positions(log, &positions);
+    ASSERT(positions_count > 1);
+    ASSERT(positions[0].line > 0);
+    ASSERT(positions[positions_count - 1].line == LINE_COUNT - 1);
+    for (unsigned int i = 0; i < positions_count; i++) {
+        if (positions[i].time < 0)
+            continue;
+
+        string line = format_line(static_cast<unsigned int>(positions[i].line));
+        len = ty_serial_log_read(log, positions[i].offset, buf, line.size());
+        buf[len > 0 ? len : 0] = 0;
+        ASSERT_STR_EQUAL(buf, line.c_str());
+        ASSERT(positions[i].time == START_TIME + static_cast<int64_t>(positions[i].line) * 1000);
+    }
+
+    ty_serial_log_seek_time(log, START_TIME + (LINE_COUNT - 2) * 1000 + 500, &pos);
+    ASSERT(pos.line == LINE_COUNT - 2 && pos.time == START_TIME + (LINE_COUNT - 2) * 1000);
+    ty_serial_log_seek_line(log, LINE_COUNT - 3, &pos);
+    ASSERT(pos.line == LINE_COUNT - 3);
+
+cleanup:
+    ty_serial_log_close(log);
+    // Removes the log and its index
+    writer.update(QString(), 0);
+}
+
+TY_C_BEGIN
+
+void test_serial_log_writer(void)
+{
+    test_serial_log_writer_round_trip();
+}
+
+TY_C_END
@@ -0,0 +1,144 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/simulator.h"
+#include "../../src/libty/board.h"
+#include "../../src/libty/class.h"
+#include "../../src/libty/firmware.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/task.h"
+
+#define SERIAL_NUMBER 12345
+#define FIRMWARE_SIZE 20000
+
+// Teensy 3.1, with delays short enough to keep the test fast
+static const hs_simulator_config board_config = {
+    .serial_number = SERIAL_NUMBER,
+    .halfkay_version = 3,
+    .halfkay_usage = 0x1E,
+    .code_size = 262144,
+    .block_size = 1024,
+    .transfer_time = 100,
+    .program_time = 500,
+    .erase_time = 20000,
+    .reboot_time = 20000,
+    .boot_time = 20000,
+    .serial = HS_SIMULATOR_SERIAL_CDC,
+    .serial_rate = 100000
+};
+
+static int find_board_callback(ty_board *board, ty_monitor_event event, void *udata)
+{
+    TY_UNUSED(event);
+
+    *(ty_board **)udata = ty_board_ref(board);
+    return 1;
+}
+
+static void test_simulator_serial(ty_board *board)
+{
+    char buf[64], expected[64];
+    ssize_t r;
+
+    // The board starts sending when the port is opened, the first line comes quickly
+    r = ty_board_serial_read(board, buf, 32, 1000);
+    ASSERT(r > 0);
+    if (r <= 0)
+        return;
+
+    sprintf(expected, "%010u %020u\n", SERIAL_NUMBER, 0);
+    ASSERT(!memcmp(buf, expected, (size_t)r));
+}
+
+static void test_simulator_upload(ty_board *board, hs_simulator_board *sim)
+{
+    ty_firmware *fw = NULL;
+    ty_task *task = NULL;
+    hs_simulator_stats stats;
+    uint8_t *flash = NULL;
+    int r;
+
+    r = ty_firmware_new("simulator.bin", &fw);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    r = ty_firmware_expand_image(fw, FIRMWARE_SIZE);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    for (size_t i = 0; i < FIRMWARE_SIZE; i++)
+        fw->image[i] = (uint8_t)(i * 7);
+
+    // Reboot, erase, write all the blocks, reset and wait for the board to come back
+    r = ty_upload(board, &fw, 1, TY_UPLOAD_NOCHECK, &task);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    r = ty_task_join(task);
+    ASSERT(!r);
+
+    flash = malloc(FIRMWARE_SIZE);
+    ASSERT(flash);
+    if (!flash)
+        goto cleanup;
+    ASSERT(hs_simulator_read_flash(sim, 0, flash, FIRMWARE_SIZE) == FIRMWARE_SIZE);
+    ASSERT(!memcmp(flash, fw->image, FIRMWARE_SIZE));
+
+    hs_simulator_get_stats(sim, &stats);
+    ASSERT(stats.reboots == 1 && stats.resets == 1 && stats.erases == 1);
+    ASSERT(stats.blocks == (FIRMWARE_SIZE + 1023) / 1024);
+
+    ASSERT(ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL));
+    ASSERT(ty_board_get_model(board) == TY_MODEL_TEENSY_31);
+
+cleanup:
+    free(flash);
+    ty_task_unref(task);
+    ty_firmware_unref(fw);
+}
+
+void test_simulator(void)
+{
+    hs_simulator_board *sim = NULL;
+    ty_monitor *monitor = NULL;
+    ty_board *board = NULL;
+    int r;
+
+    r = hs_simulator_add_board(&board_config, &sim);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    setenv("TYTOOLS_MONITOR_BACKEND", "simulator", 1);
+    r = ty_monitor_new(&monitor);
+    unsetenv("TYTOOLS_MONITOR_BACKEND");
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    r = ty_monitor_start(monitor);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    ty_monitor_list(monitor, find_board_callback, &board);
+    ASSERT(board);
+    if (!board)
+        goto cleanup;
+    ASSERT_STR_EQUAL(ty_board_get_serial_number(board), "123450");
+
+    test_simulator_serial(board);
+    test_simulator_upload(board, sim);
+
+cleanup:
+    ty_board_unref(board);
+    ty_monitor_free(monitor);
+    hs_simulator_remove_board(sim);
+}
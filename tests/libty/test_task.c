@@ -0,0 +1,230 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+
+#define WAIT_TIMEOUT 10000
+
+static ty_mutex mutex;
+static ty_cond cond;
+static bool gate_open;
+static int order[16];
+static unsigned int order_count;
+static unsigned int running, max_running;
+
+static int run_gate(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_mutex_lock(&mutex);
+    while (!gate_open)
+        ty_cond_wait(&cond, &mutex, -1);
+    ty_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+// Task names are the numbers they record
+static int run_record(ty_task *task)
+{
+    ty_mutex_lock(&mutex);
+    if (++running > max_running)
+        max_running = running;
+    ty_mutex_unlock(&mutex);
+
+    ty_delay(5);
+
+    ty_mutex_lock(&mutex);
+    if (order_count < TY_COUNTOF(order))
+        order[order_count++] = atoi(task->name);
+    running--;
+    ty_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+// Waits until another task runs at the same time, or gives up after a while
+static int run_pair(ty_task *task)
+{
+    uint64_t start = ty_millis();
+    int timeout;
+
+    ty_mutex_lock(&mutex);
+    if (++running > max_running)
+        max_running = running;
+    ty_cond_broadcast(&cond);
+    while (max_running < 2 && (timeout = ty_adjust_timeout(WAIT_TIMEOUT, start)))
+        ty_cond_wait(&cond, &mutex, timeout);
+
+    if (order_count < TY_COUNTOF(order))
+        order[order_count++] = atoi(task->name);
+    running--;
+    ty_mutex_unlock(&mutex);
+
+    return 0;
+}
+
+static int start_task(ty_pool *pool, const char *name, int (*run)(ty_task *task),
+                      ty_task_priority priority, const void *key, ty_task **rtask)
+{
+    ty_task *task = NULL;
+    int r;
+
+    r = ty_task_new(name, run, &task);
+    if (r < 0)
+        return r;
+    task->pool = pool;
+    task->priority = priority;
+    task->serial_key = key;
+
+    r = ty_task_start(task);
+    if (r < 0) {
+        ty_task_unref(task);
+        return r;
+    }
+
+    *rtask = task;
+    return 0;
+}
+
+static void reset_records(void)
+{
+    gate_open = false;
+    order_count = 0;
+    running = 0;
+    max_running = 0;
+}
+
+static void test_task_priorities(ty_pool *pool)
+{
+    ty_task *gate = NULL, *tasks[3] = {NULL};
+    int r;
+
+    reset_records();
+    ty_pool_set_max_threads(pool, 1);
+
+    // Keep the only worker busy while the other tasks pile up
+    r = start_task(pool, "gate", run_gate, TY_TASK_PRIORITY_NORMAL, NULL, &gate);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+    r = ty_task_wait(gate, TY_TASK_STATUS_RUNNING, WAIT_TIMEOUT);
+    ASSERT(r == 1);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        char name[16];
+
+        // Started from the lowest to the highest priority
+        sprintf(name, "%u", i);
+        r = start_task(pool, name, run_record, (ty_task_priority)i, NULL, &tasks[i]);
+        ASSERT(!r);
+    }
+
+    ty_mutex_lock(&mutex);
+    gate_open = true;
+    ty_cond_broadcast(&cond);
+    ty_mutex_unlock(&mutex);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        if (!tasks[i])
+            continue;
+        r = ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, WAIT_TIMEOUT);
+        ASSERT(r == 1);
+        ty_task_unref(tasks[i]);
+    }
+    ty_task_join(gate);
+    ty_task_unref(gate);
+
+    ASSERT(order_count == 3);
+    ASSERT(order[0] == 2 && order[1] == 1 && order[2] == 0);
+}
+
+static void test_task_serial_keys(ty_pool *pool)
+{
+    static const int board1 = 1, board2 = 2;
+    ty_task *tasks[6] = {NULL}, *joined;
+    char name[16];
+    int r;
+
+    reset_records();
+    ty_pool_set_max_threads(pool, 4);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        sprintf(name, "%u", i);
+        r = start_task(pool, name, run_record, TY_TASK_PRIORITY_NORMAL, &board1, &tasks[i]);
+        ASSERT(!r);
+    }
+
+    // Joining a task that has not started yet must not bypass the queue of its key
+    r = ty_task_new("6", run_record, &joined);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+    joined->pool = pool;
+    joined->serial_key = &board1;
+    r = ty_task_join(joined);
+    ASSERT(!r);
+    ty_task_unref(joined);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(tasks); i++) {
+        if (!tasks[i])
+            continue;
+        r = ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, WAIT_TIMEOUT);
+        ASSERT(r == 1);
+        ty_task_unref(tasks[i]);
+        tasks[i] = NULL;
+    }
+
+    ASSERT(order_count == 7);
+    for (unsigned int i = 0; i < order_count; i++)
+        ASSERT(order[i] == (int)i);
+    ASSERT(max_running == 1);
+
+    // Different keys still run in parallel
+    reset_records();
+    r = start_task(pool, "0", run_pair, TY_TASK_PRIORITY_NORMAL, &board1, &tasks[0]);
+    ASSERT(!r);
+    r = start_task(pool, "1", run_pair, TY_TASK_PRIORITY_NORMAL, &board2, &tasks[1]);
+    ASSERT(!r);
+    for (unsigned int i = 0; i < 2; i++) {
+        if (!tasks[i])
+            continue;
+        r = ty_task_wait(tasks[i], TY_TASK_STATUS_FINISHED, WAIT_TIMEOUT);
+        ASSERT(r == 1);
+        ty_task_unref(tasks[i]);
+    }
+    ASSERT(order_count == 2);
+    ASSERT(max_running == 2);
+}
+
+void test_task(void)
+{
+    ty_pool *pool = NULL;
+    int r;
+
+    r = ty_mutex_init(&mutex);
+    ASSERT(!r);
+    r = ty_cond_init(&cond);
+    ASSERT(!r);
+    r = ty_pool_new(&pool);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+
+    test_task_priorities(pool);
+    test_task_serial_keys(pool);
+
+cleanup:
+    ty_pool_free(pool);
+    ty_cond_release(&cond);
+    ty_mutex_release(&mutex);
+}
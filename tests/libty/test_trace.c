@@ -0,0 +1,132 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/task.h"
+#include "../../src/libty/thread.h"
+#include "../../src/libty/trace.h"
+
+static unsigned int count_occurrences(const char *str, const char *needle)
+{
+    unsigned int count = 0;
+
+    while ((str = strstr(str, needle))) {
+        count++;
+        str += strlen(needle);
+    }
+
+    return count;
+}
+
+static int run_traced_task(ty_task *task)
+{
+    TY_UNUSED(task);
+
+    ty_trace_begin("test_task_span");
+    ty_trace_end();
+
+    return 0;
+}
+
+static int run_traced_thread(void *udata)
+{
+    TY_UNUSED(udata);
+
+    for (unsigned int i = 0; i < 1500; i++) {
+        ty_trace_begin("test_thread_span");
+        ty_trace_end();
+    }
+
+    return 0;
+}
+
+static char *write_trace(void)
+{
+    FILE *fp;
+    long size;
+    char *buf = NULL;
+
+    fp = tmpfile();
+    ASSERT(fp);
+    if (!fp)
+        return NULL;
+    ASSERT(!ty_trace_write(fp));
+
+    size = ftell(fp);
+    rewind(fp);
+    buf = malloc((size_t)size + 1);
+    if (buf)
+        buf[fread(buf, 1, (size_t)size, fp)] = 0;
+
+    fclose(fp);
+    return buf;
+}
+
+void test_trace(void)
+{
+    ty_task *task = NULL;
+    ty_thread thread;
+    char *json = NULL;
+    int r;
+
+    // Nothing is recorded until tracing starts
+    ty_trace_begin("test_disabled_span");
+    ty_trace_end();
+
+    r = ty_trace_start();
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    // Unmatched end event, the span started before tracing
+    ty_trace_end();
+
+    ty_trace_begin("test_main_span");
+    r = ty_task_new("traced@123-Teensy", run_traced_task, &task);
+    ASSERT(!r);
+    if (!r)
+        ASSERT(!ty_task_join(task));
+    ty_trace_end();
+
+    // Enough events to need several chunks in the second thread
+    r = ty_thread_create(&thread, run_traced_thread, NULL);
+    ASSERT(!r);
+    if (!r)
+        ty_thread_join(&thread);
+
+    // The first thread has exited, the next one reuses its buffer
+    r = ty_thread_create(&thread, run_traced_thread, NULL);
+    ASSERT(!r);
+    if (!r)
+        ty_thread_join(&thread);
+
+    ty_trace_stop();
+    ty_trace_begin("test_disabled_span");
+    ty_trace_end();
+
+    json = write_trace();
+    ASSERT(json);
+    if (!json)
+        goto cleanup;
+
+    ASSERT(!strncmp(json, "{\"traceEvents\": [", 17));
+    ASSERT(!strstr(json, "test_disabled_span"));
+    ASSERT(count_occurrences(json, "\"name\": \"test_main_span\"") == 1);
+    ASSERT(count_occurrences(json, "\"name\": \"test_task_span\", \"cat\": \"tytools\"") == 1);
+    ASSERT(strstr(json, "\"args\": {\"task\": \"traced@123-Teensy\"}"));
+    ASSERT(count_occurrences(json, "\"name\": \"test_thread_span\"") == 3000);
+    ASSERT(count_occurrences(json, "\"ph\": \"M\"") == 2);
+    ASSERT(count_occurrences(json, "\"ph\": \"B\"") == count_occurrences(json, "\"ph\": \"E\""));
+    ASSERT(strstr(json, "\"args\": {\"name\": \"Main\"}"));
+
+cleanup:
+    free(json);
+    ty_task_unref(task);
+}
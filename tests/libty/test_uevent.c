@@ -0,0 +1,242 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/common_priv.h"
+#include "../../src/libhs/device_priv.h"
+#include "../../src/libhs/monitor_priv.h"
+
+/* Teensy rebooting to HalfKay and back, then replugged, in the format of
+   "udevadm monitor --kernel --udev --property". */
+#define TRACE_FILENAME TEST_DATA_DIRECTORY "/uevent_reboot.txt"
+
+struct replay_event {
+    bool kernel;
+    char action[16];
+    char devpath[512];
+    char subsystem[32];
+
+    // Raw kernel uevent, properties are separated by NUL bytes
+    char buf[2048];
+    size_t len;
+};
+
+struct replay_context {
+    _hs_htable devices;
+    // Device nodes currently in sysfs, according to the kernel events seen so far
+    char nodes[8][512];
+    bool trusted;
+
+    // Kernel events that _hs_parse_uevent() did not read back, or that did not fit
+    unsigned int bad_events;
+
+    char reported[32][520];
+    unsigned int reported_count;
+};
+
+static const char *const expected_reports[] = {
+    "remove /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0",
+    "add /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/0003:16C0:0478.0007/hidraw/hidraw0",
+    "remove /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/0003:16C0:0478.0007/hidraw/hidraw0",
+    "add /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0",
+    "remove /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0",
+    "add /devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0",
+    "add /devices/pci0000:00/0000:00:14.0/usb1/1-3/1-3:1.0/tty/ttyACM1",
+    "remove /devices/pci0000:00/0000:00:14.0/usb1/1-3/1-3:1.0/tty/ttyACM1"
+};
+
+static int report_callback(hs_device *dev, void *udata)
+{
+    struct replay_context *ctx = udata;
+
+    if (ctx->reported_count < TY_COUNTOF(ctx->reported)) {
+        snprintf(ctx->reported[ctx->reported_count], sizeof(ctx->reported[0]), "%s %s",
+                 dev->status == HS_DEVICE_STATUS_ONLINE ? "add" : "remove", dev->key);
+    }
+    ctx->reported_count++;
+
+    return 0;
+}
+
+static bool has_node(struct replay_context *ctx, const char *devpath)
+{
+    for (unsigned int i = 0; i < TY_COUNTOF(ctx->nodes); i++) {
+        if (strcmp(ctx->nodes[i], devpath) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static void set_node(struct replay_context *ctx, const char *devpath, bool exists)
+{
+    for (unsigned int i = 0; i < TY_COUNTOF(ctx->nodes); i++) {
+        if (exists ? !ctx->nodes[i][0] : strcmp(ctx->nodes[i], devpath) == 0) {
+            snprintf(ctx->nodes[i], sizeof(ctx->nodes[i]), "%s", exists ? devpath : "");
+            return;
+        }
+    }
+}
+
+static void add_device(struct replay_context *ctx, const char *devpath)
+{
+    hs_device *dev = calloc(1, sizeof(*dev));
+
+    if (!dev)
+        abort();
+    dev->refcount = 1;
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->key = strdup(devpath);
+    dev->location = strdup("usb-1-2");
+    dev->path = strdup(devpath);
+    if (!dev->key || !dev->location || !dev->path)
+        abort();
+
+    _hs_monitor_add(&ctx->devices, dev, report_callback, ctx);
+    hs_device_unref(dev);
+}
+
+// Same steps as hs_monitor_refresh(), with the trace standing in for sysfs and udev
+static void replay_event(struct replay_context *ctx, struct replay_event *event)
+{
+    if (strcmp(event->subsystem, "tty") && strcmp(event->subsystem, "hidraw"))
+        return;
+
+    if (event->kernel) {
+        _hs_uevent uevent;
+
+        if (ctx->trusted)
+            return;
+
+        if (!_hs_parse_uevent(event->buf, event->len, &uevent) ||
+                strcmp(uevent.action, event->action) || strcmp(uevent.devpath, event->devpath) ||
+                strcmp(uevent.subsystem, event->subsystem)) {
+            ctx->bad_events++;
+            return;
+        }
+
+        set_node(ctx, event->devpath, strcmp(event->action, "add") == 0);
+        if (strcmp(event->action, "add") == 0) {
+            add_device(ctx, event->devpath);
+        } else if (strcmp(event->action, "remove") == 0) {
+            _hs_monitor_remove(&ctx->devices, event->devpath, report_callback, ctx);
+        }
+    } else {
+        bool exists = has_node(ctx, event->devpath);
+
+        if (!_hs_monitor_accept_udev_event(event->action, exists, ctx->trusted))
+            return;
+
+        if (strcmp(event->action, "add") == 0) {
+            add_device(ctx, event->devpath);
+        } else if (strcmp(event->action, "remove") == 0) {
+            _hs_monitor_remove(&ctx->devices, event->devpath, report_callback, ctx);
+        }
+    }
+}
+
+static bool append_property(struct replay_event *event, const char *property)
+{
+    size_t len = strlen(property);
+
+    if (event->len + len + 1 >= sizeof(event->buf))
+        return false;
+
+    memcpy(event->buf + event->len, property, len + 1);
+    event->len += len + 1;
+    return true;
+}
+
+static bool replay_trace(struct replay_context *ctx, const char *filename)
+{
+    FILE *fp;
+    struct replay_event event = {0};
+    bool pending = false;
+    char line[1024];
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return false;
+
+    while (fgets(line, sizeof(line), fp)) {
+        char source[8];
+        double time;
+
+        line[strcspn(line, "\n")] = 0;
+
+        if (!line[0]) {
+            if (pending)
+                replay_event(ctx, &event);
+            pending = false;
+        } else if (sscanf(line, "%7[A-Z ][%lf] %15s %511s (%31[^)])", source, &time,
+                          event.action, event.devpath, event.subsystem) == 5) {
+            char header[600];
+
+            event.kernel = !strncmp(source, "KERNEL", 6);
+            event.len = 0;
+            snprintf(header, sizeof(header), "%s@%s", event.action, event.devpath);
+            pending = append_property(&event, header);
+        } else if (pending && !append_property(&event, line)) {
+            ctx->bad_events++;
+            pending = false;
+        }
+    }
+    if (pending)
+        replay_event(ctx, &event);
+
+    fclose(fp);
+    return true;
+}
+
+/* Each device change comes twice with the kernel backend, and the udev copy may arrive after
+   the device is gone or replaced at the same devpath. Boards must see each change once. */
+static void test_uevent_replay(bool trusted)
+{
+    struct replay_context ctx = {0};
+    int r;
+
+    r = _hs_htable_init(&ctx.devices, 64);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+    ctx.trusted = trusted;
+
+    // The board is running when the trace starts
+    set_node(&ctx, "/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0", true);
+    add_device(&ctx, "/devices/pci0000:00/0000:00:14.0/usb1/1-2/1-2:1.0/tty/ttyACM0");
+    ctx.reported_count = 0;
+
+    ASSERT(replay_trace(&ctx, TRACE_FILENAME));
+    ASSERT(!ctx.bad_events);
+    ASSERT(ctx.reported_count == TY_COUNTOF(expected_reports));
+    for (unsigned int i = 0; i < ctx.reported_count && i < TY_COUNTOF(expected_reports); i++)
+        ASSERT_STR_EQUAL(ctx.reported[i], expected_reports[i]);
+
+    _hs_monitor_clear_devices(&ctx.devices);
+    _hs_htable_release(&ctx.devices);
+}
+
+static void test_uevent_kernel(void)
+{
+    test_uevent_replay(false);
+}
+
+// Udev alone (default backend, or after an uevent socket overflow) reports the same changes
+static void test_uevent_udev(void)
+{
+    test_uevent_replay(true);
+}
+
+void test_uevent(void)
+{
+    test_uevent_kernel();
+    test_uevent_udev();
+}